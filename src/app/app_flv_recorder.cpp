@@ -0,0 +1,375 @@
+#include "app_flv_recorder.h"
+#include "protocol/rtmp_internal.h"
+#include "protocol/rtmp_util.h"
+#include "thread/thread_pool.h"
+#include "util/dlog.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <chrono>
+
+static FlvRecordConfig s_record_config = { false, "record", FLV_RECORD_BUFFER_SIZE, FLV_RECORD_MAX_PENDING_BYTES,
+                                           FLV_RECORD_DROP_TO_KEYFRAME, false };
+static longkit::ThreadPool s_record_thread_pool;    // 一个IO线程, 所有录制端共用
+static bool s_record_pool_started = false;
+
+// 音视频都有, 之后是PreviousTagSize0
+static const uint8_t s_flv_header[FLV_HEADER_SIZE + 4] = { 'F', 'L', 'V', 1, 0x05, 0, 0, 0, FLV_HEADER_SIZE, 0, 0, 0, 0 };
+
+static void UpdateMax(std::atomic<uint64_t> &max, uint64_t value)
+{
+    uint64_t cur = max.load(std::memory_order_relaxed);
+    while (value > cur && !max.compare_exchange_weak(cur, value, std::memory_order_relaxed))
+        ;
+}
+
+FlvRecorder::FlvRecorder(const std::string &path, bool append, const FlvRecordConfig &config)
+    : path_(path), append_(append), config_(config), scheduled_(false), closed_(false), dropping_(false),
+      stopped_(false), has_video_(false), fd_(-1), direct_(false), failed_(false), buf_(NULL), buf_used_(0),
+      file_offset_(0), has_base_(false), base_ts_(0), append_ts_(0), pending_bytes_(0), max_pending_bytes_(0),
+      written_bytes_(0), write_count_(0), max_write_us_(0), dropped_frames_(0), dropped_bytes_(0)
+{
+    // 写盘大小按页对齐, O_DIRECT要求
+    config_.buffer_size = (config_.buffer_size + FLV_RECORD_ALIGN - 1) / FLV_RECORD_ALIGN * FLV_RECORD_ALIGN;
+    if (config_.buffer_size == 0)
+        config_.buffer_size = FLV_RECORD_ALIGN;
+}
+
+FlvRecorder::~FlvRecorder()
+{
+    if (fd_ >= 0)
+        _Finish();
+    free(buf_);
+}
+
+int FlvRecorder::OnPacket(const MediaPacketPtr &pkt)
+{
+    bool run = false;
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        if (closed_ || stopped_)
+            return 0;
+
+        // metadata和sequence header不丢, 否则后面的帧解不了
+        size_t bytes = pkt->GetSize();
+        int type = pkt->GetType();
+        if (FLV_TYPE_VIDEO == type)
+            has_video_ = true;
+        if (FLV_TYPE_SCRIPT != type && !pkt->IsSequenceHeader()) {
+            bool over = pending_bytes_ + bytes > config_.max_pending_bytes;
+            bool boundary = has_video_ ? pkt->IsKeyFrame() : true;
+            if (dropping_ && !over && boundary) {
+                LogWarn("record {} resume, dropped {} frames", path_, dropped_frames_.load());
+                dropping_ = false;
+            } else if (dropping_ || over) {
+                if (FLV_RECORD_STOP == config_.overflow_policy) {
+                    LogError("record {} stop, disk too slow, pending {} bytes", path_, pending_bytes_.load());
+                    stopped_ = true;
+                } else if (!dropping_) {
+                    LogWarn("record {} drop frames, disk too slow, pending {} bytes", path_, pending_bytes_.load());
+                    dropping_ = true;
+                }
+                dropped_frames_++;
+                dropped_bytes_ += bytes;
+                return 0;
+            }
+        }
+
+        UpdateMax(max_pending_bytes_, pending_bytes_ += bytes);
+        queue_.push_back(pkt);
+        if (!scheduled_) {
+            scheduled_ = true;
+            if (s_record_pool_started)
+                s_record_thread_pool.post(std::bind(&FlvRecorder::_Run, shared_from_this()));
+            else
+                run = true;
+        }
+    }
+    if (run)
+        _Run();
+    return 0;
+}
+
+void FlvRecorder::Close()
+{
+    bool run = false;
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        if (closed_)
+            return;
+        closed_ = true;
+        queue_.push_back(MediaPacketPtr());
+        if (!scheduled_) {
+            scheduled_ = true;
+            if (s_record_pool_started)
+                s_record_thread_pool.post(std::bind(&FlvRecorder::_Run, shared_from_this()));
+            else
+                run = true;
+        }
+    }
+    if (run)
+        _Run();
+}
+
+FlvRecordStats FlvRecorder::GetStats() const
+{
+    FlvRecordStats stats;
+    stats.pending_bytes = pending_bytes_;
+    stats.max_pending_bytes = max_pending_bytes_;
+    stats.written_bytes = written_bytes_;
+    stats.write_count = write_count_;
+    stats.max_write_us = max_write_us_;
+    stats.dropped_frames = dropped_frames_;
+    stats.dropped_bytes = dropped_bytes_;
+    return stats;
+}
+
+// IO线程: 一次取走队列里所有的帧, 写盘期间推流端继续入队
+void FlvRecorder::_Run()
+{
+    std::vector<MediaPacketPtr> packets;
+    for (;;) {
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex_);
+            if (queue_.empty()) {
+                scheduled_ = false;
+                return;
+            }
+            packets.swap(queue_);
+        }
+        for (size_t i = 0; i < packets.size(); i++) {
+            const MediaPacketPtr &pkt = packets[i];
+            if (!pkt) {
+                _Finish();
+                continue;
+            }
+            if (fd_ < 0 && !failed_)
+                _Open();
+            if (!failed_)
+                _Write(*pkt);
+            pending_bytes_ -= pkt->GetSize();
+        }
+        packets.clear();
+    }
+}
+
+// append时读原文件最后一个tag的时间戳, 新写的帧接在后面; 原文件不是FLV时重新录
+int FlvRecorder::_Open()
+{
+    size_t pos = path_.find('/');
+    while (pos != std::string::npos) {
+        if (pos > 0 && mkdir(path_.substr(0, pos).c_str(), 0755) < 0 && errno != EEXIST) {
+            LogError("record mkdir {} failed: {}", path_.substr(0, pos), strerror(errno));
+            failed_ = true;
+            return -1;
+        }
+        pos = path_.find('/', pos + 1);
+    }
+
+    bool create = !append_;
+    if (append_) {
+        int rfd = open(path_.c_str(), O_RDONLY);
+        struct stat st;
+        uint8_t head[FLV_HEADER_SIZE];
+        uint8_t tail[4];
+        uint8_t tag[FLV_TAG_HEADER_SIZE];
+        if (rfd >= 0 && fstat(rfd, &st) == 0 && st.st_size >= (off_t)sizeof(s_flv_header)
+            && pread(rfd, head, sizeof(head), 0) == (ssize_t)sizeof(head) && 0 == memcmp(head, "FLV", 3)) {
+            file_offset_ = st.st_size;
+            // PreviousTagSize指向最后一个tag
+            uint32_t prev = 0;
+            if (pread(rfd, tail, sizeof(tail), st.st_size - 4) == (ssize_t)sizeof(tail))
+                be_read_uint32(tail, &prev);
+            if (prev >= FLV_TAG_HEADER_SIZE && (off_t)prev + 4 + (off_t)sizeof(s_flv_header) <= st.st_size
+                && pread(rfd, tag, sizeof(tag), st.st_size - 4 - prev) == (ssize_t)sizeof(tag))
+                append_ts_ = ((uint32_t)tag[4] << 16) | ((uint32_t)tag[5] << 8) | tag[6] | ((uint32_t)tag[7] << 24);
+            LogInfo("record {} append at {}, timestamp {}", path_, file_offset_, append_ts_);
+        } else if (rfd >= 0 && fstat(rfd, &st) == 0 && st.st_size > 0) {
+            LogWarn("record {} is not a flv file, rewrite it", path_);
+            create = true;
+        }
+        if (rfd >= 0)
+            close(rfd);
+    }
+
+    fd_ = create ? _Create() : open(path_.c_str(), O_WRONLY | O_CREAT, 0644);
+    if (fd_ < 0) {
+        LogError("record open {} failed: {}", path_, strerror(errno));
+        failed_ = true;
+        return -1;
+    }
+    if (posix_memalign((void **)&buf_, FLV_RECORD_ALIGN, config_.buffer_size) != 0) {
+        LogError("record {} alloc buffer failed", path_);
+        close(fd_);
+        fd_ = -1;
+        failed_ = true;
+        return -1;
+    }
+
+    // 文件偏移对齐时才能用O_DIRECT, append到非对齐的位置时用普通写
+    if (config_.direct_io && file_offset_ % FLV_RECORD_ALIGN == 0) {
+        int flags = fcntl(fd_, F_GETFL);
+        direct_ = flags >= 0 && fcntl(fd_, F_SETFL, flags | O_DIRECT) == 0;
+        if (!direct_)
+            LogWarn("record {} O_DIRECT not supported: {}", path_, strerror(errno));
+    }
+
+    if (0 == file_offset_)
+        _Append(s_flv_header, sizeof(s_flv_header));
+    LogInfo("record {} start, direct io: {}", path_, direct_);
+    return 0;
+}
+
+// 重新录制不能截断原文件: 点播还映射着它, 截断后读到文件尾之后的页会收到SIGBUS
+// 先建临时文件再rename过去, 旧的观众继续读旧的inode, 新打开的读新文件
+int FlvRecorder::_Create()
+{
+    std::string tmp = path_ + ".tmp";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return -1;
+    if (rename(tmp.c_str(), path_.c_str()) < 0) {
+        int err = errno;
+        close(fd);
+        unlink(tmp.c_str());
+        errno = err;
+        return -1;
+    }
+    return fd;
+}
+
+void FlvRecorder::_Write(const MediaPacket &pkt)
+{
+    // 时间戳从第一个音视频帧开始算, 之前的metadata和sequence header放在起点
+    uint32_t ts = append_ts_;
+    if (FLV_TYPE_SCRIPT != pkt.GetType() && !pkt.IsSequenceHeader() && !has_base_) {
+        has_base_ = true;
+        base_ts_ = pkt.GetTimestamp();
+    }
+    if (has_base_ && (int32_t)(pkt.GetTimestamp() - base_ts_) > 0)
+        ts += pkt.GetTimestamp() - base_ts_;
+
+    uint8_t header[FLV_TAG_HEADER_SIZE];
+    header[0] = (uint8_t)pkt.GetType();
+    be_write_uint24(header + 1, (uint32_t)pkt.GetSize());
+    be_write_uint24(header + 4, ts & 0xFFFFFF);
+    header[7] = (uint8_t)(ts >> 24);
+    be_write_uint24(header + 8, 0);
+    uint8_t tag_size[4];
+    be_write_uint32(tag_size, (uint32_t)(FLV_TAG_HEADER_SIZE + pkt.GetSize()));
+
+    _Append(header, sizeof(header));
+    _Append(pkt.GetData(), pkt.GetSize());
+    _Append(tag_size, sizeof(tag_size));
+}
+
+void FlvRecorder::_Append(const void *data, size_t bytes)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    while (bytes > 0 && !failed_) {
+        size_t n = config_.buffer_size - buf_used_;
+        if (n > bytes)
+            n = bytes;
+        memcpy(buf_ + buf_used_, p, n);
+        buf_used_ += n;
+        p += n;
+        bytes -= n;
+        if (buf_used_ == config_.buffer_size)
+            _Flush(false);
+    }
+}
+
+// 平时只写满的buffer; 结束时写剩下的部分, O_DIRECT下长度不对齐, 先去掉O_DIRECT
+void FlvRecorder::_Flush(bool final)
+{
+    if (0 == buf_used_ || failed_)
+        return;
+    if (final && direct_ && buf_used_ % FLV_RECORD_ALIGN != 0) {
+        int flags = fcntl(fd_, F_GETFL);
+        if (flags >= 0)
+            fcntl(fd_, F_SETFL, flags & ~O_DIRECT);
+        direct_ = false;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    size_t off = 0;
+    while (off < buf_used_) {
+        ssize_t ret = pwrite(fd_, buf_ + off, buf_used_ - off, file_offset_ + off);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0) {
+            LogError("record {} write failed: {}", path_, strerror(errno));
+            failed_ = true;
+            break;
+        }
+        off += ret;
+    }
+    uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+    file_offset_ += off;
+    written_bytes_ += off;
+    write_count_++;
+    UpdateMax(max_write_us_, us);
+    buf_used_ = 0;
+}
+
+void FlvRecorder::_Finish()
+{
+    if (fd_ < 0)
+        return;
+    _Flush(true);
+    close(fd_);
+    fd_ = -1;
+    LogInfo("record {} finish, written {} bytes in {} writes, max write {}us, max pending {} bytes, dropped {} frames",
+            path_, written_bytes_.load(), write_count_.load(), max_write_us_.load(), max_pending_bytes_.load(),
+            dropped_frames_.load());
+}
+
+int FlvRecordInit(const FlvRecordConfig &config)
+{
+    s_record_config = config;
+    if (!config.enable || s_record_pool_started)
+        return 0;
+    s_record_thread_pool.init(1);
+    if (!s_record_thread_pool.start())
+        return -1;
+    s_record_pool_started = true;
+    return 0;
+}
+
+bool FlvRecordIsEnabled()
+{
+    return s_record_config.enable;
+}
+
+int FlvRecordGetPath(const std::string &app_stream, std::string *path)
+{
+    // 流名来自客户端, 只允许app/stream这一层
+    size_t pos = app_stream.find('/');
+    if (pos == std::string::npos || pos == 0 || pos == app_stream.size() - 1
+        || app_stream.find('/', pos + 1) != std::string::npos || app_stream.find("..") != std::string::npos) {
+        LogWarn("record {} invalid stream name", app_stream);
+        return -1;
+    }
+    *path = s_record_config.dir + "/" + app_stream + ".flv";
+    return 0;
+}
+
+FlvRecorderPtr FlvRecordCreate(const std::string &app_stream, const char *stream_type)
+{
+    if (!s_record_config.enable || !stream_type)
+        return FlvRecorderPtr();
+    bool append = 0 == strcmp(stream_type, RTMP_STREAM_APPEND);
+    if (!append && 0 != strcmp(stream_type, RTMP_STREAM_RECORD))
+        return FlvRecorderPtr();
+
+    std::string path;
+    if (FlvRecordGetPath(app_stream, &path) < 0)
+        return FlvRecorderPtr();
+    return std::make_shared<FlvRecorder>(path, append, s_record_config);
+}
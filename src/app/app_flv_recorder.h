@@ -0,0 +1,124 @@
+/**
+ * FLV录制: publish类型为record/append时给LiveSource挂一个录制端, 把收到的帧写成FLV文件
+ * 1. 推流端的loop里只把帧的引用放进队列, 组装tag和写盘都在单独的IO线程, 不会阻塞在磁盘上
+ * 2. tag拷贝进按页对齐的大块buffer, 写满一块才写一次盘, 可选O_DIRECT
+ * 3. 磁盘跟不上时积压有上限, 超过上限按配置的策略丢帧或者停止录制
+ */
+#ifndef APP_FLV_RECORDER_H
+#define APP_FLV_RECORDER_H
+
+#include "app/app_live_source.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define FLV_RECORD_ALIGN                4096
+#define FLV_RECORD_BUFFER_SIZE          (1024 * 1024)       // 每次写盘的大小, FLV_RECORD_ALIGN的整数倍
+#define FLV_RECORD_MAX_PENDING_BYTES    (64 * 1024 * 1024)  // 每个录制端还没写盘的最大字节数
+
+// 积压超过上限时的处理
+enum {
+    FLV_RECORD_DROP_TO_KEYFRAME,    // 丢帧直到积压回到上限以内的下一个视频关键帧, 文件仍然可以播放
+    FLV_RECORD_STOP,                // 停止录制, 已经写入的部分保留
+};
+
+typedef struct {
+    bool enable;
+    std::string dir;                // 文件保存在 dir/app/stream.flv
+    uint32_t buffer_size;
+    uint64_t max_pending_bytes;
+    int overflow_policy;            // FLV_RECORD_XXX
+    bool direct_io;                 // 用O_DIRECT打开, 文件系统不支持时退回普通写
+} FlvRecordConfig;
+
+// 某个录制端的统计
+typedef struct {
+    uint64_t pending_bytes;         // 已经入队还没写盘的帧数据
+    uint64_t max_pending_bytes;     // pending_bytes的峰值
+    uint64_t written_bytes;         // 写进文件的字节数
+    uint64_t write_count;           // 写盘次数
+    uint64_t max_write_us;          // 单次写盘最长耗时
+    uint64_t dropped_frames;        // 积压超限丢掉的帧
+    uint64_t dropped_bytes;
+} FlvRecordStats;
+
+class FlvRecorder : public LiveConsumer, public std::enable_shared_from_this<FlvRecorder>
+{
+public:
+    /**
+     * @param path 文件路径
+     * @param append true时接在已有文件后面, 时间戳从原文件最后一帧继续
+     */
+    FlvRecorder(const std::string &path, bool append, const FlvRecordConfig &config);
+    virtual ~FlvRecorder();
+
+    // 放进队列交给IO线程, 积压超限时按策略丢帧; 没有FlvRecordInit时在调用线程直接写
+    virtual int OnPacket(const MediaPacketPtr &pkt);
+    // 推流结束, 剩下的数据写完后关闭文件
+    void Close();
+
+    FlvRecordStats GetStats() const;
+    const std::string &GetPath() const { return path_; }
+
+private:
+    void _Run();
+    int _Open();
+    int _Create();
+    void _Write(const MediaPacket &pkt);
+    void _Append(const void *data, size_t bytes);
+    void _Flush(bool final);
+    void _Finish();
+
+private:
+    std::string path_;
+    bool append_;
+    FlvRecordConfig config_;
+
+    std::mutex queue_mutex_;
+    std::vector<MediaPacketPtr> queue_;     // 空指针表示推流结束
+    bool scheduled_;                        // 已经交给IO线程
+    bool closed_;
+    bool dropping_;                         // 正在丢帧, 等下一个关键帧
+    bool stopped_;                          // FLV_RECORD_STOP策略下已经停止
+    bool has_video_;                        // 只有音频时丢帧到任意一帧为止
+
+    // 只在IO线程访问
+    int fd_;
+    bool direct_;
+    bool failed_;                           // 打开或者写入失败, 后面的帧都丢掉
+    uint8_t *buf_;                          // 按FLV_RECORD_ALIGN对齐
+    size_t buf_used_;
+    uint64_t file_offset_;
+    bool has_base_;
+    uint32_t base_ts_;                      // 第一帧的时间戳, 文件里的时间戳从0(或者原文件结尾)开始
+    uint32_t append_ts_;
+
+    std::atomic<uint64_t> pending_bytes_;
+    std::atomic<uint64_t> max_pending_bytes_;
+    std::atomic<uint64_t> written_bytes_;
+    std::atomic<uint64_t> write_count_;
+    std::atomic<uint64_t> max_write_us_;
+    std::atomic<uint64_t> dropped_frames_;
+    std::atomic<uint64_t> dropped_bytes_;
+};
+typedef std::shared_ptr<FlvRecorder> FlvRecorderPtr;
+
+// 启动IO线程, 在推流开始之前调用
+int FlvRecordInit(const FlvRecordConfig &config);
+bool FlvRecordIsEnabled();
+
+// 录制文件的路径, 点播也按这个路径找文件; 流名不合法(比如带..)时返回-1
+int FlvRecordGetPath(const std::string &app_stream, std::string *path);
+
+/**
+ * @brief 按publish类型创建录制端, live或者没有打开录制时返回空
+ *
+ * @param app_stream "app/stream"
+ * @param stream_type record/append
+ */
+FlvRecorderPtr FlvRecordCreate(const std::string &app_stream, const char *stream_type);
+
+#endif
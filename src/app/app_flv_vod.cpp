@@ -0,0 +1,270 @@
+#include "app_flv_vod.h"
+#include "util/dlog.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <map>
+#include <mutex>
+
+// 所有loop共享; 全局锁只保护map和每一项的file, 建索引只锁这个文件自己的项, 不挡别的文件
+struct FlvVodEntry
+{
+    std::mutex build_mutex;                 // 同一个文件同时只建一次索引
+    std::shared_ptr<FlvVodFile> file;       // 持有s_vod_mutex时访问
+};
+static std::mutex s_vod_mutex;
+static std::map<std::string, std::shared_ptr<FlvVodEntry> > s_vod_files;
+
+FlvVodFile::FlvVodFile()
+    : data_(NULL), size_(0), file_size_(0), mtime_(0), first_tag_(0), duration_ms_(0),
+      metadata_(0), video_config_(0), audio_config_(0)
+{
+}
+
+FlvVodFile::~FlvVodFile()
+{
+    if (data_)
+        munmap((void *)data_, size_);
+}
+
+// 持有s_vod_mutex时调用
+static bool FlvVodUnchanged(const std::shared_ptr<FlvVodFile> &file, const struct stat &st)
+{
+    return file && file->GetFileSize() == st.st_size && file->GetMtime() == st.st_mtime;
+}
+
+int FlvVodFile::Find(const std::string &path, FlvVodFilePtr *file)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) < 0)
+        return -1;
+
+    std::lock_guard<std::mutex> lock(s_vod_mutex);
+    auto it = s_vod_files.find(path);
+    if (it != s_vod_files.end() && FlvVodUnchanged(it->second->file, st))
+        *file = it->second->file;
+    return 0;
+}
+
+FlvVodFilePtr FlvVodFile::Open(const std::string &path)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) < 0)
+        return FlvVodFilePtr();
+
+    std::shared_ptr<FlvVodEntry> entry;
+    {
+        std::lock_guard<std::mutex> lock(s_vod_mutex);
+        std::shared_ptr<FlvVodEntry> &e = s_vod_files[path];
+        if (!e)
+            e = std::make_shared<FlvVodEntry>();
+        else if (FlvVodUnchanged(e->file, st))
+            return e->file;
+        entry = e;
+    }
+
+    std::lock_guard<std::mutex> build_lock(entry->build_mutex);
+    {
+        std::lock_guard<std::mutex> lock(s_vod_mutex);
+        if (FlvVodUnchanged(entry->file, st))
+            return entry->file;     // 等锁期间别的线程已经建好了
+    }
+
+    // 文件变了(比如还在录制或者重新录了), 正在看旧文件的观众继续用旧的映射
+    std::shared_ptr<FlvVodFile> file(new FlvVodFile());
+    if (file->_Map(path) < 0)
+        return FlvVodFilePtr();
+    file->_BuildIndex();
+    LogInfo("vod open {}, {} bytes, duration {}ms, {} keyframes", path, file->size_, file->duration_ms_,
+            file->keyframes_.size());
+
+    std::lock_guard<std::mutex> lock(s_vod_mutex);
+    entry->file = file;
+    if (s_vod_files.size() > FLV_VOD_CACHE_MAX_FILES) {
+        for (auto i = s_vod_files.begin(); i != s_vod_files.end();) {
+            // 没有观众, 也没有线程在建索引
+            if (i->second.use_count() == 1 && (!i->second->file || i->second->file.use_count() == 1))
+                i = s_vod_files.erase(i);
+            else
+                ++i;
+        }
+    }
+    return file;
+}
+
+int FlvVodFile::_Map(const std::string &path)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        LogWarn("vod open {} failed: {}", path, strerror(errno));
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < FLV_HEADER_SIZE + 4) {
+        close(fd);
+        return -1;
+    }
+    void *p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == p) {
+        LogWarn("vod mmap {} failed: {}", path, strerror(errno));
+        return -1;
+    }
+
+    path_ = path;
+    data_ = (const uint8_t *)p;
+    size_ = st.st_size;
+    file_size_ = st.st_size;
+    mtime_ = st.st_mtime;
+    if (0 != memcmp(data_, "FLV", 3)) {
+        LogWarn("vod {} is not a flv file", path);
+        return -1;
+    }
+    first_tag_ = ((uint32_t)data_[5] << 24 | (uint32_t)data_[6] << 16 | (uint32_t)data_[7] << 8 | data_[8]) + 4;
+    return 0;
+}
+
+// 扫一遍tag头, 只读每个tag开头的几个字节
+void FlvVodFile::_BuildIndex()
+{
+    bool has_video = false;
+    uint32_t last_audio_index = 0;
+    std::vector<FlvKeyframe> audio_index;
+    FlvTag tag;
+    for (uint64_t offset = first_tag_; ReadTag(offset, &tag); offset = tag.next) {
+        if (tag.timestamp > duration_ms_)
+            duration_ms_ = tag.timestamp;
+        if (FLV_TYPE_SCRIPT == tag.type) {
+            if (!metadata_)
+                metadata_ = offset;
+        } else if (FLV_TYPE_VIDEO == tag.type && tag.size >= 2) {
+            has_video = true;
+            uint8_t codec = tag.data[0] & 0x0F;
+            bool config = (FLV_VIDEO_CODEC_AVC == codec || FLV_VIDEO_CODEC_HEVC == codec) && 0 == tag.data[1];
+            if (config) {
+                if (!video_config_)
+                    video_config_ = offset;
+            } else if (FLV_VIDEO_KEY_FRAME == (tag.data[0] >> 4)) {
+                keyframes_.push_back({ tag.timestamp, offset });
+            }
+        } else if (FLV_TYPE_AUDIO == tag.type && tag.size >= 2) {
+            if (FLV_AUDIO_AAC == (tag.data[0] >> 4) && 0 == tag.data[1]) {
+                if (!audio_config_)
+                    audio_config_ = offset;
+            } else if (audio_index.empty() || tag.timestamp - last_audio_index >= FLV_VOD_AUDIO_INDEX_MS) {
+                audio_index.push_back({ tag.timestamp, offset });
+                last_audio_index = tag.timestamp;
+            }
+        }
+    }
+    // 只有音频时任意一帧都可以开始
+    if (!has_video)
+        keyframes_.swap(audio_index);
+}
+
+bool FlvVodFile::ReadTag(uint64_t offset, FlvTag *tag) const
+{
+    if (offset + FLV_TAG_HEADER_SIZE > size_)
+        return false;
+    const uint8_t *p = data_ + offset;
+    size_t size = (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+    if (offset + FLV_TAG_HEADER_SIZE + size + 4 > size_)
+        return false;   // 最后一个tag还没写完
+    tag->type = p[0] & 0x1F;
+    tag->timestamp = (uint32_t)p[4] << 16 | (uint32_t)p[5] << 8 | p[6] | (uint32_t)p[7] << 24;
+    tag->data = p + FLV_TAG_HEADER_SIZE;
+    tag->size = size;
+    tag->next = offset + FLV_TAG_HEADER_SIZE + size + 4;
+    return true;
+}
+
+FlvKeyframe FlvVodFile::Seek(uint32_t ms) const
+{
+    auto it = std::upper_bound(keyframes_.begin(), keyframes_.end(), ms,
+                               [](uint32_t v, const FlvKeyframe &k) { return v < k.timestamp; });
+    if (it == keyframes_.begin()) {
+        FlvKeyframe first = { 0, first_tag_ };
+        return first;
+    }
+    return *(it - 1);
+}
+
+MediaPacketPtr FlvVodFile::_CreatePacket(uint64_t offset, uint32_t timestamp) const
+{
+    FlvTag tag;
+    if (!offset || !ReadTag(offset, &tag))
+        return MediaPacketPtr();
+    return MediaPacket::Create(tag.type, tag.data, tag.size, timestamp);
+}
+
+FlvVodSession::FlvVodSession(const FlvVodFilePtr &file)
+    : file_(file), offset_(file->GetFirstTag()), start_ts_(0), start_tick_(0), pause_tick_(0),
+      paused_(false), end_(false)
+{
+}
+
+void FlvVodSession::Seek(uint32_t ms, uint64_t now)
+{
+    FlvKeyframe keyframe = file_->Seek(ms);
+    offset_ = keyframe.offset;
+    start_ts_ = keyframe.timestamp;
+    start_tick_ = now;
+    pause_tick_ = now;
+    end_ = false;
+
+    // 从文件开头播放时这些tag本来就在前面
+    pending_.clear();
+    if (offset_ == file_->GetFirstTag())
+        return;
+    MediaPacketPtr pkt;
+    if ((pkt = file_->GetMetadata(start_ts_)))
+        pending_.push_back(pkt);
+    if ((pkt = file_->GetVideoConfig(start_ts_)))
+        pending_.push_back(pkt);
+    if ((pkt = file_->GetAudioConfig(start_ts_)))
+        pending_.push_back(pkt);
+}
+
+void FlvVodSession::Pause(bool pause, uint64_t now)
+{
+    if (pause == paused_)
+        return;
+    paused_ = pause;
+    if (pause)
+        pause_tick_ = now;
+    else
+        start_tick_ += now - pause_tick_;   // 从暂停的位置继续
+}
+
+int FlvVodSession::Read(uint64_t now, size_t max_bytes, std::vector<MediaPacketPtr> *packets)
+{
+    int count = 0;
+    for (size_t i = 0; i < pending_.size(); i++, count++)
+        packets->push_back(pending_[i]);
+    pending_.clear();
+    if (paused_ || end_)
+        return count;
+
+    uint64_t deadline = start_ts_ + (now - start_tick_) + FLV_VOD_PRELOAD_MS;
+    size_t bytes = 0;
+    FlvTag tag;
+    while (bytes < max_bytes) {
+        if (!file_->ReadTag(offset_, &tag)) {
+            end_ = true;
+            break;
+        }
+        // 时间戳比seek点小的tag(比如关键帧前面的音频)不用等
+        if (tag.timestamp > start_ts_ && tag.timestamp > deadline)
+            break;
+        packets->push_back(MediaPacket::Create(tag.type, tag.data, tag.size, tag.timestamp));
+        bytes += tag.size;
+        offset_ = tag.next;
+        count++;
+    }
+    return count;
+}
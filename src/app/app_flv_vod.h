@@ -0,0 +1,128 @@
+/**
+ * FLV点播: play的start >= 0时播放录制好的FLV文件
+ * 1. 文件mmap到内存, 第一次打开时扫描一遍建关键帧索引(时间戳 -> 偏移), 按路径缓存;
+ *    建索引要读整个文件, 在线程池里做, loop里只查缓存
+ * 2. 同一个文件的所有观众共享一份映射和索引, 每个观众只有自己的读位置
+ * 3. 按时间戳匀速发送, seek跳到不晚于目标时间的关键帧
+ */
+#ifndef APP_FLV_VOD_H
+#define APP_FLV_VOD_H
+
+#include "app/app_media_packet.h"
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#define FLV_VOD_TICK_MS             20                  // 发送定时器间隔
+#define FLV_VOD_PRELOAD_MS          1000                // 开始和seek之后先多发这么多, 填满播放器的缓冲
+#define FLV_VOD_BATCH_BYTES         (256 * 1024)        // 每次最多取出的数据量
+#define FLV_VOD_CACHE_MAX_FILES     64                  // 缓存的文件个数, 超过时释放没有观众的
+#define FLV_VOD_AUDIO_INDEX_MS      1000                // 只有音频时每隔这么久记一个索引
+
+typedef struct {
+    uint32_t timestamp;
+    uint64_t offset;            // tag头在文件里的偏移
+} FlvKeyframe;
+
+typedef struct {
+    int type;                   // FLV_TYPE_XXX
+    uint32_t timestamp;
+    const uint8_t *data;
+    size_t size;
+    uint64_t next;              // 下一个tag的偏移
+} FlvTag;
+
+class FlvVodFile;
+typedef std::shared_ptr<const FlvVodFile> FlvVodFilePtr;
+
+class FlvVodFile
+{
+public:
+    ~FlvVodFile();
+
+    /**
+     * @brief 打开并建索引, 已经打开过并且文件没有变化时直接返回缓存的
+     * 会读整个文件, 不要在loop里调用; 同一个文件只有一个线程建索引, 其他的等它建好
+     *
+     * @return 文件不存在或者不是FLV时返回空
+     */
+    static FlvVodFilePtr Open(const std::string &path);
+    /**
+     * @brief 只查缓存, 不读文件, 可以在loop里调用
+     *
+     * @return 文件不存在时返回-1; 缓存里有并且文件没有变化时file设为缓存的, 否则不变
+     */
+    static int Find(const std::string &path, FlvVodFilePtr *file);
+
+    uint32_t GetDuration() const { return duration_ms_; }
+    off_t GetFileSize() const { return file_size_; }
+    time_t GetMtime() const { return mtime_; }
+    uint64_t GetFirstTag() const { return first_tag_; }
+    const std::vector<FlvKeyframe> &GetKeyframes() const { return keyframes_; }
+
+    // offset处的tag, 越界或者不完整时返回false
+    bool ReadTag(uint64_t offset, FlvTag *tag) const;
+    // 不晚于ms的最后一个关键帧, 没有时返回第一个tag
+    FlvKeyframe Seek(uint32_t ms) const;
+
+    // 文件里第一个metadata和sequence header, 从中间开始播放时先发, 没有时返回空
+    MediaPacketPtr GetMetadata(uint32_t timestamp) const { return _CreatePacket(metadata_, timestamp); }
+    MediaPacketPtr GetVideoConfig(uint32_t timestamp) const { return _CreatePacket(video_config_, timestamp); }
+    MediaPacketPtr GetAudioConfig(uint32_t timestamp) const { return _CreatePacket(audio_config_, timestamp); }
+
+private:
+    FlvVodFile();
+    int _Map(const std::string &path);
+    void _BuildIndex();
+    MediaPacketPtr _CreatePacket(uint64_t offset, uint32_t timestamp) const;
+
+private:
+    std::string path_;
+    const uint8_t *data_;
+    size_t size_;
+    off_t file_size_;           // 和mtime一起判断文件是否变化
+    time_t mtime_;
+
+    uint64_t first_tag_;
+    uint32_t duration_ms_;
+    std::vector<FlvKeyframe> keyframes_;
+    uint64_t metadata_;         // 0表示没有
+    uint64_t video_config_;
+    uint64_t audio_config_;
+};
+
+// 一个观众的播放位置, 只在连接所在的loop访问
+class FlvVodSession
+{
+public:
+    FlvVodSession(const FlvVodFilePtr &file);
+
+    // 从不晚于ms的关键帧开始, 先发metadata和sequence header
+    void Seek(uint32_t ms, uint64_t now);
+    void Pause(bool pause, uint64_t now);
+    bool IsPaused() const { return paused_; }
+    bool IsEnd() const { return end_; }
+
+    /**
+     * @brief 取出到now为止该发送的帧(多发FLV_VOD_PRELOAD_MS), 最多max_bytes
+     *
+     * @return 取出的帧数
+     */
+    int Read(uint64_t now, size_t max_bytes, std::vector<MediaPacketPtr> *packets);
+
+private:
+    FlvVodFilePtr file_;
+    uint64_t offset_;           // 下一个要发的tag
+    uint32_t start_ts_;         // seek到的关键帧时间戳
+    uint64_t start_tick_;       // 开始发start_ts_的时间, 暂停时往后移
+    uint64_t pause_tick_;
+    bool paused_;
+    bool end_;
+    std::vector<MediaPacketPtr> pending_;   // seek之后要先发的metadata和sequence header
+};
+typedef std::shared_ptr<FlvVodSession> FlvVodSessionPtr;
+
+#endif
@@ -0,0 +1,63 @@
+#include "app_gop_cache.h"
+#include "util/dlog.h"
+
+std::atomic<size_t> GopCache::s_total_bytes_(0);
+
+GopCache::GopCache() : bytes_(0), has_video_(false)
+{
+    config_.enable = true;
+    config_.max_bytes = GOP_CACHE_MAX_BYTES;
+    config_.max_duration_ms = GOP_CACHE_MAX_DURATION_MS;
+}
+
+GopCache::~GopCache()
+{
+    Clear();
+}
+
+void GopCache::Push(const MediaPacketPtr &pkt)
+{
+    if (!config_.enable || pkt->IsSequenceHeader() || FLV_TYPE_SCRIPT == pkt->GetType())
+        return;
+
+    if (FLV_TYPE_VIDEO == pkt->GetType()) {
+        has_video_ = true;
+        if (pkt->IsKeyFrame())
+            Clear();    // 新的GOP从关键帧开始
+        else if (packets_.empty())
+            return;     // 还没有等到关键帧
+    } else if (has_video_ && packets_.empty()) {
+        return;         // 有视频时音频也从关键帧之后开始缓存
+    }
+
+    packets_.push_back(pkt);
+    bytes_ += pkt->GetSize();
+    s_total_bytes_ += pkt->GetSize();
+
+    uint32_t duration = pkt->GetTimestamp() - packets_.front()->GetTimestamp();
+    if (bytes_ <= config_.max_bytes && duration <= config_.max_duration_ms)
+        return;
+
+    if (has_video_) {
+        LogWarn("gop too large, bytes: {}, duration: {}ms, drop it", bytes_, duration);
+        Clear();
+    } else {
+        while (!packets_.empty() && (bytes_ > config_.max_bytes
+               || pkt->GetTimestamp() - packets_.front()->GetTimestamp() > config_.max_duration_ms))
+            _PopFront();
+    }
+}
+
+void GopCache::Clear()
+{
+    s_total_bytes_ -= bytes_;
+    bytes_ = 0;
+    packets_.clear();
+}
+
+void GopCache::_PopFront()
+{
+    bytes_ -= packets_.front()->GetSize();
+    s_total_bytes_ -= packets_.front()->GetSize();
+    packets_.pop_front();
+}
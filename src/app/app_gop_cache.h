@@ -0,0 +1,58 @@
+/**
+ * GOP缓存: 保存最近一个关键帧开始的所有帧, 新的拉流端加入时先发这些帧, 不用等下一个关键帧
+ */
+#ifndef APP_GOP_CACHE_H
+#define APP_GOP_CACHE_H
+
+#include "app/app_media_packet.h"
+
+#include <atomic>
+#include <deque>
+
+// 默认配置
+#define GOP_CACHE_MAX_BYTES         (16 * 1024 * 1024)
+#define GOP_CACHE_MAX_DURATION_MS   10000
+
+typedef struct {
+    bool enable;
+    uint32_t max_bytes;         // 单个流最多缓存的字节数
+    uint32_t max_duration_ms;   // 单个流最多缓存的时长
+} GopCacheConfig;
+
+class GopCache
+{
+public:
+    GopCache();
+    ~GopCache();
+
+    void SetConfig(const GopCacheConfig &config) { config_ = config; }
+    const GopCacheConfig &GetConfig() const { return config_; }
+
+    /**
+     * @brief 缓存一帧, sequence header和metadata由调用者单独保存, 不要放进来
+     *
+     * 遇到视频关键帧时丢弃旧的GOP重新开始; 超过字节数或时长上限时整个丢弃,
+     * 等下一个关键帧再开始缓存(不完整的GOP对新拉流端没有意义)
+     */
+    void Push(const MediaPacketPtr &pkt);
+    void Clear();
+
+    const std::deque<MediaPacketPtr> &GetPackets() const { return packets_; }
+    size_t GetBytes() const { return bytes_; }
+
+    // 进程内所有GOP缓存占用的字节数
+    static size_t GetTotalBytes() { return s_total_bytes_; }
+
+private:
+    void _PopFront();
+
+private:
+    GopCacheConfig config_;
+    std::deque<MediaPacketPtr> packets_;
+    size_t bytes_;
+    bool has_video_;    // 纯音频流没有关键帧, 按时长滑动保存
+
+    static std::atomic<size_t> s_total_bytes_;
+};
+
+#endif
@@ -0,0 +1,236 @@
+#include "app_hls_segmenter.h"
+#include "network/netlib.h"
+#include "thread/thread_pool.h"
+#include "util/dlog.h"
+
+#include <stdio.h>
+#include <map>
+
+#define HLS_SEGMENT_RESERVE     (1024 * 1024)
+
+static HlsConfig s_hls_config = { false, HLS_DEFAULT_SEGMENT_MS, HLS_DEFAULT_WINDOW };
+static longkit::ThreadPool s_hls_thread_pool;
+static bool s_hls_pool_started = false;
+
+// 推流结束后分片器还留着, 推流端重连时接着编号, 播放器不用重新开始
+static std::mutex s_hls_mutex;
+static std::map<std::string, HlsSegmenterPtr> s_hls;
+
+HlsSegmenter::HlsSegmenter(const std::string &app_stream, const HlsConfig &config)
+    : app_stream_(app_stream), config_(config), scheduled_(false), current_(NULL),
+      start_ts_(0), last_ts_(0), frame_ts_(0), frame_interval_(0), has_frame_(false),
+      next_seq_(0), discontinuity_(false)
+{
+    size_t pos = app_stream.rfind('/');
+    name_ = pos == std::string::npos ? app_stream : app_stream.substr(pos + 1);
+}
+
+int HlsSegmenter::OnPacket(const MediaPacketPtr &pkt)
+{
+    if (!s_hls_pool_started) {
+        Input(pkt);
+        return 0;
+    }
+
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+    queue_.push_back(pkt);
+    if (!scheduled_) {
+        scheduled_ = true;
+        s_hls_thread_pool.post(std::bind(&HlsSegmenter::_Run, shared_from_this()));
+    }
+    return 0;
+}
+
+void HlsSegmenter::Finish()
+{
+    OnPacket(MediaPacketPtr());
+}
+
+// 一次取走队列里所有的帧, 打包期间推流端继续入队
+void HlsSegmenter::_Run()
+{
+    std::vector<MediaPacketPtr> packets;
+    for (;;) {
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex_);
+            if (queue_.empty()) {
+                scheduled_ = false;
+                return;
+            }
+            packets.swap(queue_);
+        }
+        for (size_t i = 0; i < packets.size(); i++)
+            Input(packets[i]);
+        packets.clear();
+    }
+}
+
+void HlsSegmenter::Input(const MediaPacketPtr &pkt)
+{
+    if (!pkt) {     // 推流结束
+        Flush();
+        discontinuity_ = true;
+        has_frame_ = false;     // 重新推流的帧率可能不一样
+        frame_interval_ = 0;
+        return;
+    }
+
+    int type = pkt->GetType();
+    if (FLV_TYPE_SCRIPT == type)
+        return;
+    if (pkt->IsSequenceHeader()) {
+        if (FLV_TYPE_VIDEO == type)
+            muxer_.SetVideoConfig(pkt->GetData(), pkt->GetSize());
+        else
+            muxer_.SetAudioConfig(pkt->GetData(), pkt->GetSize());
+        return;
+    }
+    if ((FLV_TYPE_VIDEO == type && !muxer_.HasVideo()) || (FLV_TYPE_AUDIO == type && !muxer_.HasAudio()))
+        return;
+
+    // 有视频时分片从关键帧开始, 只有音频时按时长切
+    uint32_t ts = pkt->GetTimestamp();
+    bool boundary = muxer_.HasVideo() ? pkt->IsKeyFrame() : true;
+    if (current_ && boundary && ts - start_ts_ >= config_.segment_ms)
+        _CutSegment(ts);
+    if (!current_) {
+        if (!boundary)
+            return;
+        current_ = new std::string();
+        current_->reserve(HLS_SEGMENT_RESERVE);
+        muxer_.WriteHeader(current_);
+        start_ts_ = ts;
+    }
+    muxer_.WritePacket(*pkt, current_);
+    last_ts_ = ts;
+    if (!muxer_.HasVideo() || FLV_TYPE_VIDEO == type) {
+        if (has_frame_ && ts > frame_ts_)
+            frame_interval_ = ts - frame_ts_;
+        frame_ts_ = ts;
+        has_frame_ = true;
+    }
+}
+
+void HlsSegmenter::Flush()
+{
+    if (!current_)
+        return;
+    // 中间的分片在下一个关键帧处结束, 自然包含了最后一帧; 推流结束时要自己补上
+    uint32_t end_ts = frame_ts_ + frame_interval_;
+    if ((int32_t)(end_ts - last_ts_) < 0)
+        end_ts = last_ts_;
+    if (end_ts == start_ts_) {
+        LogDebug("hls {} drop zero-length segment", app_stream_);
+        delete current_;
+        current_ = NULL;
+        return;
+    }
+    _CutSegment(end_ts);
+}
+
+void HlsSegmenter::_CutSegment(uint32_t end_ts)
+{
+    HlsSegment segment;
+    segment.seq = next_seq_++;
+    segment.duration_ms = end_ts - start_ts_;
+    segment.discontinuity = discontinuity_;
+    segment.data = SendBufferPtr(current_);
+    current_ = NULL;
+    discontinuity_ = false;
+    LogDebug("hls {} segment {}, {}ms, {} bytes", app_stream_, segment.seq, segment.duration_ms,
+             segment.data->size());
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    segments_.push_back(segment);
+    // 比m3u8多留一个, 刚拿到上一版m3u8的播放器还能下载
+    while (segments_.size() > config_.window + 1)
+        segments_.pop_front();
+    _UpdatePlaylist();
+}
+
+// 持有mutex_时调用
+void HlsSegmenter::_UpdatePlaylist()
+{
+    size_t first = segments_.size() > config_.window ? segments_.size() - config_.window : 0;
+    uint32_t target_ms = config_.segment_ms;
+    for (size_t i = first; i < segments_.size(); i++)
+        target_ms = segments_[i].duration_ms > target_ms ? segments_[i].duration_ms : target_ms;
+
+    char line[256];
+    std::string *playlist = new std::string();
+    snprintf(line, sizeof(line), "#EXTM3U\n#EXT-X-VERSION:3\n#EXT-X-TARGETDURATION:%u\n#EXT-X-MEDIA-SEQUENCE:%llu\n",
+             (target_ms + 999) / 1000, (unsigned long long)segments_[first].seq);
+    playlist->append(line);
+    for (size_t i = first; i < segments_.size(); i++) {
+        const HlsSegment &segment = segments_[i];
+        if (segment.discontinuity)
+            playlist->append("#EXT-X-DISCONTINUITY\n");
+        snprintf(line, sizeof(line), "#EXTINF:%u.%03u,\n%s-%llu.ts\n", segment.duration_ms / 1000,
+                 segment.duration_ms % 1000, name_.c_str(), (unsigned long long)segment.seq);
+        playlist->append(line);
+    }
+    playlist_ = SendBufferPtr(playlist);
+}
+
+SendBufferPtr HlsSegmenter::GetPlaylist()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return playlist_;
+}
+
+SendBufferPtr HlsSegmenter::GetSegment(uint64_t seq)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (segments_.empty() || seq < segments_.front().seq || seq > segments_.back().seq)
+        return SendBufferPtr();
+    return segments_[seq - segments_.front().seq].data;
+}
+
+int HlsInit(const HlsConfig &config, uint32_t thread_num)
+{
+    s_hls_config = config;
+    if (!config.enable || s_hls_pool_started)
+        return 0;
+    s_hls_thread_pool.init(thread_num);
+    if (!s_hls_thread_pool.start())
+        return -1;
+    s_hls_pool_started = true;
+    return 0;
+}
+
+bool HlsIsEnabled()
+{
+    return s_hls_config.enable;
+}
+
+HlsSegmenterPtr HlsAttach(const std::string &app_stream)
+{
+    std::lock_guard<std::mutex> lock(s_hls_mutex);
+    auto it = s_hls.find(app_stream);
+    if (it != s_hls.end()) {
+        it->second->loop_index_ = netlib_loop_index();  // 推流端可能换了loop
+        return it->second;
+    }
+    HlsSegmenterPtr segmenter = std::make_shared<HlsSegmenter>(app_stream, s_hls_config);
+    s_hls[app_stream] = segmenter;
+    return segmenter;
+}
+
+static HlsSegmenterPtr HlsFind(const std::string &app_stream)
+{
+    std::lock_guard<std::mutex> lock(s_hls_mutex);
+    auto it = s_hls.find(app_stream);
+    return it != s_hls.end() ? it->second : HlsSegmenterPtr();
+}
+
+SendBufferPtr HlsGetPlaylist(const std::string &app_stream)
+{
+    HlsSegmenterPtr segmenter = HlsFind(app_stream);
+    return segmenter ? segmenter->GetPlaylist() : SendBufferPtr();
+}
+
+SendBufferPtr HlsGetSegment(const std::string &app_stream, uint64_t seq)
+{
+    HlsSegmenterPtr segmenter = HlsFind(app_stream);
+    return segmenter ? segmenter->GetSegment(seq) : SendBufferPtr();
+}
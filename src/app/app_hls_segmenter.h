@@ -0,0 +1,95 @@
+/**
+ * HLS: 推流时给LiveSource挂一个分片器, 在关键帧处切TS分片, 内存里保留最近几个分片
+ * 1. 分片器是一个LiveConsumer, 推流端的loop里只把帧放进队列, 打包在线程池里做, 不影响收流
+ * 2. 分片和m3u8都是创建后不再修改的SendBufferPtr, 重复请求只增加引用计数, 不读磁盘
+ */
+#ifndef APP_HLS_SEGMENTER_H
+#define APP_HLS_SEGMENTER_H
+
+#include "app/app_live_source.h"
+#include "app/app_ts_muxer.h"
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define HLS_DEFAULT_SEGMENT_MS  2000
+#define HLS_DEFAULT_WINDOW      6
+#define HLS_DEFAULT_THREADS     2
+
+typedef struct {
+    bool enable;
+    uint32_t segment_ms;        // 目标分片时长, 只在关键帧处切, 实际时长取决于GOP
+    uint32_t window;            // m3u8里的分片个数, 内存里多留一个给正在下载的播放器
+} HlsConfig;
+
+typedef struct {
+    uint64_t seq;
+    uint32_t duration_ms;
+    bool discontinuity;         // 推流端重连后的第一个分片
+    SendBufferPtr data;
+} HlsSegment;
+
+class HlsSegmenter : public LiveConsumer, public std::enable_shared_from_this<HlsSegmenter>
+{
+public:
+    HlsSegmenter(const std::string &app_stream, const HlsConfig &config);
+    virtual ~HlsSegmenter() { delete current_; }
+
+    // 放进队列, 由线程池打包; 没有HlsInit时在调用线程直接打包
+    virtual int OnPacket(const MediaPacketPtr &pkt);
+    // 推流结束, 当前分片直接结束, 下次推流从新分片开始
+    void Finish();
+
+    // 打包一帧, 同一时间只在一个线程调用
+    void Input(const MediaPacketPtr &pkt);
+    // 结束当前分片, 最后一帧按一个帧间隔计入时长; 时长为0的分片直接丢掉
+    void Flush();
+
+    SendBufferPtr GetPlaylist();
+    SendBufferPtr GetSegment(uint64_t seq);
+
+private:
+    void _Run();
+    void _CutSegment(uint32_t end_ts);
+    void _UpdatePlaylist();
+
+private:
+    std::string app_stream_;
+    std::string name_;          // 分片文件名前缀, "app/stream"里的stream
+    HlsConfig config_;
+
+    std::mutex queue_mutex_;
+    std::vector<MediaPacketPtr> queue_;     // 空指针表示推流结束
+    bool scheduled_;                        // 已经交给线程池, 同一个流同时只有一个任务
+
+    // 只在打包线程访问
+    TsMuxer muxer_;
+    std::string *current_;                  // 正在写的分片
+    uint32_t start_ts_;
+    uint32_t last_ts_;
+    uint32_t frame_ts_;                     // 决定切片的那一路(有视频时是视频)上一帧的时间戳
+    uint32_t frame_interval_;               // 这一路的帧间隔, 0表示还不知道
+    bool has_frame_;
+    uint64_t next_seq_;
+    bool discontinuity_;
+
+    std::mutex mutex_;                      // 保护下面两个, 和http拉流端所在的loop共享
+    std::deque<HlsSegment> segments_;
+    SendBufferPtr playlist_;
+};
+typedef std::shared_ptr<HlsSegmenter> HlsSegmenterPtr;
+
+// 启动打包线程池, 在推流开始之前调用
+int HlsInit(const HlsConfig &config, uint32_t thread_num = HLS_DEFAULT_THREADS);
+bool HlsIsEnabled();
+
+// 推流开始时取这个流的分片器, 推流端重连时沿用之前的分片序号
+HlsSegmenterPtr HlsAttach(const std::string &app_stream);
+
+SendBufferPtr HlsGetPlaylist(const std::string &app_stream);
+SendBufferPtr HlsGetSegment(const std::string &app_stream, uint64_t seq);
+
+#endif
@@ -0,0 +1,565 @@
+#include "app_http_flv_conn.h"
+#include "app_hls_segmenter.h"
+#include "app_flv_recorder.h"
+#include "app_ingest_stats.h"
+#include "util/dlog.h"
+
+#include <ctype.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <unordered_map>
+
+#define HTTP_FLV_SEND_IOVEC         64              // OnWrite每次writev最多引用的队列buffer数
+#define HTTP_FLV_SEND_BATCH_BYTES   (256 * 1024)    // 每次从play_queue_取出的数据量
+#define HTTP_FLV_SUFFIX             ".flv"
+#define HTTP_HLS_PLAYLIST_SUFFIX    ".m3u8"
+#define HTTP_HLS_SEGMENT_SUFFIX     ".ts"
+#define HTTP_RECORD_PREFIX          "/record"
+
+#define HTTP_FLV_RESPONSE                       \
+    "HTTP/1.1 200 OK\r\n"                       \
+    "Connection: close\r\n"                     \
+    "Content-Type: video/x-flv\r\n"             \
+    "Cache-Control: no-cache\r\n"               \
+    "Access-Control-Allow-Origin: *\r\n\r\n"
+
+#define HTTP_HLS_RESPONSE                       \
+    "HTTP/1.1 200 OK\r\n"                       \
+    "Connection: close\r\n"                     \
+    "Content-Type: %s\r\n"                      \
+    "Content-Length: %zu\r\n"                   \
+    "Cache-Control: %s\r\n"                     \
+    "Access-Control-Allow-Origin: *\r\n\r\n"
+
+#define HTTP_FILE_RESPONSE                      \
+    "HTTP/1.1 %s\r\n"                           \
+    "Connection: close\r\n"                     \
+    "Content-Type: video/x-flv\r\n"             \
+    "Content-Length: %" PRIu64 "\r\n"           \
+    "Accept-Ranges: bytes\r\n"                  \
+    "%s"                                        \
+    "Access-Control-Allow-Origin: *\r\n\r\n"
+
+#define HTTP_FLV_ERROR_RESPONSE                 \
+    "HTTP/1.1 %s\r\n"                           \
+    "Connection: close\r\n"                     \
+    "Content-Length: 0\r\n\r\n"
+
+enum {
+    HTTP_FLV_STATE_IDLE,
+    HTTP_FLV_STATE_CONNECTED,
+    HTTP_FLV_STATE_PLAYING,
+    HTTP_FLV_STATE_CLOSED,
+};
+
+// 音视频都有, 之后是PreviousTagSize0
+static const uint8_t s_flv_header[FLV_HEADER_SIZE + 4] = { 'F', 'L', 'V', 1, 0x05, 0, 0, 0, FLV_HEADER_SIZE, 0, 0, 0, 0 };
+
+static std::atomic<uint32_t> s_conn_handle_generator(0);
+typedef std::unordered_map<uint32_t, HttpFlvConn *> HttpFlvConnMap_t;
+static thread_local HttpFlvConnMap_t s_http_flv_conn_map;   // 连接只在自己所在的loop线程访问
+
+static CFileCache s_file_cache;     // 录制文件的fd和大小, 所有loop共享
+
+static PlayerQueueConfig s_player_queue_config = { PLAYER_QUEUE_MAX_BYTES, PLAYER_QUEUE_MAX_LATENCY_MS, PLAYER_QUEUE_MAX_LAG_MS };
+
+// http-flv拉流端
+class HttpFlvConsumer : public LiveConsumer
+{
+public:
+    HttpFlvConsumer(HttpFlvConn *conn) : conn_(conn) {}
+
+    virtual int OnPacket(const MediaPacketPtr &pkt)
+    {
+        return conn_->SendPacket(pkt);
+    }
+
+private:
+    HttpFlvConn *conn_;     // 连接关闭时先从source删除, 之后不会再被调用
+};
+
+static HttpFlvConn *FindHttpFlvConnByHandle(uint32_t handle)
+{
+    HttpFlvConnMap_t::iterator it = s_http_flv_conn_map.find(handle);
+    return it != s_http_flv_conn_map.end() ? it->second : NULL;
+}
+
+static void http_flv_conn_callback(void *callback_data, uint8_t msg, uint32_t handle, void *pParam)
+{
+    NOTUSED_ARG(handle);
+    NOTUSED_ARG(pParam);
+
+    uint32_t conn_handle = (uint32_t)(uintptr_t)callback_data;
+    HttpFlvConn *pConn = FindHttpFlvConnByHandle(conn_handle);
+    if (!pConn)
+        return;
+
+    switch (msg) {
+    case NETLIB_MSG_READ:
+        pConn->OnRead();
+        break;
+    case NETLIB_MSG_WRITE:
+        pConn->OnWrite();
+        break;
+    case NETLIB_MSG_CLOSE:
+        pConn->OnClose();
+        break;
+    default:
+        LogError("!!!http_flv_conn_callback error msg:{}", msg);
+        break;
+    }
+}
+
+HttpFlvConn::HttpFlvConn() : CRefObject(1)
+{
+    m_sock_handle = NETLIB_INVALID_HANDLE;
+    conn_handle_ = ++s_conn_handle_generator;
+    if (conn_handle_ == 0)
+        conn_handle_ = ++s_conn_handle_generator;
+    state_ = HTTP_FLV_STATE_IDLE;
+    busy_ = false;
+    close_on_sent_ = false;
+    consumer_ = nullptr;
+    send_offset_ = 0;
+    busy_tick_ = 0;
+    lag_closing_ = false;
+    file_offset_ = 0;
+    file_remain_ = 0;
+    play_queue_.SetConfig(s_player_queue_config);
+}
+
+HttpFlvConn::~HttpFlvConn()
+{
+    LogInfo("~HttpFlvConn, m_sock_handle = {}, conn_handle_ = {}", m_sock_handle, conn_handle_);
+}
+
+void HttpFlvConn::Close()
+{
+    if (state_ == HTTP_FLV_STATE_CLOSED)
+        return;
+
+    if (source_)
+        LiveSource::Leave(source_, nullptr, consumer_);
+    if (play_queue_.GetDroppedFrames() > 0)
+        LogWarn("handle = {}, dropped {} frames, {} bytes", conn_handle_,
+                play_queue_.GetDroppedFrames(), play_queue_.GetDroppedBytes());
+    LogInfo("Close http-flv handle = {}", conn_handle_);
+    state_ = HTTP_FLV_STATE_CLOSED;
+    s_http_flv_conn_map.erase(conn_handle_);
+    netlib_close(m_sock_handle);
+
+    ReleaseRef();
+}
+
+void HttpFlvConn::OnConnect(net_handle_t handle)
+{
+    m_sock_handle = handle;
+    state_ = HTTP_FLV_STATE_CONNECTED;
+    s_http_flv_conn_map.insert(std::make_pair(conn_handle_, this));
+
+    netlib_option(handle, NETLIB_OPT_SET_CALLBACK, (void *)http_flv_conn_callback);
+    netlib_option(handle, NETLIB_OPT_SET_CALLBACK_DATA, reinterpret_cast<void *>(conn_handle_));
+    netlib_option(handle, NETLIB_OPT_GET_REMOTE_IP, (void *)&peer_ip_);
+}
+
+void HttpFlvConn::OnRead()
+{
+    struct iovec iov[2];
+    for (;;) {
+        int cnt = in_buf_.GetWriteSpans(iov, 2, HTTP_FLV_READ_SIZE);
+        size_t space = 0;
+        for (int i = 0; i < cnt; i++)
+            space += iov[i].iov_len;
+        int ret = netlib_recvv(m_sock_handle, iov, cnt);
+        if (ret == NETLIB_AGAIN)
+            break;
+        if (ret <= 0) {
+            Close();        // 对端关闭或者出错, 拉流端断开也走这里
+            return;
+        }
+        in_buf_.IncWriteOffset(ret);
+        if ((size_t)ret < space)
+            break;
+    }
+
+    if (state_ != HTTP_FLV_STATE_CONNECTED) {
+        in_buf_.Clear();    // 开始播放之后客户端发来的数据不用处理
+        return;
+    }
+
+    uint32_t len = in_buf_.GetReadableSize();
+    if (len > HTTP_FLV_REQUEST_MAX) {
+        LogWarn("http-flv request too long: {}, handle = {}", len, conn_handle_);
+        Close();
+        return;
+    }
+
+    char request[HTTP_FLV_REQUEST_MAX + 1];
+    request[in_buf_.Peek(request, HTTP_FLV_REQUEST_MAX)] = '\0';
+    http_parser_.ParseHttpContent(request, len);
+    if (http_parser_.IsReadAll()) {
+        in_buf_.Clear();
+        _HandleRequest();
+    }
+}
+
+// /app/stream.flv?xxx -> app/stream, 后缀不对或者不是app/stream的形式返回false
+static bool ParseStreamKey(const std::string &url, const char *suffix, std::string *key)
+{
+    size_t suffix_len = strlen(suffix);
+    if (url.size() <= 1 + suffix_len || url[0] != '/'
+        || url.compare(url.size() - suffix_len, suffix_len, suffix) != 0)
+        return false;
+    *key = url.substr(1, url.size() - 1 - suffix_len);
+    size_t pos = key->find('/');
+    return pos != std::string::npos && pos != 0 && pos != key->size() - 1;
+}
+
+/**
+ * 解析Range: bytes=a-b, bytes=a-, bytes=-n
+ *
+ * @return 1 回复[start, end), 0 忽略Range回复整个文件(格式不认识或者多段), -1 范围超出文件
+ */
+static int ParseRange(const char *range, uint64_t size, uint64_t *start, uint64_t *end)
+{
+    if (strncasecmp(range, "bytes=", 6) != 0 || strchr(range, ','))
+        return 0;
+    const char *p = range + 6;
+    char *e = NULL;
+    if (*p == '-') {
+        // 最后n个字节
+        if (!isdigit((unsigned char)p[1]))
+            return 0;
+        uint64_t n = strtoull(p + 1, &e, 10);
+        if (*e != '\0')
+            return 0;
+        if (n == 0 || size == 0)
+            return -1;
+        *start = n < size ? size - n : 0;
+        *end = size;
+        return 1;
+    }
+    if (!isdigit((unsigned char)*p))
+        return 0;
+    uint64_t first = strtoull(p, &e, 10);
+    if (*e != '-')
+        return 0;
+    p = e + 1;
+    uint64_t last = UINT64_MAX;
+    if (*p != '\0') {
+        if (!isdigit((unsigned char)*p))
+            return 0;
+        last = strtoull(p, &e, 10);
+        if (*e != '\0' || last < first)
+            return 0;
+    }
+    if (first >= size)
+        return -1;
+    *start = first;
+    *end = last < size - 1 ? last + 1 : size;
+    return 1;
+}
+
+void HttpFlvConn::_HandleRequest()
+{
+    char method = http_parser_.GetMethod();
+    if (HTTP_GET != method && HTTP_HEAD != method) {
+        _SendError("405 Method Not Allowed");
+        return;
+    }
+
+    std::string url = http_parser_.GetUrl();
+    size_t pos = url.find('?');
+    if (pos != std::string::npos)
+        url.resize(pos);
+    std::string key;
+    size_t prefix_len = strlen(HTTP_RECORD_PREFIX);
+    if (url.compare(0, prefix_len, HTTP_RECORD_PREFIX) == 0) {
+        if (!ParseStreamKey(url.substr(prefix_len), HTTP_FLV_SUFFIX, &key)) {
+            _SendError("404 Not Found");
+            return;
+        }
+        _SendRecord(key);
+        return;
+    }
+    if (HTTP_GET != method) {
+        _SendError("405 Method Not Allowed");
+        return;
+    }
+    if (ParseStreamKey(url, HTTP_HLS_PLAYLIST_SUFFIX, &key)) {
+        _SendHls(HlsGetPlaylist(key), "application/vnd.apple.mpegurl", "no-cache");
+        return;
+    }
+    if (ParseStreamKey(url, HTTP_HLS_SEGMENT_SUFFIX, &key)) {
+        // app/stream-<seq>
+        pos = key.rfind('-');
+        char *end = NULL;
+        uint64_t seq = 0;
+        if (pos != std::string::npos && pos + 1 < key.size())
+            seq = strtoull(key.c_str() + pos + 1, &end, 10);
+        if (!end || *end != '\0') {
+            _SendError("404 Not Found");
+            return;
+        }
+        key.resize(pos);
+        _SendHls(HlsGetSegment(key, seq), "video/mp2t", "max-age=60");
+        return;
+    }
+    if (!ParseStreamKey(url, HTTP_FLV_SUFFIX, &key)) {
+        _SendError("404 Not Found");
+        return;
+    }
+
+    state_ = HTTP_FLV_STATE_PLAYING;
+    std::string *head = new std::string(HTTP_FLV_RESPONSE);
+    head->append((const char *)s_flv_header, sizeof(s_flv_header));
+    _SendShared(SendBufferPtr(head));
+
+    // 加入时同步发送metadata、sequence header和GOP缓存
+    std::shared_ptr<HttpFlvConsumer> player(new HttpFlvConsumer(this));
+    consumer_ = player.get();
+    size_t players = 0;
+    source_ = LiveSource::Play(key, player, &players);
+    LogInfo("http-flv play: {}, peer: {}, players: {}", key, peer_ip_, players);
+}
+
+// m3u8和ts分片都在内存里, 回复头之后直接发共享的数据, 发完关闭
+void HttpFlvConn::_SendHls(const SendBufferPtr &body, const char *content_type, const char *cache_control)
+{
+    if (!body) {
+        _SendError("404 Not Found");
+        return;
+    }
+
+    char buf[256];
+    int n = snprintf(buf, sizeof(buf), HTTP_HLS_RESPONSE, content_type, body->size(), cache_control);
+    _SendShared(std::make_shared<const std::string>(buf, n));
+    close_on_sent_ = true;
+    _SendShared(body);
+}
+
+// 录制好的文件: 回复头之后用sendfile发送文件内容, 发完关闭
+void HttpFlvConn::_SendRecord(const std::string &app_stream)
+{
+    std::string path;
+    CachedFilePtr file;
+    if (FlvRecordIsEnabled() && FlvRecordGetPath(app_stream, &path) == 0)
+        file = s_file_cache.Open(path);
+    if (!file) {
+        _SendError("404 Not Found");
+        return;
+    }
+
+    uint64_t size = file->GetSize();
+    uint64_t start = 0;
+    uint64_t end = size;
+    const char *status = "200 OK";
+    char content_range[96] = "";
+    if (http_parser_.HasReadRange()) {
+        int ret = ParseRange(http_parser_.GetRange(), size, &start, &end);
+        if (ret < 0) {
+            status = "416 Range Not Satisfiable";
+            start = end = 0;
+            snprintf(content_range, sizeof(content_range), "Content-Range: bytes */%" PRIu64 "\r\n", size);
+        } else if (ret > 0) {
+            status = "206 Partial Content";
+            snprintf(content_range, sizeof(content_range), "Content-Range: bytes %" PRIu64 "-%" PRIu64 "/%" PRIu64 "\r\n",
+                     start, end - 1, size);
+        }
+    }
+    LogInfo("http-flv file {} {}, range {}-{}, peer: {}", path, status, start, end, peer_ip_);
+
+    char buf[512];
+    int n = snprintf(buf, sizeof(buf), HTTP_FILE_RESPONSE, status, end - start, content_range);
+    if (HTTP_GET == http_parser_.GetMethod() && end > start) {
+        file_ = file;
+        file_offset_ = start;
+        file_remain_ = end - start;
+    }
+    close_on_sent_ = true;
+    _SendShared(std::make_shared<const std::string>(buf, n));
+}
+
+// 一直发到socket发不动, 等可写时在OnWrite里继续
+void HttpFlvConn::_SendFileBody()
+{
+    while (file_remain_ > 0) {
+        size_t count = file_remain_ < HTTP_FILE_SEND_CHUNK ? file_remain_ : HTTP_FILE_SEND_CHUNK;
+        int ret = netlib_sendfile(m_sock_handle, file_->GetFd(), file_offset_, count);
+        if (ret == NETLIB_AGAIN) {
+            busy_ = true;
+            busy_tick_ = GetTickCount();
+            return;
+        }
+        if (ret <= 0) {
+            // 0表示文件被截短了, 已经回复了Content-Length, 只能断开
+            LogWarn("handle = {}, sendfile failed: {}, remain {} bytes", conn_handle_, ret, file_remain_);
+            Close();
+            return;
+        }
+        file_offset_ += ret;
+        file_remain_ -= ret;
+        if ((size_t)ret < count) {
+            busy_ = true;
+            busy_tick_ = GetTickCount();
+            return;
+        }
+    }
+
+    file_.reset();
+    if (close_on_sent_)
+        Close();
+}
+
+void HttpFlvConn::_SendError(const char *status)
+{
+    LogInfo("http-flv reply {}, url: {}", status, http_parser_.GetUrl());
+    char buf[256];
+    int n = snprintf(buf, sizeof(buf), HTTP_FLV_ERROR_RESPONSE, status);
+    close_on_sent_ = true;
+    _SendShared(std::make_shared<const std::string>(buf, n));
+}
+
+int HttpFlvConn::SendPacket(const MediaPacketPtr &pkt)
+{
+    if (!busy_ && play_queue_.Empty())
+        return _SendShared(pkt->GetFlvTag());
+
+    // socket发不动, 先排队, 超过上限时由play_queue_丢帧
+    play_queue_.Push(pkt);
+    uint32_t max_lag_ms = play_queue_.GetConfig().max_lag_ms;
+    if (max_lag_ms > 0 && GetTickCount() - busy_tick_ > max_lag_ms && !lag_closing_) {
+        // 可能在LiveSource持锁期间被调用, 不能直接Close, 投递到本loop稍后关闭
+        LogWarn("handle = {}, http-flv player lag too long, queue {} frames, {} bytes, close it",
+                conn_handle_, play_queue_.GetSize(), play_queue_.GetBytes());
+        lag_closing_ = true;
+        uint32_t conn_handle = conn_handle_;
+        netlib_post(netlib_loop_index(), [conn_handle]() {
+            HttpFlvConn *pConn = FindHttpFlvConnByHandle(conn_handle);
+            if (pConn)
+                pConn->Close();
+        });
+    }
+    return 0;
+}
+
+// 排队时只保存引用, 不拷贝
+int HttpFlvConn::_SendShared(const SendBufferPtr &buf)
+{
+    if (busy_) {
+        send_queue_.push_back(buf);
+        return 0;
+    }
+
+    IngestStageTimer timer(INGEST_STAGE_FLUSH);
+    int len = (int)buf->size();
+    int ret = netlib_send(m_sock_handle, (void *)buf->data(), len);
+    if (ret < 0)
+        ret = 0;
+    if (ret < len) {
+        send_queue_.push_back(buf);
+        send_offset_ = ret;
+        busy_ = true;
+        busy_tick_ = GetTickCount();
+    } else {
+        _OnSendDone();
+    }
+    return 0;
+}
+
+void HttpFlvConn::OnWrite()
+{
+    if (!busy_)
+        return;
+    IngestStageTimer timer(INGEST_STAGE_FLUSH);
+
+    for (;;) {
+        // send_queue_发完了才从play_queue_补充一批, 每帧的FLV tag所有拉流端共享
+        if (send_queue_.empty()) {
+            size_t batch_bytes = 0;
+            while (!play_queue_.Empty() && send_queue_.size() < HTTP_FLV_SEND_IOVEC
+                   && batch_bytes < HTTP_FLV_SEND_BATCH_BYTES) {
+                MediaPacketPtr pkt = play_queue_.Pop();
+                batch_bytes += pkt->GetSize();
+                send_queue_.push_back(pkt->GetFlvTag());
+            }
+        }
+        if (send_queue_.empty())
+            break;
+
+        struct iovec iov[HTTP_FLV_SEND_IOVEC];
+        int iovcnt = 0;
+        size_t len = 0;
+        for (auto it = send_queue_.begin(); it != send_queue_.end() && iovcnt < HTTP_FLV_SEND_IOVEC; ++it) {
+            uint32_t offset = 0 == iovcnt ? send_offset_ : 0;
+            iov[iovcnt].iov_base = (void *)((*it)->data() + offset);
+            iov[iovcnt].iov_len = (*it)->size() - offset;
+            len += iov[iovcnt].iov_len;
+            iovcnt++;
+        }
+
+        int ret = netlib_sendv(m_sock_handle, iov, iovcnt);
+        if (ret < 0)
+            ret = 0;
+
+        size_t sent = ret;
+        while (sent > 0) {
+            size_t remain = send_queue_.front()->size() - send_offset_;
+            if (sent < remain) {
+                send_offset_ += sent;
+                break;
+            }
+            sent -= remain;
+            send_queue_.pop_front();
+            send_offset_ = 0;
+        }
+
+        if ((size_t)ret < len)
+            return;     // 还没有发送完毕
+    }
+
+    busy_ = false;
+    _OnSendDone();
+}
+
+// send_queue_发完: 还有文件内容时接着发, 否则需要时关闭
+void HttpFlvConn::_OnSendDone()
+{
+    if (file_remain_ > 0)
+        _SendFileBody();
+    else if (close_on_sent_)
+        Close();
+}
+
+void HttpFlvConn::OnClose()
+{
+    Close();
+}
+
+static void http_flv_callback(void *callback_data, uint8_t msg, uint32_t handle, void *pParam)
+{
+    if (msg == NETLIB_MSG_CONNECT) {
+        // 对象在Close时释放自己
+        HttpFlvConn *pConn = new HttpFlvConn();
+        pConn->OnConnect(handle);
+    } else {
+        LogError("!!!error msg:{}", msg);
+    }
+}
+
+int HttpFlvInitListen(std::string listen_ip, uint16_t listen_port)
+{
+    int ret = netlib_listen(listen_ip.c_str(), listen_port, http_flv_callback, NULL);
+    if (ret == NETLIB_ERROR) {
+        LogError("netlib_listen failed, errno: {}, error: {}", errno, strerror(errno));
+        return ret;
+    }
+    return NETLIB_OK;
+}
+
+void HttpFlvSetPlayerQueueConfig(const PlayerQueueConfig &config)
+{
+    s_player_queue_config = config;
+}
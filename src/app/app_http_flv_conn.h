@@ -0,0 +1,83 @@
+/**
+ * http-flv拉流: GET /app/stream.flv, 和rtmp拉流端挂在同一个LiveSource上
+ * 回复不带Content-Length, 连接关闭表示结束(close-delimited), 所有拉流端共享同一份FLV tag
+ * 同一个端口也提供HLS: GET /app/stream.m3u8 和 /app/stream-<seq>.ts, 一个请求一个连接
+ * 录制好的文件: GET/HEAD /record/app/stream.flv, 支持Range, 文件内容用sendfile发送, 不经过用户态
+ */
+#ifndef APP_HTTP_FLV_CONN_H
+#define APP_HTTP_FLV_CONN_H
+
+#include "util/util.h"
+#include "util/util_buffer.h"
+#include "protocol/http_parser_wrapper.h"
+#include "network/netlib.h"
+#include "util/util_file_cache.h"
+
+#include "app/app_media_packet.h"
+#include "app/app_player_queue.h"
+#include "app/app_live_source.h"
+
+#include <deque>
+#include <memory>
+#include <string>
+
+#define HTTP_FLV_REQUEST_MAX    4096    // 请求头的最大长度
+#define HTTP_FLV_READ_SIZE      2048
+#define HTTP_FILE_SEND_CHUNK    (1024 * 1024)   // 每次sendfile最多发送的字节数, 避免一个连接占住loop
+
+class HttpFlvConn : public CRefObject
+{
+public:
+    HttpFlvConn();
+    virtual ~HttpFlvConn();
+
+    uint32_t GetConnHandle() { return conn_handle_; }
+    void Close();
+    void OnConnect(net_handle_t handle);
+    void OnRead();
+    void OnWrite();
+    void OnClose();
+
+    // 拉流端发送一帧, 发不动时进play_queue_
+    int SendPacket(const MediaPacketPtr &pkt);
+
+    const PlayerQueue &GetPlayQueue() const { return play_queue_; }
+
+private:
+    void _HandleRequest();
+    void _SendHls(const SendBufferPtr &body, const char *content_type, const char *cache_control);
+    void _SendRecord(const std::string &app_stream);
+    void _SendFileBody();
+    void _SendError(const char *status);
+    int _SendShared(const SendBufferPtr &buf);
+    void _OnSendDone();
+
+private:
+    net_handle_t m_sock_handle;
+    uint32_t conn_handle_;
+    uint32_t state_;
+    bool busy_;
+    bool close_on_sent_;                    // 错误回复发完后关闭
+    std::string peer_ip_;
+    CSegmentBuffer in_buf_;
+    CHttpParserWrapper http_parser_;
+
+    std::shared_ptr<LiveSource> source_;
+    LiveConsumer *consumer_;
+    std::deque<SendBufferPtr> send_queue_;  // 待发送数据, 按顺序发送
+    uint32_t send_offset_;                  // 队首已经发送的字节数
+    PlayerQueue play_queue_;                // 还没有进send_queue_的帧, 可以丢帧
+    uint64_t busy_tick_;                    // socket开始发不动的时间, 一直到全部发完
+    bool lag_closing_;                      // 落后太久, 已经投递了关闭
+
+    CachedFilePtr file_;                    // 正在发送的文件, 回复头发完之后发
+    uint64_t file_offset_;
+    uint64_t file_remain_;
+};
+
+int HttpFlvInitListen(std::string listen_ip, uint16_t listen_port);
+
+// 拉流端发送队列配置, 对之后新建的连接生效
+void HttpFlvSetPlayerQueueConfig(const PlayerQueueConfig &config);
+
+#endif
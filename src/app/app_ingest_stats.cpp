@@ -0,0 +1,113 @@
+#include "app_ingest_stats.h"
+
+#include <stdio.h>
+#include <time.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+typedef struct {
+    CHistogram stages[INGEST_STAGE_NUM];
+} IngestThreadStats;
+
+// 线程退出后也保留, 统计不丢; loop和线程池的线程数是固定的
+static std::mutex s_stats_mutex;
+static std::vector<IngestThreadStats *> &s_thread_stats = *new std::vector<IngestThreadStats *>();
+static std::atomic<bool> s_stats_enable(true);
+
+static thread_local IngestThreadStats *t_stats = NULL;
+static thread_local IngestStageTimer *t_current_timer = NULL;
+
+static const char *s_stage_names[INGEST_STAGE_NUM] = {
+    "parse", "demux", "fanout", "dispatch", "serialize", "flush",
+};
+
+static IngestThreadStats *GetThreadStats()
+{
+    if (!t_stats) {
+        t_stats = new IngestThreadStats();
+        std::lock_guard<std::mutex> lock(s_stats_mutex);
+        s_thread_stats.push_back(t_stats);
+    }
+    return t_stats;
+}
+
+void IngestStatsEnable(bool enable)
+{
+    s_stats_enable.store(enable, std::memory_order_relaxed);
+}
+
+bool IngestStatsIsEnabled()
+{
+    return s_stats_enable.load(std::memory_order_relaxed);
+}
+
+uint64_t IngestStatsNow()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void IngestStatsAdd(int stage, uint64_t ns)
+{
+    if (stage < 0 || stage >= INGEST_STAGE_NUM)
+        return;
+    GetThreadStats()->stages[stage].Add(ns);
+}
+
+void IngestStatsGetSnapshot(int stage, HistogramSnapshot *snapshot)
+{
+    *snapshot = HistogramSnapshot();
+    if (stage < 0 || stage >= INGEST_STAGE_NUM)
+        return;
+    std::lock_guard<std::mutex> lock(s_stats_mutex);
+    for (size_t i = 0; i < s_thread_stats.size(); i++) {
+        HistogramSnapshot one;
+        s_thread_stats[i]->stages[stage].GetSnapshot(&one);
+        snapshot->Merge(one);
+    }
+}
+
+const char *IngestStatsGetStageName(int stage)
+{
+    return stage >= 0 && stage < INGEST_STAGE_NUM ? s_stage_names[stage] : "unknown";
+}
+
+std::string IngestStatsReport()
+{
+    std::string report;
+    for (int i = 0; i < INGEST_STAGE_NUM; i++) {
+        HistogramSnapshot snapshot;
+        IngestStatsGetSnapshot(i, &snapshot);
+        char line[256];
+        snprintf(line, sizeof(line), "%-9s count %lu, avg %.1fus, p50 %.1fus, p99 %.1fus, max %.1fus\n",
+                 s_stage_names[i], (unsigned long)snapshot.count, snapshot.Mean() / 1000.0,
+                 snapshot.Percentile(50) / 1000.0, snapshot.Percentile(99) / 1000.0, snapshot.max / 1000.0);
+        report += line;
+    }
+    return report;
+}
+
+IngestStageTimer::IngestStageTimer(int stage)
+    : stage_(stage), start_(0), child_ns_(0), parent_(NULL)
+{
+    if (!IngestStatsIsEnabled()) {
+        stage_ = -1;
+        return;
+    }
+    start_ = IngestStatsNow();
+    parent_ = t_current_timer;
+    t_current_timer = this;
+}
+
+IngestStageTimer::~IngestStageTimer()
+{
+    if (stage_ < 0)
+        return;
+    uint64_t elapsed = IngestStatsNow() - start_;
+    IngestStatsAdd(stage_, elapsed > child_ns_ ? elapsed - child_ns_ : 0);
+    if (parent_)
+        parent_->child_ns_ += elapsed;
+    t_current_timer = parent_;
+}
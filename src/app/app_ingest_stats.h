@@ -0,0 +1,56 @@
+/**
+ * 推流到拉流的各个阶段耗时统计
+ * 1. 阶段: 解析chunk -> 组帧 -> 分发 -> 跨loop投递 -> 切块/封装 -> socket发送
+ * 2. 同步调用链上的阶段互相嵌套, IngestStageTimer只记自己的耗时, 不含里面嵌套的阶段
+ * 3. 每个线程一份直方图, 记录不加锁; 读的时候合并所有线程
+ */
+#ifndef APP_INGEST_STATS_H
+#define APP_INGEST_STATS_H
+
+#include "util/util_histogram.h"
+
+#include <stdint.h>
+#include <string>
+
+enum {
+    INGEST_STAGE_PARSE,         // rtmp_server_input: 握手和chunk解析
+    INGEST_STAGE_DEMUX,         // 收到一条完整的音视频消息, 创建MediaPacket
+    INGEST_STAGE_FANOUT,        // LiveSource::handler: 更新缓存, 分给本loop的拉流端, 按loop打包投递
+    INGEST_STAGE_DISPATCH,      // 投递给其他loop之后等待执行的时间
+    INGEST_STAGE_SERIALIZE,     // 每帧第一次切rtmp chunk或者封装FLV tag
+    INGEST_STAGE_FLUSH,         // 拉流端socket发送
+    INGEST_STAGE_NUM,
+};
+
+// 默认打开; 关闭之后IngestStageTimer不取时间
+void IngestStatsEnable(bool enable);
+bool IngestStatsIsEnabled();
+
+// 单调时钟, 纳秒
+uint64_t IngestStatsNow();
+
+// 直接记一个耗时(纳秒), 比如跨loop的排队时间
+void IngestStatsAdd(int stage, uint64_t ns);
+
+// 所有线程合并之后的快照
+void IngestStatsGetSnapshot(int stage, HistogramSnapshot *snapshot);
+const char *IngestStatsGetStageName(int stage);
+
+// 每个阶段一行: 次数, 平均, p50, p99, 最大(微秒)
+std::string IngestStatsReport();
+
+// 作用域计时, 嵌套的内层计时从外层扣掉
+class IngestStageTimer
+{
+public:
+    IngestStageTimer(int stage);
+    ~IngestStageTimer();
+
+private:
+    int stage_;
+    uint64_t start_;
+    uint64_t child_ns_;         // 嵌套在里面的阶段用掉的时间
+    IngestStageTimer *parent_;
+};
+
+#endif
@@ -0,0 +1,275 @@
+#include "app_live_source.h"
+#include "app_hls_segmenter.h"
+#include "app_ingest_stats.h"
+#include "network/netlib.h"
+#include "util/dlog.h"
+
+#include <algorithm>
+#include <map>
+#include <functional>
+
+static GopCacheConfig s_gop_cache_config = { true, GOP_CACHE_MAX_BYTES, GOP_CACHE_MAX_DURATION_MS };
+
+// 所有loop共享, 由s_lives_mutex保护; 需要同时加锁时先锁s_lives_mutex再锁LiveSource::mutex_
+static std::mutex s_lives_mutex;
+static std::map<std::string, std::shared_ptr<LiveSource> > s_lives;
+
+LiveConsumer::LiveConsumer()
+{
+    loop_index_ = netlib_loop_index();
+}
+
+LiveSource::LiveSource(RtmpConn *rtmp_conn, std::string app_stream)
+    : rtmp_conn_(rtmp_conn), app_stream_(app_stream)
+{
+    gop_cache_.SetConfig(s_gop_cache_config);
+}
+
+void LiveSource::update_rtmp_conn(RtmpConn *rtmp_conn)
+{
+    rtmp_conn_ = rtmp_conn;
+    gop_cache_.Clear();     // 推流端变了, 旧的GOP不能再给新拉流端
+}
+
+size_t LiveSource::add_player(const LiveConsumerPtr &player)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    players.push_back(player);
+    LiveLoopGroup *group = _GetLoopGroup(player->loop_index_);
+    LiveConsumerList *list = new LiveConsumerList(*group->players);
+    list->push_back(player);
+    group->players.reset(list);
+    if (metadata_)
+        player->OnPacket(metadata_);
+    if (video_config_)
+        player->OnPacket(video_config_);
+    if (audio_config_)
+        player->OnPacket(audio_config_);
+
+    const std::deque<MediaPacketPtr> &gop = gop_cache_.GetPackets();
+    for (auto it = gop.begin(); it != gop.end(); ++it)
+        player->OnPacket(*it);
+    LogInfo("source: {}, send gop: {} packets, {} bytes", app_stream_, gop.size(), gop_cache_.GetBytes());
+    return players.size();
+}
+
+LiveLoopGroup *LiveSource::_GetLoopGroup(uint32_t loop_index)
+{
+    if (loop_index >= loop_groups_.size())
+        loop_groups_.resize(std::max(loop_index + 1, netlib_loop_num()));
+    if (!loop_groups_[loop_index])
+        loop_groups_[loop_index] = std::make_shared<LiveLoopGroup>();
+    return loop_groups_[loop_index].get();
+}
+
+void LiveSource::_RemoveFromGroup(LiveConsumer *player)
+{
+    if (player->loop_index_ >= loop_groups_.size() || !loop_groups_[player->loop_index_])
+        return;
+    LiveLoopGroup *group = loop_groups_[player->loop_index_].get();
+    LiveConsumerList *list = new LiveConsumerList();
+    list->reserve(group->players->size());
+    for (auto it = group->players->begin(); it != group->players->end(); ++it)
+    {
+        LiveConsumerPtr p = it->lock();
+        if (p && p.get() != player)
+            list->push_back(p);
+    }
+    group->players.reset(list);
+}
+
+uint64_t LiveSource::GetDispatchDroppedFrames()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint64_t dropped = 0;
+    for (size_t i = 0; i < loop_groups_.size(); i++)
+    {
+        if (loop_groups_[i])
+            dropped += loop_groups_[i]->dropped_frames;
+    }
+    return dropped;
+}
+
+// 这个loop积压太多时不再投递, 直到下一个关键帧(纯音频流是下一个音频帧); metadata和sequence header总是投递
+static bool ShouldDispatch(LiveLoopGroup *group, const MediaPacketPtr &pkt, bool has_video, const std::string &app_stream)
+{
+    if (FLV_TYPE_SCRIPT == pkt->GetType() || pkt->IsSequenceHeader())
+        return true;
+
+    bool full = group->pending.load(std::memory_order_relaxed) >= LIVE_DISPATCH_MAX_PENDING;
+    if (group->dropping) {
+        bool resume_point = pkt->IsKeyFrame() || (FLV_TYPE_AUDIO == pkt->GetType() && !has_video);
+        if (full || !resume_point) {
+            group->dropped_frames++;
+            return false;
+        }
+        group->dropping = false;
+        return true;
+    }
+    if (full) {
+        LogWarn("source: {}, loop dispatch queue full, drop to next keyframe", app_stream);
+        group->dropping = true;
+        group->dropped_frames++;
+        return false;
+    }
+    return true;
+}
+
+int LiveSource::handler(void *param, const MediaPacketPtr &pkt)
+{
+    IngestStageTimer timer(INGEST_STAGE_FANOUT);
+    LiveSource *s = (LiveSource *)param;
+    if (!s)
+        return 0;
+
+    typedef struct {
+        uint32_t loop_index;
+        LiveLoopGroupPtr group;
+        LiveConsumerListPtr players;
+    } RemoteDispatch;
+    uint32_t loop_index = netlib_loop_index();
+    std::vector<RemoteDispatch> remotes;    // 其他loop, 每个loop投递一次
+    {
+        std::lock_guard<std::mutex> lock(s->mutex_);
+        if (!s->rtmp_conn_)     // 有推流的情况下才调用player
+            return 0;
+
+        if (FLV_TYPE_SCRIPT == pkt->GetType())
+            s->metadata_ = pkt;
+        else if (pkt->IsSequenceHeader())
+            (FLV_TYPE_VIDEO == pkt->GetType() ? s->video_config_ : s->audio_config_) = pkt;
+        else
+            s->gop_cache_.Push(pkt);
+
+        for (uint32_t i = 0; i < s->loop_groups_.size(); i++)
+        {
+            LiveLoopGroup *group = s->loop_groups_[i].get();
+            if (!group || group->players->empty())
+                continue;
+            if (i == loop_index) {
+                for (auto it = group->players->begin(); it != group->players->end(); ++it)
+                {
+                    LiveConsumerPtr player = it->lock();
+                    if (player)
+                        player->OnPacket(pkt);
+                }
+            } else if (ShouldDispatch(group, pkt, s->video_config_ != nullptr, s->app_stream_)) {
+                group->pending.fetch_add(1, std::memory_order_relaxed);
+                remotes.push_back({ i, s->loop_groups_[i], group->players });
+            }
+        }
+    }
+
+    uint64_t post_ns = IngestStatsIsEnabled() ? IngestStatsNow() : 0;
+    for (size_t i = 0; i < remotes.size(); i++)
+    {
+        const RemoteDispatch &r = remotes[i];
+        if (netlib_post(r.loop_index, std::bind(&LiveSource::remote_handler, pkt, r.group, r.players, post_ns))
+            != NETLIB_OK)
+            r.group->pending.fetch_sub(1, std::memory_order_relaxed);
+    }
+    return 0; // ignore error
+}
+
+// 拉流端离开时在自己的loop里从players删除, 这里也在那个loop, lock失败说明已经离开
+void LiveSource::remote_handler(const MediaPacketPtr &pkt, const LiveLoopGroupPtr &group,
+                                const LiveConsumerListPtr &players, uint64_t post_ns)
+{
+    group->pending.fetch_sub(1, std::memory_order_relaxed);
+    if (post_ns)
+        IngestStatsAdd(INGEST_STAGE_DISPATCH, IngestStatsNow() - post_ns);
+
+    IngestStageTimer timer(INGEST_STAGE_FANOUT);
+    for (size_t i = 0; i < players->size(); i++)
+    {
+        LiveConsumerPtr player = (*players)[i].lock();
+        if (player)
+            player->OnPacket(pkt);
+    }
+}
+
+std::shared_ptr<LiveSource> LiveSource::Publish(const std::string &app_stream, RtmpConn *rtmp_conn)
+{
+    std::shared_ptr<LiveSource> source;
+    std::lock_guard<std::mutex> lock(s_lives_mutex);
+    auto it = s_lives.find(app_stream);
+    if (it == s_lives.end()) {
+        source.reset(new LiveSource(rtmp_conn, app_stream));
+        s_lives[app_stream] = source;
+    } else {
+        // source已经创建过了(拉流端先到或者推流端重连), 更新推流端
+        source = it->second;
+        std::lock_guard<std::mutex> source_lock(source->mutex_);
+        source->update_rtmp_conn(rtmp_conn);
+    }
+
+    // HLS分片器和普通拉流端一样挂在source上, 推流结束时摘掉
+    if (HlsIsEnabled() && !source->hls_) {
+        source->hls_ = HlsAttach(app_stream);
+        source->add_player(source->hls_);
+    }
+    return source;
+}
+
+std::shared_ptr<LiveSource> LiveSource::Play(const std::string &app_stream, const LiveConsumerPtr &player,
+                                             size_t *players)
+{
+    std::shared_ptr<LiveSource> source;
+    std::lock_guard<std::mutex> lock(s_lives_mutex);
+    auto it = s_lives.find(app_stream);
+    if (it == s_lives.end()) {
+        LogWarn("source({}) not found, we create it and wait publisher", app_stream);
+        source.reset(new LiveSource(nullptr, app_stream));
+        s_lives[app_stream] = source;
+    } else {
+        source = it->second;
+    }
+
+    // 发送metadata、sequence header和GOP缓存
+    size_t n = source->add_player(player);
+    if (players)
+        *players = n;
+    return source;
+}
+
+void LiveSource::Leave(const std::shared_ptr<LiveSource> &source, RtmpConn *rtmp_conn, LiveConsumer *player)
+{
+    std::lock_guard<std::mutex> lock(s_lives_mutex);
+    std::lock_guard<std::mutex> source_lock(source->mutex_);
+    if (player) {
+        source->_RemoveFromGroup(player);
+        for (auto it = source->players.begin(); it != source->players.end(); ++it)
+        {
+            if (it->get() == player)
+            {
+                source->players.erase(it);
+                break;
+            }
+        }
+    } else if (source->rtmp_conn_ == rtmp_conn) {
+        // 还有拉流端时只清掉推流端, 等推流端重连
+        source->update_rtmp_conn(nullptr);
+        if (source->hls_) {
+            source->_RemoveFromGroup(source->hls_.get());
+            source->players.remove(source->hls_);
+            source->hls_->Finish();
+            source->hls_.reset();
+        }
+    } else {
+        return;     // 已经被新的推流端替换
+    }
+
+    // 没有推流也没有拉流了, 释放source
+    if (!source->rtmp_conn_ && source->players.empty()) {
+        auto it = s_lives.find(source->app_stream_);
+        if (it != s_lives.end() && it->second == source) {
+            LogWarn("release live source: {}", source->app_stream_);
+            s_lives.erase(it);
+        }
+    }
+}
+
+void LiveSetGopCacheConfig(const GopCacheConfig &config)
+{
+    s_gop_cache_config = config;
+}
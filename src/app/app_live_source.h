@@ -0,0 +1,116 @@
+/**
+ * 直播流: 一个推流端, 任意多个拉流端(rtmp/http-flv), 按"app/stream"查找
+ * 拉流端按所在loop分组, 推流端每帧给每个其他loop只投递一次, 由那个loop分给自己的拉流端;
+ * 每个loop的任务队列是先进先出的, 每个拉流端收到的帧保持顺序
+ */
+#ifndef APP_LIVE_SOURCE_H
+#define APP_LIVE_SOURCE_H
+
+#include "app/app_media_packet.h"
+#include "app/app_gop_cache.h"
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class RtmpConn;
+class HlsSegmenter;
+
+// 拉流端, 不同协议各自实现OnPacket
+class LiveConsumer
+{
+public:
+    LiveConsumer();
+    virtual ~LiveConsumer() {}
+
+    // 只在loop_index_所在的loop调用, 每个拉流端只是把同一帧的引用放进自己的发送队列
+    virtual int OnPacket(const MediaPacketPtr &pkt) = 0;
+
+    uint32_t loop_index_;
+};
+typedef std::shared_ptr<LiveConsumer> LiveConsumerPtr;
+
+#define LIVE_DISPATCH_MAX_PENDING   256     // 投递给一个loop还没执行的帧数上限, 超过时丢到下一个关键帧
+
+// 一个loop上的拉流端, 成员变化时整个替换, 投递出去的任务引用的列表不会再改
+typedef std::vector<std::weak_ptr<LiveConsumer> > LiveConsumerList;
+typedef std::shared_ptr<const LiveConsumerList> LiveConsumerListPtr;
+
+typedef struct LiveLoopGroup {
+    LiveConsumerListPtr players;
+    std::atomic<uint32_t> pending;      // 已经投递还没执行的帧数
+    bool dropping;                      // 积压超限, 等关键帧再恢复投递; 由LiveSource::mutex_保护
+    uint64_t dropped_frames;
+
+    LiveLoopGroup() : players(std::make_shared<const LiveConsumerList>()), pending(0), dropping(false),
+                      dropped_frames(0) {}
+} LiveLoopGroup;
+typedef std::shared_ptr<LiveLoopGroup> LiveLoopGroupPtr;
+
+// 推流端和拉流端可能在不同的loop, players和缓存由mutex_保护;
+// 其他loop的拉流端不直接调用, 按loop打包后投递给对应loop发送
+class LiveSource
+{
+public:
+    std::mutex mutex_;
+    std::list<LiveConsumerPtr> players;
+    RtmpConn *rtmp_conn_ = nullptr;
+    std::string app_stream_;
+    // 新拉流端加入时要先发的数据
+    MediaPacketPtr metadata_;
+    MediaPacketPtr video_config_;   // avc_decoder_configuration_record
+    MediaPacketPtr audio_config_;   // audio_specific_config
+    GopCache gop_cache_;
+    std::shared_ptr<HlsSegmenter> hls_;    // 有推流端且打开了HLS时也在players里
+
+    LiveSource(RtmpConn *rtmp_conn, std::string app_stream);
+    ~LiveSource() {}
+
+    // 跨loop投递丢掉的帧数, 所有loop加起来
+    uint64_t GetDispatchDroppedFrames();
+
+    void update_rtmp_conn(RtmpConn *rtmp_conn);
+
+    // 新的拉流端: 先发metadata和sequence header, 再发缓存的GOP, 之后跟着直播数据
+    // 在拉流端所在loop调用, 持锁期间推流端不会插入新的帧, 保证顺序
+    size_t add_player(const LiveConsumerPtr &player);
+
+    // 推流端收到一帧, 分发给所有拉流端
+    static int handler(void *param, const MediaPacketPtr &pkt);
+
+    /**
+     * @brief 推流端开始推流, 没有这个流时创建
+     */
+    static std::shared_ptr<LiveSource> Publish(const std::string &app_stream, RtmpConn *rtmp_conn);
+    /**
+     * @brief 拉流端加入, 流还没有推流端时先创建等待推流
+     *
+     * @param players 返回加入后的拉流端个数
+     */
+    static std::shared_ptr<LiveSource> Play(const std::string &app_stream, const LiveConsumerPtr &player,
+                                            size_t *players);
+    /**
+     * @brief 推流端或者拉流端离开, 在连接关闭时调用; 没有推流也没有拉流时释放source
+     *
+     * @param rtmp_conn 推流端离开时传入, 拉流端传NULL
+     * @param player 拉流端离开时传入, 推流端传NULL
+     */
+    static void Leave(const std::shared_ptr<LiveSource> &source, RtmpConn *rtmp_conn, LiveConsumer *player);
+
+private:
+    // 在拉流端所在loop执行, 拉流端可能已经离开
+    static void remote_handler(const MediaPacketPtr &pkt, const LiveLoopGroupPtr &group,
+                               const LiveConsumerListPtr &players, uint64_t post_ns);
+    LiveLoopGroup *_GetLoopGroup(uint32_t loop_index);
+    void _RemoveFromGroup(LiveConsumer *player);
+
+    std::vector<LiveLoopGroupPtr> loop_groups_;     // 按loop序号, 由mutex_保护
+};
+
+// GOP缓存配置, 对之后新建的source生效
+void LiveSetGopCacheConfig(const GopCacheConfig &config);
+
+#endif
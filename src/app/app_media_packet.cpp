@@ -0,0 +1,125 @@
+#include "app_media_packet.h"
+#include "app_ingest_stats.h"
+#include "protocol/rtmp_internal.h"
+#include "protocol/rtmp_msgtypeid.h"
+#include "protocol/rtmp_util.h"
+#include <string.h>
+
+// AVCPacketType为1时后面是3字节CompositionTime和4字节长度前缀的NALU,
+// 所有slice都不被参考时(AVC nal_ref_idc为0, HEVC 0-14中的偶数类型)这一帧可以丢
+static bool is_non_reference(uint8_t codec, const uint8_t *data, size_t bytes)
+{
+    bool has_slice = false;
+    size_t pos = 5;
+    while (pos + 4 < bytes) {
+        uint32_t len = (data[pos] << 24) | (data[pos + 1] << 16) | (data[pos + 2] << 8) | data[pos + 3];
+        pos += 4;
+        if (0 == len || len > bytes - pos)
+            return false;
+
+        uint8_t nal = data[pos];
+        if (FLV_VIDEO_CODEC_AVC == codec) {
+            uint8_t type = nal & 0x1F;
+            if (type >= 1 && type <= 5) {
+                if (nal & 0x60)
+                    return false;
+                has_slice = true;
+            }
+        } else {
+            uint8_t type = (nal >> 1) & 0x3F;
+            if (type < 32) {
+                if (type > 14 || (type & 1))
+                    return false;
+                has_slice = true;
+            }
+        }
+        pos += len;
+    }
+    return has_slice;
+}
+
+MediaPacket::MediaPacket(int type, const FrameBufferPtr &frame, const uint8_t *data, size_t bytes, uint32_t timestamp)
+    : type_(type), timestamp_(timestamp), keyframe_(false), sequence_header_(false),
+      disposable_(false), frame_(frame), data_(data), size_(bytes)
+{
+    if (FLV_TYPE_VIDEO == type && bytes >= 2) {
+        uint8_t codec = data[0] & 0x0F;
+        if (FLV_VIDEO_CODEC_AVC == codec || FLV_VIDEO_CODEC_HEVC == codec)
+            sequence_header_ = (0 == data[1]);
+        keyframe_ = !sequence_header_ && FLV_VIDEO_KEY_FRAME == (data[0] >> 4);
+        if (FLV_VIDEO_DISPOSABLE == (data[0] >> 4))
+            disposable_ = true;
+        else if (!sequence_header_ && !keyframe_ && (FLV_VIDEO_CODEC_AVC == codec || FLV_VIDEO_CODEC_HEVC == codec))
+            disposable_ = 1 == data[1] && is_non_reference(codec, data, bytes);
+    } else if (FLV_TYPE_AUDIO == type && bytes >= 2) {
+        sequence_header_ = FLV_AUDIO_AAC == (data[0] >> 4) && 0 == data[1];
+    }
+}
+
+MediaPacketPtr MediaPacket::Create(int type, const uint8_t *data, size_t bytes, uint32_t timestamp)
+{
+    FrameBufferPtr frame = FramePool::Create(data, bytes);
+    if (!frame)
+        return MediaPacketPtr();
+    return std::make_shared<const MediaPacket>(type, frame, frame->GetData(), bytes, timestamp);
+}
+
+MediaPacketPtr MediaPacket::Create(int type, const FrameBufferPtr &frame, const uint8_t *data, size_t bytes,
+                                   uint32_t timestamp)
+{
+    if (!frame || data < frame->GetData() || data + bytes > frame->GetData() + frame->GetSize())
+        return Create(type, data, bytes, timestamp);
+    return std::make_shared<const MediaPacket>(type, frame, data, bytes, timestamp);
+}
+
+SendBufferPtr MediaPacket::GetChunked(uint32_t chunk_size, uint32_t cid, uint32_t stream_id) const
+{
+    std::lock_guard<std::mutex> lock(chunked_mutex_);
+    for (size_t i = 0; i < chunked_.size(); i++) {
+        const ChunkedItem &item = chunked_[i];
+        if (item.chunk_size == chunk_size && item.cid == cid && item.stream_id == stream_id)
+            return item.data;
+    }
+
+    IngestStageTimer timer(INGEST_STAGE_SERIALIZE);
+    struct rtmp_chunk_header_t header;
+    header.fmt = RTMP_CHUNK_TYPE_0; // 共享数据不能依赖单个连接的头压缩状态
+    header.cid = cid;
+    header.timestamp = timestamp_;
+    header.length = (uint32_t)size_;
+    header.type = (uint8_t)(FLV_TYPE_SCRIPT == type_ ? RTMP_TYPE_DATA : type_);
+    header.stream_id = stream_id;
+
+    std::string *chunked = new std::string();
+    chunked->resize(rtmp_chunk_serialize(&header, data_, chunk_size, NULL));
+    rtmp_chunk_serialize(&header, data_, chunk_size, (uint8_t *)&(*chunked)[0]);
+
+    ChunkedItem item;
+    item.chunk_size = chunk_size;
+    item.cid = cid;
+    item.stream_id = stream_id;
+    item.data = SendBufferPtr(chunked);
+    chunked_.push_back(item);
+    return item.data;
+}
+
+SendBufferPtr MediaPacket::GetFlvTag() const
+{
+    std::lock_guard<std::mutex> lock(chunked_mutex_);
+    if (flv_tag_)
+        return flv_tag_;
+
+    IngestStageTimer timer(INGEST_STAGE_SERIALIZE);
+    std::string *tag = new std::string();
+    tag->resize(FLV_TAG_HEADER_SIZE + size_ + 4);
+    uint8_t *p = (uint8_t *)&(*tag)[0];
+    p[0] = (uint8_t)type_;
+    be_write_uint24(p + 1, (uint32_t)size_);
+    be_write_uint24(p + 4, timestamp_ & 0xFFFFFF);
+    p[7] = (uint8_t)(timestamp_ >> 24);     // TimestampExtended
+    be_write_uint24(p + 8, 0);              // StreamID
+    memcpy(p + FLV_TAG_HEADER_SIZE, data_, size_);
+    be_write_uint32(p + FLV_TAG_HEADER_SIZE + size_, (uint32_t)(FLV_TAG_HEADER_SIZE + size_));
+    flv_tag_ = SendBufferPtr(tag);
+    return flv_tag_;
+}
@@ -0,0 +1,102 @@
+/**
+ * 推流端收到的音视频帧, 分发给所有拉流端时共享同一份数据
+ */
+#ifndef APP_MEDIA_PACKET_H
+#define APP_MEDIA_PACKET_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "util/util_frame_pool.h"
+
+// FLV Tag Type
+#define FLV_TYPE_AUDIO		8
+#define FLV_TYPE_VIDEO		9
+#define FLV_TYPE_SCRIPT		18
+
+// FLV VideoTagHeader: FrameType(4bit) CodecID(4bit) AVCPacketType(8bit)
+#define FLV_VIDEO_KEY_FRAME     1
+#define FLV_VIDEO_DISPOSABLE    3       // disposable inter frame
+#define FLV_VIDEO_CODEC_AVC     7
+#define FLV_VIDEO_CODEC_HEVC    12
+// FLV AudioTagHeader: SoundFormat(4bit) ... AACPacketType(8bit)
+#define FLV_AUDIO_AAC           10
+
+#define FLV_HEADER_SIZE		9
+#define FLV_TAG_HEADER_SIZE	11
+
+// 已经序列化好的待发送数据, 创建后不再修改, 可以同时挂在多个连接的发送队列上
+typedef std::shared_ptr<const std::string> SendBufferPtr;
+
+class MediaPacket;
+typedef std::shared_ptr<const MediaPacket> MediaPacketPtr;
+
+class MediaPacket
+{
+public:
+    // data必须在frame里
+    MediaPacket(int type, const FrameBufferPtr &frame, const uint8_t *data, size_t bytes, uint32_t timestamp);
+    ~MediaPacket() {}
+
+    /**
+     * @brief 创建一帧, 数据只在这里拷贝一次
+     *
+     * @param type FLV_TYPE_AUDIO/FLV_TYPE_VIDEO/FLV_TYPE_SCRIPT
+     */
+    static MediaPacketPtr Create(int type, const uint8_t *data, size_t bytes, uint32_t timestamp);
+    /**
+     * @brief 用已经重组好的帧缓冲区创建一帧, 不拷贝
+     *
+     * data, bytes是frame里的一段(比如去掉@setDataFrame之后的script)
+     */
+    static MediaPacketPtr Create(int type, const FrameBufferPtr &frame, const uint8_t *data, size_t bytes,
+                                 uint32_t timestamp);
+
+    int GetType() const { return type_; }
+    uint32_t GetTimestamp() const { return timestamp_; }
+    const uint8_t *GetData() const { return data_; }
+    size_t GetSize() const { return size_; }
+    bool IsKeyFrame() const { return keyframe_; }               // 视频关键帧(不含sequence header)
+    bool IsSequenceHeader() const { return sequence_header_; }  // AVC/HEVC/AAC sequence header
+    bool IsDisposable() const { return disposable_; }           // 非参考视频帧, 丢掉不影响其他帧解码
+
+    /**
+     * @brief 获取按rtmp chunk切好的数据
+     *
+     * 相同(chunk_size, cid, stream_id)的拉流端共享同一份切块结果,
+     * 每帧只切块一次, 拉流端入队只增加引用计数; 可以在多个loop线程同时调用
+     */
+    SendBufferPtr GetChunked(uint32_t chunk_size, uint32_t cid, uint32_t stream_id) const;
+
+    /**
+     * @brief 获取FLV tag(11字节tag头 + 数据 + 4字节PreviousTagSize)
+     *
+     * 每帧只构造一次, 所有http-flv拉流端共享; 可以在多个loop线程同时调用
+     */
+    SendBufferPtr GetFlvTag() const;
+
+private:
+    typedef struct {
+        uint32_t chunk_size;
+        uint32_t cid;
+        uint32_t stream_id;
+        SendBufferPtr data;
+    } ChunkedItem;
+
+    int type_;
+    uint32_t timestamp_;
+    bool keyframe_;
+    bool sequence_header_;
+    bool disposable_;
+    FrameBufferPtr frame_;      // 引用计数的帧缓冲区, 推流端收到的数据和所有拉流端共享
+    const uint8_t *data_;
+    size_t size_;
+    mutable std::mutex chunked_mutex_;
+    mutable std::vector<ChunkedItem> chunked_; // 一般只有一两种组合, 线性查找即可
+    mutable SendBufferPtr flv_tag_;             // 由chunked_mutex_保护
+};
+
+#endif
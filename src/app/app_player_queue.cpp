@@ -0,0 +1,122 @@
+#include "app_player_queue.h"
+#include "util/dlog.h"
+
+// 可以丢弃的帧: sequence header之外的视频帧
+static bool is_droppable(const MediaPacketPtr &pkt)
+{
+    return FLV_TYPE_VIDEO == pkt->GetType() && !pkt->IsSequenceHeader();
+}
+
+// 计算时长用的帧: metadata和sequence header的时间戳可能是0, 不参与
+static bool is_timed(const MediaPacketPtr &pkt)
+{
+    return FLV_TYPE_SCRIPT != pkt->GetType() && !pkt->IsSequenceHeader();
+}
+
+PlayerQueue::PlayerQueue()
+    : bytes_(0), wait_keyframe_(false), dropped_frames_(0), dropped_bytes_(0)
+{
+    config_.max_bytes = PLAYER_QUEUE_MAX_BYTES;
+    config_.max_latency_ms = PLAYER_QUEUE_MAX_LATENCY_MS;
+    config_.max_lag_ms = PLAYER_QUEUE_MAX_LAG_MS;
+}
+
+void PlayerQueue::Push(const MediaPacketPtr &pkt)
+{
+    if (wait_keyframe_ && is_droppable(pkt)) {
+        if (!pkt->IsKeyFrame()) {
+            dropped_frames_++;
+            dropped_bytes_ += pkt->GetSize();
+            return;
+        }
+        wait_keyframe_ = false;
+    }
+
+    packets_.push_back(pkt);
+    bytes_ += pkt->GetSize();
+
+    if (_IsOverLimit())
+        _Shrink();
+}
+
+MediaPacketPtr PlayerQueue::Pop()
+{
+    if (packets_.empty())
+        return nullptr;
+
+    MediaPacketPtr pkt = packets_.front();
+    packets_.pop_front();
+    bytes_ -= pkt->GetSize();
+    return pkt;
+}
+
+uint32_t PlayerQueue::GetDuration() const
+{
+    auto first = packets_.begin();
+    while (first != packets_.end() && !is_timed(*first))
+        ++first;
+    auto last = packets_.rbegin();
+    while (last != packets_.rend() && !is_timed(*last))
+        ++last;
+    if (first == packets_.end() || last == packets_.rend())
+        return 0;
+    return (*last)->GetTimestamp() - (*first)->GetTimestamp();
+}
+
+bool PlayerQueue::_IsOverLimit() const
+{
+    return bytes_ > config_.max_bytes || GetDuration() > config_.max_latency_ms;
+}
+
+void PlayerQueue::_Shrink()
+{
+    size_t frames = dropped_frames_;
+    size_t bytes = dropped_bytes_;
+
+    // 第一步: 丢非参考帧, 其他帧解码不依赖它们
+    for (auto it = packets_.begin(); it != packets_.end() && _IsOverLimit();) {
+        if (is_droppable(*it) && (*it)->IsDisposable())
+            it = _Drop(it);
+        else
+            ++it;
+    }
+
+    // 第二步: 从队首开始整个丢GOP, 直到下一个关键帧
+    // deque中间erase会让所有迭代器失效, 这里用下标
+    while (_IsOverLimit()) {
+        size_t first = 0;
+        while (first < packets_.size() && !is_droppable(packets_[first]))
+            first++;
+        if (first == packets_.size())
+            break;  // 只剩音频, 不再丢
+
+        size_t next_key = first + 1;
+        while (next_key < packets_.size()
+               && !(is_droppable(packets_[next_key]) && packets_[next_key]->IsKeyFrame()))
+            next_key++;
+        if (next_key == packets_.size())
+            wait_keyframe_ = true;  // 后面的非关键帧没法解码了, 一起丢掉
+
+        for (size_t i = first; i < next_key;) {
+            if (is_droppable(packets_[i])) {
+                _Drop(packets_.begin() + i);
+                next_key--;
+            } else {
+                i++;
+            }
+        }
+        if (wait_keyframe_)
+            break;
+    }
+
+    LogWarn("player queue over limit, dropped {} frames, {} bytes, left {} frames, {} bytes",
+            dropped_frames_ - frames, dropped_bytes_ - bytes, packets_.size(), bytes_);
+}
+
+std::deque<MediaPacketPtr>::iterator PlayerQueue::_Drop(std::deque<MediaPacketPtr>::iterator it)
+{
+    dropped_frames_++;
+    dropped_bytes_ += (*it)->GetSize();
+    bytes_ -= (*it)->GetSize();
+    return packets_.erase(it);
+}
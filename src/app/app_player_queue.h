@@ -0,0 +1,66 @@
+/**
+ * 拉流端发送队列: socket发不动时帧先排在这里, 超过字节数或时长上限时按帧丢弃,
+ * 避免一个卡住的拉流端无限占用内存
+ */
+#ifndef APP_PLAYER_QUEUE_H
+#define APP_PLAYER_QUEUE_H
+
+#include "app/app_media_packet.h"
+
+#include <deque>
+
+// 默认配置, 比GOP缓存的上限大, 新拉流端加入时的GOP突发不会触发丢帧
+#define PLAYER_QUEUE_MAX_BYTES          (32 * 1024 * 1024)
+#define PLAYER_QUEUE_MAX_LATENCY_MS     15000
+#define PLAYER_QUEUE_MAX_LAG_MS         0       // 0表示不断开
+
+typedef struct {
+    uint32_t max_bytes;         // 队列最多保存的字节数
+    uint32_t max_latency_ms;    // 队列里最早和最新一帧的时间戳差
+    uint32_t max_lag_ms;        // socket持续发不动超过这个时间就断开拉流端, 0表示不断开
+} PlayerQueueConfig;
+
+class PlayerQueue
+{
+public:
+    PlayerQueue();
+    ~PlayerQueue() {}
+
+    void SetConfig(const PlayerQueueConfig &config) { config_ = config; }
+    const PlayerQueueConfig &GetConfig() const { return config_; }
+
+    /**
+     * @brief 入队一帧, 超过上限时丢帧
+     *
+     * 丢帧顺序: 先丢非参考视频帧, 还不够就从队首开始整个丢到下一个关键帧;
+     * 队列里没有后续关键帧时丢掉所有视频帧, 之后的非关键帧也丢, 直到下一个关键帧.
+     * 音频、sequence header和metadata一直保留
+     */
+    void Push(const MediaPacketPtr &pkt);
+    MediaPacketPtr Pop();
+
+    bool Empty() const { return packets_.empty(); }
+    size_t GetSize() const { return packets_.size(); }
+    size_t GetBytes() const { return bytes_; }
+    // 队列里最早和最新一帧的时间戳差
+    uint32_t GetDuration() const;
+
+    uint64_t GetDroppedFrames() const { return dropped_frames_; }
+    uint64_t GetDroppedBytes() const { return dropped_bytes_; }
+
+private:
+    bool _IsOverLimit() const;
+    void _Shrink();
+    std::deque<MediaPacketPtr>::iterator _Drop(std::deque<MediaPacketPtr>::iterator it);
+
+private:
+    PlayerQueueConfig config_;
+    std::deque<MediaPacketPtr> packets_;
+    size_t bytes_;
+    bool wait_keyframe_;        // 视频已经断了, 等下一个关键帧
+
+    uint64_t dropped_frames_;
+    uint64_t dropped_bytes_;
+};
+
+#endif
@@ -1,5 +1,6 @@
 #include "app_rtmp_conn.h"
 #include "thread/thread_pool.h"
+#include "app_ingest_stats.h"
 
 #include <errno.h>
 #include <stdio.h>
@@ -9,108 +10,60 @@
 #include <time.h>
 #include "util/dlog.h"
 #include <map>
+#include <atomic>
+#include <functional>
+#include <mutex>
 
 
 #define READ_BUF_SIZE 200000 // 每次尝试读取200K
+#define RTMP_SEND_IOVEC 64     // OnWrite每次writev最多引用的队列buffer数
+#define RTMP_READ_IOVEC 8      // READ_BUF_SIZE最多跨越的块数
+#define RTMP_SEND_BATCH_BYTES (256 * 1024)   // 每次从play_queue_取出切块的数据量
 
-static uint32_t g_conn_handle_generator = 0;
-static uint32_t  s_uuid_alloctor = 0;
+// uuid高8位是连接所在的loop, 工作线程据此把回复投递回对应loop
+#define RTMP_UUID_LOOP_SHIFT	24
+#define RTMP_UUID_SEQ_MASK		((1u << RTMP_UUID_LOOP_SHIFT) - 1)
+
+#define RTMP_RESPONSE_POOL_MAX	1024			// 缓存的空闲回复对象个数
+#define RTMP_RESPONSE_KEEP_BYTES	(64 * 1024)	// 回复对象放回池里时最多保留的字符串容量
+
+static std::atomic<uint32_t> g_conn_handle_generator(0);
+static std::atomic<uint32_t> s_uuid_alloctor(0);
 typedef unordered_map<uint32_t, RtmpConn *> UserMap_t;
 typedef unordered_map<uint32_t, RtmpConn *> RtmpConnMap_t;
 
-static UserMap_t s_uuid_conn_map;
-static RtmpConnMap_t s_rtmp_conn_map;
+// 连接只在自己所在的loop线程访问, 每个loop一份
+static thread_local UserMap_t s_uuid_conn_map;
+static thread_local RtmpConnMap_t s_rtmp_conn_map;
 
 static ThreadPool s_rtmp_thread_pool;
-
-std::list<ResponsePdu_t *> RtmpConn::s_response_pdu_list;
-std::mutex RtmpConn::s_resp_mutex;
+static RtmpAdmitHandler s_admit_handler;	// 为空时不鉴权, 在loop里直接处理
+static uint32_t s_admit_timeout_ms = RTMP_ADMIT_TIMEOUT_MS;
 
 
-
-// FLV Tag Type
-#define FLV_TYPE_AUDIO		8
-#define FLV_TYPE_VIDEO		9
-#define FLV_TYPE_SCRIPT		18
-
-class LiveConsumer
+// rtmp拉流端
+class RtmpConsumer : public LiveConsumer
 {
 public:
-    // TODO: add packet queue
-    RtmpConn* rtmp_ = nullptr;
-    struct flv_muxer_t* muxer;
+    RtmpConsumer(RtmpConn *rtmp) : rtmp_(rtmp) {}
 
-    LiveConsumer(RtmpConn* rtmp) : rtmp_(rtmp)
+    virtual int OnPacket(const MediaPacketPtr &pkt)
     {
-       
+        return rtmp_->rtmp_server_send_packet(pkt);
     }
 
-    ~LiveConsumer()
-    {
- 
-    }
-
-    static int handler(void* param, int type, const void* data, size_t bytes, uint32_t timestamp)
-    {
-        LiveConsumer* consumer = (LiveConsumer*)param;
-		int ret = 0;
-		//   LogInfo("rtmp_ conn:  {}", (void *)player->rtmp_);
-        switch (type)
-        {
-        case FLV_TYPE_SCRIPT:
-			ret = consumer->rtmp_->rtmp_server_check_send_script_metadata();
-            return consumer->rtmp_->rtmp_server_send_script(data, bytes, timestamp);
-        case FLV_TYPE_AUDIO:
-		 	ret = consumer->rtmp_->rtmp_server_check_send_audio_config();
-            return consumer->rtmp_->rtmp_server_send_audio(data, bytes, timestamp);
-        case FLV_TYPE_VIDEO:
-			ret = consumer->rtmp_->rtmp_server_check_send_video_config();
-            return consumer->rtmp_->rtmp_server_send_video(data, bytes, timestamp);		
-        default:
-            assert(0);
-            return -1;
-        }
-    }
+private:
+    RtmpConn *rtmp_;    // 连接关闭时先从source删除, 之后不会再被调用
 };
 
 
-class LiveSource
-{ 
-public:
-    std::list<std::shared_ptr<LiveConsumer> > players;
-	RtmpConn *rtmp_conn_ = nullptr;
-	std::string app_stream_;
-    LiveSource(RtmpConn *rtmp_conn, std::string app_stream)
-		: rtmp_conn_(rtmp_conn), app_stream_(app_stream)
-    {
-		
-    }
+static PlayerQueueConfig s_player_queue_config = { PLAYER_QUEUE_MAX_BYTES, PLAYER_QUEUE_MAX_LATENCY_MS, PLAYER_QUEUE_MAX_LAG_MS };
 
-    ~LiveSource()
-    {
-        
-    }
-	void update_rtmp_conn(RtmpConn *rtmp_conn) {
-		rtmp_conn_ = rtmp_conn;
-	}
+// 每个loop一份: 连接对象和握手缓冲区的slab, 构造控制消息的临时空间
+static thread_local CSlab s_conn_slab(sizeof(RtmpConn), RTMP_CONN_SLAB_OBJS);
+static thread_local CSlab s_handshake_slab(RTMP_HANDSHAKE_BUF_SIZE, RTMP_HANDSHAKE_SLAB_OBJS);
+static thread_local uint8_t s_payload[RTMP_PAYLOAD_SIZE];
 
-    static int handler(void* param, int type, const uint8_t* data, size_t bytes, uint32_t timestamp)
-    {
-        int r = 0;
-        LiveSource* s = (LiveSource*)param;
-		if(s->rtmp_conn_) {		//有推流的情况下才调用player
-			for (auto it = s->players.begin(); it != s->players.end(); ++it)
-			{
-				// TODO: push to packet queue
-				// rtmp_player_t::handler()
-				LiveConsumer::handler(it->get(), type, data, bytes,  timestamp);
-			}
-		}
-        return 0; // ignore error
-    }
-};
-
-static std::map<std::string, std::shared_ptr<LiveSource> > s_lives;
 enum {
     CONN_STATE_IDLE,
     CONN_STATE_CONNECTED,
@@ -122,6 +75,8 @@ void rtmp_server_onabort(void* param, uint32_t chunk_stream_id);
 int rtmp_server_onaudio(void* param, const uint8_t* data, size_t bytes, uint32_t timestamp);
 int rtmp_server_onvideo(void* param, const uint8_t* data, size_t bytes, uint32_t timestamp);
 int rtmp_server_onscript(void* param, const uint8_t* data, size_t bytes, uint32_t timestamp);
+void* rtmp_server_onframe_alloc(void* param, uint8_t type, size_t bytes, uint8_t** payload);
+void rtmp_server_onframe_free(void* param, void* frame);
 int rtmp_server_onconnect(void* param, int r, double transaction, const struct rtmp_connect_t* connect);
 int rtmp_server_oncreate_stream(void* param, int r, double transaction);
 int rtmp_server_ondelete_stream(void* param, int r, double transaction, double stream_id);
@@ -133,7 +88,12 @@ int rtmp_server_onseek(void* param, int r, double transaction, double milliSecon
 int rtmp_server_onreceive_audio(void* param, int r, double transaction, uint8_t audio);
 int rtmp_server_onreceive_video(void* param, int r, double transaction, uint8_t video);
 int rtmp_server_send(void* param, const uint8_t* header, uint32_t headerBytes, const uint8_t* payload, uint32_t payloadBytes);
+int rtmp_server_sendv(void* param, const struct iovec* vec, int n);
 int rtmp_server_onclose(void* param); // 传入的实际是rtmpconn
+// 鉴权之后继续处理connect/publish/play, admit不为0时拒绝
+static int rtmp_server_connect_reply(RtmpConn *ctx, double transaction, int admit);
+static int rtmp_server_publish_start(RtmpConn *ctx, int admit);
+static int rtmp_server_play_start(RtmpConn *ctx, int admit);
 
 RtmpConn *FindHttpConnByHandle(uint32_t handle) {
     RtmpConn *pConn = NULL;
@@ -145,6 +105,30 @@ RtmpConn *FindHttpConnByHandle(uint32_t handle) {
     return pConn;
 }
 
+// 点播定时器, callback_data是conn_handle_, 连接已经关闭时什么也不做
+static void rtmp_vod_timer(void *callback_data, uint8_t msg, uint32_t handle, void *pParam)
+{
+    NOTUSED_ARG(msg);
+    NOTUSED_ARG(handle);
+    NOTUSED_ARG(pParam);
+
+    RtmpConn *pConn = FindHttpConnByHandle((uint32_t)(uintptr_t)callback_data);
+    if (pConn)
+        pConn->OnVodTimer();
+}
+
+// 只触发一次, 触发后句柄失效
+static void rtmp_lag_timer(void *callback_data, uint8_t msg, uint32_t handle, void *pParam)
+{
+    NOTUSED_ARG(msg);
+    NOTUSED_ARG(handle);
+    NOTUSED_ARG(pParam);
+
+    RtmpConn *pConn = FindHttpConnByHandle((uint32_t)(uintptr_t)callback_data);
+    if (pConn)
+        pConn->OnLagTimer();
+}
+
 RtmpConn *GetRtmpConnByUuid(uint32_t uuid) {
     RtmpConn *pConn = NULL;
     UserMap_t::iterator it = s_uuid_conn_map.find(uuid);
@@ -196,18 +180,24 @@ RtmpConn::RtmpConn(/* args */):
         conn_handle_ = ++g_conn_handle_generator;
     }
 
-    uuid_ = ++s_uuid_alloctor; // 单线程里用的，不需要加锁
+    uuid_ = ++s_uuid_alloctor & RTMP_UUID_SEQ_MASK;
     if (uuid_ == 0) {
-        uuid_ = ++s_uuid_alloctor;
+        uuid_ = ++s_uuid_alloctor & RTMP_UUID_SEQ_MASK;
     }
-    s_uuid_conn_map.insert(make_pair(uuid_, this)); // 单线程里用的，不需要加锁
+    uuid_ |= netlib_loop_index() << RTMP_UUID_LOOP_SHIFT;
+    s_uuid_conn_map.insert(make_pair(uuid_, this)); // 每个loop一份，不需要加锁
     LogInfo("conn_uuid: {}, conn_handle_: {:X}", uuid_, conn_handle_);
+    play_queue_.SetConfig(s_player_queue_config);
 
     stream_id = 0;
 	receiveAudio = 1;
 	receiveVideo = 1;
 	handshake_state = RTMP_HANDSHAKE_UNINIT;
 
+	payload = s_payload;
+	handshake = NULL;
+	memset(&start, 0, sizeof(start));
+	memset(&rtmp, 0, sizeof(rtmp));
 	rtmp.parser.state = RTMP_PARSE_INIT;
 	rtmp.in_chunk_size = RTMP_CHUNK_SIZE;
 	rtmp.out_chunk_size = RTMP_CHUNK_SIZE;
@@ -217,10 +207,13 @@ RtmpConn::RtmpConn(/* args */):
 
     rtmp.param = this;
 	rtmp.send = rtmp_server_send;
+	rtmp.sendv = rtmp_server_sendv;
 	rtmp.onaudio = rtmp_server_onaudio;
 	rtmp.onvideo = rtmp_server_onvideo;
 	rtmp.onabort = rtmp_server_onabort;
 	rtmp.onscript = rtmp_server_onscript;
+	rtmp.onframe_alloc = rtmp_server_onframe_alloc;
+	rtmp.onframe_free = rtmp_server_onframe_free;
 	rtmp.server.onconnect = rtmp_server_onconnect;
 	rtmp.server.oncreate_stream = rtmp_server_oncreate_stream;
 	rtmp.server.ondelete_stream = rtmp_server_ondelete_stream;
@@ -232,47 +225,127 @@ RtmpConn::RtmpConn(/* args */):
 	rtmp.server.onreceive_audio = rtmp_server_onreceive_audio;
 	rtmp.server.onreceive_video = rtmp_server_onreceive_video;
 
-	memset(&rtmp.in_packets, 0, sizeof(struct rtmp_packet_t) * N_CHUNK_STREAM);
+	rtmp_packet_table_init(&rtmp.in_packets);
+	rtmp_packet_table_init(&rtmp.out_packets);
 
-	rtmp.out_packets[RTMP_CHANNEL_PROTOCOL].header.cid = RTMP_CHANNEL_PROTOCOL;
-	rtmp.out_packets[RTMP_CHANNEL_INVOKE].header.cid = RTMP_CHANNEL_INVOKE;
-	rtmp.out_packets[RTMP_CHANNEL_AUDIO].header.cid = RTMP_CHANNEL_AUDIO;
-	rtmp.out_packets[RTMP_CHANNEL_VIDEO].header.cid = RTMP_CHANNEL_VIDEO;
-	rtmp.out_packets[RTMP_CHANNEL_DATA].header.cid = RTMP_CHANNEL_DATA;
+	rtmp_packet_table_get(&rtmp.out_packets, RTMP_CHANNEL_PROTOCOL);
+	rtmp_packet_table_get(&rtmp.out_packets, RTMP_CHANNEL_INVOKE);
+	rtmp_packet_table_get(&rtmp.out_packets, RTMP_CHANNEL_AUDIO);
+	rtmp_packet_table_get(&rtmp.out_packets, RTMP_CHANNEL_VIDEO);
+	rtmp_packet_table_get(&rtmp.out_packets, RTMP_CHANNEL_DATA);
 }
 
 RtmpConn::~RtmpConn()
 {
+	// 对象和握手缓冲区都是本loop的slab分配的, 最后一次ReleaseRef必须在本loop
+	assert((uuid_ >> RTMP_UUID_LOOP_SHIFT) == netlib_loop_index());
 	LogInfo("~RtmpConn, m_sock_handle = {}, conn_handle_ = {}", m_sock_handle , conn_handle_);
+	rtmp_server_destroy();
+	if (handshake)
+		s_handshake_slab.Free(handshake);
+}
+
+void *RtmpConn::operator new(size_t size)
+{
+	if (size > s_conn_slab.GetObjSize())	// 派生类
+		return ::operator new(size);
+	void *ptr = s_conn_slab.Alloc();
+	if (NULL == ptr)
+		throw std::bad_alloc();
+	return ptr;
+}
+
+void RtmpConn::operator delete(void *ptr, size_t size)
+{
+	if (size > s_conn_slab.GetObjSize())
+		::operator delete(ptr);
+	else
+		s_conn_slab.Free(ptr);
 }
 
 // 线程安全的问题，如果多个线程调用会怎么样？
-// 如果send只在epoll线程被调用，out_buf_只保留还没有send的buffer
+// 如果send只在epoll线程被调用，send_queue_只保留还没有send的buffer
 // 既然这里我们是用了缓存，那调用Send意味着数据都已经被处理了
 int RtmpConn::Send(void *data, int len) 
 { 
+    struct iovec iov;
+    iov.iov_base = data;
+    iov.iov_len = len;
+    return SendV(&iov, 1);
+}
+
+// 多段数据一次writev; 调用者的内存随后会被复用, 没发完的部分只能拷贝一次后排队
+int RtmpConn::SendV(const struct iovec *iov, int iovcnt)
+{
+    last_send_tick_ = GetTickCount();
+
+    size_t len = 0;
+    for (int i = 0; i < iovcnt; i++)
+        len += iov[i].iov_len;
+
+    int ret = 0;
+    if (!busy_) {
+        ret = netlib_sendv(m_sock_handle, iov, iovcnt);
+        if (ret < 0) {
+            LogError("m_sock_handle: {}, send failed, ret = {}", m_sock_handle, ret);
+            ret = 0;
+        }
+    }
+
+    if ((size_t)ret < len) {
+        // 跳过已经发送的部分, 剩下的合并成一个buffer保存在队列里面，下次reactor write触发后再发送
+        std::string *remain = new std::string();
+        remain->reserve(len - ret);
+        size_t skip = ret;
+        for (int i = 0; i < iovcnt; i++) {
+            size_t n = iov[i].iov_len;
+            if (skip >= n) {
+                skip -= n;
+                continue;
+            }
+            remain->append((const char *)iov[i].iov_base + skip, n - skip);
+            skip = 0;
+        }
+        send_queue_.push_back(SendBufferPtr(remain));
+        if (!busy_) {
+            LogInfo("not send all={}, remain= {}", len, len - ret);
+            busy_tick_ = last_send_tick_;
+            busy_ = true;
+            _StartLagTimer();
+        }
+    } else {
+            // 已经发送完毕了
+        LogDebug("send all size:{}", ret);
+    }
+
+    return 0;
+}
+
+// 和Send一样保证顺序, 区别是排队时只保存引用
+int RtmpConn::SendShared(const SendBufferPtr &buf)
+{
     last_send_tick_ = GetTickCount();
 
     if (busy_) {
-        out_buf_.Write(data, len);
+        send_queue_.push_back(buf);
         return 0;
     }
 
-    int ret = netlib_send(m_sock_handle, data, len);
+    IngestStageTimer timer(INGEST_STAGE_FLUSH);
+    int len = (int)buf->size();
+    int ret = netlib_send(m_sock_handle, (void *)buf->data(), len);
     if (ret < 0) {
 		LogError("m_sock_handle: {}, send failed, ret = {}", m_sock_handle, ret);
         ret = 0;
 	}
 
     if (ret < len) {
-        out_buf_.Write(
-            (char *)data + ret,
-            len - ret); // 保存buffer里面，下次reactor write触发后再发送
+        send_queue_.push_back(buf);
+        send_offset_ = ret;
         busy_ = true;
-        LogInfo("not send all={}, remain= {}", len, out_buf_.GetWriteOffset());
-    } else {
-            // 已经发送完毕了
-        LogDebug("send all size:{}", ret);
+        busy_tick_ = last_send_tick_;
+        _StartLagTimer();
+        LogInfo("not send all={}, remain= {}", len, len - ret);
     }
 
     return 0;
@@ -281,7 +354,18 @@ int RtmpConn::Send(void *data, int len)
 void RtmpConn::Close() 
 {
 	rtmp_server_onclose(this);
+	if (vod_timer_) {
+		netlib_cancel_timer(vod_timer_);
+		vod_timer_ = NULL;
+	}
+	if (lag_timer_) {
+		netlib_cancel_timer(lag_timer_);
+		lag_timer_ = NULL;
+	}
  
+    if (play_queue_.GetDroppedFrames() > 0)
+        LogWarn("handle = {}, dropped {} frames, {} bytes", conn_handle_,
+                play_queue_.GetDroppedFrames(), play_queue_.GetDroppedBytes());
     LogInfo("Close handle = {}", conn_handle_);
     state_ = CONN_STATE_CLOSED;
     s_rtmp_conn_map.erase(conn_handle_);
@@ -307,57 +391,124 @@ void RtmpConn::OnConnect(net_handle_t handle)
 
 void RtmpConn::OnRead() 
 {
+    struct iovec iov[RTMP_READ_IOVEC];
+    bool closed = false;
     for (;;) {
-        uint32_t free_buf_len =
-            in_buf_.GetAllocSize() - in_buf_.GetWriteOffset();
-        if (free_buf_len < READ_BUF_SIZE + 1)
-            in_buf_.Extend(READ_BUF_SIZE + 1);
-
-        int ret = netlib_recv(m_sock_handle,
-                            in_buf_.GetBuffer() + in_buf_.GetWriteOffset(),
-                            READ_BUF_SIZE);
-        if (ret <= 0)
+        int cnt = in_buf_.GetWriteSpans(iov, RTMP_READ_IOVEC, READ_BUF_SIZE);
+        size_t space = 0;
+        for (int i = 0; i < cnt; i++)
+            space += iov[i].iov_len;
+        int ret = netlib_recvv(m_sock_handle, iov, cnt);
+        if (ret == NETLIB_AGAIN)
+            break;
+        if (ret <= 0) {
+            closed = true;      // 0是对端关闭, 其他是出错
             break;
+        }
 
         in_buf_.IncWriteOffset(ret);
-
         last_recv_tick_ = GetTickCount();
+        // 每读一批就解析掉, 缓冲区不会随着连续读满无限增长
+        if (!_ParseInput()) {
+            closed = true;
+            break;
+        }
+        if ((size_t)ret < space || state_ == CONN_STATE_CLOSED)
+            break;              // 没有读满, 内核缓冲区已经空了, 不用再读一次等EAGAIN
     }
 
-    // 分析是否符号rtmp的需求，不断进行解析
-    uint8_t *in_buf =  in_buf_.GetBuffer();
-    uint32_t buf_len = in_buf_.GetWriteOffset();
-	LogDebug("recv: {}", buf_len);
-    // 第一步 握手
-    int remain =  rtmp_server_input(in_buf, buf_len);
-    in_buf_.Skip(buf_len - remain);
-
-    // 第二步
+    if (closed && state_ != CONN_STATE_CLOSED)
+        Close();
+}
 
-    // 第三步
+// 解析缓冲区里的全部数据, 解析失败返回false
+// 可读片段可能超过RTMP_READ_IOVEC个, 要循环取完, 不能只解析前面几段就Clear
+bool RtmpConn::_ParseInput()
+{
+	LogDebug("recv: {}", in_buf_.GetReadableSize());
+    // 解析器是流式的, 每个片段直接交给它, 不需要拼成连续内存
+    IngestStageTimer timer(INGEST_STAGE_PARSE);
+    struct iovec iov[RTMP_READ_IOVEC];
+    while (!in_buf_.Empty() && !rejected_) {   // 被拒绝之后收到的数据直接丢掉
+        int cnt = in_buf_.GetReadSpans(iov, RTMP_READ_IOVEC);
+        for (int i = 0; i < cnt; i++) {
+            int r = rtmp_server_input((const uint8_t *)iov[i].iov_base, iov[i].iov_len);
+            if (0 != r) {
+                // 解析器停在一个消息中间, 后面的数据已经无法对齐, 只能断开
+                LogError("rtmp_server_input failed, r = {}", r);
+                in_buf_.Clear();
+                return false;
+            }
+            in_buf_.Skip(iov[i].iov_len);
+            if (rejected_)
+                break;
+        }
+    }
+    in_buf_.Clear();
+    return true;
 }
 
 void RtmpConn::OnWrite() {
 	// LogInfo("busy_: {}", busy_);
     if (!busy_)
         return; // 没有数据可写
-    //发送数据
-    int ret = netlib_send(m_sock_handle, out_buf_.GetBuffer(),
-                        out_buf_.GetWriteOffset());
-    if (ret < 0)
-        ret = 0;
-    //缓存总长
-    int out_buf_size = (int)out_buf_.GetWriteOffset();
-    // 跳过已经发送的数据
-    out_buf_.Read(NULL, ret);
+    IngestStageTimer timer(INGEST_STAGE_FLUSH);
+    //按顺序发送队列里的数据, 每次writev引用队列前面的多个buffer, 不拷贝
+    for (;;) {
+        // send_queue_里的数据已经切块不能再丢, 发完了才从play_queue_补充一批
+        if (send_queue_.empty()) {
+            size_t batch_bytes = 0;
+            while (!play_queue_.Empty() && send_queue_.size() < RTMP_SEND_IOVEC
+                   && batch_bytes < RTMP_SEND_BATCH_BYTES) {
+                MediaPacketPtr pkt = play_queue_.Pop();
+                batch_bytes += pkt->GetSize();
+                _QueuePacket(pkt);
+            }
+        }
+        if (send_queue_.empty())
+            break;
 
-    if (ret < out_buf_size) {   // 还没有发送完毕
-        busy_ = true;
-        LogInfo("not send all, remain = {}", out_buf_.GetWriteOffset());
-    } else {
-        // 已经发送完毕
-        busy_ = false;
+        struct iovec iov[RTMP_SEND_IOVEC];
+        int iovcnt = 0;
+        size_t len = 0;
+        for (auto it = send_queue_.begin(); it != send_queue_.end() && iovcnt < RTMP_SEND_IOVEC; ++it) {
+            uint32_t offset = 0 == iovcnt ? send_offset_ : 0;
+            iov[iovcnt].iov_base = (void *)((*it)->data() + offset);
+            iov[iovcnt].iov_len = (*it)->size() - offset;
+            len += iov[iovcnt].iov_len;
+            iovcnt++;
+        }
+
+        int ret = netlib_sendv(m_sock_handle, iov, iovcnt);
+        if (ret < 0)
+            ret = 0;
+
+        // 跳过已经发送的数据
+        size_t sent = ret;
+        while (sent > 0) {
+            size_t remain = send_queue_.front()->size() - send_offset_;
+            if (sent < remain) {
+                send_offset_ += sent;
+                break;
+            }
+            sent -= remain;
+            send_queue_.pop_front();
+            send_offset_ = 0;
+        }
+
+        if ((size_t)ret < len) {   // 还没有发送完毕
+            LogInfo("not send all, remain = {}, queue = {}", len - ret, send_queue_.size());
+            return;
+        }
+    }
+    // 已经发送完毕
+    busy_ = false;
+    if (lag_timer_) {
+        netlib_cancel_timer(lag_timer_);
+        lag_timer_ = NULL;
     }
+    if (rejected_)
+        PostClose();
 }
 
 void RtmpConn::OnClose() 
@@ -365,40 +516,213 @@ void RtmpConn::OnClose()
     Close();
 }
 
+// 投递到连接所在的loop发送
+// 工作线程交给loop发送的回复, 对象和字符串的容量都反复使用
+struct RtmpResponse
+{
+    uint32_t conn_uuid;
+    std::string data;
+};
+
+static std::mutex s_response_mutex;
+static std::vector<RtmpResponse *> s_response_pool;
+
+static RtmpResponse *RtmpResponseAlloc()
+{
+    {
+        std::lock_guard<std::mutex> lock(s_response_mutex);
+        if (!s_response_pool.empty()) {
+            RtmpResponse *resp = s_response_pool.back();
+            s_response_pool.pop_back();
+            return resp;
+        }
+    }
+    return new RtmpResponse();
+}
+
+static void RtmpResponseFree(RtmpResponse *resp)
+{
+    resp->data.clear();
+    if (resp->data.capacity() > RTMP_RESPONSE_KEEP_BYTES)
+        std::string().swap(resp->data);    // 偶尔的大回复不要一直占着
+    {
+        std::lock_guard<std::mutex> lock(s_response_mutex);
+        if (s_response_pool.size() < RTMP_RESPONSE_POOL_MAX) {
+            s_response_pool.push_back(resp);
+            return;
+        }
+    }
+    delete resp;
+}
+
 void RtmpConn::AddResponseData(uint32_t conn_uuid, string &resp_data) 
 {
     LogDebug("into");
-    ResponsePdu_t *pResp = new ResponsePdu_t;
-    pResp->conn_uuid = conn_uuid;
-    pResp->resp_data = std::move(resp_data);
-
-    s_resp_mutex.lock();
-    s_response_pdu_list.push_back(pResp);
-    s_resp_mutex.unlock();
-}
-
-void RtmpConn::SendResponseDataList() 
-{
-     LogDebug("into");
-    // 发送数据
-    s_resp_mutex.lock();
-    while (!s_response_pdu_list.empty()) {
-        ResponsePdu_t *pResp = s_response_pdu_list.front();
-        s_response_pdu_list.pop_front();
-        s_resp_mutex.unlock();
-        RtmpConn *pConn = GetRtmpConnByUuid(pResp->conn_uuid); // 该连接有可能已经被释放，如果被释放则返回NULL
-        // LogInfo("conn_uuid: {}", pResp->conn_uuid); //{0:x}
-        if (pConn) {
-            // LogInfo("send: {}", pResp->resp_data);
-            pConn->Send((void *)pResp->resp_data.c_str(),
-                        pResp->resp_data.size());  // 最终socket send
+    RtmpResponse *resp = RtmpResponseAlloc();
+    resp->conn_uuid = conn_uuid;
+    resp->data.swap(resp_data);     // 调用方拿回池里的空缓冲区, 下次拼回复可以复用容量
+    // 只捕获一个指针, std::function直接存在自己里面, 不用再分配
+    if (netlib_post(conn_uuid >> RTMP_UUID_LOOP_SHIFT, [resp]() {
+            RtmpConn *pConn = GetRtmpConnByUuid(resp->conn_uuid); // 该连接有可能已经被释放，如果被释放则返回NULL
+            if (pConn) {
+                pConn->Send((void *)resp->data.c_str(), resp->data.size());  // 最终socket send
+            }
+            RtmpResponseFree(resp);
+        }) != NETLIB_OK)
+        RtmpResponseFree(resp);
+}
+
+// 线程池里的鉴权任务, 结果投递回连接所在的loop; 排队超时没有执行时按拒绝处理
+struct RtmpAdmitTask
+{
+    RtmpAdmission admission;
+    double transaction;
+
+    void operator()()
+    {
+        int r = -1;
+        try {
+            r = s_admit_handler(admission);
+        } catch (const std::exception &e) {
+            LogError("admit handler failed: {}", e.what());
         }
-        delete pResp;
+        Complete(r);
+    }
+
+    void expire()
+    {
+        LogWarn("admit timeout, conn_uuid: {}, type: {}", admission.conn_uuid, admission.type);
+        Complete(-ETIMEDOUT);
+    }
+
+    void Complete(int r)
+    {
+        uint32_t conn_uuid = admission.conn_uuid;
+        int type = admission.type;
+        double trans = transaction;
+        netlib_post(conn_uuid >> RTMP_UUID_LOOP_SHIFT, [conn_uuid, type, trans, r]() {
+            RtmpConn *pConn = GetRtmpConnByUuid(conn_uuid); // 等待期间连接可能已经关闭
+            if (pConn) {
+                pConn->OnAdmitDone(type, trans, r);
+            }
+        });
+    }
+};
+
+int RtmpConn::Admit(int type, double transaction)
+{
+    if (!s_admit_handler)
+        return 0;
 
-        s_resp_mutex.lock();
+    RtmpAdmitTask task;
+    task.admission.type = type;
+    task.admission.conn_uuid = uuid_;
+    task.admission.peer_ip = peer_ip_;
+    // connect通过之前info还是空的, 用鉴权中的请求
+    const struct rtmp_connect_t &connect = RTMP_ADMIT_CONNECT == type ? admit_connect_ : info;
+    task.admission.app = connect.app;
+    task.admission.tc_url = connect.tcUrl;
+    if (RTMP_ADMIT_CONNECT != type) {
+        task.admission.stream_name = stream_name;
+        task.admission.stream_type = stream_type;
     }
+    task.transaction = transaction;
 
-    s_resp_mutex.unlock();
+    // 一个连接同时只有一个鉴权, 期间收到的消息排队, 结果和回复的顺序与请求一致
+    admitting_ = true;
+    s_rtmp_thread_pool.post(s_admit_timeout_ms, std::move(task));
+    return RTMP_SERVER_ASYNC_START;
+}
+
+void RtmpConn::OnAdmitDone(int type, double transaction, int r)
+{
+    if (!admitting_ || state_ == CONN_STATE_CLOSED)
+        return;
+    admitting_ = false;
+
+    int ret = 0;
+    if (RTMP_ADMIT_CONNECT == type)
+        ret = rtmp_server_connect_reply(this, transaction, r);
+    else if (RTMP_ADMIT_PUBLISH == type)
+        ret = rtmp_server_publish_start(this, r);
+    else if (RTMP_ADMIT_PLAY == type)
+        ret = rtmp_server_play_start(this, r);
+    if (0 != ret)
+        LogError("admit done, type: {}, ret = {}", type, ret);
+    RunDeferred();
+}
+
+void RtmpConn::RunDeferred()
+{
+    // 排队的消息里可能又有需要鉴权的命令, 那时停下等下一次结果
+    int ret = 0;
+    while (!_IsDeferring() && !admit_pending_.empty() && state_ != CONN_STATE_CLOSED) {
+        std::function<int()> cmd = std::move(admit_pending_.front());
+        admit_pending_.pop_front();
+        ret = cmd();
+        if (0 != ret)
+            LogError("deferred rtmp message failed, ret = {}", ret);
+    }
+}
+
+bool RtmpConn::DeferIfAdmitting(std::function<int()> &&cmd)
+{
+    if (rejected_)
+        return true;
+    if (!_IsDeferring())
+        return false;
+    admit_pending_.push_back(std::move(cmd));
+    return true;
+}
+
+// 和LiveSource跨loop投递一样, metadata和sequence header不丢; 丢了中间的帧之后, 后面的帧要等到关键帧,
+// 鉴权返回之后直接处理的帧也一样, 否则拉流端会收到参考帧已经丢掉的P帧
+bool RtmpConn::DeferIfAdmitting(const MediaPacketPtr &pkt)
+{
+    if (rejected_)
+        return true;
+    if (FLV_TYPE_VIDEO == pkt->GetType())
+        admit_has_video_ = true;
+
+    if (FLV_TYPE_SCRIPT != pkt->GetType() && !pkt->IsSequenceHeader()) {
+        bool full = _IsDeferring() && admit_pending_.size() >= RTMP_ADMIT_MAX_PENDING;
+        if (admit_dropping_) {
+            bool resume_point = pkt->IsKeyFrame() || (FLV_TYPE_AUDIO == pkt->GetType() && !admit_has_video_);
+            if (full || !resume_point)
+                return true;
+            admit_dropping_ = false;
+        } else if (full) {
+            LogWarn("handle = {}, admit pending queue full, drop to next keyframe", conn_handle_);
+            admit_dropping_ = true;
+            return true;
+        }
+    }
+
+    if (!_IsDeferring())
+        return false;
+    RtmpConn *ctx = this;
+    admit_pending_.push_back([ctx, pkt]() { return LiveSource::handler(ctx->rtmp_source_.get(), pkt); });
+    return true;
+}
+
+void RtmpConn::Reject()
+{
+    rejected_ = true;
+    admit_pending_.clear();
+    if (!busy_)
+        PostClose();
+    // 否则在OnWrite发完之后关闭
+}
+
+// 可能在解析消息的过程中调用, 不能直接Close, 投递到本loop稍后关闭
+void RtmpConn::PostClose()
+{
+    uint32_t conn_handle = conn_handle_;
+    netlib_post(netlib_loop_index(), [conn_handle]() {
+        RtmpConn *pConn = FindHttpConnByHandle(conn_handle);
+        if (pConn)
+            pConn->Close();
+    });
 }
 
 void rtmp_callback(void *callback_data, uint8_t msg, uint32_t handle, void *pParam) 
@@ -413,21 +737,17 @@ void rtmp_callback(void *callback_data, uint8_t msg, uint32_t handle, void *pPar
     }
 }
 
-void rtmp_loop_callback(void *callback_data, uint8_t msg, uint32_t handle,
-                        void *pParam) {
-    UNUSED(callback_data);
-    UNUSED(msg);
-    UNUSED(handle);
-    UNUSED(pParam);
-    RtmpConn::SendResponseDataList(); // 静态函数, 将要发送的数据循环发给客户端
+// 每个业务有自己的线程池，定时器保活后续再添加
+void RtmpSetAdmitHandler(const RtmpAdmitHandler &handler, uint32_t timeout_ms)
+{
+    s_admit_handler = handler;
+    s_admit_timeout_ms = timeout_ms;
 }
 
-// 每个业务有自己的线程池，定时器保活后续再添加
 int RtmpInitListen(std::string listen_ip, uint16_t listen_port, uint32_t thread_num)
 {
     s_rtmp_thread_pool.init(thread_num);
     s_rtmp_thread_pool.start();
-    netlib_add_loop(rtmp_loop_callback,NULL);
 
     int ret = netlib_listen(listen_ip.c_str(), listen_port, rtmp_callback, NULL);
     if (ret == NETLIB_ERROR)
@@ -438,6 +758,20 @@ int RtmpInitListen(std::string listen_ip, uint16_t listen_port, uint32_t thread_
     return NETLIB_OK;
 }
 
+void RtmpSetGopCacheConfig(const GopCacheConfig &config)
+{
+	LiveSetGopCacheConfig(config);
+}
+
+size_t RtmpGetGopCacheBytes()
+{
+	return GopCache::GetTotalBytes();
+}
+
+void RtmpSetPlayerQueueConfig(const PlayerQueueConfig &config)
+{
+	s_player_queue_config = config;
+}
 
 
 
@@ -456,7 +790,7 @@ int rtmp_server_send_control(struct rtmp_t* rtmp, const uint8_t* payload, uint32
 
 int RtmpConn::rtmp_server_send_onstatus(double transaction, int r, const char* success, const char* fail, const char* description)
 {
-	r = (int)(rtmp_netstream_onstatus(this->payload, sizeof(this->payload), transaction, 
+	r = (int)(rtmp_netstream_onstatus(this->payload, RTMP_PAYLOAD_SIZE, transaction, 
         0==r ? RTMP_LEVEL_STATUS : RTMP_LEVEL_ERROR, 0==r ? success : fail, description) - this->payload);
 	return rtmp_server_send_control(&this->rtmp, this->payload, r, this->stream_id);
 }
@@ -466,11 +800,13 @@ int RtmpConn::rtmp_server_send_handshake()
 {
     LogDebug("Send rtmp_handshake_s0 s1 s2");
 	int n, r;
-	n = rtmp_handshake_s0(this->handshake, RTMP_VERSION);
-	n += rtmp_handshake_s1(this->handshake + n, (uint32_t)time(NULL), this->payload, RTMP_HANDSHAKE_SIZE);
-	n += rtmp_handshake_s2(this->handshake + n, (uint32_t)time(NULL), this->payload, RTMP_HANDSHAKE_SIZE);
+	uint8_t *c1 = this->handshake;
+	uint8_t *s0 = this->handshake + RTMP_HANDSHAKE_SIZE;
+	n = rtmp_handshake_s0(s0, RTMP_VERSION);
+	n += rtmp_handshake_s1(s0 + n, (uint32_t)time(NULL), c1, RTMP_HANDSHAKE_SIZE);
+	n += rtmp_handshake_s2(s0 + n, (uint32_t)time(NULL), c1, RTMP_HANDSHAKE_SIZE);
 	assert(n == 1 + RTMP_HANDSHAKE_SIZE + RTMP_HANDSHAKE_SIZE);
-    r = this->Send(this->handshake, n);
+    r = this->Send(s0, n);
 	return n == r ? 0 : r;      // 返回0是正常
 }
 
@@ -478,7 +814,7 @@ int RtmpConn::rtmp_server_send_handshake()
 int RtmpConn::rtmp_server_send_set_chunk_size()
 {
 	int n, r;
-	n = rtmp_set_chunk_size(this->payload, sizeof(this->payload), RTMP_OUTPUT_CHUNK_SIZE);
+	n = rtmp_set_chunk_size(this->payload, RTMP_PAYLOAD_SIZE, RTMP_OUTPUT_CHUNK_SIZE);
 	r =this->Send(this->payload, n);
 	this->rtmp.out_chunk_size = RTMP_OUTPUT_CHUNK_SIZE;
 	return n == r ? 0 : r;
@@ -491,7 +827,7 @@ int RtmpConn::rtmp_server_send_acknowledgement(size_t size)
 	this->recv_bytes[0] += (uint32_t)size;
 	if (this->rtmp.window_size && this->recv_bytes[0] - this->recv_bytes[1] > this->rtmp.window_size)
 	{
-		n = rtmp_acknowledgement(this->payload, sizeof(this->payload), this->recv_bytes[0]);
+		n = rtmp_acknowledgement(this->payload, RTMP_PAYLOAD_SIZE, this->recv_bytes[0]);
 		r = this->Send(this->payload, n);
 		this->recv_bytes[1] = this->recv_bytes[0];
 		return n == r ? 0 : r;
@@ -503,7 +839,7 @@ int RtmpConn::rtmp_server_send_acknowledgement(size_t size)
 int RtmpConn::rtmp_server_send_server_bandwidth()
 {
 	int n, r;
-	n = rtmp_window_acknowledgement_size(this->payload, sizeof(this->payload), this->rtmp.window_size);
+	n = rtmp_window_acknowledgement_size(this->payload, RTMP_PAYLOAD_SIZE, this->rtmp.window_size);
 	r = this->Send(this->payload, n);
 	return n == r ? 0 : r;
 }
@@ -512,7 +848,7 @@ int RtmpConn::rtmp_server_send_server_bandwidth()
 int RtmpConn::rtmp_server_send_client_bandwidth()
 {
 	int n, r;
-	n = rtmp_set_peer_bandwidth(this->payload, sizeof(this->payload), this->rtmp.peer_bandwidth, RTMP_BANDWIDTH_LIMIT_DYNAMIC);
+	n = rtmp_set_peer_bandwidth(this->payload, RTMP_PAYLOAD_SIZE, this->rtmp.peer_bandwidth, RTMP_BANDWIDTH_LIMIT_DYNAMIC);
 	r = this->Send(this->payload, n);
 	return n == r ? 0 : r;
 }
@@ -520,7 +856,7 @@ int RtmpConn::rtmp_server_send_client_bandwidth()
 int RtmpConn::rtmp_server_send_stream_is_record()
 {
 	int n, r;
-	n = rtmp_event_stream_is_record(this->payload, sizeof(this->payload), this->stream_id);
+	n = rtmp_event_stream_is_record(this->payload, RTMP_PAYLOAD_SIZE, this->stream_id);
 	r = this->Send(this->payload, n);
 	return n == r ? 0 : r;
 }
@@ -528,7 +864,15 @@ int RtmpConn::rtmp_server_send_stream_is_record()
 int RtmpConn::rtmp_server_send_stream_begin()
 {
 	int n, r;
-	n = rtmp_event_stream_begin(this->payload, sizeof(this->payload), this->stream_id);
+	n = rtmp_event_stream_begin(this->payload, RTMP_PAYLOAD_SIZE, this->stream_id);
+	r = this->Send(this->payload, n);
+	return n == r ? 0 : r;
+}
+
+int RtmpConn::rtmp_server_send_stream_eof()
+{
+	int n, r;
+	n = rtmp_event_stream_eof(this->payload, RTMP_PAYLOAD_SIZE, this->stream_id);
 	r = this->Send(this->payload, n);
 	return n == r ? 0 : r;
 }
@@ -538,7 +882,7 @@ int RtmpConn::rtmp_server_rtmp_sample_access()
 	int n;
 	struct rtmp_chunk_header_t header;
 	
-	n = (int)(rtmp_netstream_rtmpsampleaccess(this->payload, sizeof(this->payload)) - this->payload);
+	n = (int)(rtmp_netstream_rtmpsampleaccess(this->payload, RTMP_PAYLOAD_SIZE) - this->payload);
 
 	header.fmt = RTMP_CHUNK_TYPE_0; // disable compact header
 	header.cid = RTMP_CHANNEL_INVOKE;
@@ -556,22 +900,43 @@ void  rtmp_server_onabort(void *param, uint32_t chunk_stream_id)
 	// (void)(void)chunk_stream_id;
 //	this->handler.onerror(-1, "client abort");
 }
+// 多块的音视频消息直接重组到池里的帧缓冲区, 帧对象是堆上的FrameBufferPtr
+void* rtmp_server_onframe_alloc(void* param, uint8_t type, size_t bytes, uint8_t** payload)
+{
+	FrameBufferPtr frame = FramePool::Alloc(bytes);
+	if (!frame)
+		return NULL;
+	*payload = frame->GetData();
+	return new FrameBufferPtr(frame);
+}
+
+void rtmp_server_onframe_free(void* param, void* frame)
+{
+	delete (FrameBufferPtr*)frame;
+}
+
+// 多块消息引用重组好的帧缓冲区, 单块消息在接收缓冲区里, 拷贝一次
+static MediaPacketPtr rtmp_server_create_packet(RtmpConn *ctx, int type, const uint8_t* data, size_t bytes, uint32_t timestamp)
+{
+	if (ctx->rtmp.frame)
+		return MediaPacket::Create(type, *(FrameBufferPtr*)ctx->rtmp.frame, data, bytes, timestamp);
+	return MediaPacket::Create(type, data, bytes, timestamp);
+}
+
 // 第一个音频帧
 int rtmp_server_onaudio(void* param, const uint8_t* data, size_t bytes, uint32_t timestamp)
 {
     LogDebug("into, bytes: {}", bytes);
+    IngestStageTimer timer(INGEST_STAGE_DEMUX);
     RtmpConn *ctx = (RtmpConn*)param;
-	if(!ctx->audio_buf_) {
-		ctx->audio_buf_ = new TagBuffer;
-		ctx->audio_buf_->bytes = bytes;
-		ctx->audio_buf_->timestamp = timestamp;
-		ctx->audio_buf_->data = new uint8_t[bytes];
-		memcpy(ctx->audio_buf_->data, data, bytes);
-		LogInfo("get audio_specific_config, bytes: {}", bytes);
-	}
+	MediaPacketPtr pkt = rtmp_server_create_packet(ctx, FLV_TYPE_AUDIO, data, bytes, timestamp);
+	if (!pkt)
+		return -ENOMEM;
+	if (ctx->DeferIfAdmitting(pkt))
+		return 0;
 	// 先找到对应的source
 
-	LiveSource::handler(ctx->rtmp_source_.get(), FLV_TYPE_AUDIO, data, bytes, timestamp);
+	LiveSource::handler(ctx->rtmp_source_.get(), pkt);
 	// return this->handler.onaudio(data, bytes, timestamp);
     return 0;
 }
@@ -579,17 +944,15 @@ int rtmp_server_onaudio(void* param, const uint8_t* data, size_t bytes, uint32_t
 int rtmp_server_onvideo(void* param, const uint8_t* data, size_t bytes, uint32_t timestamp)
 {
     LogDebug("into, bytes: {}", bytes);
+    IngestStageTimer timer(INGEST_STAGE_DEMUX);
     RtmpConn *ctx = (RtmpConn*)param;
-	if(!ctx->video_buf_) {
-		ctx->video_buf_ = new TagBuffer;
-		ctx->video_buf_->bytes = bytes;
-		ctx->video_buf_->timestamp = timestamp;
-		ctx->video_buf_->data = new uint8_t[bytes];
-		memcpy(ctx->video_buf_->data, data, bytes);
-		LogInfo("get avc_decoder_configuration_record, bytes: {}", bytes);
-	}
+	MediaPacketPtr pkt = rtmp_server_create_packet(ctx, FLV_TYPE_VIDEO, data, bytes, timestamp);
+	if (!pkt)
+		return -ENOMEM;
+	if (ctx->DeferIfAdmitting(pkt))
+		return 0;
 
-	LiveSource::handler(ctx->rtmp_source_.get(), FLV_TYPE_VIDEO, data, bytes, timestamp);
+	LiveSource::handler(ctx->rtmp_source_.get(), pkt);
 	// return this->handler.onvideo(data, bytes, timestamp);
     return 0;
 }
@@ -597,61 +960,92 @@ int rtmp_server_onvideo(void* param, const uint8_t* data, size_t bytes, uint32_t
 int rtmp_server_onscript(void* param, const uint8_t* data, size_t bytes, uint32_t timestamp)
 {
     LogInfo("into");
+    IngestStageTimer timer(INGEST_STAGE_DEMUX);
     RtmpConn *ctx = (RtmpConn*)param;
-	if(!ctx->script_buf_) {
-		ctx->script_buf_ = new TagBuffer;
-		ctx->script_buf_->bytes = bytes;
-		ctx->script_buf_->timestamp = timestamp;
-		ctx->script_buf_->data = new uint8_t[bytes];
-		memcpy(ctx->script_buf_->data, data, bytes);
-		LogInfo("get script metadata, bytes: {}", bytes);
-	}
-	LiveSource::handler(ctx->rtmp_source_.get(), FLV_TYPE_SCRIPT, data, bytes, timestamp);
+	MediaPacketPtr pkt = rtmp_server_create_packet(ctx, FLV_TYPE_SCRIPT, data, bytes, timestamp);
+	if (!pkt)
+		return -ENOMEM;
+	if (ctx->DeferIfAdmitting(pkt))
+		return 0;
+	LiveSource::handler(ctx->rtmp_source_.get(), pkt);
 	// return this->handler.onscript(data, bytes, timestamp);
     return 0;
 }
 
-// 7.2.1.1. connect (p29)
-// _result/_error
-int  rtmp_server_onconnect(void* param, int r, double transaction, const struct rtmp_connect_t* connect)
+// 回复connect, 拒绝时回_error
+static int rtmp_server_connect_reply(RtmpConn *ctx, double transaction, int admit)
 {
-	int n;
-	assert((double)RTMP_ENCODING_AMF_0 == connect->encoding || (double)RTMP_ENCODING_AMF_3 == connect->encoding);
-    RtmpConn *ctx = (RtmpConn*)param;
-	if (0 == r)
+	int n, r;
+	if (0 != admit)
 	{
-		assert(1 == (int)transaction);
-		memcpy(&ctx->info, connect, sizeof(ctx->info));
-		r = ctx->rtmp_server_send_server_bandwidth();
-		r = 0 == r ? ctx->rtmp_server_send_client_bandwidth() : r;
-		r = 0 == r ? ctx->rtmp_server_send_set_chunk_size() : r;
+		// 不关闭的话客户端可以不理_error, 接着用被拒绝的app推拉流
+		LogWarn("connect rejected, app: {}, peer: {}, r = {}", ctx->admit_connect_.app, ctx->GetPeerIP(), admit);
+		n = (int)(rtmp_netconnection_error(ctx->payload, RTMP_PAYLOAD_SIZE, transaction,
+                "NetConnection.Connect.Rejected", RTMP_LEVEL_ERROR, "Connection rejected.") - ctx->payload);
+		r = rtmp_server_send_control(&ctx->rtmp, ctx->payload, n, 0);
+		ctx->Reject();
+		return r;
 	}
 
+	ctx->AcceptConnect();
+
+	r = ctx->rtmp_server_send_server_bandwidth();
+	r = 0 == r ? ctx->rtmp_server_send_client_bandwidth() : r;
+	r = 0 == r ? ctx->rtmp_server_send_set_chunk_size() : r;
 	if(0 == r)
 	{
-		n = (int)(rtmp_netconnection_connect_reply(ctx->payload, sizeof(ctx->payload), transaction, 
+		n = (int)(rtmp_netconnection_connect_reply(ctx->payload, RTMP_PAYLOAD_SIZE, transaction, 
                 RTMP_FMSVER, RTMP_CAPABILITIES, "NetConnection.Connect.Success", RTMP_LEVEL_STATUS, 
-                "Connection Succeeded.", connect->encoding) - ctx->payload);
+                "Connection Succeeded.", ctx->info.encoding) - ctx->payload);
 		r = rtmp_server_send_control(&ctx->rtmp, ctx->payload, n, 0);
 	}
 
 	return r;
 }
 
+// 7.2.1.1. connect (p29)
+// _result/_error
+int  rtmp_server_onconnect(void* param, int r, double transaction, const struct rtmp_connect_t* connect)
+{
+	assert((double)RTMP_ENCODING_AMF_0 == connect->encoding || (double)RTMP_ENCODING_AMF_3 == connect->encoding);
+    RtmpConn *ctx = (RtmpConn*)param;
+	struct rtmp_connect_t info = *connect;
+	if (ctx->DeferIfAdmitting([=]() { return rtmp_server_onconnect(param, r, transaction, &info); }))
+		return 0;
+
+	if (0 == r)
+	{
+		memcpy(&ctx->admit_connect_, connect, sizeof(ctx->admit_connect_));
+		if (ctx->IsConnected())
+		{
+			LogWarn("repeat connect, app: {}, peer: {}", connect->app, ctx->GetPeerIP());
+			return rtmp_server_connect_reply(ctx, transaction, -EEXIST);
+		}
+		r = ctx->Admit(RTMP_ADMIT_CONNECT, transaction);
+		if (RTMP_SERVER_ASYNC_START == r)
+			return 0;
+		r = rtmp_server_connect_reply(ctx, transaction, r);
+	}
+
+	return r;
+}
+
 // 7.2.1.3. createStream (p36)
 // _result/_error
 int rtmp_server_oncreate_stream(void* param, int r, double transaction)
 {
     RtmpConn *ctx = (RtmpConn*)param;
+	if (ctx->DeferIfAdmitting([=]() { return rtmp_server_oncreate_stream(param, r, transaction); }))
+		return 0;
 	if (0 == r)
 	{
 		ctx->stream_id = 1;
 		//r = this->handler.oncreate_stream(&this->stream_id);
 		if (0 == r)
-			r = (int)(rtmp_netconnection_create_stream_reply(ctx->payload, sizeof(ctx->payload),
+			r = (int)(rtmp_netconnection_create_stream_reply(ctx->payload, RTMP_PAYLOAD_SIZE,
                 transaction, ctx->stream_id) - ctx->payload);
 		else
-			r = (int)(rtmp_netconnection_error(ctx->payload, sizeof(ctx->payload), transaction, 
+			r = (int)(rtmp_netconnection_error(ctx->payload, RTMP_PAYLOAD_SIZE, transaction, 
                 "NetConnection.CreateStream.Failed", RTMP_LEVEL_ERROR, "createStream failed.") - ctx->payload);
 		r = rtmp_server_send_control(&ctx->rtmp, ctx->payload, r, 0/*this->stream_id*/); // must be 0
 	}
@@ -664,6 +1058,8 @@ int rtmp_server_oncreate_stream(void* param, int r, double transaction)
 int rtmp_server_ondelete_stream(void* param, int r, double transaction, double stream_id)
 {
     RtmpConn *ctx = (RtmpConn*)param;
+	if (ctx->DeferIfAdmitting([=]() { return rtmp_server_ondelete_stream(param, r, transaction, stream_id); }))
+		return 0;
 	if (0 == r)
 	{
 		stream_id = ctx->stream_id = 0; // clear stream id
@@ -674,23 +1070,59 @@ int rtmp_server_ondelete_stream(void* param, int r, double transaction, double s
 	return r;
 }
 
+static int rtmp_server_stream_length_reply(RtmpConn *ctx, double transaction, double duration)
+{
+	int r = (int)(rtmp_netconnection_get_stream_length_reply(ctx->payload, RTMP_PAYLOAD_SIZE, transaction, duration) - ctx->payload);
+	return rtmp_server_send_control(&ctx->rtmp, ctx->payload, r, ctx->stream_id);
+}
+
 int rtmp_server_onget_stream_length(void* param, int r, double transaction, const char* stream_name)
 {
 	double duration = -1;
     RtmpConn *ctx = (RtmpConn*)param; 
+	std::string name(stream_name ? stream_name : "");
+	if (ctx->DeferIfAdmitting([=]() { return rtmp_server_onget_stream_length(param, r, transaction, name.c_str()); }))
+		return 0;
 
 	if (0 == r )
     // && this->handler.ongetduration)
 	{
-		// get duration (seconds)
+		// get duration (seconds), 只有录制的文件有时长, 直播返回-1
+		std::string key(ctx->info.app);
+		key += "/";
+		key += stream_name ? stream_name : "";
+		std::string path;
+		if (0 == FlvRecordGetPath(key, &path))
+			return ctx->OpenVod(path, [ctx, transaction](const FlvVodFilePtr &file) {
+				return rtmp_server_stream_length_reply(ctx, transaction, file ? file->GetDuration() / 1000.0 : -1);
+			});
 		r = 0;// this->handler.ongetduration(this->info.app, stream_name, &duration);
 		if (0 == r)
-		{
-			r = (int)(rtmp_netconnection_get_stream_length_reply(ctx->payload, sizeof(ctx->payload), transaction, duration) - ctx->payload);
-			r = rtmp_server_send_control(&ctx->rtmp, ctx->payload, r, ctx->stream_id);
-		}
+			r = rtmp_server_stream_length_reply(ctx, transaction, duration);
+	}
+
+	return r;
+}
+
+// 回复publish并开始推流
+static int rtmp_server_publish_start(RtmpConn *ctx, int admit)
+{
+	std::string key(ctx->info.app);
+	key += "/";
+	key += ctx->stream_name;
+	int r = ctx->rtmp_server_start(admit, NULL);
+	if (0 != admit)
+	{
+		LogWarn("publish rejected, key: {}, peer: {}, r = {}", key, ctx->GetPeerIP(), admit);
+		return r;
 	}
 
+	ctx->rtmp_source_ = LiveSource::Publish(key, ctx);
+	if (!ctx->recorder_) {
+		ctx->recorder_ = FlvRecordCreate(key, ctx->stream_type);
+		if (ctx->recorder_)
+			ctx->rtmp_source_->add_player(ctx->recorder_);
+	}
 	return r;
 }
 
@@ -700,35 +1132,72 @@ int rtmp_server_onget_stream_length(void* param, int r, double transaction, cons
 int rtmp_server_onpublish(void* param, int r, double transaction, const char* stream_name, const char* stream_type)
 {
     RtmpConn *ctx = (RtmpConn*)param; 
-	std::string key(ctx->info.app);
-    key += "/";
-    key += stream_name;
-	LogWarn("into, key: {}, stream_type: {}", key, stream_type);
+	std::string name(stream_name ? stream_name : "");
+	std::string type(stream_type ? stream_type : "");
+	if (ctx->DeferIfAdmitting([=]() { return rtmp_server_onpublish(param, r, transaction, name.c_str(), type.c_str()); }))
+		return 0;
+
+	LogWarn("into, key: {}/{}, stream_type: {}", ctx->info.app, name, type);
 	if (0 == r)
 	{
 		ctx->start.play = RTMP_SERVER_ONPUBLISH;
 		ctx->start.transaction = transaction;
-		snprintf(ctx->stream_name, sizeof(ctx->stream_name) - 1, "%s", stream_name ? stream_name : "");
-		snprintf(ctx->stream_type, sizeof(ctx->stream_type) - 1, "%s", stream_type ? stream_type : "");
+		snprintf(ctx->stream_name, sizeof(ctx->stream_name) - 1, "%s", name.c_str());
+		snprintf(ctx->stream_type, sizeof(ctx->stream_type) - 1, "%s", type.c_str());
 
-		r = 0; // this->handler.onpublish(this->info.app, stream_name, stream_type);
+		r = ctx->IsConnected() ? ctx->Admit(RTMP_ADMIT_PUBLISH, transaction) : -EPERM;	// 没有connect不能推流
 		if (RTMP_SERVER_ASYNC_START == r || 0 == ctx->start.play)
 			return RTMP_SERVER_ASYNC_START == r ? 0 : r;
 
-		r = ctx->rtmp_server_start(r, NULL);
+		r = rtmp_server_publish_start(ctx, r);
+	}
+	return r;
+}
+
+static int rtmp_server_play_live(RtmpConn *ctx, const std::string &key)
+{
+	std::shared_ptr<RtmpConsumer> player(new RtmpConsumer(ctx));
+	ctx->consumer_ = player.get();		// 通过裸指针判断
+	size_t players = 0;
+	ctx->rtmp_source_ = LiveSource::Play(key, player, &players);	// 保留source
+	LogWarn("source app stream: {},  players: {}", key, players);
+	return 0;
+}
+
+// 回复play并开始拉流, 录制的文件走点播
+static int rtmp_server_play_start(RtmpConn *ctx, int admit)
+{
+	std::string key(ctx->info.app);
+	key += "/";
+	key += ctx->stream_name;
+	double start = ctx->start.begin;
+	int r = ctx->rtmp_server_start(admit, NULL);
+	if (0 != admit)
+	{
+		LogWarn("play rejected, key: {}, peer: {}, r = {}", key, ctx->GetPeerIP(), admit);
+		return r;
+	}
+
+	if (ctx->consumer_ || ctx->vod_)
+	{
+		LogError("source({}), rtmp conn({}) repeat join\n", key, (void *)ctx);
+		return  -1;
 	}
-	std::shared_ptr<LiveSource> source = nullptr;
-	auto it = s_lives.find(key);
-	if(it == s_lives.end()) {		// source没有找到
-    	std::shared_ptr<LiveSource> source(new LiveSource(ctx, key));
-			// assert();  // 之前的如果不删除会有这个问题
-		s_lives[key] = source;
-		ctx->rtmp_source_ = source;
-	} else {	// source还存在的情况下
-		ctx->rtmp_source_ = it->second;				// source已经创建过了
-		ctx->rtmp_source_->update_rtmp_conn(ctx);	// 将rtmp source的rtmp conn更新为当前连接
+
+	// start >= 0 播放录制的文件(单位和ffmpeg一样按毫秒), 文件不存在时按直播处理
+	std::string path;
+	if (start >= 0 && 0 == FlvRecordGetPath(key, &path))
+	{
+		int ret = ctx->OpenVod(path, [ctx, key, path, start](const FlvVodFilePtr &file) {
+			if (!file)
+				return rtmp_server_play_live(ctx, key);
+			LogInfo("vod play: {}, start: {}ms", path, start);
+			ctx->StartVod(file, (uint32_t)start);
+			return 0;
+		});
+		return 0 != r ? r : ret;
 	}
-    
+	rtmp_server_play_live(ctx, key);
 	return r;
 }
 
@@ -738,9 +1207,9 @@ int rtmp_server_onplay(void* param, int r, double transaction, const char* strea
 {
     RtmpConn *ctx = (RtmpConn*)param; 
 	// LogInfo("%s, %s, %f, %f, %d)\n", app, stream, start, duration, (int)reset);
-    std::string key(ctx->info.app);
-    key += "/";
-    key += stream_name;
+	std::string name(stream_name ? stream_name : "");
+	if (ctx->DeferIfAdmitting([=]() { return rtmp_server_onplay(param, r, transaction, name.c_str(), start, duration, reset); }))
+		return 0;
 
 	LogInfo("into");
 	if (0 == r)
@@ -748,45 +1217,16 @@ int rtmp_server_onplay(void* param, int r, double transaction, const char* strea
 		ctx->start.play = RTMP_SERVER_ONPLAY;
 		ctx->start.reset = reset;
 		ctx->start.transaction = transaction;
-		snprintf(ctx->stream_name, sizeof(ctx->stream_name) - 1, "%s", stream_name ? stream_name : "");
+		ctx->start.begin = start;
+		snprintf(ctx->stream_name, sizeof(ctx->stream_name) - 1, "%s", name.c_str());
 		snprintf(ctx->stream_type, sizeof(ctx->stream_type) - 1, "%s", -1 == start ? RTMP_STREAM_LIVE : RTMP_STREAM_RECORD);
 
-		r =  0; //this->handler.onplay(this->info.app, stream_name, start, duration, reset);
+		r = ctx->IsConnected() ? ctx->Admit(RTMP_ADMIT_PLAY, transaction) : -EPERM;	// 没有connect不能拉流
 		if (RTMP_SERVER_ASYNC_START == r || 0 == ctx->start.play)
 			return RTMP_SERVER_ASYNC_START == r ? 0 : r;
 
-		r = ctx->rtmp_server_start(r, NULL);
-	}
-
-	std::shared_ptr<class LiveSource> s;
-	auto it = s_lives.find(key);
-	if (it == s_lives.end())
-	{
-		LogWarn("source({}) not found, we create it and wait publisher\n", key);
-		std::shared_ptr<LiveSource> source(new LiveSource(ctx, key));
-	 	s = source;
-		s_lives[key] = s;
-	} else {
-		s = it->second;
-	}
-	for (auto j = s->players.begin(); j != s->players.end(); ++j)
-	{
-		if (j->get()->rtmp_ == ctx)
-		{
-			LogError("source({}), rtmp conn({}) repeat join\n", key, param );
-			return  -1;
-		}
+		r = rtmp_server_play_start(ctx, r);
 	}
-	std::shared_ptr<LiveConsumer> player(new LiveConsumer(ctx));
-	s->players.push_back(player);
-	LogWarn("source app stream: {},  players: {}", key, s->players.size());
-	//   LogInfo("rtmp_ conn 2:  {}",  (void *)player->rtmp_);
-	ctx->rtmp_source_ = s;			// 保留source
-	ctx->consumer_ = player.get();		// 通过裸指针判断
-	// 这里发？ 还是在收到新的audio、video再发？
-	// 发送metadata
-	// 发送 avc_decoder_configuration_record
-	// 发送 audio_specific_config
 	return r;
 }
 
@@ -796,9 +1236,13 @@ int rtmp_server_onplay(void* param, int r, double transaction, const char* strea
 int rtmp_server_onpause(void* param, int r, double transaction, uint8_t pause, double milliSeconds)
 {
     RtmpConn *ctx = (RtmpConn*)param; 
+	if (ctx->DeferIfAdmitting([=]() { return rtmp_server_onpause(param, r, transaction, pause, milliSeconds); }))
+		return 0;
 	if (0 == r)
 	{
 		// r = this->handler.onpause(pause, (uint32_t)milliSeconds);
+		if (ctx->vod_)
+			ctx->vod_->Pause(0 != pause, GetTickCount());
 		r = ctx->rtmp_server_send_onstatus(transaction, r, pause ? "NetStream.Pause.Notify" : "NetStream.Unpause.Notify", "NetStream.Pause.Failed", "");
 	}
 
@@ -811,10 +1255,14 @@ int rtmp_server_onpause(void* param, int r, double transaction, uint8_t pause, d
 int rtmp_server_onseek(void* param, int r, double transaction, double milliSeconds)
 {
     RtmpConn *ctx = (RtmpConn*)param; 
+	if (ctx->DeferIfAdmitting([=]() { return rtmp_server_onseek(param, r, transaction, milliSeconds); }))
+		return 0;
 	if (0 == r)
 	{
 		// r = this->handler.onseek((uint32_t)milliSeconds);
 		r = ctx->rtmp_server_send_onstatus(transaction, r, "NetStream.Seek.Notify", "NetStream.Seek.Failed", "");
+		if (ctx->vod_)
+			ctx->StartVod(nullptr, milliSeconds > 0 ? (uint32_t)milliSeconds : 0);
 	}
 
 	return r;
@@ -826,6 +1274,8 @@ int rtmp_server_onseek(void* param, int r, double transaction, double milliSecon
 int rtmp_server_onreceive_audio(void* param, int r, double transaction, uint8_t audio)
 {
     RtmpConn *ctx = (RtmpConn*)param; 
+	if (ctx->DeferIfAdmitting([=]() { return rtmp_server_onreceive_audio(param, r, transaction, audio); }))
+		return 0;
 	if(0 == r)
 	{
 		ctx->receiveAudio = audio;
@@ -842,6 +1292,8 @@ int rtmp_server_onreceive_audio(void* param, int r, double transaction, uint8_t
 int rtmp_server_onreceive_video(void* param, int r, double transaction, uint8_t video)
 {
     RtmpConn *ctx = (RtmpConn*)param; 
+	if (ctx->DeferIfAdmitting([=]() { return rtmp_server_onreceive_video(param, r, transaction, video); }))
+		return 0;
 	if(0 == r)
 	{
 		ctx->receiveVideo = video;
@@ -860,54 +1312,43 @@ int  rtmp_server_send(void* param, const uint8_t* header, uint32_t headerBytes,
 	
     RtmpConn *ctx = (RtmpConn *) param;
 	LogDebug("headerBytes: {}, payloadBytes: {}", headerBytes, payloadBytes);
-	int r;
-	r = ctx->Send((void*)header, headerBytes);
-    r = ctx->Send((void*)payload, payloadBytes);
+	struct iovec iov[2];
+	iov[0].iov_base = (void*)header;
+	iov[0].iov_len = headerBytes;
+	iov[1].iov_base = (void*)payload;
+	iov[1].iov_len = payloadBytes;
+	ctx->SendV(iov, 2);
 	return  0; //(r == (int)(payloadBytes + headerBytes)) ? 0 : -1;
 }
 
+// 一条消息的所有chunk一次发出
+int rtmp_server_sendv(void* param, const struct iovec* vec, int n)
+{
+    RtmpConn *ctx = (RtmpConn *) param;
+	ctx->SendV(vec, n);
+	return 0;
+}
+
 int rtmp_server_onclose(void* param)
 {
 	RtmpConn *ctx = (RtmpConn *) param;
 
-	if(ctx->consumer_) {
-		//如果是拉流play
-		for (auto j = ctx->rtmp_source_->players.begin(); j != ctx->rtmp_source_->players.end(); ++j)
-		{
-			if (j->get() == ctx->consumer_)
-			{
-				ctx->rtmp_source_->players.erase(j);
-				break;
-			}
-		}
-	} else { // 如果是推流
-		// 先分析当前player，如果当前source还有player则则不能释放source
-		if(ctx->rtmp_source_->players.size() > 0)  {
-			// 只释放链接
-			ctx->rtmp_source_->rtmp_conn_ = nullptr;	// 设置为空
-		} else {
-			for (auto j = s_lives.begin(); j != s_lives.end(); ++j)
-			{
-				if (j->second.get()  == ctx->rtmp_source_.get())
-				{
-					LogWarn("release rtmp source: {}\n", ctx->info.app);
-					s_lives.erase(j);	// 移除这个source
-				}
-			}
-		}
+	if(!ctx->rtmp_source_)
+		return 0;	// 还没有publish/play
+
+	if (ctx->recorder_) {
+		LiveSource::Leave(ctx->rtmp_source_, nullptr, ctx->recorder_.get());
+		ctx->recorder_->Close();	// IO线程写完剩下的数据后关闭文件
+		ctx->recorder_.reset();
 	}
+	LiveSource::Leave(ctx->rtmp_source_, ctx->consumer_ ? nullptr : ctx, ctx->consumer_);
+	return 0;
 }
 
 void RtmpConn::rtmp_server_destroy()
 {
-	size_t i;
-	assert(sizeof(this->rtmp.in_packets) == sizeof(this->rtmp.out_packets));
-	for (i = 0; i < N_CHUNK_STREAM; i++)
-	{
-		assert(NULL == this->rtmp.out_packets[i].payload);
-		if (this->rtmp.in_packets[i].payload)
-			free(this->rtmp.in_packets[i].payload);
-	}
+	rtmp_packet_table_free(&this->rtmp, &this->rtmp.in_packets);
+	rtmp_packet_table_free(&this->rtmp, &this->rtmp.out_packets);
 }
 
 int RtmpConn::rtmp_server_getstate()
@@ -932,6 +1373,9 @@ int RtmpConn::rtmp_server_input(const uint8_t* data, size_t bytes)
             LogDebug("RTMP_HANDSHAKE_UNINIT -> RTMP_HANDSHAKE_0");
 			this->handshake_state = RTMP_HANDSHAKE_0;
 			this->handshake_bytes = 0; // clear buffer
+			this->handshake = (uint8_t*)s_handshake_slab.Alloc();
+			if (NULL == this->handshake)
+				return -ENOMEM;
 			assert(*p <= RTMP_VERSION);
 			bytes -= 1;
 			p += 1;  // C0 和 S0 包由一个字节组成 , 所以这里跳过1字节
@@ -942,7 +1386,7 @@ int RtmpConn::rtmp_server_input(const uint8_t* data, size_t bytes)
 			assert(RTMP_HANDSHAKE_SIZE > this->handshake_bytes);
 			n = RTMP_HANDSHAKE_SIZE - this->handshake_bytes;
 			n = n <= bytes ? n : bytes;
-			memcpy(this->payload + this->handshake_bytes, p, n);    // 缓存握手数据
+			memcpy(this->handshake + this->handshake_bytes, p, n);    // 缓存握手数据
 			this->handshake_bytes += n;
 			bytes -= n;
 			p += n;
@@ -961,7 +1405,7 @@ int RtmpConn::rtmp_server_input(const uint8_t* data, size_t bytes)
 			assert(RTMP_HANDSHAKE_SIZE > this->handshake_bytes);
 			n = RTMP_HANDSHAKE_SIZE - this->handshake_bytes;
 			n = n <= bytes ? n : bytes;
-			memcpy(this->payload + this->handshake_bytes, p, n);
+			memcpy(this->handshake + this->handshake_bytes, p, n);
 			this->handshake_bytes += n;
 			bytes -= n;
 			p += n;
@@ -970,6 +1414,8 @@ int RtmpConn::rtmp_server_input(const uint8_t* data, size_t bytes)
 			{
 				this->handshake_state = RTMP_HANDSHAKE_2;   //握手已经成功
 				this->handshake_bytes = 0; // clear buffer
+				s_handshake_slab.Free(this->handshake);
+				this->handshake = NULL;
 			}
 			break;
 
@@ -1022,37 +1468,6 @@ int RtmpConn::rtmp_server_start( int r, const char* msg)
 	return r;
 }
 
-int RtmpConn::rtmp_server_check_send_audio_config() 
-{ 
-	if(rtmp_source_->rtmp_conn_->audio_buf_ && !is_send_audio_config_) {
-		rtmp_server_send_audio(rtmp_source_->rtmp_conn_->audio_buf_->data, 
-							rtmp_source_->rtmp_conn_->audio_buf_->bytes, 
-							rtmp_source_->rtmp_conn_->audio_buf_->timestamp);
-		is_send_audio_config_ = true;
-	}
-	return 0; 
-}
-
-int RtmpConn::rtmp_server_check_send_video_config() 
-{
-	if(rtmp_source_->rtmp_conn_->video_buf_ && !is_send_video_config_) {
-		rtmp_server_send_video(rtmp_source_->rtmp_conn_->video_buf_->data, 
-				rtmp_source_->rtmp_conn_->video_buf_->bytes, rtmp_source_->rtmp_conn_->video_buf_->timestamp);
-		is_send_video_config_ = true;
-	}
-	return 0;  
-}
-
-int RtmpConn::rtmp_server_check_send_script_metadata() 
-{
-	if(rtmp_source_->rtmp_conn_->script_buf_ && !is_send_script_metadata_) {
-		rtmp_server_send_script(rtmp_source_->rtmp_conn_->script_buf_->data,
-				 rtmp_source_->rtmp_conn_->script_buf_->bytes, rtmp_source_->rtmp_conn_->script_buf_->timestamp);
-		is_send_script_metadata_ = true;
-	}
-	return 0;  
-}
-
 int RtmpConn::rtmp_server_send_audio(const void* data, size_t bytes, uint32_t timestamp)
 {
 	struct rtmp_chunk_header_t header;
@@ -1099,3 +1514,182 @@ int RtmpConn::rtmp_server_send_script(const void* data, size_t bytes, uint32_t t
 
 	return rtmp_chunk_write(&this->rtmp, &header, (const uint8_t*)data);
 }
+
+// 同一帧按(chunk size, cid, stream id)只切块一次, 这里只把引用放进发送队列
+int RtmpConn::rtmp_server_send_packet(const MediaPacketPtr &pkt)
+{
+	switch (pkt->GetType())
+	{
+	case FLV_TYPE_AUDIO:
+		if (0 == this->receiveAudio)
+			return 0; // client don't want receive audio
+		break;
+	case FLV_TYPE_VIDEO:
+		if (0 == this->receiveVideo)
+			return 0; // client don't want receive video
+		break;
+	case FLV_TYPE_SCRIPT:
+		break;
+	default:
+		assert(0);
+		return -1;
+	}
+
+	if (!busy_ && play_queue_.Empty())
+		return _QueuePacket(pkt);
+
+	// socket发不动, 先排队, 超过上限时由play_queue_丢帧
+	play_queue_.Push(pkt);
+	_StartLagTimer();
+	CheckLag();
+	return 0;
+}
+
+// socket发不动时开始计时; 推流端停了或者只剩稀疏的音频时没有新帧触发检查, 由定时器兜底
+void RtmpConn::_StartLagTimer()
+{
+	uint32_t max_lag_ms = play_queue_.GetConfig().max_lag_ms;
+	if (0 == max_lag_ms || lag_timer_ || (!consumer_ && !vod_))
+		return;
+	lag_timer_ = netlib_add_timer(rtmp_lag_timer, reinterpret_cast<void *>(conn_handle_), max_lag_ms + 1, 0);
+}
+
+void RtmpConn::OnLagTimer()
+{
+	lag_timer_ = NULL;
+	CheckLag();
+	if (busy_ && !lag_closing_)
+		_StartLagTimer();	// 时钟取整差一点没到, 接着等
+}
+
+void RtmpConn::CheckLag()
+{
+	uint32_t max_lag_ms = play_queue_.GetConfig().max_lag_ms;
+	if (0 == max_lag_ms || !busy_ || lag_closing_ || GetTickCount() - busy_tick_ <= max_lag_ms)
+		return;
+	// 可能在LiveSource持锁期间被调用, 不能直接Close, 投递到本loop稍后关闭
+	LogWarn("handle = {}, player lag too long, queue {} frames, {} bytes, close it",
+			conn_handle_, play_queue_.GetSize(), play_queue_.GetBytes());
+	lag_closing_ = true;
+	PostClose();
+}
+
+// file为空时是seek, 沿用之前打开的文件
+void RtmpConn::StartVod(const FlvVodFilePtr &file, uint32_t start_ms)
+{
+	if (file)
+		vod_ = std::make_shared<FlvVodSession>(file);
+	vod_->Seek(start_ms, GetTickCount());
+	if (!vod_timer_)
+		vod_timer_ = netlib_add_timer(rtmp_vod_timer, reinterpret_cast<void *>(conn_handle_), FLV_VOD_TICK_MS,
+									  FLV_VOD_TICK_MS);
+	OnVodTimer();
+}
+
+void RtmpConn::OnVodTimer()
+{
+	// 上一批还没发完时不读文件, 慢的观众不会在内存里积压
+	if (!vod_ || busy_ || !play_queue_.Empty())
+		return;
+
+	std::vector<MediaPacketPtr> packets;
+	vod_->Read(GetTickCount(), FLV_VOD_BATCH_BYTES, &packets);
+	for (size_t i = 0; i < packets.size(); i++)
+		rtmp_server_send_packet(packets[i]);
+
+	// 播完了停掉定时器, 之后seek会重新启动
+	if (vod_->IsEnd() && vod_timer_) {
+		LogInfo("vod end, handle = {}", conn_handle_);
+		rtmp_server_send_stream_eof();
+		rtmp_server_send_onstatus(0, 0, "NetStream.Play.Stop", "NetStream.Play.Failed", "Stopped playing");
+		netlib_cancel_timer(vod_timer_);
+		vod_timer_ = NULL;
+	}
+}
+
+// 线程池里打开点播文件建索引, 和鉴权一样结果投递回连接所在的loop; 排队超时没有执行时按打不开处理
+struct RtmpVodOpenTask
+{
+	uint32_t conn_uuid;
+	std::string path;
+	std::function<int(const FlvVodFilePtr &)> done;
+
+	void operator()()
+	{
+		Complete(FlvVodFile::Open(path));
+	}
+
+	void expire()
+	{
+		LogWarn("vod open timeout, conn_uuid: {}, path: {}", conn_uuid, path);
+		Complete(nullptr);
+	}
+
+	void Complete(const FlvVodFilePtr &file)
+	{
+		uint32_t uuid = conn_uuid;
+		std::function<int(const FlvVodFilePtr &)> cb(std::move(done));
+		netlib_post(uuid >> RTMP_UUID_LOOP_SHIFT, [uuid, file, cb]() {
+			RtmpConn *pConn = GetRtmpConnByUuid(uuid);	// 期间连接可能已经关闭
+			if (pConn)
+				pConn->OnVodOpened(file, cb);
+		});
+	}
+};
+
+int RtmpConn::OpenVod(const std::string &path, std::function<int(const FlvVodFilePtr &)> &&done)
+{
+	FlvVodFilePtr file;
+	if (FlvVodFile::Find(path, &file) < 0 || file)
+		return done(file);
+
+	// 建索引要读整个文件, 放到线程池里, 结果投递回本loop
+	RtmpVodOpenTask task;
+	task.conn_uuid = uuid_;
+	task.path = path;
+	task.done = std::move(done);
+	vod_opening_ = true;
+	s_rtmp_thread_pool.post(RTMP_VOD_OPEN_TIMEOUT_MS, std::move(task));
+	return 0;
+}
+
+void RtmpConn::OnVodOpened(const FlvVodFilePtr &file, const std::function<int(const FlvVodFilePtr &)> &done)
+{
+	if (!vod_opening_ || state_ == CONN_STATE_CLOSED)
+		return;
+	vod_opening_ = false;
+	int ret = done(file);
+	if (0 != ret)
+		LogError("vod open done, ret = {}", ret);
+	RunDeferred();
+}
+
+// 切块后发送或者放进send_queue_
+int RtmpConn::_QueuePacket(const MediaPacketPtr &pkt)
+{
+	struct rtmp_chunk_header_t header;
+	switch (pkt->GetType())
+	{
+	case FLV_TYPE_AUDIO:
+		header.cid = RTMP_CHANNEL_AUDIO;
+		header.type = RTMP_TYPE_AUDIO;
+		break;
+	case FLV_TYPE_VIDEO:
+		header.cid = RTMP_CHANNEL_VIDEO;
+		header.type = RTMP_TYPE_VIDEO;
+		break;
+	default:
+		header.cid = RTMP_CHANNEL_INVOKE;
+		header.type = RTMP_TYPE_DATA;
+		break;
+	}
+
+	header.fmt = RTMP_CHUNK_TYPE_0;
+	header.timestamp = pkt->GetTimestamp();
+	header.length = (uint32_t)pkt->GetSize();
+	header.stream_id = this->stream_id;
+	if (0 != rtmp_chunk_header_update(&this->rtmp, &header))
+		return -1;
+
+	return SendShared(pkt->GetChunked(this->rtmp.out_chunk_size, header.cid, header.stream_id));
+}
@@ -4,6 +4,8 @@
 #include <iostream>
 #include "util/util.h"
 #include "util/util_pdu.h"
+#include "util/util_buffer.h"
+#include "util/util_slab.h"
 #include "util/dlog.h"
 #include "protocol/rtmp_handshake.h"
 
@@ -20,52 +22,70 @@
 #include "protocol/rtmp_control_message.h"
 #include "protocol/rtmp_event.h"
 
+#include "app/app_media_packet.h"
+#include "app/app_gop_cache.h"
+#include "app/app_player_queue.h"
+#include "app/app_live_source.h"
+#include "app/app_flv_recorder.h"
+#include "app/app_flv_vod.h"
+
 #include <list>
+#include <deque>
 #include <mutex>
 #include <memory>
+#include <functional>
 
 
 
 using namespace longkit;
-class LiveSource;
-class LiveConsumer;
 // 具体的RMTP连接，推流拉流都在此
-typedef struct {
-    uint32_t conn_uuid; // 用于查找connection
-    string resp_data;   // 要回发的数据
-} ResponsePdu_t;
 
 #define RTMP_FMSVER				"FMS/3,0,1,123"
 #define RTMP_CAPABILITIES		31
 #define RTMP_OUTPUT_CHUNK_SIZE	4096
 #define RTMP_SERVER_ASYNC_START 0x12345678 // magic number, user call rtmp_server_start
+#define RTMP_PAYLOAD_SIZE		(2 * 1024)
+#define RTMP_HANDSHAKE_BUF_SIZE	(3 * RTMP_HANDSHAKE_SIZE + 1)	// c1/c2 + s0s1s2
+#define RTMP_CONN_SLAB_OBJS		64	// 每个slab的连接数
+#define RTMP_HANDSHAKE_SLAB_OBJS	16
+#define RTMP_ADMIT_TIMEOUT_MS	5000	// 鉴权在线程池里排队超过这个时间直接拒绝
+#define RTMP_VOD_OPEN_TIMEOUT_MS	5000	// 点播文件建索引在线程池里排队超过这个时间按打不开处理
+#define RTMP_ADMIT_MAX_PENDING	1024	// 鉴权返回前排队的命令和音视频消息, 超过之后音视频丢到下一个关键帧
 
 enum { RTMP_SERVER_ONPLAY = 1, RTMP_SERVER_ONPUBLISH = 2};
+enum { RTMP_ADMIT_CONNECT = 1, RTMP_ADMIT_PUBLISH, RTMP_ADMIT_PLAY };
 
+// 交给鉴权回调的请求, 都是拷贝, 回调在线程池里执行时连接可能已经关闭
+struct RtmpAdmission
+{
+	int type;					// RTMP_ADMIT_XXX
+	uint32_t conn_uuid;
+	std::string peer_ip;
+	std::string app;
+	std::string tc_url;
+	std::string stream_name;	// publish/play
+	std::string stream_type;	// publish: live/record/append, play: live/record
+};
 
-typedef struct {
-	uint8_t *data;
-	uint32_t bytes;
-	uint32_t timestamp;
-}TagBuffer;
+// 返回0允许, 其他拒绝; 在线程池里调用, 可以阻塞(查库, 调webhook)
+typedef std::function<int(const RtmpAdmission &admission)> RtmpAdmitHandler;
 
 class RtmpConn : public CRefObject 
 {
 public:
     /* data */
-	TagBuffer *audio_buf_ = nullptr;
-	bool is_send_audio_config_ = false;
-	TagBuffer *video_buf_ = nullptr;
-	bool is_send_video_config_ = false;
-	TagBuffer *script_buf_  = nullptr;
-	bool is_send_script_metadata_ = false;
-	
 public:
     RtmpConn(/* args */);
     virtual ~RtmpConn();
+
+    // 连接对象从所在loop的slab分配, 在Close里释放, 也在同一个loop
+    static void *operator new(size_t size);
+    static void operator delete(void *ptr, size_t size);
     uint32_t GetConnHandle() { return conn_handle_; }
     char *GetPeerIP() { return (char *)peer_ip_.c_str(); }
     int Send(void *data, int len);
+    int SendV(const struct iovec *iov, int iovcnt);   // 多段数据一次writev
+    int SendShared(const SendBufferPtr &buf);   // 共享数据只入队引用, 不拷贝
     void Close();
     virtual void OnConnect(net_handle_t handle);
     virtual void OnRead();
@@ -73,8 +93,7 @@ public:
     virtual void OnClose();
 
     static void AddResponseData(uint32_t conn_uuid,
-                                string &resp_data); // 工作线程调用
-    static void SendResponseDataList();             // 主线程调用
+                                string &resp_data); // 工作线程调用, 投递到连接所在的loop发送
 
 public:
 	int rtmp_server_send_onstatus(double transaction, int r, const char* success, const char* fail, const char* description);
@@ -85,32 +104,64 @@ public:
 	int rtmp_server_send_client_bandwidth();
 	int rtmp_server_send_stream_is_record();
 	int rtmp_server_send_stream_begin();
+	int rtmp_server_send_stream_eof();
 	int rtmp_server_rtmp_sample_access();
 	void rtmp_server_destroy();
 	int rtmp_server_getstate();
 	int rtmp_server_input(const uint8_t* data, size_t bytes);
 	int rtmp_server_start( int r, const char* msg);
-	int rtmp_server_check_send_audio_config();
-	int rtmp_server_check_send_video_config();
-	int rtmp_server_check_send_script_metadata();
 	int rtmp_server_send_audio(const void* data, size_t bytes, uint32_t timestamp);
 	int rtmp_server_send_video(const void* data, size_t bytes, uint32_t timestamp);
 	int rtmp_server_send_script(const void* data, size_t bytes, uint32_t timestamp);
+	int rtmp_server_send_packet(const MediaPacketPtr &pkt);	// 拉流端发送一帧, 发不动时进play_queue_
+
+	// 点播: 从start_ms开始按时间戳发送文件里的tag, 由定时器驱动, socket发不动时暂停读文件
+	void StartVod(const FlvVodFilePtr &file, uint32_t start_ms);
+	void OnVodTimer();
+	// 打开录制的文件, 缓存里有时直接调done; 否则在线程池里建索引, 期间的消息和鉴权时一样排队
+	int OpenVod(const std::string &path, std::function<int(const FlvVodFilePtr &)> &&done);
+	void OnVodOpened(const FlvVodFilePtr &file, const std::function<int(const FlvVodFilePtr &)> &done);
+
+	// 设置了鉴权回调时提交到线程池并返回RTMP_SERVER_ASYNC_START, 否则返回0
+	int Admit(int type, double transaction);
+	// 鉴权结果投递回本loop之后调用, 然后按顺序执行期间排队的消息
+	void OnAdmitDone(int type, double transaction, int r);
+	// 鉴权返回之前收到的命令排队, 返回true表示已经排队, connect被拒绝之后直接丢掉
+	bool DeferIfAdmitting(std::function<int()> &&cmd);
+	// 音视频和命令一起排队, 排满之后丢到下一个关键帧; 返回true表示已经排队或者丢掉
+	bool DeferIfAdmitting(const MediaPacketPtr &pkt);
+	// 鉴权或者打开点播文件返回后, 按顺序执行排队的消息
+	void RunDeferred();
+	// connect被拒绝: 不再处理任何消息, _error发完之后关闭
+	void Reject();
+	// connect通过之后才把请求复制到info
+	void AcceptConnect() { memcpy(&info, &admit_connect_, sizeof(info)); connected_ = true; }
+	bool IsConnected() const { return connected_; }
+
+	// 拉流端socket持续发不动超过max_lag_ms时投递关闭, 新帧入队和发不动期间的定时器都会检查
+	void CheckLag();
+	void OnLagTimer();
+
+	const PlayerQueue &GetPlayQueue() const { return play_queue_; }
 
 	std::shared_ptr<LiveSource> rtmp_source_ = nullptr;
 	LiveConsumer *consumer_ = nullptr;
+	FlvRecorderPtr recorder_;	// publish类型为record/append时录制, 和拉流端一样挂在source上
+	FlvVodSessionPtr vod_;		// 点播时的播放位置, 不经过LiveSource
+	timer_handle_t vod_timer_ = NULL;
 	struct rtmp_t  rtmp;
 	uint32_t recv_bytes[2]; // for rtmp_acknowledgement
 
 	void* param;
 	// struct rtmp_server_handler_t handler;
 
-	uint8_t payload[2 * 1024];
-	uint8_t handshake[2 * RTMP_HANDSHAKE_SIZE + 1]; // only for handshake
+	uint8_t *payload; // 构造控制消息的临时空间(RTMP_PAYLOAD_SIZE), 同一个loop的连接共用
+	uint8_t *handshake; // only for handshake, 从loop的池里分配, 握手完成后还回去
 	size_t handshake_bytes;
 	int handshake_state; // RTMP_HANDSHAKE_XXX
 
 	struct rtmp_connect_t info; // Server application name, e.g.: testapp
+	struct rtmp_connect_t admit_connect_;	// 鉴权中的connect请求, 通过之后才复制到info
 	char stream_name[256]; // Play/Publishing stream name, flv:sample, mp3:sample, H.264/AAC: mp4:sample.m4v
 	char stream_type[18]; // Publishing type: live/record/append
 	uint32_t stream_id; // createStream/deleteStream
@@ -123,9 +174,17 @@ public:
 		double transaction;
 		int reset;
 		int play; // RTMP_SERVER_ONPLAY/RTMP_SERVER_ONPUBLISH
+		double begin; // play的start参数, -1直播, >=0点播(毫秒)
 	} start;
 
  protected:
+    bool _ParseInput();
+    int _QueuePacket(const MediaPacketPtr &pkt);
+    void PostClose();
+    void _StartLagTimer();
+    // 鉴权和打开点播文件不会同时进行: 一个进行中时play命令排队, 另一个不会开始
+    bool _IsDeferring() const { return admitting_ || vod_opening_; }
+
     net_handle_t m_sock_handle;
     uint32_t conn_handle_;
     bool busy_;
@@ -133,20 +192,40 @@ public:
     uint32_t state_;
     std::string peer_ip_;
     uint16_t peer_port_;
-    CSimpleBuffer in_buf_;
-    CSimpleBuffer out_buf_;
+    CSegmentBuffer in_buf_;
+    std::deque<SendBufferPtr> send_queue_;  // 待发送数据, 按顺序发送
+    uint32_t send_offset_ = 0;              // 队首已经发送的字节数
+    PlayerQueue play_queue_;                // 拉流端还没有切块的帧, 可以丢帧, 排在send_queue_之后
+    uint64_t busy_tick_ = 0;                // socket开始发不动的时间, 一直到全部发完
+    bool lag_closing_ = false;              // 落后太久, 已经投递了关闭
+    timer_handle_t lag_timer_ = NULL;       // 发不动之后max_lag_ms触发, 发完就取消
+    bool admitting_ = false;                // 鉴权还没返回
+    bool vod_opening_ = false;              // 点播文件的索引还没建好, 和鉴权一样让后面的消息排队
+    std::deque<std::function<int()> > admit_pending_;  // 鉴权或者建索引期间收到的消息, 按收到的顺序
+    bool admit_dropping_ = false;           // 排满之后丢音视频, 等到关键帧才恢复
+    bool admit_has_video_ = false;          // 收到过视频, 只有音频时音频帧就是恢复点
+    bool connected_ = false;                // connect已经通过
+    bool rejected_ = false;                 // connect被拒绝, 正在关闭
 
     uint64_t last_send_tick_;
     uint64_t last_recv_tick_;
 
   
  
-    uint32_t uuid_;                  // 自己的uuid
-
-    static std::mutex s_resp_mutex;
-    static std::list<ResponsePdu_t *> s_response_pdu_list; // 主线程发送回复消息
+    uint32_t uuid_;                  // 自己的uuid, 高8位是所在的loop
 };
 
 int RtmpInitListen(std::string listen_ip, uint16_t listen_port, uint32_t thread_num);
 
+// connect/publish/play先在线程池里鉴权, 慢的鉴权不会卡住loop上的其他连接; 在RtmpInitListen之前调用
+void RtmpSetAdmitHandler(const RtmpAdmitHandler &handler, uint32_t timeout_ms = RTMP_ADMIT_TIMEOUT_MS);
+
+// GOP缓存配置, 对之后新建的source生效
+void RtmpSetGopCacheConfig(const GopCacheConfig &config);
+// 所有source的GOP缓存占用的内存
+size_t RtmpGetGopCacheBytes();
+
+// 拉流端发送队列配置, 对之后新建的连接生效
+void RtmpSetPlayerQueueConfig(const PlayerQueueConfig &config);
+
 #endif
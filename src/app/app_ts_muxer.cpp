@@ -0,0 +1,307 @@
+#include "app_ts_muxer.h"
+#include "util/dlog.h"
+
+#include <string.h>
+
+#define TS_STREAM_TYPE_AVC  0x1B
+#define TS_STREAM_TYPE_AAC  0x0F    // ADTS
+#define PES_STREAM_VIDEO    0xE0
+#define PES_STREAM_AUDIO    0xC0
+#define TS_CLOCK_PER_MS     90
+#define TS_PCR_DELAY        (300 * TS_CLOCK_PER_MS)  // PCR比DTS早一点, 给解码器留缓冲
+#define ADTS_HEADER_SIZE    7
+
+static const uint8_t s_aud[] = { 0, 0, 0, 1, 0x09, 0xF0 };
+static const uint8_t s_start_code[] = { 0, 0, 0, 1 };
+
+// CRC32/MPEG-2: 多项式0x04C11DB7, 不反转, 只用在很短的PAT/PMT上, 按位算就够了
+static uint32_t crc32_mpeg2(const uint8_t *data, size_t bytes)
+{
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < bytes; i++) {
+        crc ^= (uint32_t)data[i] << 24;
+        for (int j = 0; j < 8; j++)
+            crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04C11DB7 : crc << 1;
+    }
+    return crc;
+}
+
+static void write_timestamp(uint8_t *p, uint8_t prefix, uint64_t ts)
+{
+    p[0] = (uint8_t)((prefix << 4) | (((ts >> 30) & 0x07) << 1) | 1);
+    p[1] = (uint8_t)(ts >> 22);
+    p[2] = (uint8_t)((((ts >> 15) & 0x7F) << 1) | 1);
+    p[3] = (uint8_t)(ts >> 7);
+    p[4] = (uint8_t)(((ts & 0x7F) << 1) | 1);
+}
+
+TsMuxer::TsMuxer()
+    : nalu_length_size_(4), aac_object_type_(0), aac_sample_rate_index_(0), aac_channels_(0),
+      cc_video_(0), cc_audio_(0), cc_pat_(0), cc_pmt_(0)
+{
+}
+
+// FrameType|CodecID, AVCPacketType, CompositionTime(3), AVCDecoderConfigurationRecord
+int TsMuxer::SetVideoConfig(const uint8_t *data, size_t bytes)
+{
+    if (bytes < 11 || FLV_VIDEO_CODEC_AVC != (data[0] & 0x0F)) {
+        LogWarn("ts muxer only supports avc video, codec: {}", bytes > 0 ? data[0] & 0x0F : 0);
+        return -1;
+    }
+
+    const uint8_t *p = data + 5;
+    const uint8_t *end = data + bytes;
+    nalu_length_size_ = (p[4] & 0x03) + 1;
+    sps_.clear();
+    pps_.clear();
+    p += 5;
+    for (int k = 0; k < 2; k++) {
+        if (p >= end)
+            return -1;
+        int num = 0 == k ? (*p++ & 0x1F) : *p++;
+        for (int i = 0; i < num; i++) {
+            if (p + 2 > end)
+                return -1;
+            size_t len = (p[0] << 8) | p[1];
+            p += 2;
+            if (p + len > end)
+                return -1;
+            (0 == k ? sps_ : pps_).push_back(std::string((const char *)p, len));
+            p += len;
+        }
+    }
+    return sps_.empty() ? -1 : 0;
+}
+
+// SoundFormat|..., AACPacketType, AudioSpecificConfig
+int TsMuxer::SetAudioConfig(const uint8_t *data, size_t bytes)
+{
+    if (bytes < 4 || FLV_AUDIO_AAC != (data[0] >> 4)) {
+        LogWarn("ts muxer only supports aac audio, format: {}", bytes > 0 ? data[0] >> 4 : 0);
+        return -1;
+    }
+    aac_object_type_ = data[2] >> 3;
+    aac_sample_rate_index_ = ((data[2] & 0x07) << 1) | (data[3] >> 7);
+    aac_channels_ = (data[3] >> 3) & 0x0F;
+    return 0 == aac_object_type_ ? -1 : 0;
+}
+
+void TsMuxer::WriteHeader(std::string *out)
+{
+    uint8_t section[64];
+
+    // PAT: 只有一个节目
+    uint8_t *p = section;
+    *p++ = 0x00;                        // table_id
+    *p++ = 0xB0;                        // section_syntax_indicator, section_length在后面补
+    *p++ = 0;
+    *p++ = 0x00; *p++ = 0x01;           // transport_stream_id
+    *p++ = 0xC1;                        // version 0, current_next_indicator
+    *p++ = 0; *p++ = 0;                 // section_number, last_section_number
+    *p++ = 0x00; *p++ = 0x01;           // program_number
+    *p++ = 0xE0 | (TS_PID_PMT >> 8); *p++ = TS_PID_PMT & 0xFF;
+    section[2] = (uint8_t)(p - section + 4 - 3);
+    uint32_t crc = crc32_mpeg2(section, p - section);
+    *p++ = crc >> 24; *p++ = crc >> 16; *p++ = crc >> 8; *p++ = crc;
+    _WriteSection(0, section, p - section, out);
+
+    // PMT: 有视频时PCR在视频上
+    uint16_t pcr_pid = HasVideo() ? TS_PID_VIDEO : TS_PID_AUDIO;
+    p = section;
+    *p++ = 0x02;
+    *p++ = 0xB0;
+    *p++ = 0;
+    *p++ = 0x00; *p++ = 0x01;           // program_number
+    *p++ = 0xC1;
+    *p++ = 0; *p++ = 0;
+    *p++ = 0xE0 | (pcr_pid >> 8); *p++ = pcr_pid & 0xFF;
+    *p++ = 0xF0; *p++ = 0x00;           // program_info_length
+    if (HasVideo()) {
+        *p++ = TS_STREAM_TYPE_AVC;
+        *p++ = 0xE0 | (TS_PID_VIDEO >> 8); *p++ = TS_PID_VIDEO & 0xFF;
+        *p++ = 0xF0; *p++ = 0x00;
+    }
+    if (HasAudio()) {
+        *p++ = TS_STREAM_TYPE_AAC;
+        *p++ = 0xE0 | (TS_PID_AUDIO >> 8); *p++ = TS_PID_AUDIO & 0xFF;
+        *p++ = 0xF0; *p++ = 0x00;
+    }
+    section[2] = (uint8_t)(p - section + 4 - 3);
+    crc = crc32_mpeg2(section, p - section);
+    *p++ = crc >> 24; *p++ = crc >> 16; *p++ = crc >> 8; *p++ = crc;
+    _WriteSection(TS_PID_PMT, section, p - section, out);
+}
+
+void TsMuxer::_WriteSection(uint16_t pid, const uint8_t *section, size_t bytes, std::string *out)
+{
+    uint8_t pkt[TS_PACKET_SIZE];
+    uint8_t &cc = 0 == pid ? cc_pat_ : cc_pmt_;
+    memset(pkt, 0xFF, sizeof(pkt));
+    pkt[0] = 0x47;
+    pkt[1] = 0x40 | (pid >> 8);
+    pkt[2] = pid & 0xFF;
+    pkt[3] = 0x10 | (cc++ & 0x0F);
+    pkt[4] = 0;                         // pointer_field
+    memcpy(pkt + 5, section, bytes);
+    out->append((const char *)pkt, sizeof(pkt));
+}
+
+int TsMuxer::WritePacket(const MediaPacket &pkt, std::string *out)
+{
+    if (FLV_TYPE_VIDEO == pkt.GetType())
+        return _WriteVideo(pkt, out);
+    if (FLV_TYPE_AUDIO == pkt.GetType())
+        return _WriteAudio(pkt, out);
+    return 0;   // metadata不进TS
+}
+
+// 长度前缀的NALU转成Annex B, 前面加AUD, 关键帧再加SPS/PPS
+int TsMuxer::_WriteVideo(const MediaPacket &pkt, std::string *out)
+{
+    const uint8_t *data = pkt.GetData();
+    size_t bytes = pkt.GetSize();
+    if (!HasVideo() || bytes < 5 || FLV_VIDEO_CODEC_AVC != (data[0] & 0x0F) || 1 != data[1])
+        return -1;
+
+    int32_t cts = (data[2] << 16) | (data[3] << 8) | data[4];
+    if (cts & 0x800000)
+        cts |= 0xFF000000;      // 有符号24位
+    uint64_t dts = (uint64_t)pkt.GetTimestamp() * TS_CLOCK_PER_MS;
+    uint64_t pts = dts + (int64_t)cts * TS_CLOCK_PER_MS;
+
+    uint8_t header[19];
+    header[0] = 0; header[1] = 0; header[2] = 1;
+    header[3] = PES_STREAM_VIDEO;
+    header[4] = 0; header[5] = 0;       // 视频PES_packet_length填0, 表示不限
+    header[6] = 0x80;
+    header[7] = 0xC0;                   // PTS和DTS
+    header[8] = 10;
+    write_timestamp(header + 9, 3, pts);
+    write_timestamp(header + 14, 1, dts);
+
+    pes_.clear();
+    pes_.append((const char *)header, sizeof(header));
+    pes_.append((const char *)s_aud, sizeof(s_aud));
+    if (pkt.IsKeyFrame()) {
+        for (size_t i = 0; i < sps_.size(); i++) {
+            pes_.append((const char *)s_start_code, sizeof(s_start_code));
+            pes_.append(sps_[i]);
+        }
+        for (size_t i = 0; i < pps_.size(); i++) {
+            pes_.append((const char *)s_start_code, sizeof(s_start_code));
+            pes_.append(pps_[i]);
+        }
+    }
+
+    size_t pos = 5;
+    while (pos + nalu_length_size_ <= bytes) {
+        size_t len = 0;
+        for (uint8_t i = 0; i < nalu_length_size_; i++)
+            len = (len << 8) | data[pos + i];
+        pos += nalu_length_size_;
+        if (len > bytes - pos)
+            return -1;
+        if (len > 0 && 9 != (data[pos] & 0x1F)) {    // 自己已经加了AUD
+            pes_.append((const char *)s_start_code, sizeof(s_start_code));
+            pes_.append((const char *)data + pos, len);
+        }
+        pos += len;
+    }
+
+    _WritePes(TS_PID_VIDEO, true, pkt.IsKeyFrame(), dts > TS_PCR_DELAY ? dts - TS_PCR_DELAY : 0, out);
+    return 0;
+}
+
+// 每个AAC帧加ADTS头
+int TsMuxer::_WriteAudio(const MediaPacket &pkt, std::string *out)
+{
+    const uint8_t *data = pkt.GetData();
+    size_t bytes = pkt.GetSize();
+    if (!HasAudio() || bytes < 3 || FLV_AUDIO_AAC != (data[0] >> 4) || 1 != data[1])
+        return -1;
+
+    uint64_t pts = (uint64_t)pkt.GetTimestamp() * TS_CLOCK_PER_MS;
+    size_t frame_len = ADTS_HEADER_SIZE + bytes - 2;
+    size_t pes_len = 3 + 5 + frame_len;
+
+    uint8_t header[14 + ADTS_HEADER_SIZE];
+    header[0] = 0; header[1] = 0; header[2] = 1;
+    header[3] = PES_STREAM_AUDIO;
+    header[4] = (uint8_t)(pes_len >> 8);
+    header[5] = (uint8_t)pes_len;
+    header[6] = 0x80;
+    header[7] = 0x80;                   // 只有PTS
+    header[8] = 5;
+    write_timestamp(header + 9, 2, pts);
+
+    uint8_t *adts = header + 14;
+    uint8_t profile = aac_object_type_ - 1;
+    adts[0] = 0xFF;
+    adts[1] = 0xF1;                     // MPEG-4, 没有CRC
+    adts[2] = (uint8_t)((profile << 6) | (aac_sample_rate_index_ << 2) | (aac_channels_ >> 2));
+    adts[3] = (uint8_t)(((aac_channels_ & 0x03) << 6) | (frame_len >> 11));
+    adts[4] = (uint8_t)(frame_len >> 3);
+    adts[5] = (uint8_t)(((frame_len & 0x07) << 5) | 0x1F);
+    adts[6] = 0xFC;
+
+    pes_.clear();
+    pes_.append((const char *)header, sizeof(header));
+    pes_.append((const char *)data + 2, bytes - 2);
+    _WritePes(TS_PID_AUDIO, !HasVideo(), false, pts, out);
+    return 0;
+}
+
+// PES切成188字节的TS包, 第一个包可能带PCR, 最后一个包用adaptation field填充
+void TsMuxer::_WritePes(uint16_t pid, bool with_pcr, bool random_access, uint64_t pcr, std::string *out)
+{
+    uint8_t &cc = TS_PID_VIDEO == pid ? cc_video_ : cc_audio_;
+    size_t pos = 0;
+    bool first = true;
+    while (pos < pes_.size()) {
+        uint8_t pkt[TS_PACKET_SIZE];
+        size_t remain = pes_.size() - pos;
+
+        bool has_fields = first && (with_pcr || random_access);
+        size_t af_body = has_fields ? 1 + (with_pcr ? 6 : 0) : 0;   // adaptation_field_length之后的字节
+        size_t af_total = has_fields ? 1 + af_body : 0;
+        size_t payload = TS_PACKET_SIZE - 4 - af_total;
+        if (remain < payload) {
+            size_t stuff = payload - remain;
+            if (0 == af_total) {
+                af_total = stuff;
+                af_body = stuff - 1;    // stuff为1时只有长度字节
+            } else {
+                af_total += stuff;
+                af_body += stuff;
+            }
+            payload = remain;
+        }
+
+        pkt[0] = 0x47;
+        pkt[1] = (uint8_t)((first ? 0x40 : 0) | (pid >> 8));
+        pkt[2] = pid & 0xFF;
+        pkt[3] = (uint8_t)((af_total ? 0x30 : 0x10) | (cc++ & 0x0F));
+        uint8_t *p = pkt + 4;
+        if (af_total) {
+            uint8_t *af_end = p + af_total;
+            *p++ = (uint8_t)af_body;
+            if (af_body) {
+                *p++ = (uint8_t)((has_fields && random_access ? 0x40 : 0) | (has_fields && with_pcr ? 0x10 : 0));
+                if (has_fields && with_pcr) {
+                    *p++ = (uint8_t)(pcr >> 25);
+                    *p++ = (uint8_t)(pcr >> 17);
+                    *p++ = (uint8_t)(pcr >> 9);
+                    *p++ = (uint8_t)(pcr >> 1);
+                    *p++ = (uint8_t)(((pcr & 1) << 7) | 0x7E);
+                    *p++ = 0;
+                }
+                memset(p, 0xFF, af_end - p);
+            }
+            p = af_end;
+        }
+        memcpy(p, pes_.data() + pos, payload);
+        out->append((const char *)pkt, sizeof(pkt));
+        pos += payload;
+        first = false;
+    }
+}
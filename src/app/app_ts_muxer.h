@@ -0,0 +1,68 @@
+/**
+ * MPEG-TS打包: FLV的AVC视频和AAC音频转成TS, 给HLS分片用
+ * 只在一个线程使用, 不加锁
+ */
+#ifndef APP_TS_MUXER_H
+#define APP_TS_MUXER_H
+
+#include "app/app_media_packet.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#define TS_PACKET_SIZE      188
+#define TS_PID_PMT          0x1000
+#define TS_PID_VIDEO        0x0100
+#define TS_PID_AUDIO        0x0101
+
+class TsMuxer
+{
+public:
+    TsMuxer();
+    ~TsMuxer() {}
+
+    /**
+     * @brief 解析sequence header(FLV tag body), 之后的帧才能打包
+     *
+     * @return 0成功, 不支持的编码返回-1
+     */
+    int SetVideoConfig(const uint8_t *data, size_t bytes);
+    int SetAudioConfig(const uint8_t *data, size_t bytes);
+    bool HasVideo() const { return !sps_.empty(); }
+    bool HasAudio() const { return aac_object_type_ != 0; }
+
+    // PAT和PMT, 每个分片开头写一次
+    void WriteHeader(std::string *out);
+
+    /**
+     * @brief 打包一帧, 追加到out
+     *
+     * @return 0成功, 还没有对应的sequence header或者数据不完整时返回-1
+     */
+    int WritePacket(const MediaPacket &pkt, std::string *out);
+
+private:
+    int _WriteVideo(const MediaPacket &pkt, std::string *out);
+    int _WriteAudio(const MediaPacket &pkt, std::string *out);
+    void _WritePes(uint16_t pid, bool with_pcr, bool random_access, uint64_t pcr, std::string *out);
+    void _WriteSection(uint16_t pid, const uint8_t *section, size_t bytes, std::string *out);
+
+private:
+    // AVC
+    std::vector<std::string> sps_;
+    std::vector<std::string> pps_;
+    uint8_t nalu_length_size_;
+    // AAC
+    uint8_t aac_object_type_;
+    uint8_t aac_sample_rate_index_;
+    uint8_t aac_channels_;
+
+    uint8_t cc_video_;          // 各PID的continuity_counter
+    uint8_t cc_audio_;
+    uint8_t cc_pat_;
+    uint8_t cc_pmt_;
+    std::string pes_;           // 正在打包的PES, 复用内存
+};
+
+#endif
@@ -17,42 +17,49 @@
 #include "base_socket.h"
 #include "event_dispatch.h"
 #include "util/dlog.h"
+#include <atomic>
+#include <poll.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+#define ACCEPT_RETRY_MS 100     // fd用完时过一会儿再accept
 
-#include <map>
-#include <utility>
-using std::map;
-using std::make_pair;
-typedef std::unordered_map<net_handle_t, CBaseSocket *> SocketMap;
-SocketMap g_socket_map;
+enum {
+    ACCEPT_ADMIT,
+    ACCEPT_DEFER,
+    ACCEPT_REJECT
+};
 
-// 添加一个基础套接字到全局映射中
+static NetlibAcceptConfig s_accept_config = {
+    NETLIB_DEFAULT_BACKLOG, NETLIB_DEFAULT_ACCEPT_BUDGET, 0, 0, NETLIB_DEFAULT_MAX_DEFER_MS
+};
+static std::atomic<uint64_t> s_accepted(0);
+static std::atomic<uint64_t> s_deferred(0);
+static std::atomic<uint64_t> s_rejected(0);
+
+// 添加一个基础套接字到所属loop的映射中
 // 参数:
 // - pSocket: 指向要添加的CBaseSocket对象的指针
 void AddBaseSocket(CBaseSocket *pSocket) {
-    g_socket_map.insert(make_pair((net_handle_t)pSocket->GetSocket(), pSocket));
+    pSocket->GetDispatch()->AddSocket(pSocket);
 }
 
-// 从全局映射中移除一个基础套接字
+// 从所属loop的映射中移除一个基础套接字
 // 参数:
 // - pSocket: 指向要移除的CBaseSocket象的指针
 void RemoveBaseSocket(CBaseSocket *pSocket) {
-    g_socket_map.erase((net_handle_t)pSocket->GetSocket());
+    pSocket->GetDispatch()->RemoveSocket(pSocket);
 }
 
 // 根据文件描述符查找对应的基础套接字
+// 句柄只属于创建它的loop, 所以只在当前线程所在loop里查找
 // 参数:
 // - fd: 要查找的套接字文件描述符
 // 返回值:
 // - 如果找到，返回对应的CBaseSocket指针；否则返回NULL
 CBaseSocket *FindBaseSocket(net_handle_t fd) {
-    CBaseSocket *pSocket = NULL;
-    SocketMap::iterator iter = g_socket_map.find(fd);
-    if (iter != g_socket_map.end()) {
-        pSocket = iter->second;
-        pSocket->AddRef();
-    }
-
-    return pSocket;
+    return CEventDispatch::Instance()->FindSocket(fd);
 }
 
 //////////////////////////////
@@ -62,11 +69,35 @@ CBaseSocket::CBaseSocket(): CRefObject(0) {
     // printf("CBaseSocket::CBaseSocket\n");
     socket_ = INVALID_SOCKET;
     state_ = SOCKET_STATE_IDLE;
+    reuse_port_ = false;
+    dispatch_ = CEventDispatch::Instance();
+    tokens_ = 0;
+    token_rate_ = 0;
+    token_burst_ = 0;
+    token_tick_ = 0;
+    defer_tick_ = 0;
+    accept_timer_ = NULL;
+#ifdef NETLIB_HAVE_URING
+    uring_ = NULL;
+#endif
+}
+
+void CBaseSocket::SetAcceptConfig(const NetlibAcceptConfig &config) {
+    s_accept_config = config;
+}
+
+void CBaseSocket::GetAcceptStats(NetlibAcceptStats *stats) {
+    stats->accepted = s_accepted;
+    stats->deferred = s_deferred;
+    stats->rejected = s_rejected;
 }
 
 // CBaseSocket类的析构函数
 CBaseSocket::~CBaseSocket() {
     // printf("CBaseSocket::~CBaseSocket, socket=%d\n", m_socket);
+#ifdef NETLIB_HAVE_URING
+    delete uring_;
+#endif
 }
 
 // 监听指定IP和端口
@@ -96,6 +127,9 @@ int CBaseSocket::Listen(const char *server_ip, uint16_t port,
 
     // 设置地址重用和非阻塞模式
     _SetReuseAddr(socket_);
+    if (reuse_port_) {
+        _SetReusePort(socket_);
+    }
     _SetNonblock(socket_);
 
     // 绑定地址和端口
@@ -110,7 +144,7 @@ int CBaseSocket::Listen(const char *server_ip, uint16_t port,
     }
 
     // 开始监听
-    ret = listen(socket_, 64);
+    ret = listen(socket_, s_accept_config.backlog > 0 ? s_accept_config.backlog : NETLIB_DEFAULT_BACKLOG);
     if (ret == SOCKET_ERROR) {
         LogError("listen failed, err_code={}, server_ip={}, port={}, error: {}", 
                  _GetErrorCode(), server_ip, port, strerror(errno));
@@ -121,12 +155,24 @@ int CBaseSocket::Listen(const char *server_ip, uint16_t port,
     // 设置套接字状态为监听中
     state_ = SOCKET_STATE_LISTENING;
 
+    // 用SO_REUSEPORT时每个loop一个监听socket, 平分令牌
+    if (s_accept_config.rate > 0) {
+        uint32_t share = reuse_port_ ? CEventDispatch::GetInstanceNum() : 1;
+        token_rate_ = (double)s_accept_config.rate / share / 1000;
+        token_burst_ = (double)(s_accept_config.burst ? s_accept_config.burst : s_accept_config.rate) / share;
+        if (token_burst_ < 1) {
+            token_burst_ = 1;
+        }
+        tokens_ = token_burst_;
+        token_tick_ = GetTickCount();
+    }
+
     printf("CBaseSocket::Listen 正在监听 %s:%d\n", server_ip, port);
 
     // 将套接字添加到全局映射中
     AddBaseSocket(this);
     // 添加读取和异常事件到事件分发器
-    CEventDispatch::Instance()->AddEvent(socket_, SOCKET_READ | SOCKET_EXCEP);
+    dispatch_->AddEvent(socket_, SOCKET_READ | SOCKET_EXCEP);
     return NETLIB_OK;
 }
 
@@ -167,7 +213,7 @@ net_handle_t CBaseSocket::Connect(const char *server_ip, uint16_t port,
     }
     state_ = SOCKET_STATE_CONNECTING;
     AddBaseSocket(this);
-    CEventDispatch::Instance()->AddEvent(socket_, SOCKET_ALL);
+    dispatch_->AddEvent(socket_, SOCKET_ALL);
 
     return (net_handle_t)socket_;
 }
@@ -182,12 +228,18 @@ int CBaseSocket::Send(void *buf, int len) {
     if (state_ != SOCKET_STATE_CONNECTED)
         return NETLIB_ERROR;
 
+#ifdef NETLIB_HAVE_URING
+    if (uring_) {
+        struct iovec iov = { buf, (size_t)len };
+        return _UringSendV(&iov, 1);
+    }
+#endif
     int ret = send(socket_, (char *)buf, len, 0);
     if (ret == SOCKET_ERROR) {
         int err_code = _GetErrorCode();
         if (_IsBlock(err_code)) {
 #if ((defined _WIN32) || (defined __APPLE__))
-            CEventDispatch::Instance()->AddEvent(socket_, SOCKET_WRITE);
+            dispatch_->AddEvent(socket_, SOCKET_WRITE);
 #endif
             ret = 0;
             // printf("socket send block fd=%d", m_socket);
@@ -199,6 +251,92 @@ int CBaseSocket::Send(void *buf, int len) {
     return ret;
 }
 
+// 聚合发送, 一次writev发出多段数据, 超过IOV_MAX时分批
+// 参数:
+// - iov: 数据段数组
+// - iovcnt: 数据段个数
+// 返回值:
+// - 成功发送的字节数(遇到EAGAIN时可能只发送了一部分)，失败返回NETLIB_ERROR
+int CBaseSocket::SendV(const struct iovec *iov, int iovcnt) {
+    if (state_ != SOCKET_STATE_CONNECTED)
+        return NETLIB_ERROR;
+
+#ifdef NETLIB_HAVE_URING
+    if (uring_) {
+        return _UringSendV(iov, iovcnt);
+    }
+#endif
+    int total = 0;
+    while (iovcnt > 0) {
+        int n = iovcnt < IOV_MAX ? iovcnt : IOV_MAX;
+        size_t expect = 0;
+        for (int i = 0; i < n; i++) {
+            expect += iov[i].iov_len;
+        }
+
+        ssize_t ret = writev(socket_, iov, n);
+        if (ret == SOCKET_ERROR) {
+            int err_code = _GetErrorCode();
+            if (_IsBlock(err_code)) {
+                break;
+            }
+            printf("writev failed, err_code=%d, iovcnt=%d", err_code, n);
+            return total > 0 ? total : NETLIB_ERROR;
+        }
+
+        total += (int)ret;
+        if ((size_t)ret < expect) {
+            break; // 发送缓冲区满了
+        }
+        iov += n;
+        iovcnt -= n;
+    }
+
+    return total;
+}
+
+// 发送文件的一段
+// 参数:
+// - fd: 文件
+// - offset: 文件偏移
+// - count: 最多发送的字节数
+// 返回值:
+// - 发出的字节数, 文件读完返回0, 发送缓冲区满返回NETLIB_AGAIN, 出错返回NETLIB_ERROR
+int CBaseSocket::SendFile(int fd, uint64_t offset, size_t count) {
+    if (state_ != SOCKET_STATE_CONNECTED)
+        return NETLIB_ERROR;
+    if (count > SOCKET_SENDFILE_MAX)
+        count = SOCKET_SENDFILE_MAX;
+
+#ifdef NETLIB_HAVE_URING
+    if (uring_) {
+        return _UringSendFile(fd, offset, count);
+    }
+#endif
+#ifdef __linux__
+    off_t off = (off_t)offset;
+    ssize_t ret = sendfile(socket_, fd, &off, count);
+#else
+    // 没有sendfile的平台读到栈上再发
+    char buf[16 * 1024];
+    ssize_t ret = pread(fd, buf, count < sizeof(buf) ? count : sizeof(buf), (off_t)offset);
+    if (ret > 0)
+        ret = send(socket_, buf, ret, 0);
+#endif
+    if (ret == SOCKET_ERROR) {
+        int err_code = _GetErrorCode();
+        if (_IsBlock(err_code)) {
+#if ((defined _WIN32) || (defined __APPLE__))
+            dispatch_->AddEvent(socket_, SOCKET_WRITE);
+#endif
+            return NETLIB_AGAIN;
+        }
+        printf("sendfile failed, err_code=%d, count=%zu", err_code, count);
+        return NETLIB_ERROR;
+    }
+    return (int)ret;
+}
+
 // 接收数据
 // 参数:
 // - buf: 接收数据的缓冲区
@@ -206,43 +344,84 @@ int CBaseSocket::Send(void *buf, int len) {
 // 返回值:
 // - 实际接收的字节数
 int CBaseSocket::Recv(void *buf, int len) {
-    return recv(socket_, (char *)buf, len, 0);
+#ifdef NETLIB_HAVE_URING
+    if (uring_) {
+        struct iovec iov = { buf, (size_t)len };
+        return _UringRecvV(&iov, 1);
+    }
+#endif
+    int ret = recv(socket_, (char *)buf, len, 0);
+    if (ret == SOCKET_ERROR && _IsBlock(_GetErrorCode())) {
+        return NETLIB_AGAIN;
+    }
+    return ret;
+}
+
+// 分散接收, 一次readv填满多段缓冲区
+// 参数:
+// - iov: 缓冲区数组
+// - iovcnt: 缓冲区个数
+// 返回值:
+// - 实际接收的字节数
+int CBaseSocket::RecvV(const struct iovec *iov, int iovcnt) {
+#ifdef NETLIB_HAVE_URING
+    if (uring_) {
+        return _UringRecvV(iov, iovcnt);
+    }
+#endif
+    int ret = readv(socket_, iov, iovcnt < IOV_MAX ? iovcnt : IOV_MAX);
+    if (ret == SOCKET_ERROR && _IsBlock(_GetErrorCode())) {
+        return NETLIB_AGAIN;
+    }
+    return ret;
 }
 
 // 关闭套接字连接
 // 返回值:
 // - 总是返回0
 int CBaseSocket::Close() {
-    CEventDispatch::Instance()->RemoveEvent(socket_, SOCKET_ALL);
+    if (accept_timer_) {
+        dispatch_->StopTimer(accept_timer_);
+        accept_timer_ = NULL;
+    }
+#ifdef NETLIB_HAVE_URING
+    if (uring_) {
+        return _UringClose();
+    }
+#endif
+    dispatch_->RemoveEvent(socket_, SOCKET_ALL);
     RemoveBaseSocket(this);
     // printf("close socket fd:%d\n", socket_);
     closesocket(socket_);
+    socket_ = INVALID_SOCKET;   // 本轮事件里后面的回调据此判断已经关闭
     ReleaseRef();
 
     return 0;
 }
 
 // 处理可读事件
-void CBaseSocket::OnRead() {
+// 不再用FIONREAD判断关闭: 上层recv返回0就是对端关闭, 返回的字节数比缓冲区少说明已经读空
+// 参数:
+// - peer_closed: 对端已经关闭写, 上层读完数据后没有自己关闭时通知关闭
+void CBaseSocket::OnRead(bool peer_closed) {
     if (state_ == SOCKET_STATE_LISTENING) {
         _AcceptNewSocket();
-    } else {
-        u_long avail = 0;
-        int ret = ioctlsocket(socket_, FIONREAD, &avail);
-        if ((SOCKET_ERROR == ret) || (avail == 0)) {
-            callback_(callback_data_, NETLIB_MSG_CLOSE, (net_handle_t)socket_,
-                      NULL);
-        } else {
-            callback_(callback_data_, NETLIB_MSG_READ, (net_handle_t)socket_,
-                      NULL);
-        }
+        return;
+    }
+
+    callback_(callback_data_, NETLIB_MSG_READ, (net_handle_t)socket_, NULL);
+    if (peer_closed) {
+        OnClose();
     }
 }
 
 // 处理可写事件
 void CBaseSocket::OnWrite() {
+    if (socket_ == INVALID_SOCKET) {
+        return;     // 本轮的读回调里已经关闭
+    }
 #if ((defined _WIN32) || (defined __APPLE__))
-    CEventDispatch::Instance()->RemoveEvent(socket_, SOCKET_WRITE);
+    dispatch_->RemoveEvent(socket_, SOCKET_WRITE);
 #endif
 
     if (state_ == SOCKET_STATE_CONNECTING) {
@@ -270,6 +449,9 @@ void CBaseSocket::OnWrite() {
 
 // 处理关闭事件
 void CBaseSocket::OnClose() {
+    if (socket_ == INVALID_SOCKET) {
+        return;     // 已经关闭
+    }
     state_ = SOCKET_STATE_CLOSING;
     callback_(callback_data_, NETLIB_MSG_CLOSE, (net_handle_t)socket_, NULL);
 }
@@ -355,6 +537,22 @@ void CBaseSocket::_SetReuseAddr(SOCKET fd) {
     }
 }
 
+// 设置端口可重用, 每个loop各自监听同一端口, 由内核分配新连接
+// 参数:
+// - fd: 要设置的套接字文件描述符
+void CBaseSocket::_SetReusePort(SOCKET fd) {
+#ifdef SO_REUSEPORT
+    int reuse = 1;
+    int ret =
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, (char *)&reuse, sizeof(reuse));
+    if (ret == SOCKET_ERROR) {
+        printf("_SetReusePort failed, err_code=%d, fd=%d", _GetErrorCode(), fd);
+    }
+#else
+    UNUSED(fd);
+#endif
+}
+
 // 设置套接字为无延迟模式（禁用Nagle算法）
 // 参数:
 // - fd: 要设置的套接字文件描述符
@@ -389,37 +587,582 @@ void CBaseSocket::_SetAddr(const char *ip, const uint16_t port,
     }
 }
 
+// 令牌桶准入
+// 有令牌时接入; 没有令牌时先让连接留在backlog里, 等到有令牌时再accept;
+// backlog从开始推迟起一直没有清空超过max_defer_ms时, 没有令牌的连接accept后直接关闭,
+// 让客户端尽快重试别的节点
+// 参数:
+// - now: 当前时间(ms)
+// 返回值:
+// - ACCEPT_ADMIT/ACCEPT_DEFER/ACCEPT_REJECT
+int CBaseSocket::_Admit(uint64_t now) {
+    if (token_rate_ <= 0) {
+        return ACCEPT_ADMIT;
+    }
+
+    tokens_ += (now - token_tick_) * token_rate_;
+    if (tokens_ > token_burst_) {
+        tokens_ = token_burst_;
+    }
+    token_tick_ = now;
+    if (tokens_ >= 1) {
+        return ACCEPT_ADMIT;
+    }
+
+    if (defer_tick_ == 0) {
+        defer_tick_ = now;
+    }
+    if (now - defer_tick_ >= s_accept_config.max_defer_ms) {
+        return ACCEPT_REJECT;
+    }
+    s_deferred++;
+    _ScheduleAccept((uint64_t)((1 - tokens_) / token_rate_) + 1);
+    return ACCEPT_DEFER;
+}
+
+void CBaseSocket::_ScheduleAccept(uint64_t delay) {
+    if (accept_timer_) {
+        return;
+    }
+    accept_timer_ = dispatch_->StartTimer(_OnAcceptTimer, this, delay, 0);
+}
+
+void CBaseSocket::_OnAcceptTimer(void *callback_data, uint8_t msg, uint32_t handle, void *pParam) {
+    CBaseSocket *pSocket = (CBaseSocket *)callback_data;
+    pSocket->accept_timer_ = NULL;     // 只触发一次, 句柄已经失效
+    pSocket->_AcceptNewSocket();
+}
+
 // 接受新的连接
+// 监听socket是边沿触发, 没有接完(额度用完或者被推迟)时由定时器接着accept
 void CBaseSocket::_AcceptNewSocket() {
     SOCKET fd = 0;
     sockaddr_in peer_addr;
-    socklen_t addr_len = sizeof(sockaddr_in);
+    socklen_t addr_len;
+    uint32_t budget = s_accept_config.accept_budget ? s_accept_config.accept_budget : UINT32_MAX;
+    while (true) {
+        if (budget == 0) {
+            // 本轮额度用完, 先处理本轮其他连接的事件
+            _ScheduleAccept(0);
+            break;
+        }
+        int admit = _Admit(GetTickCount());
+        if (admit == ACCEPT_DEFER) {
+            break;
+        }
+
+        addr_len = sizeof(sockaddr_in);
+#ifdef __linux__
+        fd = accept4(socket_, (sockaddr *)&peer_addr, &addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+        fd = accept(socket_, (sockaddr *)&peer_addr, &addr_len);
+#endif
+        if (fd == INVALID_SOCKET) {
+            int err = _GetErrorCode();
+            if (err == EINTR || err == ECONNABORTED || err == EPROTO) {
+                continue;   // 这个连接没了, backlog里可能还有
+            }
+            if (_IsBlock(err)) {
+                defer_tick_ = 0;    // backlog清空了
+#ifdef NETLIB_HAVE_URING
+                if (uring_) {
+                    _UringArmAccept();  // 之后交给多次触发的accept
+                }
+#endif
+                break;
+            }
+            if (err == EMFILE || err == ENFILE || err == ENOBUFS || err == ENOMEM) {
+                LogWarn("accept failed, err_code={}, error: {}, retry after {}ms", err, strerror(err), ACCEPT_RETRY_MS);
+                _ScheduleAccept(ACCEPT_RETRY_MS);
+            }
+            break;
+        }
+        budget--;
+
+        if (admit == ACCEPT_REJECT) {
+            closesocket(fd);
+            s_rejected++;
+            continue;
+        }
+        if (token_rate_ > 0) {
+            tokens_ -= 1;
+        }
+        s_accepted++;
+        _OnAccepted(fd, peer_addr);
+    }
+}
+
+// 为新连接创建CBaseSocket, 注册到所属loop后回调NETLIB_MSG_CONNECT
+// 参数:
+// - fd: 已经是非阻塞的新连接(非Linux平台在这里设置)
+// - peer_addr: 对端地址
+void CBaseSocket::_OnAccepted(SOCKET fd, const sockaddr_in &peer_addr) {
     char ip_str[64];
-    while ((fd = accept(socket_, (sockaddr *)&peer_addr, &addr_len)) !=
-           INVALID_SOCKET) {
-        CBaseSocket *pSocket = new CBaseSocket();
-        uint32_t ip = ntohl(peer_addr.sin_addr.s_addr);
-        uint16_t port = ntohs(peer_addr.sin_port);
+    CBaseSocket *pSocket = new CBaseSocket();
+    uint32_t ip = ntohl(peer_addr.sin_addr.s_addr);
+    uint16_t port = ntohs(peer_addr.sin_port);
 
-        snprintf(ip_str, sizeof(ip_str), "%d.%d.%d.%d", ip >> 24,
-                 (ip >> 16) & 0xFF, (ip >> 8) & 0xFF, ip & 0xFF);
+    snprintf(ip_str, sizeof(ip_str), "%d.%d.%d.%d", ip >> 24,
+             (ip >> 16) & 0xFF, (ip >> 8) & 0xFF, ip & 0xFF);
 
-        // printf("AcceptNewSocket, socket=%d from %s:%d\n", fd, ip_str, port);
+    // printf("AcceptNewSocket, socket=%d from %s:%d\n", fd, ip_str, port);
 
-        pSocket->SetSocket(fd);
-        pSocket->SetCallback(callback_);
-        pSocket->SetCallbackData(callback_data_);
-        pSocket->SetState(SOCKET_STATE_CONNECTED);
-        pSocket->SetRemoteIP(ip_str);
-        pSocket->SetRemotePort(port);
+    pSocket->SetSocket(fd);
+    pSocket->SetCallback(callback_);
+    pSocket->SetCallbackData(callback_data_);
+    pSocket->SetState(SOCKET_STATE_CONNECTED);
+    pSocket->SetRemoteIP(ip_str);
+    pSocket->SetRemotePort(port);
 
-        _SetNoDelay(fd);
-        _SetNonblock(fd);
-        AddBaseSocket(pSocket);
-        CEventDispatch::Instance()->AddEvent(fd, SOCKET_READ | SOCKET_EXCEP);
-        callback_(callback_data_, NETLIB_MSG_CONNECT, (net_handle_t)fd, NULL);
+    _SetNoDelay(fd);
+#ifndef __linux__
+    _SetNonblock(fd);
+#endif
+
+    // 没有SO_REUSEPORT时只有一个监听socket, 新连接轮流交给各个loop
+    uint32_t loop_num = CEventDispatch::GetInstanceNum();
+    if (!reuse_port_ && loop_num > 1) {
+        static uint32_t s_next_loop = 0;
+        CEventDispatch *dispatch = CEventDispatch::Instance(s_next_loop++ % loop_num);
+        if (dispatch != dispatch_) {
+            pSocket->SetDispatch(dispatch);
+            callback_t callback = callback_;
+            void *callback_data = callback_data_;
+            dispatch->PostTask([pSocket, callback, callback_data]() {
+                AddBaseSocket(pSocket);
+                pSocket->GetDispatch()->AddEvent(pSocket->GetSocket(), SOCKET_READ | SOCKET_EXCEP);
+                callback(callback_data, NETLIB_MSG_CONNECT, (net_handle_t)pSocket->GetSocket(), NULL);
+            });
+            return;
+        }
+    }
+
+    AddBaseSocket(pSocket);
+    dispatch_->AddEvent(fd, SOCKET_READ | SOCKET_EXCEP);
+    callback_(callback_data_, NETLIB_MSG_CONNECT, (net_handle_t)fd, NULL);
+}
+
+#ifdef NETLIB_HAVE_URING
+
+UringState::UringState(SOCKET sock) {
+    fd = sock;
+    inflight = 0;
+    accept_armed = false;
+    recv_armed = false;
+    poll_armed = false;
+    send_inflight = false;
+    send_queued = false;
+    read_ready = false;
+    write_blocked = false;
+    eof = false;
+    closing = false;
+    error = 0;
+    send_offset = 0;
+    linger_timer = NULL;
+}
+
+void UringState::ClearOut() {
+    send_buf.clear();
+    send_offset = 0;
+    pending_buf.clear();
+}
+
+static inline uint64_t _UringData(CBaseSocket *pSocket, uint8_t op) {
+    return (uint64_t)(uintptr_t)pSocket | op;
+}
+
+// AddEvent时调用, 第一次调用时持有一个引用, 直到所有请求结束
+void CBaseSocket::UringAttach() {
+    if (!uring_) {
+        uring_ = new UringState(socket_);
+        AddRef();
+    }
+    if (state_ == SOCKET_STATE_LISTENING) {
+        _UringArmAccept();
+    } else if (state_ == SOCKET_STATE_CONNECTING) {
+        _UringArmPoll();
+    } else {
+        _UringArmRecv();
+    }
+}
+
+void CBaseSocket::_UringArmAccept() {
+    if (uring_->accept_armed || uring_->closing) {
+        return;
+    }
+    if (dispatch_->GetUring()->PrepAccept(uring_->fd, _UringData(this, URING_OP_ACCEPT))) {
+        uring_->accept_armed = true;
+        uring_->inflight++;
+    }
+}
+
+void CBaseSocket::_UringArmRecv() {
+    if (uring_->recv_armed || uring_->closing || uring_->eof || uring_->error) {
+        return;
+    }
+    if (dispatch_->GetUring()->PrepRecv(uring_->fd, _UringData(this, URING_OP_RECV))) {
+        uring_->recv_armed = true;
+        uring_->inflight++;
+    }
+}
+
+void CBaseSocket::_UringArmPoll() {
+    if (uring_->poll_armed) {
+        return;
+    }
+    if (dispatch_->GetUring()->PrepPollAdd(uring_->fd, POLLOUT, _UringData(this, URING_OP_POLL))) {
+        uring_->poll_armed = true;
+        uring_->inflight++;
+    }
+}
+
+void CBaseSocket::_UringQueueSend() {
+    if (!uring_->send_queued) {
+        uring_->send_queued = true;
+        dispatch_->UringQueueSend(this);
+    }
+}
+
+void CBaseSocket::_UringQueueRead() {
+    if (!uring_->read_ready && !uring_->closing) {
+        uring_->read_ready = true;
+        dispatch_->UringQueueRead(this);
+    }
+}
+
+// 把还没读走的接收缓冲区还给内核
+void CBaseSocket::_UringRecycle() {
+    CUringPoller *uring = dispatch_->GetUring();
+    while (!uring_->recv_bufs.empty()) {
+        uring->RecycleBuffer(uring_->recv_bufs.front().bid);
+        uring_->recv_bufs.pop_front();
+    }
+}
+
+// 拷贝进发送缓冲区, 本轮循环结束时和其他socket的发送一起提交
+// 缓冲区满了只收下一部分, 和非阻塞writev遇到EAGAIN一样, 调用者等NETLIB_MSG_WRITE
+int CBaseSocket::_UringSendV(const struct iovec *iov, int iovcnt) {
+    if (uring_->error) {
+        errno = uring_->error;
+        return NETLIB_ERROR;
+    }
+
+    uint32_t buffered = uring_->OutSize();
+    uint32_t room = buffered < URING_SEND_BUF_MAX ? URING_SEND_BUF_MAX - buffered : 0;
+    int total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        uint32_t n = iov[i].iov_len < room ? (uint32_t)iov[i].iov_len : room;
+        uring_->pending_buf.append((const char *)iov[i].iov_base, n);
+        total += n;
+        room -= n;
+        if (n < iov[i].iov_len) {
+            uring_->write_blocked = true;
+            break;
+        }
     }
+
+    if (total > 0) {
+        _UringQueueSend();
+    }
+    return total;
 }
 
+// io_uring模式下发送都要经过send_buf, 直接pread进pending_buf, 只多一次拷贝
+int CBaseSocket::_UringSendFile(int fd, uint64_t offset, size_t count) {
+    if (uring_->error) {
+        errno = uring_->error;
+        return NETLIB_ERROR;
+    }
 
+    uint32_t buffered = uring_->OutSize();
+    size_t room = buffered < URING_SEND_BUF_MAX ? URING_SEND_BUF_MAX - buffered : 0;
+    if (room == 0) {
+        uring_->write_blocked = true;
+        return NETLIB_AGAIN;
+    }
+    size_t n = count < room ? count : room;
+    size_t old_size = uring_->pending_buf.size();
+    uring_->pending_buf.resize(old_size + n);
+    ssize_t ret = pread(fd, &uring_->pending_buf[old_size], n, (off_t)offset);
+    uring_->pending_buf.resize(old_size + (ret > 0 ? ret : 0));
+    if (ret <= 0) {
+        return ret < 0 ? NETLIB_ERROR : 0;
+    }
+
+    if ((size_t)ret < count) {
+        uring_->write_blocked = true;
+    }
+    _UringQueueSend();
+    return (int)ret;
+}
+
+// 从内核填好的接收缓冲区拷贝出来, 读完的缓冲区马上还回去
+int CBaseSocket::_UringRecvV(const struct iovec *iov, int iovcnt) {
+    CUringPoller *uring = dispatch_->GetUring();
+    int total = 0;
+    int i = 0;
+    size_t iov_offset = 0;
+    while (!uring_->recv_bufs.empty() && i < iovcnt) {
+        UringRecvBuf &buf = uring_->recv_bufs.front();
+        size_t n = iov[i].iov_len - iov_offset;
+        if (n > buf.len) {
+            n = buf.len;
+        }
+        memcpy((uint8_t *)iov[i].iov_base + iov_offset, uring->GetBuffer(buf.bid) + buf.offset, n);
+        total += (int)n;
+        buf.offset += n;
+        buf.len -= n;
+        if (buf.len == 0) {
+            uring->RecycleBuffer(buf.bid);
+            uring_->recv_bufs.pop_front();
+        }
+        iov_offset += n;
+        if (iov_offset == iov[i].iov_len) {
+            i++;
+            iov_offset = 0;
+        }
+    }
+
+    if (total > 0) {
+        return total;
+    }
+    if (uring_->error) {
+        errno = uring_->error;
+        return NETLIB_ERROR;
+    }
+    return uring_->eof ? 0 : NETLIB_AGAIN;
+}
 
+// 取消accept/recv, 发送缓冲区里的数据继续发完(最多URING_LINGER_MS)再关闭fd
+int CBaseSocket::_UringClose() {
+    CUringPoller *uring = dispatch_->GetUring();
+    RemoveBaseSocket(this);
+    socket_ = INVALID_SOCKET;
+    uring_->closing = true;
+    _UringRecycle();
+
+    if (uring_->accept_armed) {
+        uring->PrepCancel(_UringData(this, URING_OP_ACCEPT));
+    }
+    if (uring_->recv_armed) {
+        uring->PrepCancel(_UringData(this, URING_OP_RECV));
+    }
+    if (state_ == SOCKET_STATE_CONNECTING && uring_->poll_armed) {
+        uring->PrepCancel(_UringData(this, URING_OP_POLL));
+    }
+    if (uring_->OutSize() > 0 && !uring_->error) {
+        uring_->linger_timer = dispatch_->StartTimer(_OnLingerTimer, this, URING_LINGER_MS, 0);
+    }
+
+    UringTryRelease();
+    ReleaseRef();
+    return 0;
+}
+
+// 对端一直不收, 放弃剩下的数据; shutdown让还在等的send/poll结束
+void CBaseSocket::_OnLingerTimer(void *callback_data, uint8_t msg, uint32_t handle, void *pParam) {
+    CBaseSocket *pSocket = (CBaseSocket *)callback_data;
+    UringState *state = pSocket->uring_;
+    state->linger_timer = NULL;
+    state->error = ETIMEDOUT;
+    state->ClearOut();
+    shutdown(state->fd, SHUT_RDWR);
+    pSocket->UringTryRelease();
+}
+
+void CBaseSocket::UringTryRelease() {
+    if (!uring_ || !uring_->closing || uring_->inflight > 0 || uring_->send_queued
+        || uring_->read_ready) {
+        return;
+    }
+    if (uring_->OutSize() > 0 && !uring_->error) {
+        return;
+    }
+
+    if (uring_->linger_timer) {
+        dispatch_->StopTimer(uring_->linger_timer);
+    }
+    _UringRecycle();
+    closesocket(uring_->fd);
+    delete uring_;
+    uring_ = NULL;
+    ReleaseRef();
+}
+
+// 多次触发的accept收到的连接, 准入规则和_AcceptNewSocket一样
+// 没有令牌时内核已经接了这个连接, 收下它(透支一个令牌), 停掉accept让后面的连接留在backlog里,
+// 定时器到了之后用_AcceptNewSocket把backlog接完, 再重新挂上
+void CBaseSocket::_UringAccept(SOCKET fd) {
+    int admit = _Admit(GetTickCount());
+    if (admit == ACCEPT_REJECT) {
+        closesocket(fd);
+        s_rejected++;
+        return;
+    }
+    if (admit == ACCEPT_DEFER && uring_->accept_armed) {
+        dispatch_->GetUring()->PrepCancel(_UringData(this, URING_OP_ACCEPT));
+    }
+
+    sockaddr_in peer_addr;
+    socklen_t addr_len = sizeof(peer_addr);
+    if (getpeername(fd, (sockaddr *)&peer_addr, &addr_len) != 0) {
+        closesocket(fd);    // 对端已经断开
+        return;
+    }
+    if (token_rate_ > 0) {
+        tokens_ -= 1;
+    }
+    s_accepted++;
+    _OnAccepted(fd, peer_addr);
+}
+
+// 完成事件, 回调放在最后: 回调里可能关闭socket并释放uring_
+void CBaseSocket::OnUringEvent(uint8_t op, int res, uint32_t flags) {
+    bool more = (flags & IORING_CQE_F_MORE) != 0;
+    switch (op) {
+    case URING_OP_ACCEPT:
+        if (!more) {
+            uring_->accept_armed = false;
+            uring_->inflight--;
+        }
+        if (res >= 0) {
+            if (uring_->closing) {
+                closesocket(res);
+                return;
+            }
+            if (!more && !accept_timer_) {
+                _UringArmAccept();
+            }
+            _UringAccept(res);
+        } else if (!uring_->closing && res != -ECANCELED) {
+            // fd用完等错误会结束多次触发的accept, 过一会儿用_AcceptNewSocket接着接
+            LogWarn("uring accept failed, error: {}, retry after {}ms", strerror(-res), ACCEPT_RETRY_MS);
+            _ScheduleAccept(ACCEPT_RETRY_MS);
+        } else if (!uring_->closing && !accept_timer_) {
+            _UringArmAccept();
+        }
+        break;
+
+    case URING_OP_RECV:
+        if (!more) {
+            uring_->recv_armed = false;
+            uring_->inflight--;
+        }
+        if (res > 0) {
+            uint16_t bid = flags >> IORING_CQE_BUFFER_SHIFT;
+            if (uring_->closing) {
+                dispatch_->GetUring()->RecycleBuffer(bid);
+                return;
+            }
+            uring_->recv_bufs.push_back({ bid, 0, (uint32_t)res });
+            if (!more) {
+                dispatch_->UringQueueRearm(this);
+            }
+            _UringQueueRead();
+        } else if (res == 0) {
+            uring_->eof = true;
+            _UringQueueRead();
+        } else if (res == -ENOBUFS) {
+            // 缓冲区暂时用完, 本轮回调读走之后再挂
+            if (!uring_->closing) {
+                dispatch_->UringQueueRearm(this);
+            }
+        } else if (res != -ECANCELED) {
+            uring_->error = -res;
+            _UringQueueRead();
+        }
+        break;
+
+    case URING_OP_SEND:
+        uring_->send_inflight = false;
+        uring_->inflight--;
+        if (res > 0) {
+            uring_->send_offset += res;
+            if (uring_->send_offset == uring_->send_buf.size()) {
+                uring_->send_offset = 0;
+                uring_->send_buf.clear();
+                if (uring_->send_buf.capacity() > URING_SEND_BUF_KEEP) {
+                    std::string().swap(uring_->send_buf);
+                }
+            }
+        } else if (res == -EAGAIN) {
+            _UringArmPoll();    // 发送缓冲区满了, 可写后再发
+            return;
+        } else if (res < 0) {
+            uring_->error = -res;
+            uring_->ClearOut();
+        }
+        if (uring_->error) {
+            OnClose();
+            return;
+        }
+        if (uring_->OutSize() > 0) {
+            _UringQueueSend();
+        }
+        if (uring_->write_blocked && !uring_->closing
+            && uring_->OutSize() <= URING_SEND_BUF_MAX / 2) {
+            uring_->write_blocked = false;
+            OnWrite();
+        }
+        break;
+
+    case URING_OP_POLL:
+        uring_->poll_armed = false;
+        uring_->inflight--;
+        if (state_ == SOCKET_STATE_CONNECTING) {
+            if (uring_->closing) {
+                return;
+            }
+            OnWrite();
+            if (uring_ && state_ == SOCKET_STATE_CONNECTED && socket_ != INVALID_SOCKET) {
+                _UringArmRecv();
+            }
+        } else if (res < 0 || (res & (POLLERR | POLLHUP))) {
+            if (!uring_->error) {
+                uring_->error = res < 0 ? -res : EPIPE;
+            }
+            uring_->ClearOut();
+            OnClose();
+        } else {
+            _UringQueueSend();
+        }
+        break;
+    }
+}
+
+// 本批CQE里收到了数据或者对端关闭, 和epoll一样只回调一次
+void CBaseSocket::UringOnReadReady() {
+    uring_->read_ready = false;
+    if (socket_ == INVALID_SOCKET) {
+        return;
+    }
+    OnRead(uring_->eof || uring_->error);
+}
+
+// 本轮循环结束时调用, 攒下的数据用一个send发出
+void CBaseSocket::UringFlushSend() {
+    uring_->send_queued = false;
+    if (uring_->send_inflight || uring_->poll_armed || uring_->error || uring_->OutSize() == 0) {
+        return;
+    }
+
+    if (uring_->send_offset == uring_->send_buf.size()) {
+        uring_->send_buf.clear();
+        uring_->send_offset = 0;
+        uring_->send_buf.swap(uring_->pending_buf);
+    }
+    const char *data = uring_->send_buf.data() + uring_->send_offset;
+    uint32_t len = uring_->send_buf.size() - uring_->send_offset;
+    if (dispatch_->GetUring()->PrepSend(uring_->fd, data, len, _UringData(this, URING_OP_SEND))) {
+        uring_->send_inflight = true;
+        uring_->inflight++;
+    }
+}
+
+void CBaseSocket::UringRearm() {
+    if (uring_) {
+        _UringArmRecv();
+    }
+}
+
+#endif
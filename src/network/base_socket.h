@@ -7,6 +7,59 @@
 
 #include "util/ostype.h"
 #include "util/util.h"
+#include "network/netlib.h"
+#include <sys/uio.h>
+#include <limits.h>
+#ifdef NETLIB_HAVE_URING
+#include "poller/uring_poller.h"
+#include <deque>
+#endif
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+class CEventDispatch;
+
+#define SOCKET_SENDFILE_MAX (1 << 30)       // 一次SendFile最多的字节数, 返回值是int
+
+#ifdef NETLIB_HAVE_URING
+#define URING_SEND_BUF_MAX  (256 * 1024)    // 发送缓冲区上限, 超过时SendV只收一部分, 发走一半后通知可写
+#define URING_SEND_BUF_KEEP (64 * 1024)     // 发完后保留的容量, 偶尔的大突发不一直占着内存
+#define URING_LINGER_MS     3000            // 关闭时发送缓冲区里还有数据, 最多再发这么久
+
+typedef struct {
+    uint16_t bid;           // 内核选的缓冲区
+    uint32_t offset;
+    uint32_t len;
+} UringRecvBuf;
+
+// io_uring模式下socket的状态, 只在所属loop访问
+struct UringState {
+    SOCKET fd;              // Close后socket_已经无效, 所有请求结束后才关闭fd
+    uint32_t inflight;      // 还没收到最后一个CQE的请求数
+    bool accept_armed;
+    bool recv_armed;
+    bool poll_armed;        // 等连接完成, 或者send返回EAGAIN后等可写
+    bool send_inflight;     // send_buf交给内核了, 完成之前不能改
+    bool send_queued;
+    bool read_ready;
+    bool write_blocked;     // SendV没有收下全部数据, 发走一半后回调NETLIB_MSG_WRITE
+    bool eof;
+    bool closing;
+    int error;
+    std::deque<UringRecvBuf> recv_bufs;
+    // 两个缓冲区轮换: 发送中的不动, 新数据追加到pending_buf, 发完后交换
+    std::string send_buf;
+    uint32_t send_offset;
+    std::string pending_buf;
+    timer_handle_t linger_timer;
+
+    UringState(SOCKET sock);
+    uint32_t OutSize() { return send_buf.size() - send_offset + pending_buf.size(); }
+    void ClearOut();
+};
+#endif
 
 enum {
     SOCKET_STATE_IDLE,
@@ -31,6 +84,10 @@ public:
     void SetCallbackData(void *data) { callback_data_ = data; }
     void SetRemoteIP(char *ip) { remote_ip_ = ip; }
     void SetRemotePort(uint16_t port) { remote_port_ = port; }
+    void SetReusePort(bool reuse_port) { reuse_port_ = reuse_port; }
+    // 所属的loop, 默认是创建socket的线程所在的loop
+    void SetDispatch(CEventDispatch *dispatch) { dispatch_ = dispatch; }
+    CEventDispatch *GetDispatch() { return dispatch_; }
     void SetSendBufSize(uint32_t send_size);
     void SetRecvBufSize(uint32_t recv_size);
 
@@ -48,25 +105,73 @@ public:
 
     int Send(void *buf, int len);
 
+    int SendV(const struct iovec *iov, int iovcnt);
+
+    // 把文件fd从offset开始的count字节发出去, epoll模式用sendfile, 数据不经过用户态
+    // 返回值: >0 发出的字节数, 0 文件已经读完, NETLIB_AGAIN 发送缓冲区满, NETLIB_ERROR 出错
+    int SendFile(int fd, uint64_t offset, size_t count);
+
+    // 返回值: >0 收到的字节数, 0 对端关闭, NETLIB_AGAIN 暂时没有数据, NETLIB_ERROR 出错
     int Recv(void *buf, int len);
 
+    int RecvV(const struct iovec *iov, int iovcnt);
+
     int Close();
 
+    static void SetAcceptConfig(const NetlibAcceptConfig &config);
+    static void GetAcceptStats(NetlibAcceptStats *stats);
+
   public:
-    void OnRead();
+    // peer_closed: 对端已经关闭写(EPOLLRDHUP/EV_EOF), 回调读完数据后socket还没关就通知关闭
+    void OnRead(bool peer_closed = false);
     void OnWrite();
     void OnClose();
 
+#ifdef NETLIB_HAVE_URING
+    // 以下由io_uring事件循环调用
+    // AddEvent时按状态挂上多次触发的accept/recv, 或者等连接完成
+    void UringAttach();
+    void OnUringEvent(uint8_t op, int res, uint32_t flags);
+    void UringOnReadReady();
+    void UringFlushSend();
+    void UringRearm();
+    // 关闭后所有请求都结束了才真正关闭fd并释放
+    void UringTryRelease();
+#endif
+
   private: // 私有函数以_ 开头
     int _GetErrorCode();
     bool _IsBlock(int error_code);
 
     void _SetNonblock(SOCKET fd);
     void _SetReuseAddr(SOCKET fd);
+    void _SetReusePort(SOCKET fd);
     void _SetNoDelay(SOCKET fd);
     void _SetAddr(const char *ip, const uint16_t port, sockaddr_in *addr);
 
     void _AcceptNewSocket();
+    // 新连接建好CBaseSocket后交给所属loop
+    void _OnAccepted(SOCKET fd, const sockaddr_in &peer_addr);
+    // 令牌桶准入, 返回ACCEPT_ADMIT/ACCEPT_DEFER/ACCEPT_REJECT
+    int _Admit(uint64_t now);
+    // delay毫秒后在定时器里继续accept, 已经安排了就不重复
+    void _ScheduleAccept(uint64_t delay);
+    static void _OnAcceptTimer(void *callback_data, uint8_t msg, uint32_t handle, void *pParam);
+
+#ifdef NETLIB_HAVE_URING
+    int _UringSendV(const struct iovec *iov, int iovcnt);
+    int _UringSendFile(int fd, uint64_t offset, size_t count);
+    int _UringRecvV(const struct iovec *iov, int iovcnt);
+    int _UringClose();
+    void _UringAccept(SOCKET fd);
+    void _UringArmAccept();
+    void _UringArmRecv();
+    void _UringArmPoll();
+    void _UringQueueSend();
+    void _UringQueueRead();
+    void _UringRecycle();
+    static void _OnLingerTimer(void *callback_data, uint8_t msg, uint32_t handle, void *pParam);
+#endif
 
   private:
     string remote_ip_;
@@ -79,6 +184,20 @@ public:
 
     uint8_t state_;
     SOCKET socket_;
+    bool reuse_port_;
+    CEventDispatch *dispatch_;
+
+    // 监听socket的准入状态, 只在所属loop访问
+    double tokens_;
+    double token_rate_;         // 每毫秒补充的令牌, 0表示不限
+    double token_burst_;
+    uint64_t token_tick_;
+    uint64_t defer_tick_;       // 开始推迟accept的时间, backlog清空后归0
+    timer_handle_t accept_timer_;
+
+#ifdef NETLIB_HAVE_URING
+    UringState *uring_;         // 不是io_uring模式时为NULL
+#endif
 };
 
 CBaseSocket *FindBaseSocket(net_handle_t fd);
@@ -1,16 +1,28 @@
 // 包含必要的头文件
 #include "event_dispatch.h"
 #include "base_socket.h"
+#include "netlib.h"
+#include "util/dlog.h"
+#if !defined(_WIN32) && !defined(__APPLE__)
+#include <sys/eventfd.h>
+#include <poll.h>
+#endif
 
 // 定义最小定时器持续时间为100毫秒
 #define MIN_TIMER_DURATION 100 // 100 miliseconds
 
 // 静态成员变量初始化
-CEventDispatch *CEventDispatch::event_dispatch_ = NULL;
+int CEventDispatch::io_backend_ = NETLIB_IO_EPOLL;
+std::vector<CEventDispatch *> CEventDispatch::instances_;
+std::vector<std::thread> CEventDispatch::threads_;
+thread_local CEventDispatch *CEventDispatch::current_ = NULL;
 
 // CEventDispatch构造函数
-CEventDispatch::CEventDispatch() {
+CEventDispatch::CEventDispatch(uint32_t index)
+    : timer_wheel_(GetTickCount()), task_queue_(EVENT_TASK_QUEUE_SIZE) {
+    index_ = index;
     running_ = false;
+    self_wakeup_ = true;    // 第一轮执行一次loop回调
 #ifdef _WIN32
     // Windows平台初始化
     FD_ZERO(&m_read_set);
@@ -28,6 +40,27 @@ CEventDispatch::CEventDispatch() {
     if (epfd_ == -1) {
         printf("epoll_create failed");
     }
+    wakeup_pending_ = false;
+    wakeup_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakeup_fd_ == -1) {
+        printf("eventfd failed, errno=%d", errno);
+    } else {
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.fd = wakeup_fd_;
+        epoll_ctl(epfd_, EPOLL_CTL_ADD, wakeup_fd_, &ev);
+    }
+#endif
+#ifdef NETLIB_HAVE_URING
+    uring_ = NULL;
+    if (io_backend_ == NETLIB_IO_URING) {
+        uring_ = new CUringPoller();
+        if (!uring_->Init(URING_DEFAULT_ENTRIES, URING_DEFAULT_BUF_COUNT, URING_DEFAULT_BUF_SIZE)) {
+            LogWarn("io_uring unavailable, loop {} falls back to epoll", index_);
+            delete uring_;
+            uring_ = NULL;
+        }
+    }
 #endif
 }
 
@@ -41,59 +74,62 @@ CEventDispatch::~CEventDispatch() {
 #else
     // Linux平台关闭epoll
     close(epfd_);
+    if (wakeup_fd_ != -1) {
+        close(wakeup_fd_);
+    }
+#endif
+#ifdef NETLIB_HAVE_URING
+    delete uring_;
 #endif
 }
 
-// 添加定时器
+// 添加定时器, 已经存在时更新间隔并重新计时
 void CEventDispatch::AddTimer(callback_t callback, void *user_data,
                               uint64_t interval) {
-    list<TimerItem *>::iterator it;
-    // 检查是否已存在相同的定时器
-    for (it = timer_list_.begin(); it != timer_list_.end(); it++) {
-        TimerItem *pItem = *it;
-        if (pItem->callback == callback && pItem->user_data == user_data) {
-            // 如果存在，更新间隔和下次触发时间
-            pItem->interval = interval;
-            pItem->next_tick = GetTickCount() + interval;
-            return;
-        }
+    std::pair<callback_t, void *> key(callback, user_data);
+    std::map<std::pair<callback_t, void *>, timer_handle_t>::iterator it = named_timers_.find(key);
+    if (it != named_timers_.end()) {
+        timer_wheel_.Reset(it->second, GetTickCount(), interval);
+        return;
     }
 
-    // 创建新的定时器项
-    TimerItem *pItem = new TimerItem;
-    pItem->callback = callback;
-    pItem->user_data = user_data;
-    pItem->interval = interval;
-    pItem->next_tick = GetTickCount() + interval;
-    timer_list_.push_back(pItem);
+    named_timers_[key] = timer_wheel_.Add(callback, user_data, GetTickCount(), interval, interval);
 }
 
 // 移除定时器
 void CEventDispatch::RemoveTimer(callback_t callback, void *user_data) {
-    list<TimerItem *>::iterator it;
-    for (it = timer_list_.begin(); it != timer_list_.end(); it++) {
-        TimerItem *pItem = *it;
-        if (pItem->callback == callback && pItem->user_data == user_data) {
-            timer_list_.erase(it);
-            delete pItem;
-            return;
-        }
+    std::map<std::pair<callback_t, void *>, timer_handle_t>::iterator it =
+        named_timers_.find(std::make_pair(callback, user_data));
+    if (it != named_timers_.end()) {
+        timer_wheel_.Cancel(it->second);
+        named_timers_.erase(it);
     }
 }
 
+timer_handle_t CEventDispatch::StartTimer(callback_t callback, void *user_data, uint64_t delay,
+                                          uint64_t interval) {
+    return timer_wheel_.Add(callback, user_data, GetTickCount(), delay, interval);
+}
+
+void CEventDispatch::StopTimer(timer_handle_t timer) {
+    timer_wheel_.Cancel(timer);
+}
+
 // 检查并触发定时器
 void CEventDispatch::_CheckTimer() {
-    uint64_t curr_tick = GetTickCount();
-    list<TimerItem *>::iterator it;
+    timer_wheel_.Advance(GetTickCount());
+}
 
-    for (it = timer_list_.begin(); it != timer_list_.end();) {
-        TimerItem *pItem = *it;
-        it++; // 提前递增迭代器，因为回调可能会删除当前项
-        if (curr_tick >= pItem->next_tick) {
-            pItem->next_tick += pItem->interval;
-            pItem->callback(pItem->user_data, NETLIB_MSG_TIMER, 0, NULL);
-        }
+int CEventDispatch::_GetWaitTimeout(uint32_t wait_timeout) {
+    // 本loop自己投递的任务和自己唤醒自己都不会写eventfd, 不能等
+    if (self_wakeup_ || !task_queue_.Empty()) {
+        return 0;
     }
+    uint64_t timeout = timer_wheel_.NextTimeout(GetTickCount(), wait_timeout);
+    if (timeout >= NETLIB_WAIT_INFINITE) {
+        return -1;
+    }
+    return timeout > INT32_MAX ? INT32_MAX : (int)timeout;
 }
 
 // 添加循环任务
@@ -104,6 +140,15 @@ void CEventDispatch::AddLoop(callback_t callback, void *user_data) {
     loop_list_.push_back(pItem);
 }
 
+// 线程安全; 本loop线程里只打标记, 这一轮不等待
+void CEventDispatch::Wakeup() {
+    if (current_ == this) {
+        self_wakeup_ = true;
+    } else {
+        _Wakeup();
+    }
+}
+
 // 检查并执行循环任务
 void CEventDispatch::_CheckLoop() {
     for (list<TimerItem *>::iterator it = loop_list_.begin();
@@ -113,13 +158,165 @@ void CEventDispatch::_CheckLoop() {
     }
 }
 
-// 获取CEventDispatch单例
+// 本loop的socket表
+void CEventDispatch::AddSocket(CBaseSocket *pSocket) {
+    socket_map_.insert(std::make_pair((net_handle_t)pSocket->GetSocket(), pSocket));
+}
+
+void CEventDispatch::RemoveSocket(CBaseSocket *pSocket) {
+    socket_map_.erase((net_handle_t)pSocket->GetSocket());
+}
+
+// 找到后增加引用计数, 调用者负责ReleaseRef
+CBaseSocket *CEventDispatch::FindSocket(net_handle_t fd) {
+    CBaseSocket *pSocket = NULL;
+    std::unordered_map<net_handle_t, CBaseSocket *>::iterator iter = socket_map_.find(fd);
+    if (iter != socket_map_.end()) {
+        pSocket = iter->second;
+        pSocket->AddRef();
+    }
+
+    return pSocket;
+}
+
+// 投递任务, 可以在任意线程调用
+void CEventDispatch::PostTask(const std::function<void()> &task) {
+    task_queue_.Push(task);
+    Wakeup();
+}
+
+void CEventDispatch::PostTask(std::function<void()> &&task) {
+    task_queue_.Push(std::move(task));
+    Wakeup();
+}
+
+// 执行投递过来的任务, 执行期间再投递的下一轮执行
+void CEventDispatch::_CheckTask() {
+    task_queue_.Drain([](std::function<void()> &task) { task(); });
+}
+
+// 没有eventfd的平台每轮都执行loop回调
+void CEventDispatch::_CheckSignal() {
+    bool signaled = self_wakeup_;
+    self_wakeup_ = false;
+#if !defined(_WIN32) && !defined(__APPLE__)
+    // 先清标志再取任务, 之后投递和唤醒的会重新写eventfd
+    if (wakeup_pending_.exchange(false, std::memory_order_acq_rel) || wakeup_fd_ == -1) {
+        signaled = true;
+    }
+#else
+    signaled = true;
+#endif
+    if (signaled) {
+        _CheckLoop();
+    }
+    _CheckTask();
+}
+
+// 上一次写的还没处理时不用再写, 大量投递时每轮最多一次系统调用
+void CEventDispatch::_Wakeup() {
+#if !defined(_WIN32) && !defined(__APPLE__)
+    if (wakeup_fd_ != -1 && !wakeup_pending_.exchange(true, std::memory_order_acq_rel)) {
+        uint64_t one = 1;
+        if (write(wakeup_fd_, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            printf("eventfd write failed, errno=%d", errno);
+        }
+    }
+#endif
+}
+
+// 只清掉eventfd的计数, 任务在这一轮的_CheckTask里执行
+void CEventDispatch::_OnWakeup() {
+#if !defined(_WIN32) && !defined(__APPLE__)
+    uint64_t count;
+    while (read(wakeup_fd_, &count, sizeof(count)) > 0) {
+    }
+#endif
+}
+
+// 获取当前线程所在的CEventDispatch
 CEventDispatch *CEventDispatch::Instance() {
-    if (event_dispatch_ == NULL) {
-        event_dispatch_ = new CEventDispatch();
+    if (current_ != NULL) {
+        return current_;
+    }
+
+    return Instance(0);
+}
+
+CEventDispatch *CEventDispatch::Instance(uint32_t index) {
+    if (instances_.empty()) {
+        InitInstances(1);
+    }
+
+    return instances_[index % instances_.size()];
+}
+
+void CEventDispatch::InitInstances(uint32_t num) {
+    if (num == 0) {
+        num = 1;
+    }
+    for (uint32_t i = instances_.size(); i < num; i++) {
+        instances_.push_back(new CEventDispatch(i));
+    }
+}
+
+uint32_t CEventDispatch::GetInstanceNum() {
+    if (instances_.empty()) {
+        InitInstances(1);
+    }
+
+    return instances_.size();
+}
+
+// 绑定到第index个CPU, 每个loop独占一个核
+static void _BindCpu(std::thread::native_handle_type handle, uint32_t index) {
+#ifdef __linux__
+    long cpu_num = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpu_num <= 0) {
+        return;
+    }
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(index % cpu_num, &cpuset);
+    if (pthread_setaffinity_np(handle, sizeof(cpu_set_t), &cpuset) != 0) {
+        printf("pthread_setaffinity_np failed, loop=%u", index);
     }
+#else
+    UNUSED(handle);
+    UNUSED(index);
+#endif
+}
+
+void CEventDispatch::StartAll(uint32_t wait_timeout) {
+    uint32_t num = GetInstanceNum();
+    for (uint32_t i = 1; i < num; i++) {
+        CEventDispatch *dispatch = instances_[i];
+        threads_.push_back(std::thread([dispatch, wait_timeout]() {
+            dispatch->StartDispatch(wait_timeout);
+        }));
+        _BindCpu(threads_.back().native_handle(), i);
+    }
+    if (num > 1) {
+        _BindCpu(pthread_self(), 0);
+    }
+
+    instances_[0]->StartDispatch(wait_timeout);
+
+    for (size_t i = 0; i < threads_.size(); i++) {
+        threads_[i].join();
+    }
+    threads_.clear();
+}
 
-    return event_dispatch_;
+// 实际使用的IO后端, 以0号loop为准
+int CEventDispatch::GetIoBackend() {
+    return Instance(0)->IsUring() ? NETLIB_IO_URING : NETLIB_IO_EPOLL;
+}
+
+void CEventDispatch::StopAll() {
+    for (size_t i = 0; i < instances_.size(); i++) {
+        instances_[i]->StopDispatch();
+    }
 }
 
 #ifdef _WIN32
@@ -162,16 +359,21 @@ void CEventDispatch::RemoveEvent(SOCKET fd, uint8_t socket_event) {
 void CEventDispatch::StartDispatch(uint32_t wait_timeout) {
     fd_set read_set, write_set, excep_set;
     timeval timeout;
+    // 没有eventfd, 其他线程投递的任务最多等一个EVENT_POLL_TIMEOUT
+    if (wait_timeout > EVENT_POLL_TIMEOUT) {
+        wait_timeout = EVENT_POLL_TIMEOUT;
+    }
     timeout.tv_sec = 0;
-    timeout.tv_usec = wait_timeout * 1000; // 10 millisecond
+    timeout.tv_usec = wait_timeout * 1000;
 
     if (running_)
         return;
     running_ = true;
+    current_ = this;
 
     while (running_) {
         _CheckTimer();
-        _CheckLoop();
+        _CheckSignal();
 
         if (!m_read_set.fd_count && !m_write_set.fd_count &&
             !m_excep_set.fd_count) {
@@ -269,19 +471,23 @@ void CEventDispatch::StartDispatch(uint32_t wait_timeout) {
     // 定义事件数组和计数器
     struct kevent events[1024];
     int nfds = 0;
-    // 设置超时结构���
     struct timespec timeout;
-    timeout.tv_sec = 0;
-    timeout.tv_nsec = wait_timeout * 1000000;
 
     // 如果已经在运行，直接返回
     if (running_)
         return;
     running_ = true;
+    current_ = this;
 
     // 主事件循环
     while (running_) {
-        // 等待事件发生
+        // 等待事件发生, 最多等到下一个定时器到期
+        int wait_ms = _GetWaitTimeout(wait_timeout);
+        if (wait_ms < 0) {
+            wait_ms = EVENT_POLL_TIMEOUT;
+        }
+        timeout.tv_sec = wait_ms / 1000;
+        timeout.tv_nsec = (wait_ms % 1000) * 1000000;
         nfds = kevent(m_kqfd, NULL, 0, events, 1024, &timeout);
 
         // 处理所有发生的事件
@@ -294,7 +500,7 @@ void CEventDispatch::StartDispatch(uint32_t wait_timeout) {
             // 处理读事件
             if (events[i].filter == EVFILT_READ) {
                 // printf("OnRead, socket=%d\n", ev_fd);
-                pSocket->OnRead();
+                pSocket->OnRead(events[i].flags & EV_EOF);
             }
 
             // 处理写事件
@@ -309,20 +515,36 @@ void CEventDispatch::StartDispatch(uint32_t wait_timeout) {
 
         // 检查定时器
         _CheckTimer();
-        // 检查循环
-        _CheckLoop();
+        // 检查循环, 执行其他线程投递的任务
+        _CheckSignal();
     }
 }
 
 // MacOS平台：停止事件分发
-void CEventDispatch::StopDispatch() { running_ = false; }
+void CEventDispatch::StopDispatch() {
+    running_ = false;
+    Wakeup();
+}
 
 #else
 
 // Linux平台：添加事件
 void CEventDispatch::AddEvent(SOCKET fd, uint8_t socket_event) {
+#ifdef NETLIB_HAVE_URING
+    if (uring_) {
+        // io_uring按socket状态挂多次触发的请求, 不区分事件
+        std::unordered_map<net_handle_t, CBaseSocket *>::iterator it = socket_map_.find(fd);
+        if (it != socket_map_.end()) {
+            it->second->UringAttach();
+        }
+        return;
+    }
+#endif
     struct epoll_event ev;
     ev.events = EPOLLIN | EPOLLOUT | EPOLLET | EPOLLPRI | EPOLLERR | EPOLLHUP;
+#ifdef EPOLLRDHUP
+    ev.events |= EPOLLRDHUP;
+#endif
     ev.data.fd = fd;
     if (epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev) != 0) {
         printf("epoll_ctl() failed, errno=%d", errno);
@@ -331,6 +553,11 @@ void CEventDispatch::AddEvent(SOCKET fd, uint8_t socket_event) {
 
 // Linux平台：移除事件
 void CEventDispatch::RemoveEvent(SOCKET fd, uint8_t socket_event) {
+#ifdef NETLIB_HAVE_URING
+    if (uring_) {
+        return;     // 由CBaseSocket::Close取消请求
+    }
+#endif
     if (epoll_ctl(epfd_, EPOLL_CTL_DEL, fd, NULL) != 0) {
         printf("epoll_ctl failed, errno=%d", errno);
     }
@@ -344,28 +571,39 @@ void CEventDispatch::StartDispatch(uint32_t wait_timeout) {
     if (running_)
         return;
     running_ = true;
+    current_ = this;
+
+#ifdef NETLIB_HAVE_URING
+    if (uring_) {
+        _StartUringDispatch(wait_timeout);
+        return;
+    }
+#endif
 
     while (running_) {
-        nfds = epoll_wait(epfd_, events, 1024, wait_timeout);
+        nfds = epoll_wait(epfd_, events, 1024, _GetWaitTimeout(wait_timeout));
         for (int i = 0; i < nfds; i++) {
             int ev_fd = events[i].data.fd;
+            if (ev_fd == wakeup_fd_) {
+                _OnWakeup();
+                continue;
+            }
             CBaseSocket *pSocket = FindBaseSocket(ev_fd);
             if (!pSocket)
                 continue;
 
-// Commit  2023-02-28
+            // 对端关闭时先把缓冲区里剩下的数据读完, 再关闭
 #ifdef EPOLLRDHUP
-            if (events[i].events & EPOLLRDHUP) {
-                // printf("On Peer Close, socket=%d, ev_fd);
-                pSocket->OnClose();
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP)) {
+                // printf("OnRead, socket=%d\n", ev_fd);
+                pSocket->OnRead(events[i].events & EPOLLRDHUP);
             }
-#endif
-            // Commit End
-
+#else
             if (events[i].events & EPOLLIN) {
                 // printf("OnRead, socket=%d\n", ev_fd);
                 pSocket->OnRead();
             }
+#endif
 
             if (events[i].events & EPOLLOUT) {
                 // printf("OnWrite, socket=%d\n", ev_fd);
@@ -381,11 +619,101 @@ void CEventDispatch::StartDispatch(uint32_t wait_timeout) {
         }
 
         _CheckTimer();
-        _CheckLoop();
+        _CheckSignal();
     }
 }
 
-// Linux平台：停止事件分发
-void CEventDispatch::StopDispatch() { running_ = false; }
+// Linux平台：停止事件分发, 唤醒阻塞在等待里的loop
+void CEventDispatch::StopDispatch() {
+    running_ = false;
+    Wakeup();
+}
+
+#ifdef NETLIB_HAVE_URING
+
+void CEventDispatch::UringQueueSend(CBaseSocket *pSocket) {
+    pSocket->AddRef();
+    uring_send_list_.push_back(pSocket);
+}
+
+void CEventDispatch::UringQueueRead(CBaseSocket *pSocket) {
+    pSocket->AddRef();
+    uring_read_list_.push_back(pSocket);
+}
+
+void CEventDispatch::UringQueueRearm(CBaseSocket *pSocket) {
+    pSocket->AddRef();
+    uring_rearm_list_.push_back(pSocket);
+}
+
+// 提交前把本轮攒下的请求准备好: 缓冲区还回来之后重新挂recv, 所有有数据的socket各一个send
+void CEventDispatch::_UringFlush() {
+    std::vector<CBaseSocket *> sockets;
+    sockets.swap(uring_rearm_list_);
+    for (size_t i = 0; i < sockets.size(); i++) {
+        sockets[i]->UringRearm();
+        sockets[i]->UringTryRelease();
+        sockets[i]->ReleaseRef();
+    }
+
+    sockets.clear();
+    sockets.swap(uring_send_list_);
+    for (size_t i = 0; i < sockets.size(); i++) {
+        sockets[i]->UringFlushSend();
+        sockets[i]->UringTryRelease();
+        sockets[i]->ReleaseRef();
+    }
+}
+
+// io_uring事件循环: 每轮一次io_uring_enter提交本轮所有请求并等待完成事件
+void CEventDispatch::_StartUringDispatch(uint32_t wait_timeout) {
+    std::vector<CBaseSocket *> sockets;
+    uint64_t wakeup_data = (uint64_t)(uintptr_t)this | URING_OP_WAKEUP;
+    if (wakeup_fd_ != -1) {
+        uring_->PrepPollAdd(wakeup_fd_, POLLIN, wakeup_data);
+    }
+    while (running_) {
+        _UringFlush();
+        int wait_ms = _GetWaitTimeout(wait_timeout);
+        uring_->SubmitAndWait(wait_ms < 0 ? URING_WAIT_FOREVER : wait_ms);
+
+        // 请求还没结束时socket不会释放, 指针可以直接用
+        struct io_uring_cqe *cqe;
+        while ((cqe = uring_->PeekCqe()) != NULL) {
+            uint64_t user_data = cqe->user_data;
+            int res = cqe->res;
+            uint32_t flags = cqe->flags;
+            uring_->SeenCqe();
+
+            if (user_data == wakeup_data) {
+                // 单次触发的poll, 清掉计数后重新挂上
+                _OnWakeup();
+                uring_->PrepPollAdd(wakeup_fd_, POLLIN, wakeup_data);
+                continue;
+            }
+            CBaseSocket *pSocket = (CBaseSocket *)(uintptr_t)(user_data & ~(uint64_t)URING_OP_MASK);
+            if (!pSocket)
+                continue;   // 取消请求的完成事件
+            pSocket->AddRef();
+            pSocket->OnUringEvent(user_data & URING_OP_MASK, res, flags);
+            pSocket->UringTryRelease();
+            pSocket->ReleaseRef();
+        }
+
+        // 同一批里多次收到数据的socket只回调一次
+        sockets.clear();
+        sockets.swap(uring_read_list_);
+        for (size_t i = 0; i < sockets.size(); i++) {
+            sockets[i]->UringOnReadReady();
+            sockets[i]->UringTryRelease();
+            sockets[i]->ReleaseRef();
+        }
+
+        _CheckTimer();
+        _CheckSignal();
+    }
+}
+
+#endif
 
 #endif
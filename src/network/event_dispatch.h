@@ -1,7 +1,15 @@
 /*
  * A socket event dispatcher, features include:
  * 1. portable: worked both on Windows, MAC OS X,  LINUX platform
- * 2. a singleton pattern: only one instance of this class can exist
+ * 2. one loop per thread: N instances, each with its own poller fd, socket map
+ *    and timer wheel; Instance() returns the loop of the calling thread
+ * 3. poller timeout is computed from the next timer deadline
+ * 4. on Linux the poller is epoll by default, or io_uring when selected and supported:
+ *    multishot accept/recv, and all sends of one loop iteration submitted together
+ * 5. tasks posted from other threads go through a lock-free MPSC queue; on Linux the
+ *    poster wakes the loop through an eventfd, at most one write until the loop drains
+ * 6. on Linux an idle loop blocks until a socket event, the next timer or a wakeup;
+ *    loop callbacks only run in iterations that were woken up
  */
 #ifndef __EVENT_DISPATCH_H__
 #define __EVENT_DISPATCH_H__
@@ -9,9 +17,25 @@
 #include "util/ostype.h"
 #include "util/util.h"
 #include "util/lock.h"
+#include "timer_wheel.h"
+#include "util/util_mpsc_queue.h"
+#ifdef NETLIB_HAVE_URING
+#include "poller/uring_poller.h"
+#endif
 
 #include <list>
+#include <atomic>
+#include <vector>
+#include <thread>
+#include <functional>
+#include <unordered_map>
+#include <map>
 using std::list;
+
+#define EVENT_TASK_QUEUE_SIZE   16384   // 投递任务的环形队列大小, 满了进溢出链表
+#define EVENT_POLL_TIMEOUT      100     // 没有eventfd的平台(select/kqueue)最长等待时间, loop回调每轮都执行
+
+class CBaseSocket;
 enum {
     SOCKET_READ = 0x1,
     SOCKET_WRITE = 0x2,
@@ -26,34 +50,84 @@ class CEventDispatch {
     void AddEvent(SOCKET fd, uint8_t socket_event);
     void RemoveEvent(SOCKET fd, uint8_t socket_event);
 
+    // 按(callback, user_data)查找的周期定时器, 兼容旧接口
     void AddTimer(callback_t callback, void *user_data, uint64_t interval);
     void RemoveTimer(callback_t callback, void *user_data);
 
+    // 返回句柄的定时器, 取消不需要查找, 只能在本loop线程调用
+    timer_handle_t StartTimer(callback_t callback, void *user_data, uint64_t delay,
+                              uint64_t interval);
+    void StopTimer(timer_handle_t timer);
+
     void AddLoop(callback_t callback, void *user_data);
+    // 线程安全, 下一轮执行loop回调
+    void Wakeup();
 
-    void StartDispatch(uint32_t wait_timeout = 100);
+    // 本loop的socket表, 只在本loop线程访问
+    void AddSocket(CBaseSocket *pSocket);
+    void RemoveSocket(CBaseSocket *pSocket);
+    CBaseSocket *FindSocket(net_handle_t fd);
+
+    // 线程安全, 任务在本loop线程下一轮循环时执行; 其他线程投递时唤醒loop
+    void PostTask(const std::function<void()> &task);
+    void PostTask(std::function<void()> &&task);
+
+    void StartDispatch(uint32_t wait_timeout = EVENT_POLL_TIMEOUT);
     void StopDispatch();
 
     bool IsRunning() { return running_; }
+    uint32_t GetIndex() { return index_; }
+
+#ifdef NETLIB_HAVE_URING
+    bool IsUring() { return uring_ != NULL; }
+    CUringPoller *GetUring() { return uring_; }
+    // 下一次提交前处理, 同一个socket只排一次, 排队期间持有引用
+    void UringQueueSend(CBaseSocket *pSocket);
+    void UringQueueRead(CBaseSocket *pSocket);
+    void UringQueueRearm(CBaseSocket *pSocket);
+#else
+    bool IsUring() { return false; }
+#endif
 
+    // 当前线程所在的loop, 不在loop线程时返回0号loop
     static CEventDispatch *Instance();
+    static CEventDispatch *Instance(uint32_t index);
+    static bool IsInLoopThread() { return current_ != NULL; }
+
+    // 创建num个loop, 必须在监听和StartAll之前调用, 默认只有1个
+    static void InitInstances(uint32_t num);
+    static uint32_t GetInstanceNum();
+    // 1..N-1号loop各起一个线程并绑定CPU, 0号loop在调用线程运行, 直到StopAll
+    static void StartAll(uint32_t wait_timeout);
+    static void StopAll();
+
+    // IO后端(NETLIB_IO_EPOLL/NETLIB_IO_URING), 在InitInstances之前设置, io_uring不可用时退回epoll
+    static void SetIoBackend(int backend) { io_backend_ = backend; }
+    static int GetIoBackend();
 
   protected:
-    CEventDispatch();
+    CEventDispatch(uint32_t index);
 
   private:
     void _CheckTimer();
     void _CheckLoop();
+    void _CheckTask();
+    // 被唤醒过才执行loop回调, 然后执行投递的任务
+    void _CheckSignal();
+    void _Wakeup();
+    void _OnWakeup();
+    // 等到下一个定时器到期, 最多wait_timeout; 返回-1表示一直等
+    int _GetWaitTimeout(uint32_t wait_timeout);
+#ifdef NETLIB_HAVE_URING
+    void _StartUringDispatch(uint32_t wait_timeout);
+    void _UringFlush();
+#endif
 
     typedef struct {
         callback_t callback;
         void *user_data;
-        uint64_t interval;
-        uint64_t next_tick;
     } TimerItem;
 
-    
-
   private:
 #ifdef _WIN32
     fd_set m_read_set;
@@ -63,14 +137,33 @@ class CEventDispatch {
     int m_kqfd;
 #else
     int epfd_;
+#endif
+#ifdef NETLIB_HAVE_URING
+    CUringPoller *uring_;
+    std::vector<CBaseSocket *> uring_send_list_;    // 有数据要发, 本轮一起提交
+    std::vector<CBaseSocket *> uring_read_list_;    // 本批CQE里收到数据, 每个socket只回调一次
+    std::vector<CBaseSocket *> uring_rearm_list_;   // 缓冲区用完后停掉的recv
 #endif
     CLock lock_;
-    list<TimerItem *> timer_list_; // 定时器
+    CTimerWheel timer_wheel_;      // 定时器
+    std::map<std::pair<callback_t, void *>, timer_handle_t> named_timers_; // AddTimer注册的定时器
     list<TimerItem *> loop_list_;  // 自定义loop
+    std::unordered_map<net_handle_t, CBaseSocket *> socket_map_;
+
+    CMpscQueue<std::function<void()> > task_queue_; // 其他线程投递过来的任务
+#if !defined(_WIN32) && !defined(__APPLE__)
+    int wakeup_fd_;                             // eventfd, 有任务投递时写1
+    std::atomic<bool> wakeup_pending_;          // 已经写过还没处理, 期间不用再写
+#endif
+    bool self_wakeup_;                          // 本loop线程自己唤醒自己, 不用写eventfd
 
-    static CEventDispatch *event_dispatch_;
+    uint32_t index_;
+    std::atomic<bool> running_;
 
-    bool running_;
+    static int io_backend_;
+    static std::vector<CEventDispatch *> instances_;
+    static std::vector<std::thread> threads_;
+    static thread_local CEventDispatch *current_;
 };
 
 #endif
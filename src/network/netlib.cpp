@@ -5,9 +5,12 @@
 #include "util/dlog.h"
 
 // 初始化网络库
+// 参数:
+//   loop_num: 事件循环(线程)个数, 一般设置为CPU核数
 // 返回值: NETLIB_OK 表示成功，NETLIB_ERROR 表示失败
-int netlib_init() {
+int netlib_init(uint32_t loop_num) {
     int ret = NETLIB_OK;
+    CEventDispatch::InitInstances(loop_num);
 #ifdef _WIN32
     // Windows平台特定的初始化
     WSADATA wsaData;
@@ -34,7 +37,36 @@ int netlib_destroy() {
     return ret;
 }
 
+// 选择IO后端, 对之后netlib_init创建的loop生效
+// 参数:
+//   backend: NETLIB_IO_EPOLL 或 NETLIB_IO_URING
+void netlib_set_io_backend(int backend) {
+    CEventDispatch::SetIoBackend(backend);
+}
+
+// 实际使用的IO后端, 请求io_uring但内核不支持时是NETLIB_IO_EPOLL
+int netlib_get_io_backend() {
+    return CEventDispatch::GetIoBackend();
+}
+
+// 设置新连接准入配置, 对之后的netlib_listen生效
+// 参数:
+//   config: backlog, 每轮accept额度, 令牌桶参数
+void netlib_set_accept_config(const NetlibAcceptConfig &config) {
+    CBaseSocket::SetAcceptConfig(config);
+}
+
+// 获取所有监听socket累计的准入计数
+// 参数:
+//   stats: 输出
+void netlib_get_accept_stats(NetlibAcceptStats *stats) {
+    CBaseSocket::GetAcceptStats(stats);
+}
+
 // 在指定IP和端口上监听连接
+// 多个loop时每个loop用SO_REUSEPORT各自监听, 由内核把新连接分到各个loop;
+// 不支持SO_REUSEPORT时只在0号loop监听, accept后轮流交给各个loop.
+// 需要在netlib_eventloop之前调用
 // 参数:
 //   server_ip: 服务器IP地址
 //   port: 监听端口
@@ -43,20 +75,29 @@ int netlib_destroy() {
 // 返回值: NETLIB_OK 表示成功，NETLIB_ERROR 表示失败
 int netlib_listen(const char *server_ip, uint16_t port, callback_t callback,
                   void *callback_data) {
-    CBaseSocket *pSocket = new CBaseSocket();
-    if (!pSocket)
-    {
-        LogError("Failed to create CBaseSocket object");
-        return NETLIB_ERROR;
-    }
+    uint32_t listen_num = 1;
+#ifdef SO_REUSEPORT
+    listen_num = CEventDispatch::GetInstanceNum();
+#endif
+    for (uint32_t i = 0; i < listen_num; i++) {
+        CBaseSocket *pSocket = new CBaseSocket();
+        if (!pSocket)
+        {
+            LogError("Failed to create CBaseSocket object");
+            return NETLIB_ERROR;
+        }
+        pSocket->SetDispatch(CEventDispatch::Instance(i));
+        pSocket->SetReusePort(listen_num > 1);
 
-    int ret = pSocket->Listen(server_ip, port, callback, callback_data);
-    if (ret == NETLIB_ERROR)
-    {
-        LogError("CBaseSocket::Listen failed, errno: {}, error: {}", errno, strerror(errno));
-        delete pSocket;
+        int ret = pSocket->Listen(server_ip, port, callback, callback_data);
+        if (ret == NETLIB_ERROR)
+        {
+            LogError("CBaseSocket::Listen failed, errno: {}, error: {}", errno, strerror(errno));
+            delete pSocket;
+            return ret;
+        }
     }
-    return ret;
+    return NETLIB_OK;
 }
 
 // 连接到指定IP和端口
@@ -95,6 +136,39 @@ int netlib_send(net_handle_t handle, void *buf, int len) {
     return ret;
 }
 
+// 聚合发送数据, 多段数据只用一次系统调用
+// 参数:
+//   handle: 网络句柄
+//   iov: 数据段数组
+//   iovcnt: 数据段个数
+// 返回值: 成功发送的字节数，失败返回NETLIB_ERROR
+int netlib_sendv(net_handle_t handle, const struct iovec *iov, int iovcnt) {
+    CBaseSocket *pSocket = FindBaseSocket(handle);
+    if (!pSocket) {
+        return NETLIB_ERROR;
+    }
+    int ret = pSocket->SendV(iov, iovcnt);
+    pSocket->ReleaseRef();
+    return ret;
+}
+
+// 发送文件的一段, epoll模式下用sendfile零拷贝
+// 参数:
+//   handle: 网络句柄
+//   fd: 文件
+//   offset: 文件偏移
+//   count: 最多发送的字节数
+// 返回值: 成功发送的字节数, 文件读完返回0, 发送缓冲区满返回NETLIB_AGAIN, 失败返回NETLIB_ERROR
+int netlib_sendfile(net_handle_t handle, int fd, uint64_t offset, size_t count) {
+    CBaseSocket *pSocket = FindBaseSocket(handle);
+    if (!pSocket) {
+        return NETLIB_ERROR;
+    }
+    int ret = pSocket->SendFile(fd, offset, count);
+    pSocket->ReleaseRef();
+    return ret;
+}
+
 // 接收数据
 // 参数:
 //   handle: 网络句柄
@@ -111,6 +185,22 @@ int netlib_recv(net_handle_t handle, void *buf, int len) {
     return ret;
 }
 
+// 分散接收数据
+// 参数:
+//   handle: 网络句柄
+//   iov: 缓冲区数组
+//   iovcnt: 缓冲区个数
+// 返回值: 实际接收的字节数，失败返回NETLIB_ERROR
+int netlib_recvv(net_handle_t handle, const struct iovec *iov, int iovcnt) {
+    CBaseSocket *pSocket = FindBaseSocket(handle);
+    if (!pSocket)
+        return NETLIB_ERROR;
+
+    int ret = pSocket->RecvV(iov, iovcnt);
+    pSocket->ReleaseRef();
+    return ret;
+}
+
 // 关闭连接
 // 参数:
 //   handle: 要关闭的网络句柄
@@ -192,25 +282,77 @@ int netlib_delete_timer(callback_t callback, void *user_data) {
     return 0;
 }
 
-// 添加循环任务
+// 在当前loop添加定时器
+// 参数:
+//   callback: 定时器回调函数
+//   user_data: 回调函数的用户数据
+//   delay: 第一次触发的延迟（毫秒）
+//   interval: 之后的触发间隔（毫秒）, 0表示只触发一次
+// 返回值: 定时器句柄, 只触发一次的定时器触发后句柄失效
+timer_handle_t netlib_add_timer(callback_t callback, void *user_data, uint64_t delay,
+                                uint64_t interval) {
+    return CEventDispatch::Instance()->StartTimer(callback, user_data, delay, interval);
+}
+
+// 取消定时器, 必须在添加它的loop线程调用
+// 参数:
+//   timer: netlib_add_timer返回的句柄
+void netlib_cancel_timer(timer_handle_t timer) {
+    CEventDispatch::Instance()->StopTimer(timer);
+}
+
+// 添加循环任务, 每个loop都会执行
 // 参数:
 //   callback: 循环任务回调函数
 //   user_data: 回调函数的用户数据
 // 返回值: 0 表示成功
 int netlib_add_loop(callback_t callback, void *user_data) {
-    CEventDispatch::Instance()->AddLoop(callback, user_data);
+    for (uint32_t i = 0; i < CEventDispatch::GetInstanceNum(); i++) {
+        CEventDispatch::Instance(i)->AddLoop(callback, user_data);
+    }
     return 0;
 }
 
-// 启动事件循环
+// 投递任务到指定loop执行, 可以在任意线程调用
+// 参数:
+//   loop_index: loop序号, 见netlib_loop_index
+//   task: 要执行的任务
+// 返回值: NETLIB_OK 表示成功，NETLIB_ERROR 表示失败
+int netlib_post(uint32_t loop_index, std::function<void()> task) {
+    if (loop_index >= CEventDispatch::GetInstanceNum())
+        return NETLIB_ERROR;
+
+    CEventDispatch::Instance(loop_index)->PostTask(std::move(task));
+    return NETLIB_OK;
+}
+
+// 唤醒loop, 下一轮执行netlib_add_loop注册的回调
+// 参数:
+//   loop_index: loop序号
+// 返回值: NETLIB_OK 表示成功，NETLIB_ERROR 表示失败
+int netlib_wakeup(uint32_t loop_index) {
+    if (loop_index >= CEventDispatch::GetInstanceNum())
+        return NETLIB_ERROR;
+
+    CEventDispatch::Instance(loop_index)->Wakeup();
+    return NETLIB_OK;
+}
+
+// loop个数
+uint32_t netlib_loop_num() { return CEventDispatch::GetInstanceNum(); }
+
+// 当前线程所在的loop序号, 不在loop线程时返回0
+uint32_t netlib_loop_index() { return CEventDispatch::Instance()->GetIndex(); }
+
+// 启动事件循环, 阻塞直到netlib_stop_event
 // 参数:
-//   wait_timeout: 等待超时时间（毫秒）
+//   wait_timeout: 最长等待时间（毫秒）, NETLIB_WAIT_INFINITE表示只由定时器决定
 void netlib_eventloop(uint32_t wait_timeout) {
-    CEventDispatch::Instance()->StartDispatch(wait_timeout);
+    CEventDispatch::StartAll(wait_timeout);
 }
 
-// 停止事件循环
-void netlib_stop_event() { CEventDispatch::Instance()->StopDispatch(); }
+// 停止所有事件循环
+void netlib_stop_event() { CEventDispatch::StopAll(); }
 
 // 检查事件循环是否正在运行
 // 返回值: true 表示正在运行，false 表示未运行
@@ -2,6 +2,10 @@
 #define __NETLIB_H__
 
 #include "util/ostype.h"
+#include "network/timer_wheel.h"
+
+#include <functional>
+#include <sys/uio.h>
 
 #define NETLIB_OPT_SET_CALLBACK 1
 #define NETLIB_OPT_SET_CALLBACK_DATA 2
@@ -14,10 +18,47 @@
 
 #define NETLIB_MAX_SOCKET_BUF_SIZE (128 * 1024)
 
-int netlib_init();
+#define NETLIB_DEFAULT_BACKLOG          1024
+#define NETLIB_DEFAULT_ACCEPT_BUDGET    64
+#define NETLIB_DEFAULT_MAX_DEFER_MS     1000
+
+#define NETLIB_WAIT_INFINITE            0xFFFFFFFF  // 没有定时器时一直等到有事件或者被唤醒
+
+// Linux上的IO后端
+enum {
+    NETLIB_IO_EPOLL = 0,
+    NETLIB_IO_URING             // 需要编译时打开ENABLE_IO_URING, 内核6.0以上
+};
+
+// 新连接准入配置, 在netlib_listen之前设置
+typedef struct {
+    int backlog;                // listen的backlog, 实际还受net.core.somaxconn限制
+    uint32_t accept_budget;     // 每个监听socket每轮最多accept的连接数, 剩下的留到本轮事件处理完之后
+    uint32_t rate;              // 令牌桶: 每秒最多接入的新连接数(所有loop合计), 0表示不限
+    uint32_t burst;             // 令牌桶容量(所有loop合计)
+    uint32_t max_defer_ms;      // 没有令牌时新连接留在backlog里等, 最多等这么久, 之后accept后直接关闭
+} NetlibAcceptConfig;
+
+typedef struct {
+    uint64_t accepted;          // 接入的连接数
+    uint64_t deferred;          // 因为没有令牌推迟accept的次数
+    uint64_t rejected;          // accept后直接关闭的连接数
+} NetlibAcceptStats;
+
+int netlib_init(uint32_t loop_num = 1);
 
 int netlib_destroy();
 
+// 选择IO后端, 在netlib_init之前调用; io_uring不可用时退回epoll
+void netlib_set_io_backend(int backend);
+
+// 实际使用的IO后端
+int netlib_get_io_backend();
+
+void netlib_set_accept_config(const NetlibAcceptConfig &config);
+
+void netlib_get_accept_stats(NetlibAcceptStats *stats);
+
 int netlib_listen(
 	const char *server_ip,
 	uint16_t port,
@@ -32,8 +73,15 @@ net_handle_t netlib_connect(
 
 int netlib_send(net_handle_t handle, void *buf, int len);
 
+int netlib_sendv(net_handle_t handle, const struct iovec *iov, int iovcnt);
+
+// 发送文件fd的[offset, offset + count), 返回发出的字节数, 0表示文件已经读完, 发不动时返回NETLIB_AGAIN
+int netlib_sendfile(net_handle_t handle, int fd, uint64_t offset, size_t count);
+
 int netlib_recv(net_handle_t handle, void *buf, int len);
 
+int netlib_recvv(net_handle_t handle, const struct iovec *iov, int iovcnt);
+
 int netlib_close(net_handle_t handle);
 
 int netlib_option(net_handle_t handle, int opt, void *optval);
@@ -42,9 +90,26 @@ int netlib_register_timer(callback_t callback, void *user_data, uint64_t interva
 
 int netlib_delete_timer(callback_t callback, void *user_data);
 
+// 在当前loop添加定时器, 返回的句柄用于取消; 只能在loop线程调用
+timer_handle_t netlib_add_timer(callback_t callback, void *user_data, uint64_t delay, uint64_t interval);
+
+void netlib_cancel_timer(timer_handle_t timer);
+
+// loop回调只在loop被唤醒(其他线程投递任务或者netlib_wakeup)的那一轮执行, 还有事要做时自己再唤醒
 int netlib_add_loop(callback_t callback, void *user_data);
 
-void netlib_eventloop(uint32_t wait_timeout = 100);
+// 唤醒loop, 下一轮执行loop回调; 可以在任意线程调用
+int netlib_wakeup(uint32_t loop_index);
+
+// 投递任务到loop执行; 按值接收, 调用方传右值时一路移动到队列里, 不再拷贝
+int netlib_post(uint32_t loop_index, std::function<void()> task);
+
+uint32_t netlib_loop_num();
+
+uint32_t netlib_loop_index();
+
+// wait_timeout是最长等待时间, 默认只由定时器决定; 没有eventfd的平台上限是EVENT_POLL_TIMEOUT
+void netlib_eventloop(uint32_t wait_timeout = NETLIB_WAIT_INFINITE);
 
 void netlib_stop_event();
 
@@ -0,0 +1,235 @@
+#include "timer_wheel.h"
+
+CTimerWheel::CTimerWheel(uint64_t now) {
+    current_ = now;
+    size_ = 0;
+    running_ = NULL;
+    for (int i = 0; i < TIMER_WHEEL_ROOT_SIZE; i++) {
+        _ListInit(&root_[i]);
+    }
+    for (int level = 0; level < TIMER_WHEEL_LEVELS - 1; level++) {
+        for (int i = 0; i < TIMER_WHEEL_LEVEL_SIZE; i++) {
+            _ListInit(&levels_[level][i]);
+        }
+    }
+}
+
+CTimerWheel::~CTimerWheel() {
+    TimerNode all;
+    _ListInit(&all);
+    for (int i = 0; i < TIMER_WHEEL_ROOT_SIZE; i++) {
+        _ListMove(&root_[i], &all);
+    }
+    for (int level = 0; level < TIMER_WHEEL_LEVELS - 1; level++) {
+        for (int i = 0; i < TIMER_WHEEL_LEVEL_SIZE; i++) {
+            _ListMove(&levels_[level][i], &all);
+        }
+    }
+    while (!_ListEmpty(&all)) {
+        TimerNode *node = all.next;
+        _ListDel(node);
+        delete node;
+    }
+}
+
+timer_handle_t CTimerWheel::Add(callback_t callback, void *user_data, uint64_t now,
+                                uint64_t delay, uint64_t interval) {
+    TimerNode *node = new TimerNode;
+    node->expire = now + delay;
+    node->interval = interval;
+    node->callback = callback;
+    node->user_data = user_data;
+    node->cancelled = false;
+    _Insert(node);
+    size_++;
+    return node;
+}
+
+void CTimerWheel::Cancel(timer_handle_t timer) {
+    if (timer == running_) {
+        timer->cancelled = true;  // 回调返回后释放
+        return;
+    }
+    _ListDel(timer);
+    delete timer;
+    size_--;
+}
+
+void CTimerWheel::Reset(timer_handle_t timer, uint64_t now, uint64_t interval) {
+    _ListDel(timer);
+    timer->interval = interval;
+    timer->expire = now + interval;
+    _Insert(timer);
+}
+
+void CTimerWheel::Advance(uint64_t now) {
+    if (size_ == 0) {
+        if (current_ <= now) {
+            current_ = now + 1;
+        }
+        return;
+    }
+
+    TimerNode expired;
+    _ListInit(&expired);
+    while (current_ <= now && size_ > 0) {
+        // 跳过没有到期定时器也不用分散的tick, 睡了很久之后不用逐ms推进
+        uint64_t tick = _NextTick();
+        if (tick > now) {
+            break;
+        }
+        current_ = tick;
+        uint32_t index = current_ & (TIMER_WHEEL_ROOT_SIZE - 1);
+        if (index == 0) {
+            // 第0层转完一圈, 依次把上层当前槽分散下来
+            for (int level = 0; level < TIMER_WHEEL_LEVELS - 1; level++) {
+                uint32_t level_index = (current_ >> (TIMER_WHEEL_ROOT_BITS + level * TIMER_WHEEL_LEVEL_BITS))
+                                       & (TIMER_WHEEL_LEVEL_SIZE - 1);
+                _Cascade(level, level_index);
+                if (level_index != 0) {
+                    break;
+                }
+            }
+        }
+
+        // 先推进再回调, 回调里新加的定时器最早放到下一个tick
+        current_++;
+        _ListMove(&root_[index], &expired);
+        while (!_ListEmpty(&expired)) {
+            TimerNode *node = expired.next;
+            _ListDel(node);
+
+            running_ = node;
+            node->callback(node->user_data, NETLIB_MSG_TIMER, 0, NULL);
+            running_ = NULL;
+
+            if (node->next != node) {
+                continue;   // 回调里Reset过, 已经重新放进时间轮
+            }
+            if (node->cancelled || node->interval == 0) {
+                delete node;
+                size_--;
+                continue;
+            }
+            node->expire += node->interval;
+            if (node->expire <= now) {
+                node->expire = now + node->interval;  // 落后太多时不补触发
+            }
+            _Insert(node);
+        }
+    }
+    if (current_ <= now) {
+        current_ = now + 1;
+    }
+}
+
+uint64_t CTimerWheel::NextTimeout(uint64_t now, uint64_t max_timeout) {
+    if (size_ == 0) {
+        return max_timeout;
+    }
+
+    uint64_t tick = _NextTick();
+    if (tick <= now) {
+        return 0;
+    }
+    return tick - now < max_timeout ? tick - now : max_timeout;
+}
+
+// 下一个需要处理的tick: 第0层最早的非空槽, 或者上层非空槽重新分散的时间, 取早的
+uint64_t CTimerWheel::_NextTick() {
+    // 第0层的定时器都在[current_, current_ + 256)内, 按tick顺序第一个非空槽就是最早的
+    uint64_t tick = UINT64_MAX;
+    for (uint64_t i = 0; i < TIMER_WHEEL_ROOT_SIZE; i++) {
+        if (!_ListEmpty(&root_[(current_ + i) & (TIMER_WHEEL_ROOT_SIZE - 1)])) {
+            tick = current_ + i;
+            break;
+        }
+    }
+    // 分散只发生在第0层转完一圈的tick上, 在那之前找到了就不用看上层
+    uint64_t wrap = (current_ + TIMER_WHEEL_ROOT_SIZE - 1) & ~(uint64_t)(TIMER_WHEEL_ROOT_SIZE - 1);
+    if (tick < wrap) {
+        return tick;
+    }
+
+    // 上层的槽j在下一个对齐到2^shift且序号为j的tick分散, 那时更低的层序号都是0
+    for (int level = 0; level < TIMER_WHEEL_LEVELS - 1; level++) {
+        int shift = TIMER_WHEEL_ROOT_BITS + level * TIMER_WHEEL_LEVEL_BITS;
+        uint64_t base = current_ >> shift;
+        for (uint64_t j = 0; j < TIMER_WHEEL_LEVEL_SIZE; j++) {
+            if (_ListEmpty(&levels_[level][j])) {
+                continue;
+            }
+            uint64_t k = base + ((j - base) & (TIMER_WHEEL_LEVEL_SIZE - 1));
+            if ((k << shift) < current_) {
+                k += TIMER_WHEEL_LEVEL_SIZE;
+            }
+            if ((k << shift) < tick) {
+                tick = k << shift;
+            }
+        }
+    }
+    return tick;
+}
+
+void CTimerWheel::_Insert(TimerNode *node) {
+    uint64_t expire = node->expire < current_ ? current_ : node->expire;
+    uint64_t delta = expire - current_;
+    if (delta < TIMER_WHEEL_ROOT_SIZE) {
+        _ListAdd(&root_[expire & (TIMER_WHEEL_ROOT_SIZE - 1)], node);
+        return;
+    }
+
+    if (delta >= TIMER_WHEEL_MAX_SPAN) {
+        expire = current_ + TIMER_WHEEL_MAX_SPAN - 1;   // 超出范围, 先放在最远的槽, 分散时按真实时间重新放
+    }
+    for (int level = 0; level < TIMER_WHEEL_LEVELS - 1; level++) {
+        int shift = TIMER_WHEEL_ROOT_BITS + level * TIMER_WHEEL_LEVEL_BITS;
+        if (delta < (1ull << (shift + TIMER_WHEEL_LEVEL_BITS)) || level == TIMER_WHEEL_LEVELS - 2) {
+            _ListAdd(&levels_[level][(expire >> shift) & (TIMER_WHEEL_LEVEL_SIZE - 1)], node);
+            return;
+        }
+    }
+}
+
+void CTimerWheel::_Cascade(int level, uint32_t index) {
+    TimerNode list;
+    _ListInit(&list);
+    _ListMove(&levels_[level][index], &list);
+    while (!_ListEmpty(&list)) {
+        TimerNode *node = list.next;
+        _ListDel(node);
+        _Insert(node);
+    }
+}
+
+void CTimerWheel::_ListInit(TimerNode *head) {
+    head->prev = head;
+    head->next = head;
+}
+
+void CTimerWheel::_ListAdd(TimerNode *head, TimerNode *node) {
+    node->prev = head->prev;
+    node->next = head;
+    head->prev->next = node;
+    head->prev = node;
+}
+
+// 摘下后指向自己, 重复摘下没有影响
+void CTimerWheel::_ListDel(TimerNode *node) {
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->prev = node;
+    node->next = node;
+}
+
+// 把from整个接到to的末尾
+void CTimerWheel::_ListMove(TimerNode *from, TimerNode *to) {
+    if (_ListEmpty(from)) {
+        return;
+    }
+    from->next->prev = to->prev;
+    to->prev->next = from->next;
+    from->prev->next = to;
+    to->prev = from->prev;
+    _ListInit(from);
+}
@@ -0,0 +1,73 @@
+/*
+ * 分层时间轮, 每个loop一个, 只在本loop线程访问
+ * 1. 精度1ms, 4层: 256 + 64 + 64 + 64个槽, 覆盖2^26ms(约18.6小时), 更远的到期后重新放入
+ * 2. 添加、取消都是O(1): 定时器节点是侵入式双向链表, 句柄就是节点指针, 取消不需要查找
+ * 3. 推进时每个tick只处理一个槽, 第0层转完一圈时把上一层的一个槽重新分散下来;
+ *    没有定时器到期也不用分散的tick直接跳过
+ */
+#ifndef __TIMER_WHEEL_H__
+#define __TIMER_WHEEL_H__
+
+#include "util/ostype.h"
+
+#define TIMER_WHEEL_LEVELS      4
+#define TIMER_WHEEL_ROOT_BITS   8
+#define TIMER_WHEEL_LEVEL_BITS  6
+#define TIMER_WHEEL_ROOT_SIZE   (1 << TIMER_WHEEL_ROOT_BITS)
+#define TIMER_WHEEL_LEVEL_SIZE  (1 << TIMER_WHEEL_LEVEL_BITS)
+#define TIMER_WHEEL_MAX_SPAN    (1ull << (TIMER_WHEEL_ROOT_BITS + (TIMER_WHEEL_LEVELS - 1) * TIMER_WHEEL_LEVEL_BITS))
+
+typedef struct TimerNode {
+    struct TimerNode *prev;
+    struct TimerNode *next;
+    uint64_t expire;        // 到期时间(ms)
+    uint64_t interval;      // 0表示只触发一次
+    callback_t callback;
+    void *user_data;
+    bool cancelled;         // 在自己的回调里被取消, 回调返回后再释放
+} TimerNode;
+
+typedef TimerNode *timer_handle_t;
+
+class CTimerWheel {
+  public:
+    CTimerWheel(uint64_t now);
+    ~CTimerWheel();
+
+    // delay毫秒后触发, interval不为0时之后每隔interval触发一次
+    // 只触发一次的定时器回调返回后句柄就失效了, 不能再Cancel
+    timer_handle_t Add(callback_t callback, void *user_data, uint64_t now, uint64_t delay,
+                       uint64_t interval);
+    // 取消后句柄失效; 可以在任意定时器回调里调用, 包括取消自己
+    void Cancel(timer_handle_t timer);
+    // 修改间隔并从now开始重新计时
+    void Reset(timer_handle_t timer, uint64_t now, uint64_t interval);
+
+    // 触发所有到期的定时器
+    void Advance(uint64_t now);
+    // 距离下一个定时器到期最多还有多少毫秒, 没有定时器时返回max_timeout;
+    // 下一个定时器在上层时返回它所在的槽重新分散的时间, 只会提前醒来, 不会晚, 每层最多多醒一次
+    uint64_t NextTimeout(uint64_t now, uint64_t max_timeout);
+
+    size_t Size() { return size_; }
+
+  private:
+    uint64_t _NextTick();
+    void _Insert(TimerNode *node);
+    void _Cascade(int level, uint32_t index);
+
+    static void _ListInit(TimerNode *head);
+    static bool _ListEmpty(TimerNode *head) { return head->next == head; }
+    static void _ListAdd(TimerNode *head, TimerNode *node);
+    static void _ListDel(TimerNode *node);
+    static void _ListMove(TimerNode *from, TimerNode *to);
+
+  private:
+    TimerNode root_[TIMER_WHEEL_ROOT_SIZE];
+    TimerNode levels_[TIMER_WHEEL_LEVELS - 1][TIMER_WHEEL_LEVEL_SIZE];
+    uint64_t current_;      // 下一个要处理的tick, 之前的都已经触发
+    size_t size_;
+    TimerNode *running_;    // 正在执行回调的定时器
+};
+
+#endif
@@ -0,0 +1,316 @@
+#include "uring_poller.h"
+
+#ifdef NETLIB_HAVE_URING
+
+#include "util/dlog.h"
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+#include <string.h>
+#include <time.h>
+
+static int io_uring_setup(uint32_t entries, struct io_uring_params *params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_enter(int fd, uint32_t to_submit, uint32_t min_complete, uint32_t flags,
+                          void *arg, size_t arg_size) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, arg_size);
+}
+
+// 多次触发的recv是6.0加的, 旧内核会在第一次recv时才报EINVAL, 所以先看版本
+static bool _KernelAtLeast(int major, int minor) {
+    struct utsname name;
+    int kmajor = 0, kminor = 0;
+    if (uname(&name) != 0 || sscanf(name.release, "%d.%d", &kmajor, &kminor) != 2) {
+        return false;
+    }
+    return kmajor > major || (kmajor == major && kminor >= minor);
+}
+
+CUringPoller::CUringPoller() {
+    ring_fd_ = -1;
+    sq_ptr_ = MAP_FAILED;
+    sq_size_ = 0;
+    cq_ptr_ = MAP_FAILED;
+    cq_size_ = 0;
+    sqes_ = (struct io_uring_sqe *)MAP_FAILED;
+    sqes_size_ = 0;
+    sq_ktail_ = NULL;
+    sq_khead_ = NULL;
+    sq_mask_ = 0;
+    sq_entries_ = 0;
+    sqe_tail_ = 0;
+    sqe_submitted_ = 0;
+    cq_khead_ = NULL;
+    cq_ktail_ = NULL;
+    cq_mask_ = 0;
+    cqes_ = NULL;
+    bufs_ = NULL;
+    buf_count_ = 0;
+    buf_size_ = 0;
+}
+
+CUringPoller::~CUringPoller() {
+    if (ring_fd_ >= 0) {
+        close(ring_fd_);   // 先关ring, 内核不再访问下面的内存
+    }
+    free(bufs_);
+    if (sqes_ != MAP_FAILED) {
+        munmap(sqes_, sqes_size_);
+    }
+    if (cq_ptr_ != MAP_FAILED && cq_ptr_ != sq_ptr_) {
+        munmap(cq_ptr_, cq_size_);
+    }
+    if (sq_ptr_ != MAP_FAILED) {
+        munmap(sq_ptr_, sq_size_);
+    }
+}
+
+bool CUringPoller::Init(uint32_t entries, uint32_t buf_count, uint32_t buf_size) {
+    if (!_KernelAtLeast(6, 0)) {
+        LogWarn("io_uring multishot recv needs linux 6.0+");
+        return false;
+    }
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL;
+    params.cq_entries = entries * 4;
+    ring_fd_ = io_uring_setup(entries, &params);
+    if (ring_fd_ < 0) {
+        LogWarn("io_uring_setup failed, error: {}", strerror(errno));
+        return false;
+    }
+    if (!(params.features & IORING_FEAT_EXT_ARG) || !(params.features & IORING_FEAT_NODROP)) {
+        LogWarn("io_uring lacks EXT_ARG/NODROP, features: {:#x}", params.features);
+        return false;
+    }
+
+    sq_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_size_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        sq_size_ = cq_size_ = sq_size_ > cq_size_ ? sq_size_ : cq_size_;
+    }
+    sq_ptr_ = mmap(NULL, sq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_,
+                   IORING_OFF_SQ_RING);
+    if (sq_ptr_ == MAP_FAILED) {
+        LogWarn("mmap sq ring failed, error: {}", strerror(errno));
+        return false;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        cq_ptr_ = sq_ptr_;
+    } else {
+        cq_ptr_ = mmap(NULL, cq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_,
+                       IORING_OFF_CQ_RING);
+        if (cq_ptr_ == MAP_FAILED) {
+            LogWarn("mmap cq ring failed, error: {}", strerror(errno));
+            return false;
+        }
+    }
+    sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+    sqes_ = (struct io_uring_sqe *)mmap(NULL, sqes_size_, PROT_READ | PROT_WRITE,
+                                        MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+    if (sqes_ == MAP_FAILED) {
+        LogWarn("mmap sqes failed, error: {}", strerror(errno));
+        return false;
+    }
+
+    uint8_t *sq = (uint8_t *)sq_ptr_;
+    sq_khead_ = (unsigned *)(sq + params.sq_off.head);
+    sq_ktail_ = (unsigned *)(sq + params.sq_off.tail);
+    sq_mask_ = *(unsigned *)(sq + params.sq_off.ring_mask);
+    sq_entries_ = params.sq_entries;
+    // SQE按下标顺序使用, 间接数组固定成恒等映射
+    unsigned *sq_array = (unsigned *)(sq + params.sq_off.array);
+    for (unsigned i = 0; i < sq_entries_; i++) {
+        sq_array[i] = i;
+    }
+    sqe_tail_ = sqe_submitted_ = *sq_ktail_;
+
+    uint8_t *cq = (uint8_t *)cq_ptr_;
+    cq_khead_ = (unsigned *)(cq + params.cq_off.head);
+    cq_ktail_ = (unsigned *)(cq + params.cq_off.tail);
+    cq_mask_ = *(unsigned *)(cq + params.cq_off.ring_mask);
+    cqes_ = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    return _SetupBuffers(buf_count, buf_size);
+}
+
+bool CUringPoller::_SetupBuffers(uint32_t buf_count, uint32_t buf_size) {
+    bufs_ = (uint8_t *)malloc((size_t)buf_count * buf_size);
+    if (bufs_ == NULL) {
+        return false;
+    }
+    buf_count_ = buf_count;
+    buf_size_ = buf_size;
+    buf_free_.reserve(buf_count);
+    buf_commit_.reserve(buf_count);
+    for (uint32_t i = 0; i < buf_count; i++) {
+        RecycleBuffer((uint16_t)i);
+    }
+    CommitBuffers();
+    return true;
+}
+
+struct io_uring_sqe *CUringPoller::GetSqe() {
+    unsigned head = __atomic_load_n(sq_khead_, __ATOMIC_ACQUIRE);
+    if (sqe_tail_ - head >= sq_entries_) {
+        SubmitAndWait(-1);
+        head = __atomic_load_n(sq_khead_, __ATOMIC_ACQUIRE);
+        if (sqe_tail_ - head >= sq_entries_) {
+            return NULL;
+        }
+    }
+
+    struct io_uring_sqe *sqe = &sqes_[sqe_tail_ & sq_mask_];
+    sqe_tail_++;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+// wait_ms < 0: 只提交不等待
+int CUringPoller::SubmitAndWait(int wait_ms) {
+    CommitBuffers();
+
+    uint32_t to_submit = sqe_tail_ - sqe_submitted_;
+    if (to_submit > 0) {
+        __atomic_store_n(sq_ktail_, sqe_tail_, __ATOMIC_RELEASE);
+        sqe_submitted_ = sqe_tail_;
+    }
+    if (wait_ms < 0 || (wait_ms == 0 && HasCqe())) {
+        return to_submit > 0 ? _Enter(to_submit, 0, 0, -1) : 0;
+    }
+    return _Enter(to_submit, 1, IORING_ENTER_GETEVENTS, wait_ms);
+}
+
+int CUringPoller::_Enter(uint32_t to_submit, uint32_t min_complete, uint32_t flags, int wait_ms) {
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+    void *parg = NULL;
+    size_t arg_size = 0;
+    if ((flags & IORING_ENTER_GETEVENTS) && wait_ms != URING_WAIT_FOREVER) {
+        ts.tv_sec = wait_ms / 1000;
+        ts.tv_nsec = (wait_ms % 1000) * 1000000;
+        memset(&arg, 0, sizeof(arg));
+        arg.ts = (uint64_t)(uintptr_t)&ts;
+        flags |= IORING_ENTER_EXT_ARG;
+        parg = &arg;
+        arg_size = sizeof(arg);
+    }
+
+    int ret = io_uring_enter(ring_fd_, to_submit, min_complete, flags, parg, arg_size);
+    if (ret < 0 && errno != ETIME && errno != EINTR && errno != EBUSY) {
+        LogError("io_uring_enter failed, error: {}", strerror(errno));
+    }
+    return ret;
+}
+
+struct io_uring_cqe *CUringPoller::PeekCqe() {
+    unsigned head = *cq_khead_;
+    if (head == __atomic_load_n(cq_ktail_, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    return &cqes_[head & cq_mask_];
+}
+
+void CUringPoller::SeenCqe() {
+    __atomic_store_n(cq_khead_, *cq_khead_ + 1, __ATOMIC_RELEASE);
+}
+
+bool CUringPoller::PrepAccept(int fd, uint64_t user_data) {
+    struct io_uring_sqe *sqe = GetSqe();
+    if (!sqe) {
+        return false;
+    }
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = user_data;
+    return true;
+}
+
+bool CUringPoller::PrepRecv(int fd, uint64_t user_data) {
+    struct io_uring_sqe *sqe = GetSqe();
+    if (!sqe) {
+        return false;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUF_GROUP;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->user_data = user_data;
+    return true;
+}
+
+bool CUringPoller::PrepSend(int fd, const void *buf, uint32_t len, uint64_t user_data) {
+    struct io_uring_sqe *sqe = GetSqe();
+    if (!sqe) {
+        return false;
+    }
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = len;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = user_data;
+    return true;
+}
+
+bool CUringPoller::PrepPollAdd(int fd, uint32_t poll_mask, uint64_t user_data) {
+    struct io_uring_sqe *sqe = GetSqe();
+    if (!sqe) {
+        return false;
+    }
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = poll_mask;
+    sqe->user_data = user_data;
+    return true;
+}
+
+bool CUringPoller::PrepCancel(uint64_t target) {
+    struct io_uring_sqe *sqe = GetSqe();
+    if (!sqe) {
+        return false;
+    }
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = target;
+    sqe->user_data = URING_OP_NONE;
+    return true;
+}
+
+void CUringPoller::CommitBuffers() {
+    if (buf_free_.empty()) {
+        return;
+    }
+    // 先换出来, GetSqe在SQ满时会提交, 又会走到这里
+    buf_commit_.swap(buf_free_);
+    size_t i = 0;
+    while (i < buf_commit_.size()) {
+        uint16_t start = buf_commit_[i];
+        size_t n = 1;
+        while (i + n < buf_commit_.size() && buf_commit_[i + n] == start + n) {
+            n++;
+        }
+        struct io_uring_sqe *sqe = GetSqe();
+        if (!sqe) {
+            break;      // 剩下的下一轮再还
+        }
+        sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+        sqe->fd = (int)n;
+        sqe->addr = (uint64_t)(uintptr_t)GetBuffer(start);
+        sqe->len = buf_size_;
+        sqe->off = start;
+        sqe->buf_group = URING_BUF_GROUP;
+        sqe->user_data = URING_OP_NONE;
+        i += n;
+    }
+    buf_free_.insert(buf_free_.end(), buf_commit_.begin() + i, buf_commit_.end());
+    buf_commit_.clear();
+}
+
+#endif
@@ -0,0 +1,97 @@
+/*
+ * io_uring的薄封装, 每个loop一个实例, 只在本loop线程访问
+ * 1. 直接用系统调用和linux/io_uring.h, 不依赖liburing
+ * 2. SQE先在用户态攒着, 每轮循环只用一次io_uring_enter提交并等待
+ * 3. 接收用内核选择的缓冲区(IORING_OP_PROVIDE_BUFFERS), 空闲连接不占接收缓冲区
+ *    没用PBUF_RING: 部分内核/虚拟化环境下注册能成功但recv总是返回ENOBUFS
+ */
+#ifndef __URING_POLLER_H__
+#define __URING_POLLER_H__
+
+#ifdef NETLIB_HAVE_URING
+
+#include "util/ostype.h"
+#include <linux/io_uring.h>
+#include <vector>
+
+#define URING_DEFAULT_ENTRIES       4096    // SQ大小, CQ是它的4倍, 多次触发的请求一批会产生很多CQE
+#define URING_DEFAULT_BUF_COUNT     512     // 每个loop的接收缓冲区个数
+#define URING_DEFAULT_BUF_SIZE      (16 * 1024)
+#define URING_BUF_GROUP             0
+#define URING_WAIT_FOREVER          INT32_MAX   // SubmitAndWait一直等到有完成事件
+
+// user_data低3位是请求类型, 其余是CBaseSocket指针
+enum {
+    URING_OP_NONE = 0,
+    URING_OP_ACCEPT,
+    URING_OP_RECV,
+    URING_OP_SEND,
+    URING_OP_POLL,
+    URING_OP_WAKEUP,        // 其他线程投递任务, 指针部分是CEventDispatch
+    URING_OP_MASK = 0x7
+};
+
+class CUringPoller {
+  public:
+    CUringPoller();
+    ~CUringPoller();
+
+    // 内核不支持(多次触发的recv需要6.0以上)或者被禁止时返回false, 调用者改用epoll
+    bool Init(uint32_t entries, uint32_t buf_count, uint32_t buf_size);
+
+    // SQ满了时先提交再取
+    struct io_uring_sqe *GetSqe();
+    // 提交攒着的SQE, 没有CQE时最多等wait_ms毫秒; 小于0只提交不等, URING_WAIT_FOREVER不限时
+    int SubmitAndWait(int wait_ms);
+
+    struct io_uring_cqe *PeekCqe();
+    void SeenCqe();
+    bool HasCqe() { return PeekCqe() != NULL; }
+
+    bool PrepAccept(int fd, uint64_t user_data);        // 多次触发的accept
+    bool PrepRecv(int fd, uint64_t user_data);          // 多次触发的recv, 从缓冲区环里取缓冲区
+    bool PrepSend(int fd, const void *buf, uint32_t len, uint64_t user_data);
+    bool PrepPollAdd(int fd, uint32_t poll_mask, uint64_t user_data);
+    bool PrepCancel(uint64_t target);                   // 按user_data取消, 完成事件user_data为0
+
+    uint8_t *GetBuffer(uint16_t bid) { return bufs_ + (size_t)bid * buf_size_; }
+    uint32_t GetBufferSize() { return buf_size_; }
+    // 缓冲区用完后先攒着, CommitBuffers把连续的一段合成一个PROVIDE_BUFFERS请求还给内核
+    void RecycleBuffer(uint16_t bid) { buf_free_.push_back(bid); }
+    void CommitBuffers();
+
+  private:
+    int _Enter(uint32_t to_submit, uint32_t min_complete, uint32_t flags, int wait_ms);
+    bool _SetupBuffers(uint32_t buf_count, uint32_t buf_size);
+
+  private:
+    int ring_fd_;
+    void *sq_ptr_;
+    size_t sq_size_;
+    void *cq_ptr_;
+    size_t cq_size_;
+    struct io_uring_sqe *sqes_;
+    size_t sqes_size_;
+
+    unsigned *sq_ktail_;
+    unsigned *sq_khead_;
+    unsigned sq_mask_;
+    unsigned sq_entries_;
+    unsigned sqe_tail_;         // 已经取出的SQE
+    unsigned sqe_submitted_;    // 已经提交给内核的SQE
+
+    unsigned *cq_khead_;
+    unsigned *cq_ktail_;
+    unsigned cq_mask_;
+    struct io_uring_cqe *cqes_;
+
+    uint8_t *bufs_;
+    uint32_t buf_count_;
+    uint32_t buf_size_;
+    std::vector<uint16_t> buf_free_;    // 还没还给内核的缓冲区
+    std::vector<uint16_t> buf_commit_;
+};
+
+#endif
+
+#endif
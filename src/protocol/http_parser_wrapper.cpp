@@ -38,6 +38,7 @@ void CHttpParserWrapper::ParseHttpContent(const char *buf, uint32_t len) {
     read_content_type_ = false;  // 是否读取Content-Type
     read_content_len_ = false;   // 是否读取Content-Length
     read_host_ = false;          // 是否读取Host
+    read_range_ = false;         // 是否读取Range
     total_length_ = 0;           // 总长度
     url_.clear();                // URL
     body_content_.clear();       // 消息体内容
@@ -47,6 +48,7 @@ void CHttpParserWrapper::ParseHttpContent(const char *buf, uint32_t len) {
     content_type_.clear();       // Content-Type
     content_len_ = 0;            // Content-Length
     host_.clear();               // Host
+    range_.clear();              // Range
 
     // 执行HTTP解析
     http_parser_execute(&http_parser_, &settings_, buf, len);
@@ -96,6 +98,11 @@ int CHttpParserWrapper::OnHeaderField(http_parser *parser, const char *at,
             ((CHttpParserWrapper *)obj)->SetReadHost(true);
         }
     }
+    if (!((CHttpParserWrapper *)obj)->HasReadRange()) {
+        if (length == 5 && strncasecmp(at, "Range", 5) == 0) {
+            ((CHttpParserWrapper *)obj)->SetReadRange(true);
+        }
+    }
     return 0;
 }
 
@@ -134,6 +141,11 @@ int CHttpParserWrapper::OnHeaderValue(http_parser *parser, const char *at,
         ((CHttpParserWrapper *)obj)->SetHost(at, length);
         ((CHttpParserWrapper *)obj)->SetReadHost(false);
     }
+
+    if (((CHttpParserWrapper *)obj)->IsReadRange()) {
+        ((CHttpParserWrapper *)obj)->SetRange(at, length);
+        ((CHttpParserWrapper *)obj)->SetReadRange(false);
+    }
     return 0;
 }
 
@@ -28,6 +28,8 @@ class CHttpParserWrapper {
     bool HasReadContentLen() { return content_len_ != 0; }
     bool IsReadHost() { return read_host_; }
     bool HasReadHost() { return host_.size() > 0; }
+    bool IsReadRange() { return read_range_; }
+    bool HasReadRange() { return range_.size() > 0; }
 
     uint32_t GetTotalLength() { return total_length_; }
     char *GetUrl() { return (char *)url_.c_str(); }
@@ -40,6 +42,7 @@ class CHttpParserWrapper {
     char *GetContentType() { return (char *)content_type_.c_str(); }
     uint32_t GetContentLen() { return content_len_; }
     char *GetHost() { return (char *)host_.c_str(); }
+    char *GetRange() { return (char *)range_.c_str(); }
 
     void SetUrl(const char *url, size_t length) { url_.append(url, length); }
     void SetReferer(const char *referer, size_t length) {
@@ -62,6 +65,9 @@ class CHttpParserWrapper {
     void SetHost(const char *host, size_t length) {
         host_.append(host, length);
     }
+    void SetRange(const char *range, size_t length) {
+        range_.append(range, length);
+    }
     void SetReadAll() { read_all_ = true; }
     void SetReadReferer(bool read_referer) { read_referer_ = read_referer; }
     void SetReadForwardIP(bool read_forward_ip) {
@@ -77,6 +83,7 @@ class CHttpParserWrapper {
         read_content_len_ = read_content_len;
     }
     void SetReadHost(bool read_host) { read_host_ = read_host; }
+    void SetReadRange(bool read_range) { read_range_ = read_range; }
 
     static int OnUrl(http_parser *parser, const char *at, size_t length,
                      void *obj);
@@ -100,6 +107,7 @@ class CHttpParserWrapper {
     bool read_content_type_;
     bool read_content_len_;
     bool read_host_;
+    bool read_range_;
     uint32_t total_length_;
     string url_;
     string body_content_;
@@ -109,6 +117,7 @@ class CHttpParserWrapper {
     string content_type_;
     uint32_t content_len_;
     string host_;
+    string range_;
 };
 
 #endif
@@ -10,48 +10,6 @@
 
 #define MIN(x, y) ((x) < (y) ? (x) : (y))
 
-static struct rtmp_packet_t* rtmp_packet_find(struct rtmp_t* rtmp, uint32_t cid)
-{
-	RTMP_TRACE_INTO
-	// LogInfo("cid: {}", cid);
-	uint32_t i;
-	struct rtmp_packet_t* pkt;
-
-	// The protocol supports up to 65597 streams with IDs 3-65599
-	assert(cid <= 65535 + 64 && cid >= 2 /* Protocol Control Messages */);
-	for (i = 0; i < N_CHUNK_STREAM; i++)
-	{
-		pkt = rtmp->in_packets + ((i + cid) % N_CHUNK_STREAM);
-		if (pkt->header.cid == cid)
-			return pkt;
-	}
-	return NULL;
-}
-
-static struct rtmp_packet_t* rtmp_packet_create(struct rtmp_t* rtmp, uint32_t cid)
-{
-	RTMP_TRACE_INTO
-	uint32_t i;
-	struct rtmp_packet_t* pkt;
-
-	// The protocol supports up to 65597 streams with IDs 3-65599
-	assert(cid <= 65535 + 64 && cid >= 2 /* Protocol Control Messages */);
-	assert(NULL == rtmp_packet_find(rtmp, cid));
-	for (i = 0; i < N_CHUNK_STREAM; i++)
-	{
-		pkt = rtmp->in_packets + ((i + cid) % N_CHUNK_STREAM);
-		if (0 == pkt->header.cid) {
-			LogDebug("rtmp_packet_find pkt->bytes: {}", pkt->bytes);
-			if(pkt->bytes > 1000000) {
-				pkt->bytes = 0;
-				LogError("fix me, pkt->bytes exception");
-			}
-			return pkt;
-		}
-	}
-	return NULL;
-}
-
 static struct rtmp_packet_t* rtmp_packet_parse(struct rtmp_t* rtmp, const uint8_t* buffer)
 {
 	RTMP_TRACE_INTO
@@ -63,13 +21,13 @@ static struct rtmp_packet_t* rtmp_packet_parse(struct rtmp_t* rtmp, const uint8_
 	buffer += rtmp_chunk_basic_header_read(buffer, &fmt, &cid);
 
 	// load previous header
-	packet = rtmp_packet_find(rtmp, cid);
+	packet = rtmp_packet_table_find(&rtmp->in_packets, cid);
 	if (NULL == packet)
 	{
 		if (RTMP_CHUNK_TYPE_0 != fmt && RTMP_CHUNK_TYPE_1 != fmt)
 			return NULL; // don't know stream length
 
-		packet = rtmp_packet_create(rtmp, cid);
+		packet = rtmp_packet_table_get(&rtmp->in_packets, cid);
 		if (NULL == packet)
 			return NULL;
 	}
@@ -86,11 +44,24 @@ static int rtmp_packet_alloc(struct rtmp_t* rtmp, struct rtmp_packet_t* packet)
 {
 	RTMP_TRACE_INTO
 	void* p;
-	(void)rtmp;
 
 	// 24-bytes length
 	assert(0 == packet->bytes);
 	assert(packet->header.length < (1 << 24));
+	assert(NULL == packet->frame);
+
+	// 音视频直接重组到上层的帧缓冲区, 完成后这块内存就是交给上层的帧
+	if (rtmp->onframe_alloc && packet->header.length > 0 && (RTMP_TYPE_AUDIO == packet->header.type
+		|| RTMP_TYPE_VIDEO == packet->header.type || RTMP_TYPE_DATA == packet->header.type))
+	{
+		packet->frame = rtmp->onframe_alloc(rtmp->param, packet->header.type, packet->header.length, &packet->frame_payload);
+		if (packet->frame)
+		{
+			packet->frame_capacity = packet->header.length;
+			return 0;
+		}
+	}
+
 	// fixed SMS (Chinacache Smart Media Server) packet->header.length = 0
 	if (0 == packet->capacity || packet->capacity < packet->header.length)
 	{
@@ -111,7 +82,8 @@ int rtmp_chunk_read(struct rtmp_t* rtmp, const uint8_t* data, size_t bytes)
 	const static uint32_t s_header_size[] = { 11, 7, 3, 0 };
 
 	int r, invalid_extended_timestamp;
-	size_t size, offset = 0;
+	size_t size, capacity, offset = 0;
+	uint8_t* payload;
 	uint8_t extended_timestamp_buffer[4];
 	uint32_t extended_timestamp = 0;
 	struct rtmp_parser_t* parser = &rtmp->parser;
@@ -162,7 +134,6 @@ int rtmp_chunk_read(struct rtmp_t* rtmp, const uint8_t* data, size_t bytes)
 			if (parser->bytes >= size)
 			{
 				parser->pkt = rtmp_packet_parse(rtmp, parser->buffer);
-				LogDebug("rtmp_packet_parse pkt->bytes: {}", parser->pkt->bytes);
 				parser->state = RTMP_PARSE_EXTENDED_TIMESTAMP;
 			}
 			break;
@@ -207,9 +178,6 @@ int rtmp_chunk_read(struct rtmp_t* rtmp, const uint8_t* data, size_t bytes)
 						parser->pkt->clock = parser->pkt->delta;
 					else
 						parser->pkt->clock += parser->pkt->delta;
-
-					if (0 != rtmp_packet_alloc(rtmp, parser->pkt))
-						return -ENOMEM;
 				}
 				parser->state = RTMP_PARSE_PAYLOAD;
 
@@ -223,11 +191,34 @@ int rtmp_chunk_read(struct rtmp_t* rtmp, const uint8_t* data, size_t bytes)
 			break;
 
 		case RTMP_PARSE_PAYLOAD:
+			if (NULL == parser->pkt) return -ENOMEM;
+
+			if (0 == parser->pkt->bytes)
+			{
+				// 单个块的消息已经完整地在接收缓冲区里, 直接交给rtmp_handler, 不拷贝
+				if (parser->pkt->header.length <= rtmp->in_chunk_size && parser->pkt->header.length <= bytes - offset)
+				{
+					parser->state = RTMP_PARSE_INIT; // reset parser state
+					memcpy(&header, &parser->pkt->header, sizeof(header));
+					header.timestamp = parser->pkt->clock;
+					offset += header.length;
+					r = rtmp_handler(rtmp, &header, data + offset - header.length);
+					if (0 != r) return r;
+					break;
+				}
+
+				// 跨块或者没收全, 按原来的方式拼接
+				if (0 != rtmp_packet_alloc(rtmp, parser->pkt))
+					return -ENOMEM;
+			}
+
+			payload = parser->pkt->frame ? parser->pkt->frame_payload : parser->pkt->payload;
+			capacity = parser->pkt->frame ? parser->pkt->frame_capacity : parser->pkt->capacity;
 			// LogInfo("pkt->bytes1: {}", parser->pkt->bytes);
-			if (NULL == parser->pkt || NULL == parser->pkt->payload 
-				|| parser->pkt->bytes > parser->pkt->capacity 
+			if (NULL == payload
+				|| parser->pkt->bytes > capacity
 				|| parser->pkt->bytes > parser->pkt->header.length 
-				|| parser->pkt->header.length > parser->pkt->capacity)
+				|| parser->pkt->header.length > capacity)
 			{
 				assert(0);
 				return -ENOMEM;
@@ -237,7 +228,7 @@ int rtmp_chunk_read(struct rtmp_t* rtmp, const uint8_t* data, size_t bytes)
 			size = MIN(rtmp->in_chunk_size - (parser->pkt->bytes % rtmp->in_chunk_size), 
 				parser->pkt->header.length - parser->pkt->bytes);
 			size = MIN(size, bytes - offset);
-			if(size > 0) memcpy(parser->pkt->payload + parser->pkt->bytes, data + offset, size);
+			if(size > 0) memcpy(payload + parser->pkt->bytes, data + offset, size);
 			parser->pkt->bytes += size;
 			// LogInfo("pkt->bytes2: {}", parser->pkt->bytes);
 			if(parser->pkt->bytes > 1000000) {
@@ -254,7 +245,15 @@ int rtmp_chunk_read(struct rtmp_t* rtmp, const uint8_t* data, size_t bytes)
 
 				memcpy(&header, &parser->pkt->header, sizeof(header));
 				header.timestamp = parser->pkt->clock;
-				r = rtmp_handler(rtmp, &header, parser->pkt->payload);
+				rtmp->frame = parser->pkt->frame;
+				r = rtmp_handler(rtmp, &header, payload);
+				rtmp->frame = NULL;
+				if (parser->pkt->frame)
+				{
+					// 上层需要的话已经在回调里增加了引用
+					rtmp->onframe_free(rtmp->param, parser->pkt->frame);
+					parser->pkt->frame = NULL;
+				}
 				if(0 != r) return r;
 			}
 			else if (0 == (parser->pkt->bytes % rtmp->in_chunk_size))
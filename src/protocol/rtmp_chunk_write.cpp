@@ -2,6 +2,7 @@
 #include "rtmp_chunk_header.h"
 #include "rtmp_internal.h"
 #include "rtmp_util.h"
+#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include <errno.h>
@@ -10,40 +11,6 @@
 /* 3-bytes basic header + 11-bytes message header + 4-bytes extended timestamp */
 //#define MAX_CHUNK_HEADER 18
 
-static struct rtmp_packet_t* rtmp_packet_find(struct rtmp_t* rtmp, uint32_t cid)
-{
-	RTMP_TRACE_INTO
-	uint32_t i;
-	struct rtmp_packet_t* pkt;
-
-	// The protocol supports up to 65597 streams with IDs 3-65599
-	assert(cid <= 65535 + 64 && cid >= 2 /* Protocol Control Messages */);
-	for (i = 0; i < N_CHUNK_STREAM; i++)
-	{	// 如果cid=3
-		pkt = rtmp->out_packets + ((i + cid) % N_CHUNK_STREAM);
-		if (pkt->header.cid == cid)
-			return pkt;
-	}
-	return NULL;
-}
-
-//static struct rtmp_packet_t* rtmp_packet_create(struct rtmp_t* rtmp, uint32_t cid)
-//{
-//	uint32_t i;
-//	struct rtmp_packet_t* pkt;
-//
-//	// The protocol supports up to 65597 streams with IDs 3-65599
-//	assert(cid <= 65535 + 64 && cid >= 2 /* Protocol Control Messages */);
-//	assert(NULL == rtmp_packet_find(rtmp, cid));
-//	for (i = 0; i < N_CHUNK_STREAM; i++)
-//	{
-//		pkt = rtmp->out_packets + ((i + cid) % N_CHUNK_STREAM);
-//		if (0 == pkt->header.cid)
-//			return pkt;
-//	}
-//	return NULL;
-//}
-
 static const struct rtmp_chunk_header_t* rtmp_chunk_header_zip(struct rtmp_t* rtmp, const struct rtmp_chunk_header_t* header)
 {
 	RTMP_TRACE_INTO
@@ -56,15 +23,9 @@ static const struct rtmp_chunk_header_t* rtmp_chunk_header_zip(struct rtmp_t* rt
 	memcpy(&h, header, sizeof(h));
 
 	// find previous chunk header
-	pkt = rtmp_packet_find(rtmp, h.cid);
+	pkt = rtmp_packet_table_get(&rtmp->out_packets, h.cid);
 	if (NULL == pkt)
-	{
-		//pkt = rtmp_packet_create(rtmp, h.cid);
-		//if (NULL == pkt)
-		//	return NULL; // too many chunk stream id
-		assert(0);
-		return NULL; // can't find chunk stream id 
-	}
+		return NULL; // too many chunk stream id
 
 	h.fmt = RTMP_CHUNK_TYPE_0;
 	if (RTMP_CHUNK_TYPE_0 != header->fmt /* enable compress */
@@ -89,6 +50,46 @@ static const struct rtmp_chunk_header_t* rtmp_chunk_header_zip(struct rtmp_t* rt
 	return &pkt->header;
 }
 
+// 栈上的iovec个数, 一条消息的chunk数超过一半时才malloc
+#define N_CHUNK_IOVEC 64
+
+// 首块头和后续块头(TYPE_3, 所有后续块都相同)各写一次, iovec重复引用后续块头
+static int rtmp_chunk_writev(struct rtmp_t* rtmp, const struct rtmp_chunk_header_t* header, const uint8_t* payload, const uint8_t* p, uint32_t headerSize)
+{
+	int r, n;
+	uint8_t c[MAX_CHUNK_HEADER];
+	uint32_t chunkSize, contSize, payloadSize, chunks;
+	struct iovec vec[N_CHUNK_IOVEC];
+	struct iovec* iov;
+
+	payloadSize = header->length;
+	chunks = (payloadSize + rtmp->out_chunk_size - 1) / rtmp->out_chunk_size;
+	iov = chunks * 2 <= N_CHUNK_IOVEC ? vec : (struct iovec*)malloc(chunks * 2 * sizeof(struct iovec));
+	if (!iov)
+		return -ENOMEM;
+
+	contSize = rtmp_chunk_basic_header_write(c, RTMP_CHUNK_TYPE_3, header->cid);
+	if (header->timestamp >= 0xFFFFFF)
+		contSize += rtmp_chunk_extended_timestamp_write(c + contSize, header->timestamp);
+
+	for (n = 0; payloadSize > 0; n += 2)
+	{
+		chunkSize = payloadSize < rtmp->out_chunk_size ? payloadSize : rtmp->out_chunk_size;
+		iov[n].iov_base = (void*)(0 == n ? p : c);
+		iov[n].iov_len = 0 == n ? headerSize : contSize;
+		iov[n + 1].iov_base = (void*)payload;
+		iov[n + 1].iov_len = chunkSize;
+
+		payload += chunkSize;
+		payloadSize -= chunkSize;
+	}
+
+	r = rtmp->sendv(rtmp->param, iov, n);
+	if (iov != vec)
+		free(iov);
+	return r;
+}
+
 int rtmp_chunk_write(struct rtmp_t* rtmp, const struct rtmp_chunk_header_t* h, const uint8_t* payload)
 {
 	RTMP_TRACE_INTO
@@ -108,6 +109,9 @@ int rtmp_chunk_write(struct rtmp_t* rtmp, const struct rtmp_chunk_header_t* h, c
 	if(header->timestamp >= 0xFFFFFF)
 		headerSize += rtmp_chunk_extended_timestamp_write(p + headerSize, header->timestamp);
 
+	if (rtmp->sendv)
+		return payloadSize > 0 ? rtmp_chunk_writev(rtmp, header, payload, p, headerSize) : 0;
+
 	while (payloadSize > 0 && 0 == r)
 	{
 		chunkSize = payloadSize < rtmp->out_chunk_size ? payloadSize : rtmp->out_chunk_size;
@@ -126,3 +130,58 @@ int rtmp_chunk_write(struct rtmp_t* rtmp, const struct rtmp_chunk_header_t* h, c
 
 	return r;
 }
+
+size_t rtmp_chunk_serialize(const struct rtmp_chunk_header_t* header, const uint8_t* payload, uint32_t chunk_size, uint8_t* out)
+{
+	RTMP_TRACE_INTO
+	uint8_t p[MAX_CHUNK_HEADER];
+	uint32_t chunkSize, headerSize, payloadSize;
+	size_t bytes = 0;
+
+	assert(RTMP_CHUNK_TYPE_0 == header->fmt);
+	assert(chunk_size > 0);
+	payloadSize = header->length;
+	headerSize = rtmp_chunk_basic_header_write(p, header->fmt, header->cid);
+	headerSize += rtmp_chunk_message_header_write(p + headerSize, header);
+	if (header->timestamp >= 0xFFFFFF)
+		headerSize += rtmp_chunk_extended_timestamp_write(p + headerSize, header->timestamp);
+
+	do
+	{
+		chunkSize = payloadSize < chunk_size ? payloadSize : chunk_size;
+		if (out)
+		{
+			memcpy(out + bytes, p, headerSize);
+			memcpy(out + bytes + headerSize, payload, chunkSize);
+		}
+		bytes += headerSize + chunkSize;
+
+		payload += chunkSize;
+		payloadSize -= chunkSize;
+
+		if (payloadSize > 0)
+		{
+			headerSize = rtmp_chunk_basic_header_write(p, RTMP_CHUNK_TYPE_3, header->cid);
+			if (header->timestamp >= 0xFFFFFF)
+				headerSize += rtmp_chunk_extended_timestamp_write(p + headerSize, header->timestamp);
+		}
+	} while (payloadSize > 0);
+
+	return bytes;
+}
+
+int rtmp_chunk_header_update(struct rtmp_t* rtmp, const struct rtmp_chunk_header_t* header)
+{
+	RTMP_TRACE_INTO
+	struct rtmp_packet_t* pkt;
+
+	assert(RTMP_CHUNK_TYPE_0 == header->fmt);
+	pkt = rtmp_packet_table_get(&rtmp->out_packets, header->cid);
+	if (NULL == pkt)
+		return -EINVAL;
+
+	// 预先切块的消息总是完整头(TYPE_0), 后续的压缩头以它为基准
+	memcpy(&pkt->header, header, sizeof(pkt->header));
+	pkt->clock = header->timestamp;
+	return 0;
+}
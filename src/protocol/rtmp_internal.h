@@ -4,9 +4,11 @@
 #include "rtmp_chunk_header.h"
 #include "rtmp_netconnection.h"
 #include "rtmp_netstream.h"
+#include <sys/uio.h>
 
-// 定义最大块流数量
-#define N_CHUNK_STREAM	8 // maximum chunk stream count
+// 块流表: cid 2-8直接下标, 其他cid放在按需分配的哈希表里
+#define N_CHUNK_STREAM_FAST		9	// cid < 9 直接下标(0和1不是合法的cid)
+#define N_CHUNK_STREAM_EXTRA	64	// 其他cid最多同时保存的个数, 限制每个连接的内存
 // 定义最大流名称长度
 #define N_STREAM_NAME	256
 
@@ -72,6 +74,19 @@ struct rtmp_packet_t
 	uint8_t* payload;
 	size_t capacity; // 仅用于网络读取
 	size_t bytes; // 仅用于网络读取
+
+	void* frame; // 上层分配的帧对象, 不为NULL时负载重组到frame_payload而不是payload
+	uint8_t* frame_payload;
+	size_t frame_capacity;
+};
+
+// 块流表, 查找O(1)
+struct rtmp_packet_table_t
+{
+	struct rtmp_packet_t fast[N_CHUNK_STREAM_FAST];
+	struct rtmp_packet_t** extra; // 开放寻址(线性探测), NULL表示空槽, 第一次用到cid >= 9时分配
+	uint32_t capacity; // extra的槽数, 2的幂
+	uint32_t count;
 };
 
 // 5.3.1. 块格式 (p11)
@@ -115,14 +130,17 @@ struct rtmp_t
 	uint8_t limit_type; // 客户端带宽限制类型
 	
 	// 块头
-	struct rtmp_packet_t in_packets[N_CHUNK_STREAM]; // 从网络接收
-	struct rtmp_packet_t out_packets[N_CHUNK_STREAM]; // 发送到网络
+	struct rtmp_packet_table_t in_packets; // 从网络接收
+	struct rtmp_packet_table_t out_packets; // 发送到网络
 	struct rtmp_parser_t parser;
 
 	void* param;
 
 	/// @return 0-成功, 其他-错误
 	int (*send)(void* param, const uint8_t* header, uint32_t headerBytes, const uint8_t* payload, uint32_t payloadBytes);
+	/// 一条消息所有chunk的头和payload片段, 设置后rtmp_chunk_write一次调用发完整条消息
+	/// @return 0-成功, 其他-错误
+	int (*sendv)(void* param, const struct iovec* vec, int n);
 	
 	int (*onaudio)(void* param, const uint8_t* data, size_t bytes, uint32_t timestamp);
 	int (*onvideo)(void* param, const uint8_t* data, size_t bytes, uint32_t timestamp);
@@ -130,6 +148,13 @@ struct rtmp_t
 
 	void (*onabort)(void* param, uint32_t chunk_stream_id);
 
+	/// 为一条多块的音视频/script消息分配重组缓冲区, 负载直接重组到上层的帧缓冲区, 回调时不再拷贝
+	/// @param payload 写入地址, 至少bytes字节
+	/// @return 上层的帧对象, NULL-使用rtmp_packet_t自己的缓冲区
+	void* (*onframe_alloc)(void* param, uint8_t type, size_t bytes, uint8_t** payload);
+	void (*onframe_free)(void* param, void* frame);
+	void* frame; // onaudio/onvideo/onscript回调期间, 当前消息所在的帧对象, 没有时为NULL
+
 	struct
 	{
 		// 服务器端回调函数
@@ -157,10 +182,26 @@ struct rtmp_t
 	} client;
 };
 
+void rtmp_packet_table_init(struct rtmp_packet_table_t* table);
+/// 释放所有块流和payload, 未完成消息的帧对象通过rtmp->onframe_free释放(rtmp可以为NULL)
+void rtmp_packet_table_free(struct rtmp_t* rtmp, struct rtmp_packet_table_t* table);
+/// @return NULL-这个cid还没有出现过
+struct rtmp_packet_t* rtmp_packet_table_find(struct rtmp_packet_table_t* table, uint32_t cid);
+/// 查找, 不存在时创建; 其他cid已满时淘汰一个没有未完成消息的块流
+/// @return NULL-N_CHUNK_STREAM_EXTRA个块流都有未完成的消息
+struct rtmp_packet_t* rtmp_packet_table_get(struct rtmp_packet_table_t* table, uint32_t cid);
+
 /// @return 0-成功, 其他-错误
 int rtmp_chunk_read(struct rtmp_t* rtmp, const uint8_t* data, size_t bytes);
 /// @return 0-成功, 其他-错误
 int rtmp_chunk_write(struct rtmp_t* rtmp, const struct rtmp_chunk_header_t* header, const uint8_t* payload);
+/// 把一条消息按chunk_size切块序列化到out(不依赖连接状态, 首块必须是RTMP_CHUNK_TYPE_0)
+/// @param out NULL时只计算需要的字节数
+/// @return 序列化后的字节数
+size_t rtmp_chunk_serialize(const struct rtmp_chunk_header_t* header, const uint8_t* payload, uint32_t chunk_size, uint8_t* out);
+/// 发送了rtmp_chunk_serialize的结果后, 同步该chunk stream的头压缩状态
+/// @return 0-成功, 其他-错误
+int rtmp_chunk_header_update(struct rtmp_t* rtmp, const struct rtmp_chunk_header_t* header);
 
 int rtmp_handler(struct rtmp_t* rtmp, struct rtmp_chunk_header_t* header, const uint8_t* payload);
 int rtmp_event_handler(struct rtmp_t* rtmp, const struct rtmp_chunk_header_t* header, const uint8_t* data);
@@ -0,0 +1,168 @@
+#include "rtmp_debug.h"
+#include "rtmp_internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define N_CHUNK_STREAM_EXTRA_MIN 8 // extra第一次分配的槽数
+
+static inline uint32_t rtmp_packet_hash(uint32_t cid, uint32_t capacity)
+{
+	return (cid * 2654435761u) & (capacity - 1);
+}
+
+static void rtmp_packet_table_insert(struct rtmp_packet_t** slots, uint32_t capacity, struct rtmp_packet_t* pkt)
+{
+	uint32_t i = rtmp_packet_hash(pkt->header.cid, capacity);
+	while (slots[i])
+		i = (i + 1) & (capacity - 1);
+	slots[i] = pkt;
+}
+
+static int rtmp_packet_table_grow(struct rtmp_packet_table_t* table)
+{
+	uint32_t i, capacity;
+	struct rtmp_packet_t** slots;
+
+	capacity = table->capacity ? table->capacity * 2 : N_CHUNK_STREAM_EXTRA_MIN;
+	slots = (struct rtmp_packet_t**)calloc(capacity, sizeof(struct rtmp_packet_t*));
+	if (NULL == slots)
+		return -1;
+
+	for (i = 0; i < table->capacity; i++)
+	{
+		if (table->extra[i])
+			rtmp_packet_table_insert(slots, capacity, table->extra[i]);
+	}
+	free(table->extra);
+	table->extra = slots;
+	table->capacity = capacity;
+	return 0;
+}
+
+// 线性探测的删除: 把后面同一簇里可以前移的元素往前挪, 不需要墓碑
+static void rtmp_packet_table_remove(struct rtmp_packet_table_t* table, uint32_t i)
+{
+	uint32_t j, k, mask;
+	mask = table->capacity - 1;
+	table->extra[i] = NULL;
+	for (j = (i + 1) & mask; table->extra[j]; j = (j + 1) & mask)
+	{
+		k = rtmp_packet_hash(table->extra[j]->header.cid, table->capacity);
+		// k不在(i, j]之间时, j上的元素可以挪到i
+		if ((i <= j) ? (k <= i || k > j) : (k <= i && k > j))
+		{
+			table->extra[i] = table->extra[j];
+			table->extra[j] = NULL;
+			i = j;
+		}
+	}
+	table->count--;
+}
+
+// 淘汰一个没有未完成消息的块流, 它之后再出现时只能从TYPE_0/TYPE_1开始
+static int rtmp_packet_table_evict(struct rtmp_packet_table_t* table)
+{
+	uint32_t i;
+	struct rtmp_packet_t* pkt;
+	for (i = 0; i < table->capacity; i++)
+	{
+		pkt = table->extra[i];
+		if (pkt && 0 == pkt->bytes)
+		{
+			assert(NULL == pkt->frame);
+			LogWarn("too many chunk streams, evict cid: {}", pkt->header.cid);
+			rtmp_packet_table_remove(table, i);
+			free(pkt->payload);
+			free(pkt);
+			return 0;
+		}
+	}
+	return -1;
+}
+
+void rtmp_packet_table_init(struct rtmp_packet_table_t* table)
+{
+	memset(table, 0, sizeof(*table));
+}
+
+static void rtmp_packet_release(struct rtmp_t* rtmp, struct rtmp_packet_t* pkt)
+{
+	if (pkt->frame && rtmp && rtmp->onframe_free)
+		rtmp->onframe_free(rtmp->param, pkt->frame);
+	free(pkt->payload);
+}
+
+void rtmp_packet_table_free(struct rtmp_t* rtmp, struct rtmp_packet_table_t* table)
+{
+	uint32_t i;
+	for (i = 0; i < N_CHUNK_STREAM_FAST; i++)
+		rtmp_packet_release(rtmp, &table->fast[i]);
+
+	for (i = 0; i < table->capacity; i++)
+	{
+		if (table->extra[i])
+		{
+			rtmp_packet_release(rtmp, table->extra[i]);
+			free(table->extra[i]);
+		}
+	}
+	free(table->extra);
+	memset(table, 0, sizeof(*table));
+}
+
+struct rtmp_packet_t* rtmp_packet_table_find(struct rtmp_packet_table_t* table, uint32_t cid)
+{
+	RTMP_TRACE_INTO
+	uint32_t i;
+
+	// The protocol supports up to 65597 streams with IDs 3-65599
+	assert(cid <= 65535 + 64 && cid >= 2 /* Protocol Control Messages */);
+	if (cid < N_CHUNK_STREAM_FAST)
+		return table->fast[cid].header.cid == cid && cid >= 2 ? &table->fast[cid] : NULL;
+
+	if (NULL == table->extra)
+		return NULL;
+
+	for (i = rtmp_packet_hash(cid, table->capacity); table->extra[i]; i = (i + 1) & (table->capacity - 1))
+	{
+		if (table->extra[i]->header.cid == cid)
+			return table->extra[i];
+	}
+	return NULL;
+}
+
+struct rtmp_packet_t* rtmp_packet_table_get(struct rtmp_packet_table_t* table, uint32_t cid)
+{
+	RTMP_TRACE_INTO
+	struct rtmp_packet_t* pkt;
+
+	pkt = rtmp_packet_table_find(table, cid);
+	if (pkt)
+		return pkt;
+
+	if (cid < 2)
+		return NULL;
+
+	if (cid < N_CHUNK_STREAM_FAST)
+	{
+		pkt = &table->fast[cid];
+		pkt->header.cid = cid;
+		return pkt;
+	}
+
+	if (table->count >= N_CHUNK_STREAM_EXTRA && 0 != rtmp_packet_table_evict(table))
+		return NULL;
+
+	// 负载不超过1/2
+	if ((table->count + 1) * 2 > table->capacity && 0 != rtmp_packet_table_grow(table))
+		return NULL;
+
+	pkt = (struct rtmp_packet_t*)calloc(1, sizeof(struct rtmp_packet_t));
+	if (NULL == pkt)
+		return NULL;
+	pkt->header.cid = cid;
+	rtmp_packet_table_insert(table->extra, table->capacity, pkt);
+	table->count++;
+	return pkt;
+}
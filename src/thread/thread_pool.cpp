@@ -1,4 +1,5 @@
 #include "thread_pool.h"
+#include <time.h>
 namespace longkit {
  void ThreadPool::onlytest() {
 
@@ -30,21 +31,7 @@ int _gettimeofday(struct timeval &tv)
 
 void getNow(timeval *tv)
 {
-#if TARGET_PLATFORM_IOS || TARGET_PLATFORM_LINUX
-
-    int idx = _buf_idx;
-    *tv = _t[idx];
-    if(fabs(_cpu_cycle - 0) < 0.0001 && _use_tsc)
-    {
-        addTimeOffset(*tv, idx);
-    }
-    else
-    {
-        TC_Common::gettimeofday(*tv);
-    }
-#else
     _gettimeofday(*tv);
-#endif
 }
 
 int64_t getNowMs()
@@ -55,4 +42,20 @@ int64_t getNowMs()
     return tv.tv_sec * (int64_t)1000 + tv.tv_usec / 1000;
 }
 
+int64_t getMonoMs()
+{
+#if WIN32
+    return (int64_t)GetTickCount64();
+#else
+    struct timespec ts;
+#ifdef CLOCK_MONOTONIC_COARSE
+    // 走vDSO只读内核每个tick更新的时间, 精度是一个tick(1~4ms), 任务超时够用
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    return ts.tv_sec * (int64_t)1000 + ts.tv_nsec / 1000000;
+#endif
+}
+
 }
\ No newline at end of file
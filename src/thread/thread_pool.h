@@ -6,9 +6,17 @@
 #include <future>        // 用于std::future
 #include <functional>    // 用于std::function
 #include <iostream>      // 用于标准输入输出
-#include <queue>         // 用于std::queue
+#include <deque>         // 用于溢出队列
+#include <algorithm>     // 用于std::push_heap
+#include <stdexcept>
 #include <mutex>         // 用于std::mutex
-#include <memory>        // 用于std::shared_ptr
+#include <condition_variable>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <new>           // 用于placement new
+#include <type_traits>
+#include <cstddef>       // 用于std::max_align_t
 #include <sys/time.h>    // 用于时间相关操作
 
 using namespace std;
@@ -28,6 +36,9 @@ using namespace std;
  * 
  * 注意:
  * ThreadPool::exec执行任务返回的是个future对象, 可以通过future异步获取结果
+ * 不需要返回值时用ThreadPool::post, 不创建future
+ * 带超时的任务到期还没开始执行就不再执行, future得到TaskExpiredError;
+ * setDeadlineFirst(true)之后带超时的任务按到期时间先后执行
  * 
  * 示例:
  * int testInt(int i)
@@ -52,24 +63,312 @@ namespace longkit {
 // 获取当前时间的函数声明
 void getNow(timeval *tv);
 int64_t getNowMs();
+// 单调时钟(毫秒), Linux上用CLOCK_MONOTONIC_COARSE, 不受改系统时间影响, 只用来算任务超时
+int64_t getMonoMs();
 
 // 定义宏，用于获取当前时间
 #define TNOW      getNow()
 #define TNOWMS    getNowMs()
+#define TMONOMS   getMonoMs()
 
+#define THREAD_POOL_QUEUE_SIZE      1024    // 每个工作线程的环形队列大小, 满了进共享的溢出队列
+#define THREAD_TASK_INLINE_SIZE     64      // 任务对象不超过这个大小时直接放在槽位里, 不分配内存
+
+/**
+ * @brief 任务超时没有执行, exec返回的future得到这个异常
+ */
+class TaskExpiredError : public std::runtime_error
+{
+public:
+    TaskExpiredError() : std::runtime_error("thread pool task expired") {}
+};
+
+/**
+ * @brief 只能移动的void()可调用对象, 小对象直接存在内部缓冲区
+ *
+ * 和std::function相比可以放promise这种只能移动的对象, 移动时不分配内存
+ * 对象有expire()成员时, 任务过期不执行会调用它
+ */
+class InlineFunc
+{
+public:
+    InlineFunc() : ops_(NULL) {}
+
+    template <class F, class = typename std::enable_if<
+                           !std::is_same<typename std::decay<F>::type, InlineFunc>::value>::type>
+    InlineFunc(F &&f) : ops_(NULL)
+    {
+        typedef typename std::decay<F>::type T;
+        if constexpr (sizeof(T) <= THREAD_TASK_INLINE_SIZE && alignof(T) <= alignof(std::max_align_t) &&
+                      std::is_nothrow_move_constructible<T>::value) {
+            new (buf_) T(std::forward<F>(f));
+            ops_ = &InlineOps<T>::ops;
+        } else {
+            *reinterpret_cast<T **>(buf_) = new T(std::forward<F>(f));
+            ops_ = &HeapOps<T>::ops;
+        }
+    }
+
+    InlineFunc(InlineFunc &&other) noexcept : ops_(other.ops_)
+    {
+        if (ops_) {
+            ops_->move(buf_, other.buf_);
+            other.ops_ = NULL;
+        }
+    }
+
+    InlineFunc &operator=(InlineFunc &&other) noexcept
+    {
+        if (this != &other) {
+            reset();
+            if (other.ops_) {
+                other.ops_->move(buf_, other.buf_);
+                ops_ = other.ops_;
+                other.ops_ = NULL;
+            }
+        }
+        return *this;
+    }
+
+    InlineFunc(const InlineFunc &) = delete;
+    InlineFunc &operator=(const InlineFunc &) = delete;
+
+    ~InlineFunc() { reset(); }
+
+    void operator()() { ops_->invoke(buf_); }
+
+    // 任务过期不执行
+    void expire() { ops_->expire(buf_); }
+
+    explicit operator bool() const { return ops_ != NULL; }
+
+    void reset()
+    {
+        if (ops_) {
+            ops_->destroy(buf_);
+            ops_ = NULL;
+        }
+    }
+
+private:
+    struct Ops
+    {
+        void (*invoke)(void *buf);
+        void (*move)(void *dst, void *src);     // 移动到dst, 并析构src
+        void (*destroy)(void *buf);
+        void (*expire)(void *buf);
+    };
+
+    template <class T, class = void>
+    struct HasExpire : std::false_type {};
+
+    template <class T>
+    struct HasExpire<T, std::void_t<decltype(std::declval<T &>().expire())> > : std::true_type {};
+
+    template <class T>
+    static void expireObject(T &object)
+    {
+        if constexpr (HasExpire<T>::value)
+            object.expire();
+    }
+
+    template <class T>
+    struct InlineOps
+    {
+        static void invoke(void *buf) { (*static_cast<T *>(buf))(); }
+        static void move(void *dst, void *src)
+        {
+            new (dst) T(std::move(*static_cast<T *>(src)));
+            static_cast<T *>(src)->~T();
+        }
+        static void destroy(void *buf) { static_cast<T *>(buf)->~T(); }
+        static void expire(void *buf) { expireObject(*static_cast<T *>(buf)); }
+        static constexpr Ops ops = {invoke, move, destroy, expire};
+    };
+
+    // 放不下的对象在堆上, 缓冲区里只存指针
+    template <class T>
+    struct HeapOps
+    {
+        static void invoke(void *buf) { (**static_cast<T **>(buf))(); }
+        static void move(void *dst, void *src) { *static_cast<T **>(dst) = *static_cast<T **>(src); }
+        static void destroy(void *buf) { delete *static_cast<T **>(buf); }
+        static void expire(void *buf) { expireObject(**static_cast<T **>(buf)); }
+        static constexpr Ops ops = {invoke, move, destroy, expire};
+    };
+
+    alignas(std::max_align_t) unsigned char buf_[THREAD_TASK_INLINE_SIZE];
+    const Ops *ops_;
+};
+
+/**
+ * @brief exec提交的任务: 执行结果或者异常交给future, 过期时给TaskExpiredError
+ */
+template <class R, class F>
+struct FutureTask
+{
+    F                   _func;
+    std::promise<R>     _promise;
+
+    void operator()()
+    {
+        try
+        {
+            if constexpr (std::is_void<R>::value)
+            {
+                _func();
+                _promise.set_value();
+            }
+            else
+            {
+                _promise.set_value(_func());
+            }
+        }
+        catch (...)
+        {
+            _promise.set_exception(std::current_exception());
+        }
+    }
+
+    void expire()
+    {
+        // 异常对象只读, 所有过期的任务共用一个, 过期时不再分配内存
+        static const std::exception_ptr s_expired = std::make_exception_ptr(TaskExpiredError());
+        _promise.set_exception(s_expired);
+    }
+};
+
+/**
+ * @brief 线程池
+ *
+ * 1. 每个工作线程一个定长环形队列, 其他线程提交任务时轮流放进各个队列, 一次CAS, 不加锁
+ * 2. 工作线程里提交的任务放进自己的队列; 自己的队列空了去别的队列偷
+ * 3. 队列满了放进共享的加锁溢出队列, 提交不会失败; 溢出时不保证先提交的先执行
+ * 4. 任务直接存在槽位里, 小的可调用对象不分配内存; post不创建future
+ * 5. 超时用粗粒度单调时钟, 取出任务时已经过期的不执行, 计入过期数; stop时没执行的丢掉, 计入丢弃数
+ * 6. 按到期时间调度(可选): 带超时的任务放进共享的加锁最小堆, 工作线程优先从堆里取
+ */
 class ThreadPool
 {
 protected:
     // 定义任务结构体
     struct TaskFunc
     {
-        TaskFunc(uint64_t expireTime) : _expireTime(expireTime)
+        TaskFunc() : _expireTime(0)
+        { }
+
+        template <class F>
+        TaskFunc(F &&f, int64_t expireTime) : _func(std::forward<F>(f)), _expireTime(expireTime)
         { }
 
-        std::function<void()>   _func;      // 存储任务函数
+        InlineFunc             _func;      // 存储任务函数
         int64_t                _expireTime = 0;	// 任务的过期时间（绝对时间）
     };
-    typedef shared_ptr<TaskFunc> TaskFuncPtr;  // 使用智能指针管理TaskFunc
+
+    /**
+     * @brief 多生产者多消费者定长队列, 每个槽位一个序号
+     *
+     * 生产者和消费者各自CAS占位, 写完/取完之后发布序号; 任务在槽位之间移动, 不分配内存
+     */
+    class TaskQueue
+    {
+    public:
+        explicit TaskQueue(size_t capacity) : head_(0), tail_(0)
+        {
+            size_t size = 2;
+            while (size < capacity)
+                size <<= 1;
+            mask_ = size - 1;
+            slots_ = new Slot[size];
+            for (size_t i = 0; i < size; i++)
+                slots_[i].seq.store(i, std::memory_order_relaxed);
+        }
+
+        ~TaskQueue() { delete[] slots_; }
+
+        // 成功时task被移走, 满了返回false
+        bool push(TaskFunc &task)
+        {
+            size_t pos = tail_.load(std::memory_order_relaxed);
+            for (;;)
+            {
+                Slot &slot = slots_[pos & mask_];
+                size_t seq = slot.seq.load(std::memory_order_acquire);
+                intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+                if (diff == 0)
+                {
+                    if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    {
+                        slot.task = std::move(task);
+                        slot.seq.store(pos + 1, std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if (diff < 0)
+                {
+                    return false;
+                }
+                else
+                {
+                    pos = tail_.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        // 空了或者队首还没写完返回false
+        bool pop(TaskFunc &task)
+        {
+            size_t pos = head_.load(std::memory_order_relaxed);
+            for (;;)
+            {
+                Slot &slot = slots_[pos & mask_];
+                size_t seq = slot.seq.load(std::memory_order_acquire);
+                intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+                if (diff == 0)
+                {
+                    if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    {
+                        task = std::move(slot.task);
+                        slot.seq.store(pos + mask_ + 1, std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if (diff < 0)
+                {
+                    return false;
+                }
+                else
+                {
+                    pos = head_.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+    private:
+        struct Slot
+        {
+            std::atomic<size_t> seq;    // ==pos时可以写, ==pos+1时可以读
+            TaskFunc task;
+        };
+
+        Slot *slots_;
+        size_t mask_;
+        alignas(64) std::atomic<size_t> head_;
+        alignas(64) std::atomic<size_t> tail_;
+    };
+
+    // 工作线程所属的线程池和序号, 用来把工作线程里提交的任务放进自己的队列
+    struct WorkerContext
+    {
+        ThreadPool *pool;
+        size_t index;
+    };
+
+    static WorkerContext &currentWorker()
+    {
+        static thread_local WorkerContext context = {NULL, 0};
+        return context;
+    }
 
 public:
     /**
@@ -80,26 +379,31 @@ public:
         }
 
     /**
-    * @brief 析构函数, 会停止所有线程
+    * @brief 析构函数, 会停止所有线程, 没执行的任务直接丢掉
     */
     virtual ~ThreadPool() {
-         stop();
+        stop();
+        for (size_t i = 0; i < queues_.size(); i++)
+        {
+            delete queues_[i];
+        }
     }
 
     /**
-    * @brief 初始化线程池
+    * @brief 初始化线程池, 创建每个工作线程的队列
     *
     * @param num 工作线程个数
     * @return 初始化是否成功
     */
     bool init(size_t num) {
         std::unique_lock<std::mutex> lock(mutex_);
-        if (!threads_.empty())
+        if (!threads_.empty() || !queues_.empty())
         {
             return false;  // 如果线程池已经初始化，返回false
         }
 
-        threadNum_ = num;  // 设置线程数量
+        threadNum_ = num > 0 ? num : 1;  // 设置线程数量
+        createQueues();
         return true;
     }
 
@@ -115,16 +419,32 @@ public:
     }
 
     /**
-    * @brief 获取当前线程池的任务数
+    * @brief 获取当前线程池的任务数(还没开始执行的)
     *
     * @return size_t 线程池的任务数
     */
     size_t getJobNum()
     {
-        std::unique_lock<std::mutex> lock(mutex_);
-        return tasks_.size();
+        return pending_.load();
     }
 
+    /**
+    * @brief 超时没有执行的任务数
+    */
+    uint64_t getExpiredNum() { return expired_.load(); }
+
+    /**
+    * @brief stop时还没执行被丢掉的任务数
+    */
+    uint64_t getDroppedNum() { return dropped_.load(); }
+
+    /**
+    * @brief 带超时的任务按到期时间先后执行, 不带超时的照常; 在start之前设置
+    *
+    * @param enable 是否打开
+    */
+    void setDeadlineFirst(bool enable) { deadlineFirst_ = enable; }
+
     /**
     * @brief 停止所有线程, 会等待所有线程结束
     */
@@ -147,6 +467,9 @@ public:
 
         std::unique_lock<std::mutex> lock(mutex_);
         threads_.clear();  // 清空线程容器
+        lock.unlock();
+
+        dropAll();  // 线程都退出了, 剩下的任务不会再执行
     }
 
     /**
@@ -161,9 +484,13 @@ public:
             return false;  // 如果线程已经启动，返回false
         }
 
+        if (queues_.empty())
+        {
+            createQueues();  // 没有调用init, 用默认线程数
+        }
         for (size_t i = 0; i < threadNum_; i++)
         {
-            threads_.push_back(new thread(&ThreadPool::run, this));  // 创建并启动线程
+            threads_.push_back(new thread(&ThreadPool::run, this, i));  // 创建并启动线程
         }
         return true;
     }
@@ -178,7 +505,7 @@ public:
     template <class F, class... Args>
     auto exec(F&& f, Args&&... args) -> std::future<decltype(f(args...))>
     {
-        return exec(0,f,args...);  // 调用带超时参数的exec函数，超时时间为0表示不设置超时
+        return exec(0, std::forward<F>(f), std::forward<Args>(args)...);  // 超时时间为0表示不设置超时
     }
 
     /**
@@ -192,31 +519,57 @@ public:
     template <class F, class... Args>
     auto exec(int64_t timeoutMs, F&& f, Args&&... args) -> std::future<decltype(f(args...))>
     {
-        int64_t expireTime =  (timeoutMs == 0 ? 0 : TNOWMS + timeoutMs);  // 计算任务的过期时间
+        int64_t expireTime =  (timeoutMs == 0 ? 0 : TMONOMS + timeoutMs);  // 计算任务的过期时间
         using RetType = decltype(f(args...));  // 推导返回值类型
-        
-        // 创建packaged_task，将函数和参数绑定
-        auto task = std::make_shared<std::packaged_task<RetType()>>(
-            std::bind(std::forward<F>(f), std::forward<Args>(args)...)
-        );
-
-        
-
-        // 创建任务指针，设置过期时间
-        TaskFuncPtr fPtr = std::make_shared<TaskFunc>(expireTime);
-        fPtr->_func = [task]() {  // 设置任务函数
-            (*task)();
-        };
+        using BindType = decltype(std::bind(std::forward<F>(f), std::forward<Args>(args)...));
 
-        std::unique_lock<std::mutex> lock(mutex_);
-        tasks_.push(fPtr);              // 将任务插入队列
-        condition_.notify_one();        // 唤醒一个等待的线程
+        // promise只能移动, 直接放进任务里, 不再包一层shared_ptr
+        FutureTask<RetType, BindType> task{std::bind(std::forward<F>(f), std::forward<Args>(args)...),
+                                           std::promise<RetType>()};
+        std::future<RetType> future = task._promise.get_future();
 
-        return task->get_future();  // 返回future对象
+        TaskFunc taskFunc(std::move(task), expireTime);
+        push(taskFunc);
+        return future;
+    }
+
+    /**
+    * @brief 提交任务, 不关心返回值; 不创建future, 小任务不分配内存
+    *
+    * @param f 任务函数
+    * @param args 任务函数的参数
+    */
+    template <class F, class... Args>
+    auto post(F&& f, Args&&... args) -> decltype(f(args...), void())
+    {
+        post(0, std::forward<F>(f), std::forward<Args>(args)...);
+    }
+
+    /**
+    * @brief 提交任务, 不关心返回值
+    *
+    * @param timeoutMs 超时时间，单位ms (为0时不做超时控制)；若任务超时，此任务将被丢弃
+    * @param f 任务函数
+    * @param args 任务函数的参数
+    */
+    template <class F, class... Args>
+    auto post(int64_t timeoutMs, F&& f, Args&&... args) -> decltype(f(args...), void())
+    {
+        int64_t expireTime =  (timeoutMs == 0 ? 0 : TMONOMS + timeoutMs);
+        if constexpr (sizeof...(Args) == 0)
+        {
+            TaskFunc taskFunc(std::forward<F>(f), expireTime);
+            push(taskFunc);
+        }
+        else
+        {
+            TaskFunc taskFunc(std::bind(std::forward<F>(f), std::forward<Args>(args)...), expireTime);
+            push(taskFunc);
+        }
     }
 
     /**
-    * @brief 等待当前任务队列中所有工作全部结束(队列无任务)
+    * @brief 等待所有任务执行结束(队列无任务, 也没有正在执行的)
     *
     * @param millsecond 等待的时间(ms), -1表示永远等待
     * @return true: 所有工作都处理完毕, false: 超时退出
@@ -224,50 +577,179 @@ public:
     bool waitForAllDone(int millsecond = -1) {
         std::unique_lock<std::mutex> lock(mutex_);
 
-        if (tasks_.empty())
+        if (isAllDone())
             return true;
 
         if (millsecond < 0)
         {
-            condition_.wait(lock, [this] { return tasks_.empty(); });
+            done_.wait(lock, [this] { return isAllDone(); });
             return true;
         }
         else
         {
-            return condition_.wait_for(lock, std::chrono::milliseconds(millsecond), [this] { return tasks_.empty(); });
+            return done_.wait_for(lock, std::chrono::milliseconds(millsecond), [this] { return isAllDone(); });
         }
     }
 
 protected:
+    void createQueues() {
+        for (size_t i = 0; i < threadNum_; i++)
+        {
+            queues_.push_back(new TaskQueue(THREAD_POOL_QUEUE_SIZE));
+        }
+    }
+
     /**
-    * @brief 获取任务
+    * @brief 放进队列并唤醒空闲线程
     *
+    * @param task 提交的任务, 会被移走
+    */
+    void push(TaskFunc &task) {
+        // 先加排队数, 任务被取走时不会减成负数; 工作线程看到排队数但还没取到时会让出CPU重试
+        pending_.fetch_add(1);
+
+        size_t num = queues_.size();
+        bool queued = false;
+        if (deadlineFirst_ && task._expireTime != 0)
+        {
+            std::unique_lock<std::mutex> lock(deadlineMutex_);
+            deadline_.push_back(std::move(task));
+            std::push_heap(deadline_.begin(), deadline_.end(), laterDeadline);
+            deadlineNum_.fetch_add(1);
+            queued = true;
+        }
+        else if (num > 0)
+        {
+            WorkerContext &context = currentWorker();
+            size_t index = context.pool == this ? context.index : next_.fetch_add(1, std::memory_order_relaxed) % num;
+            queued = queues_[index]->push(task);
+        }
+        if (!queued)
+        {
+            std::unique_lock<std::mutex> lock(overflowMutex_);
+            overflow_.push_back(std::move(task));
+            overflowNum_.fetch_add(1);
+        }
+
+        // 和工作线程睡眠前的检查配对: 要么它看到pending_, 要么这里看到idle_
+        if (idle_.load() > 0)
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            condition_.notify_one();
+        }
+    }
+
+    /**
+    * @brief 获取任务: 到期时间最早的, 自己的队列, 溢出队列, 其他线程的队列
+    *
+    * @param index 工作线程序号
     * @param task 用于存储获取到的任务
     * @return 是否成功获取任务
     */
-    bool get(TaskFuncPtr&task) {
+    bool get(size_t index, TaskFunc &task) {
+        bool ok = popDeadline(task) || queues_[index]->pop(task);
+        if (!ok && overflowNum_.load(std::memory_order_relaxed) > 0)
+        {
+            std::unique_lock<std::mutex> lock(overflowMutex_);
+            if (!overflow_.empty())
+            {
+                task = std::move(overflow_.front());
+                overflow_.pop_front();
+                overflowNum_.fetch_sub(1);
+                ok = true;
+            }
+        }
+        for (size_t i = 1; !ok && i < queues_.size(); i++)
+        {
+            ok = queues_[(index + i) % queues_.size()]->pop(task);
+        }
+        if (ok)
+        {
+            // 先算正在执行再减排队数, waitForAllDone不会看到两个都是0
+            active_.fetch_add(1);
+            pending_.fetch_sub(1);
+        }
+        return ok;
+    }
+
+    /**
+    * @brief 没有任务时睡眠, 直到有任务提交或者退出
+    */
+    void wait() {
+        if (pending_.load() > 0)
+        {
+            std::this_thread::yield();  // 任务正在放进队列
+            return;
+        }
+
         std::unique_lock<std::mutex> lock(mutex_);
+        idle_.fetch_add(1);
+        condition_.wait(lock, [this] {
+            return bTerminate_ || pending_.load() > 0;
+        });
+        idle_.fetch_sub(1);
+    }
+
+    static bool laterDeadline(const TaskFunc &a, const TaskFunc &b) { return a._expireTime > b._expireTime; }
 
-        if (tasks_.empty())
+    bool popDeadline(TaskFunc &task) {
+        if (deadlineNum_.load(std::memory_order_relaxed) == 0)
         {
-            condition_.wait(lock, [this] { 
-                return bTerminate_ || !tasks_.empty();  
-            });
+            return false;
         }
 
-        if (bTerminate_)
+        std::unique_lock<std::mutex> lock(deadlineMutex_);
+        if (deadline_.empty())
+        {
             return false;
+        }
+        std::pop_heap(deadline_.begin(), deadline_.end(), laterDeadline);
+        task = std::move(deadline_.back());
+        deadline_.pop_back();
+        deadlineNum_.fetch_sub(1);
+        return true;
+    }
 
-        if (!tasks_.empty())
+    /**
+    * @brief 丢掉所有没执行的任务, exec的future得到broken_promise
+    */
+    void dropAll() {
+        uint64_t dropped = 0;
+        TaskFunc task;
+        for (size_t i = 0; i < queues_.size(); i++)
         {
-            task = std::move(tasks_.front());  // 使用移动语义获取任务
-            tasks_.pop();  // 移除已获取的任务
-            return true;
+            while (queues_[i]->pop(task))
+            {
+                task._func.reset();
+                dropped++;
+            }
         }
 
-        return false;
+        std::deque<TaskFunc> overflow;
+        {
+            std::unique_lock<std::mutex> lock(overflowMutex_);
+            overflow.swap(overflow_);
+            overflowNum_ = 0;
+        }
+        std::vector<TaskFunc> deadline;
+        {
+            std::unique_lock<std::mutex> lock(deadlineMutex_);
+            deadline.swap(deadline_);
+            deadlineNum_ = 0;
+        }
+        dropped += overflow.size() + deadline.size();
+
+        if (dropped > 0)
+        {
+            dropped_.fetch_add(dropped);
+            pending_.fetch_sub(dropped);
+            std::unique_lock<std::mutex> lock(mutex_);
+            done_.notify_all();
+        }
     }
 
+    bool isAllDone() { return pending_.load() == 0 && active_.load() == 0; }
+
     /**
     * @brief 检查线程池是否需要退出
     */
@@ -275,59 +757,94 @@ protected:
 
     /**
     * @brief 线程运行函数
+    *
+    * @param index 工作线程序号
     */
-    void run() {
+    void run(size_t index) {
+        currentWorker().pool = this;
+        currentWorker().index = index;
+
         while (!isTerminate())
         {
-            TaskFuncPtr task;
-            bool ok = get(task);        // 获取任务
-            if (ok)
+            TaskFunc task;
+            if (!get(index, task))      // 获取任务
+            {
+                wait();
+                continue;
+            }
+
+            try
             {
-                ++atomic_;  // 增加正在执行的任务计数
-                try
+                if (task._expireTime != 0 && task._expireTime < TMONOMS)
                 {
-                    if (task->_expireTime != 0 && task->_expireTime < TNOWMS)
-                    {
-                        // 任务已超时，可以在这里添加处理逻辑
-                    }
-                    else
-                    {
-                        task->_func();  // 执行任务
-                    }
+                    // 任务已超时, 不执行, future得到TaskExpiredError
+                    task._func.expire();
+                    expired_.fetch_add(1, std::memory_order_relaxed);
                 }
-                catch (...)
+                else
                 {
-                    // 捕获所有异常，防止线程意外退出
+                    task._func();  // 执行任务
                 }
+            }
+            catch (...)
+            {
+                // 捕获所有异常，防止线程意外退出
+            }
+            task._func.reset();     // 先释放任务持有的对象, 再算执行完
 
-                --atomic_;  // 减少正在执行的任务计数
-
-                // 检查是否所有任务都执行完毕
+            active_.fetch_sub(1);
+            // 检查是否所有任务都执行完毕
+            if (isAllDone())
+            {
                 std::unique_lock<std::mutex> lock(mutex_);
-                if (atomic_ == 0 && tasks_.empty())
-                {
-                    condition_.notify_all();  // 通知等待的线程（如waitForAllDone）
-                }
+                done_.notify_all();  // 通知等待的线程（如waitForAllDone）
             }
         }
+        currentWorker().pool = NULL;
     }
 
     void onlytest();  // 测试用函数，实现未给出
 
 protected:
-    queue<TaskFuncPtr> tasks_;  // 任务队列
+    std::vector<TaskQueue*>   queues_;  // 每个工作线程一个任务队列, init之后不再变
+
+    std::mutex                overflowMutex_;  // 保护溢出队列
+
+    std::deque<TaskFunc>      overflow_;  // 队列满了或者还没init时提交的任务
+
+    std::atomic<size_t>       overflowNum_{ 0 };  // 溢出队列里的任务数, 不加锁判断是否要去取
+
+    bool                      deadlineFirst_ = false;  // 带超时的任务按到期时间调度
+
+    std::mutex                deadlineMutex_;  // 保护到期时间堆
+
+    std::vector<TaskFunc>     deadline_;  // 按到期时间排的最小堆
+
+    std::atomic<size_t>       deadlineNum_{ 0 };  // 堆里的任务数, 不加锁判断是否要去取
 
     std::vector<std::thread*> threads_;  // 工作线程容器
 
-    std::mutex                mutex_;  // 互斥锁，用于保护共享数据
+    std::mutex                mutex_;  // 互斥锁，用于线程睡眠和等待结束
+
+    std::condition_variable   condition_;  // 条件变量，唤醒空闲的工作线程
 
-    std::condition_variable   condition_;  // 条件变量，用于线程同步
+    std::condition_variable   done_;  // 条件变量，所有任务执行完时通知waitForAllDone
 
     size_t                    threadNum_;  // 线程数量
 
-    bool                      bTerminate_;  // 是否终止线程池的标志
+    std::atomic<bool>         bTerminate_;  // 是否终止线程池的标志
+
+    std::atomic<size_t>       pending_{ 0 };  // 已提交还没开始执行的任务数
+
+    std::atomic<size_t>       active_{ 0 };  // 正在执行的任务数
+
+    std::atomic<int>          idle_{ 0 };  // 睡眠中的线程数, 大于0时提交才去唤醒
+
+    std::atomic<size_t>       next_{ 0 };  // 其他线程提交时轮流选队列
+
+    std::atomic<uint64_t>     expired_{ 0 };  // 超时没有执行的任务数
 
-    std::atomic<int>          atomic_{ 0 };  // 原子计数器，记录正在执行的任务数
+    std::atomic<uint64_t>     dropped_{ 0 };  // stop时丢掉的任务数
 };
 
 }// namespace longkit
@@ -81,7 +81,8 @@ typedef int conn_handle_t;
 enum
 {
     NETLIB_OK = 0,
-    NETLIB_ERROR = -1
+    NETLIB_ERROR = -1,
+    NETLIB_AGAIN = -2       // 非阻塞接收时暂时没有数据
 };
 
 #define NETLIB_INVALID_HANDLE -1
@@ -0,0 +1,216 @@
+/*
+ * util_buffer.cpp
+ */
+
+#include "util_buffer.h"
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+// 每个loop线程一个块池, 不需要加锁
+struct BlockPool : public std::vector<uchar_t *> {
+    ~BlockPool() {
+        for (size_t i = 0; i < size(); i++) {
+            free((*this)[i]);
+        }
+    }
+};
+static thread_local BlockPool s_block_pool;
+
+uchar_t *CSegmentBuffer::_AllocBlock() {
+    if (!s_block_pool.empty()) {
+        uchar_t *block = s_block_pool.back();
+        s_block_pool.pop_back();
+        return block;
+    }
+    return (uchar_t *)malloc(SEGMENT_BLOCK_SIZE);
+}
+
+void CSegmentBuffer::_FreeBlock(uchar_t *block) {
+    if (s_block_pool.size() < SEGMENT_POOL_MAX_BLOCKS) {
+        s_block_pool.push_back(block);
+    } else {
+        free(block);
+    }
+}
+
+CSegmentBuffer::CSegmentBuffer() {
+    ring_ = NULL;
+    ring_cap_ = 0;
+    head_ = 0;
+    block_cnt_ = 0;
+    write_block_ = 0;
+    read_pos_ = 0;
+    write_pos_ = 0;
+    size_ = 0;
+}
+
+CSegmentBuffer::~CSegmentBuffer() {
+    while (block_cnt_ > 0) {
+        _PopBack();
+    }
+    free(ring_);
+}
+
+void CSegmentBuffer::_PushBlock(uchar_t *block) {
+    if (block_cnt_ == ring_cap_) {
+        uint32_t cap = ring_cap_ ? ring_cap_ * 2 : 8;
+        uchar_t **ring = (uchar_t **)malloc(cap * sizeof(uchar_t *));
+        for (uint32_t i = 0; i < block_cnt_; i++) {
+            ring[i] = _Block(i);
+        }
+        free(ring_);
+        ring_ = ring;
+        ring_cap_ = cap;
+        head_ = 0;
+    }
+    ring_[(head_ + block_cnt_) & (ring_cap_ - 1)] = block;
+    block_cnt_++;
+}
+
+void CSegmentBuffer::_PopFront() {
+    _FreeBlock(ring_[head_]);
+    head_ = (head_ + 1) & (ring_cap_ - 1);
+    block_cnt_--;
+}
+
+void CSegmentBuffer::_PopBack() {
+    _FreeBlock(_Block(block_cnt_ - 1));
+    block_cnt_--;
+}
+
+void CSegmentBuffer::_Reserve(uint32_t len) {
+    uint32_t free_size = 0;
+    if (write_block_ < block_cnt_) {
+        free_size = (block_cnt_ - write_block_) * SEGMENT_BLOCK_SIZE - write_pos_;
+    }
+    while (free_size < len) {
+        _PushBlock(_AllocBlock());
+        free_size += SEGMENT_BLOCK_SIZE;
+    }
+}
+
+int CSegmentBuffer::GetWriteSpans(struct iovec *iov, int max_cnt, uint32_t min_size) {
+    _Reserve(min_size);
+
+    int cnt = 0;
+    uint32_t offset = write_pos_;
+    for (uint32_t i = write_block_; i < block_cnt_ && cnt < max_cnt; i++) {
+        if (offset < SEGMENT_BLOCK_SIZE) {
+            iov[cnt].iov_base = _Block(i) + offset;
+            iov[cnt].iov_len = SEGMENT_BLOCK_SIZE - offset;
+            cnt++;
+        }
+        offset = 0;
+    }
+    return cnt;
+}
+
+void CSegmentBuffer::IncWriteOffset(uint32_t len) {
+    size_ += len;
+    while (len > 0) {
+        if (write_pos_ == SEGMENT_BLOCK_SIZE) {
+            write_block_++;
+            write_pos_ = 0;
+        }
+        uint32_t n = SEGMENT_BLOCK_SIZE - write_pos_;
+        if (n > len) {
+            n = len;
+        }
+        write_pos_ += n;
+        len -= n;
+    }
+}
+
+uint32_t CSegmentBuffer::Write(const void *buf, uint32_t len) {
+    // 当前块放得下时直接拷贝
+    if (write_block_ < block_cnt_ && SEGMENT_BLOCK_SIZE - write_pos_ >= len) {
+        memcpy(_Block(write_block_) + write_pos_, buf, len);
+        write_pos_ += len;
+        size_ += len;
+        return len;
+    }
+
+    struct iovec iov[8];
+    uint32_t written = 0;
+    while (written < len) {
+        int cnt = GetWriteSpans(iov, 8, len - written);
+        for (int i = 0; i < cnt && written < len; i++) {
+            uint32_t n = iov[i].iov_len < len - written ? iov[i].iov_len : len - written;
+            memcpy(iov[i].iov_base, (const uchar_t *)buf + written, n);
+            written += n;
+            IncWriteOffset(n);
+        }
+    }
+    return len;
+}
+
+int CSegmentBuffer::GetReadSpans(struct iovec *iov, int max_cnt) {
+    int cnt = 0;
+    for (uint32_t i = 0; i <= write_block_ && i < block_cnt_ && cnt < max_cnt; i++) {
+        uint32_t begin = (i == 0) ? read_pos_ : 0;
+        uint32_t end = (i == write_block_) ? write_pos_ : SEGMENT_BLOCK_SIZE;
+        if (end > begin) {
+            iov[cnt].iov_base = _Block(i) + begin;
+            iov[cnt].iov_len = end - begin;
+            cnt++;
+        }
+    }
+    return cnt;
+}
+
+uint32_t CSegmentBuffer::Peek(void *buf, uint32_t len) {
+    if (len > size_) {
+        len = size_;
+    }
+
+    uint32_t copied = 0;
+    for (uint32_t i = 0; copied < len; i++) {
+        uint32_t begin = (i == 0) ? read_pos_ : 0;
+        uint32_t end = (i == write_block_) ? write_pos_ : SEGMENT_BLOCK_SIZE;
+        uint32_t n = end - begin < len - copied ? end - begin : len - copied;
+        memcpy((uchar_t *)buf + copied, _Block(i) + begin, n);
+        copied += n;
+    }
+    return len;
+}
+
+uint32_t CSegmentBuffer::Read(void *buf, uint32_t len) {
+    if (buf) {
+        len = Peek(buf, len);
+    }
+    return Skip(len);
+}
+
+uint32_t CSegmentBuffer::Skip(uint32_t len) {
+    if (len > size_) {
+        len = size_;
+    }
+    size_ -= len;
+    if (size_ == 0) {
+        // 读完了, 所有块都变成空块, 从头开始写, 只留几块备用
+        while (block_cnt_ > SEGMENT_IDLE_BLOCKS) {
+            _PopBack();
+        }
+        write_block_ = 0;
+        read_pos_ = 0;
+        write_pos_ = 0;
+        return len;
+    }
+
+    read_pos_ += len;
+    while (read_pos_ >= SEGMENT_BLOCK_SIZE && write_block_ > 0) {
+        read_pos_ -= SEGMENT_BLOCK_SIZE;
+        _PopFront();
+        write_block_--;
+    }
+    if (write_block_ == 0 && size_ <= SEGMENT_COMPACT_SIZE && read_pos_ >= SEGMENT_COMPACT_SIZE) {
+        uchar_t *block = _Block(0);
+        memmove(block, block + read_pos_, size_);
+        read_pos_ = 0;
+        write_pos_ = size_;
+    }
+    return len;
+}
+
+void CSegmentBuffer::Clear() { Skip(size_); }
@@ -0,0 +1,73 @@
+/*
+ * util_buffer.h
+ *
+ * 分段缓冲区: 数据保存在一串固定大小的块里, 块从线程内的池里分配
+ * 1. 消费(Skip/Read)只移动读位置, 读完的块还回池, 不做memmove
+ * 2. 可读片段可以直接交给writev, 可写片段可以直接交给recv/readv
+ * 3. 只剩一小段没消费完的数据时(收包解析留下的半个消息), 挪回块头,
+ *    让后续写入一直复用块头部分热的缓存, 挪动的字节数有上限
+ */
+
+#ifndef __UTIL_BUFFER_H__
+#define __UTIL_BUFFER_H__
+
+#include "ostype.h"
+#include <sys/uio.h>
+
+#define SEGMENT_BLOCK_SIZE      (64 * 1024)
+#define SEGMENT_POOL_MAX_BLOCKS 256     // 每个线程最多缓存的空闲块数
+#define SEGMENT_COMPACT_SIZE    4096    // 剩余数据不超过这个大小时挪回块头
+#define SEGMENT_IDLE_BLOCKS     4       // 读完后留着备用的块数, 够一次200K的recv不用再分配
+
+class CSegmentBuffer {
+  public:
+    CSegmentBuffer();
+    ~CSegmentBuffer();
+
+    uint32_t GetReadableSize() { return size_; }
+    bool Empty() { return size_ == 0; }
+
+    // 拷贝追加数据
+    uint32_t Write(const void *buf, uint32_t len);
+    // 拷贝并消费数据
+    uint32_t Read(void *buf, uint32_t len);
+    // 只拷贝不消费
+    uint32_t Peek(void *buf, uint32_t len);
+    // 消费数据, 只移动读位置
+    uint32_t Skip(uint32_t len);
+    void Clear();
+
+    // 可读片段, 返回片段个数
+    int GetReadSpans(struct iovec *iov, int max_cnt);
+    // 预留至少min_size字节的可写空间并返回可写片段, 写入后调用IncWriteOffset提交
+    int GetWriteSpans(struct iovec *iov, int max_cnt, uint32_t min_size);
+    void IncWriteOffset(uint32_t len);
+
+  private:
+    CSegmentBuffer(const CSegmentBuffer &);
+    CSegmentBuffer &operator=(const CSegmentBuffer &);
+
+    void _Reserve(uint32_t len);
+    // 第i块, 0是读位置所在的块
+    uchar_t *_Block(uint32_t i) { return ring_[(head_ + i) & (ring_cap_ - 1)]; }
+    void _PushBlock(uchar_t *block);
+    void _PopFront();
+    void _PopBack();
+
+    static uchar_t *_AllocBlock();
+    static void _FreeBlock(uchar_t *block);
+
+  private:
+    // 块指针的环形数组, 容量是2的幂; [0, write_block_]有数据, 之后是预留的空块
+    // 不用std::deque: 收包路径每次都要遍历块, 默认不开优化的构建下deque的开销比拷贝数据还大
+    uchar_t **ring_;
+    uint32_t ring_cap_;
+    uint32_t head_;
+    uint32_t block_cnt_;
+    uint32_t write_block_;
+    uint32_t read_pos_;             // 在第0块里的读位置
+    uint32_t write_pos_;            // 在第write_block_块里的写位置
+    uint32_t size_;                 // 可读字节数
+};
+
+#endif
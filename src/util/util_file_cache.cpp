@@ -0,0 +1,86 @@
+#include "util_file_cache.h"
+#include "util.h"
+#include "dlog.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+CCachedFile::~CCachedFile()
+{
+    if (fd_ >= 0)
+        close(fd_);
+}
+
+CFileCache::CFileCache(size_t max_files, uint64_t revalidate_ms)
+    : max_files_(max_files), revalidate_ms_(revalidate_ms)
+{
+}
+
+CachedFilePtr CFileCache::Open(const std::string &path)
+{
+    uint64_t now = GetTickCount();
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = files_.find(path);
+    if (it != files_.end() && now - it->second.check_tick < revalidate_ms_)
+        return it->second.file;
+
+    struct stat st;
+    if (stat(path.c_str(), &st) < 0 || !S_ISREG(st.st_mode)) {
+        if (it != files_.end())
+            files_.erase(it);
+        return CachedFilePtr();
+    }
+    if (it != files_.end()) {
+        const CachedFilePtr &file = it->second.file;
+        if ((uint64_t)st.st_size == file->size_ && st.st_mtime == file->mtime_ && st.st_ino == file->ino_) {
+            it->second.check_tick = now;
+            return file;
+        }
+        // 文件变了, 正在发送旧文件的连接继续用旧fd
+        files_.erase(it);
+    }
+
+    CachedFilePtr file = _Open(path, st);
+    if (!file)
+        return file;
+    if (files_.size() >= max_files_) {
+        for (auto i = files_.begin(); i != files_.end();) {
+            if (i->second.file.use_count() == 1)
+                i = files_.erase(i);
+            else
+                ++i;
+        }
+    }
+    // 都在使用时不缓存, 用完就关
+    if (files_.size() < max_files_)
+        files_[path] = { file, now };
+    return file;
+}
+
+size_t CFileCache::GetSize()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return files_.size();
+}
+
+CachedFilePtr CFileCache::_Open(const std::string &path, const struct stat &st)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        LogWarn("file cache open {} failed: {}", path, strerror(errno));
+        return CachedFilePtr();
+    }
+    std::shared_ptr<CCachedFile> file(new CCachedFile());
+    file->fd_ = fd;
+    // 用打开之后的fstat, stat和open之间文件可能被换掉
+    struct stat fst;
+    if (fstat(fd, &fst) < 0)
+        fst = st;
+    file->size_ = fst.st_size;
+    file->mtime_ = fst.st_mtime;
+    file->ino_ = fst.st_ino;
+    return file;
+}
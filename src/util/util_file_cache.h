@@ -0,0 +1,66 @@
+/*
+ * util_file_cache.h
+ *
+ * 打开的文件缓存: 按路径缓存fd和文件大小, 给sendfile用
+ * 1. 同一个文件的请求共享一个fd, 不用每次open/fstat
+ * 2. 缓存的条目隔一段时间stat一次, 文件变了(还在录制)重新打开, 正在发送旧文件的连接继续用旧fd
+ * 3. 所有loop共享, 加锁; 最后一个引用释放时关闭fd
+ */
+
+#ifndef __UTIL_FILE_CACHE_H__
+#define __UTIL_FILE_CACHE_H__
+
+#include "ostype.h"
+#include <sys/types.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#define FILE_CACHE_MAX_FILES        256
+#define FILE_CACHE_REVALIDATE_MS    1000    // 多久stat一次检查文件是否变化
+
+class CCachedFile {
+  public:
+    ~CCachedFile();
+
+    int GetFd() const { return fd_; }
+    uint64_t GetSize() const { return size_; }
+    time_t GetMtime() const { return mtime_; }
+
+  private:
+    friend class CFileCache;
+    CCachedFile() : fd_(-1), size_(0), mtime_(0), ino_(0) {}
+
+    int fd_;
+    uint64_t size_;
+    time_t mtime_;
+    ino_t ino_;
+};
+
+typedef std::shared_ptr<const CCachedFile> CachedFilePtr;
+
+class CFileCache {
+  public:
+    CFileCache(size_t max_files = FILE_CACHE_MAX_FILES, uint64_t revalidate_ms = FILE_CACHE_REVALIDATE_MS);
+
+    // 文件不存在或者不是普通文件时返回空
+    CachedFilePtr Open(const std::string &path);
+
+    size_t GetSize();
+
+  private:
+    typedef struct {
+        CachedFilePtr file;
+        uint64_t check_tick;    // 上次stat的时间
+    } Entry;
+
+    CachedFilePtr _Open(const std::string &path, const struct stat &st);
+
+    size_t max_files_;
+    uint64_t revalidate_ms_;
+    std::mutex mutex_;
+    std::unordered_map<std::string, Entry> files_;
+};
+
+#endif
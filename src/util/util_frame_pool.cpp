@@ -0,0 +1,81 @@
+#include "util_frame_pool.h"
+#include <stdlib.h>
+#include <string.h>
+#include <mutex>
+#include <vector>
+
+struct FrameClass {
+    std::vector<FrameBuffer *> frames;
+};
+
+struct FrameClasses {
+    std::mutex mutex;
+    FrameClass classes[FRAME_POOL_CLASSES];
+    size_t cached_bytes;
+
+    FrameClasses() : cached_bytes(0) {}
+};
+
+// 不析构: 退出时还可能有全局对象持有帧
+static FrameClasses &s_frame_pool = *new FrameClasses();
+
+static int frame_class_index(size_t bytes) {
+    int index = 0;
+    while (index < FRAME_POOL_CLASSES && ((size_t)1 << (FRAME_POOL_MIN_SHIFT + index)) < bytes) {
+        index++;
+    }
+    return index < FRAME_POOL_CLASSES ? index : -1;
+}
+
+FrameBufferPtr FramePool::Alloc(size_t bytes) {
+    FrameBuffer *frame = NULL;
+    int index = frame_class_index(bytes);
+    if (index >= 0) {
+        std::lock_guard<std::mutex> lock(s_frame_pool.mutex);
+        FrameClass &cls = s_frame_pool.classes[index];
+        if (!cls.frames.empty()) {
+            frame = cls.frames.back();
+            cls.frames.pop_back();
+            s_frame_pool.cached_bytes -= frame->capacity_;
+        }
+    }
+
+    if (!frame) {
+        frame = new FrameBuffer();
+        frame->capacity_ = index >= 0 ? ((size_t)1 << (FRAME_POOL_MIN_SHIFT + index)) : bytes;
+        frame->data_ = (uint8_t *)malloc(frame->capacity_ ? frame->capacity_ : 1);
+        frame->index_ = index;
+        if (!frame->data_) {
+            delete frame;
+            return FrameBufferPtr();
+        }
+    }
+    frame->size_ = bytes;
+    return FrameBufferPtr(frame, FramePool::_Release);
+}
+
+FrameBufferPtr FramePool::Create(const void *data, size_t bytes) {
+    FrameBufferPtr frame = Alloc(bytes);
+    if (frame && bytes > 0) {
+        memcpy(frame->GetData(), data, bytes);
+    }
+    return frame;
+}
+
+size_t FramePool::GetCachedBytes() {
+    std::lock_guard<std::mutex> lock(s_frame_pool.mutex);
+    return s_frame_pool.cached_bytes;
+}
+
+void FramePool::_Release(FrameBuffer *frame) {
+    if (frame->index_ >= 0) {
+        std::lock_guard<std::mutex> lock(s_frame_pool.mutex);
+        FrameClass &cls = s_frame_pool.classes[frame->index_];
+        if ((cls.frames.size() + 1) * frame->capacity_ <= FRAME_POOL_CLASS_BYTES) {
+            cls.frames.push_back(frame);
+            s_frame_pool.cached_bytes += frame->capacity_;
+            return;
+        }
+    }
+    delete frame;
+}
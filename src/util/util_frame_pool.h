@@ -0,0 +1,55 @@
+/*
+ * util_frame_pool.h
+ *
+ * 引用计数的帧缓冲区: 推流端收到的一帧直接重组到这里, 之后所有拉流端引用同一块内存
+ * 1. 按2的幂分级, 从全局池里分配, 最后一个引用释放时还回池里
+ * 2. 分配和释放可以在不同的loop线程, 池用锁保护, 每帧只加锁两次
+ */
+
+#ifndef __UTIL_FRAME_POOL_H__
+#define __UTIL_FRAME_POOL_H__
+
+#include "ostype.h"
+#include <stdlib.h>
+#include <memory>
+
+#define FRAME_POOL_MIN_SHIFT    10                      // 最小1KB
+#define FRAME_POOL_MAX_SHIFT    22                      // 最大4MB, 更大的帧直接malloc
+#define FRAME_POOL_CLASSES      (FRAME_POOL_MAX_SHIFT - FRAME_POOL_MIN_SHIFT + 1)
+#define FRAME_POOL_CLASS_BYTES  (16 * 1024 * 1024)      // 每一级最多缓存的空闲字节数
+
+class FrameBuffer {
+  public:
+    uint8_t *GetData() const { return data_; }
+    size_t GetSize() const { return size_; }
+    size_t GetCapacity() const { return capacity_; }
+    void SetSize(size_t size) { size_ = size; }
+
+  private:
+    friend class FramePool;
+    FrameBuffer() : data_(NULL), size_(0), capacity_(0), index_(-1) {}
+    ~FrameBuffer() { free(data_); }
+
+    uint8_t *data_;
+    size_t size_;
+    size_t capacity_;
+    int index_;             // 所在的级别, -1表示不进池
+};
+
+typedef std::shared_ptr<FrameBuffer> FrameBufferPtr;
+
+class FramePool {
+  public:
+    // 分配至少bytes字节的缓冲区, GetSize()为bytes
+    static FrameBufferPtr Alloc(size_t bytes);
+    // 分配并拷贝
+    static FrameBufferPtr Create(const void *data, size_t bytes);
+
+    // 当前缓存的空闲字节数
+    static size_t GetCachedBytes();
+
+  private:
+    static void _Release(FrameBuffer *frame);
+};
+
+#endif
@@ -0,0 +1,80 @@
+#include "util_histogram.h"
+#include <string.h>
+
+HistogramSnapshot::HistogramSnapshot() : count(0), sum(0), max(0)
+{
+    memset(buckets, 0, sizeof(buckets));
+}
+
+void HistogramSnapshot::Merge(const HistogramSnapshot &other)
+{
+    count += other.count;
+    sum += other.sum;
+    if (other.max > max)
+        max = other.max;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+        buckets[i] += other.buckets[i];
+}
+
+uint64_t HistogramSnapshot::Percentile(double p) const
+{
+    uint64_t total = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+        total += buckets[i];
+    if (total == 0)
+        return 0;
+
+    uint64_t rank = (uint64_t)(total * p / 100);
+    if (rank >= total)
+        rank = total - 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += buckets[i];
+        if (seen > rank) {
+            // 最后一个桶没有上界, 用最大值
+            uint64_t upper = i == HISTOGRAM_BUCKETS - 1 ? max : ((uint64_t)1 << i) - 1;
+            return upper < max ? upper : max;
+        }
+    }
+    return max;
+}
+
+CHistogram::CHistogram()
+{
+    Reset();
+}
+
+int CHistogram::GetBucket(uint64_t value)
+{
+    if (value == 0)
+        return 0;
+    int bucket = 64 - __builtin_clzll(value);
+    return bucket < HISTOGRAM_BUCKETS ? bucket : HISTOGRAM_BUCKETS - 1;
+}
+
+void CHistogram::Add(uint64_t value)
+{
+    _Inc(count_, 1);
+    _Inc(sum_, value);
+    if (value > max_.load(std::memory_order_relaxed))
+        max_.store(value, std::memory_order_relaxed);
+    _Inc(buckets_[GetBucket(value)], 1);
+}
+
+void CHistogram::Reset()
+{
+    count_.store(0, std::memory_order_relaxed);
+    sum_.store(0, std::memory_order_relaxed);
+    max_.store(0, std::memory_order_relaxed);
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+        buckets_[i].store(0, std::memory_order_relaxed);
+}
+
+void CHistogram::GetSnapshot(HistogramSnapshot *snapshot) const
+{
+    snapshot->count = count_.load(std::memory_order_relaxed);
+    snapshot->sum = sum_.load(std::memory_order_relaxed);
+    snapshot->max = max_.load(std::memory_order_relaxed);
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+        snapshot->buckets[i] = buckets_[i].load(std::memory_order_relaxed);
+}
@@ -0,0 +1,54 @@
+/*
+ * util_histogram.h
+ *
+ * 耗时直方图: 按2的幂分桶, 每个桶只是一个计数
+ * 1. 一个CHistogram只由一个线程写, 写只是relaxed的load/store, 不加锁也没有原子的读改写
+ * 2. 其他线程可以随时读出快照, 多个线程的快照可以合并, 结果是近似值
+ */
+
+#ifndef __UTIL_HISTOGRAM_H__
+#define __UTIL_HISTOGRAM_H__
+
+#include "ostype.h"
+#include <atomic>
+
+#define HISTOGRAM_BUCKETS   40      // 第i个桶是[2^(i-1), 2^i), 最后一个桶放更大的值
+
+typedef struct HistogramSnapshot {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[HISTOGRAM_BUCKETS];
+
+    HistogramSnapshot();
+    void Merge(const HistogramSnapshot &other);
+    // 第p(0-100)百分位所在桶的上界, 没有数据时返回0
+    uint64_t Percentile(double p) const;
+    uint64_t Mean() const { return count ? sum / count : 0; }
+} HistogramSnapshot;
+
+class CHistogram {
+  public:
+    CHistogram();
+
+    // 只在写的线程调用
+    void Add(uint64_t value);
+    void Reset();
+
+    // 任意线程调用
+    void GetSnapshot(HistogramSnapshot *snapshot) const;
+
+    static int GetBucket(uint64_t value);
+
+  private:
+    static void _Inc(std::atomic<uint64_t> &v, uint64_t n) {
+        v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    std::atomic<uint64_t> count_;
+    std::atomic<uint64_t> sum_;
+    std::atomic<uint64_t> max_;
+    std::atomic<uint64_t> buckets_[HISTOGRAM_BUCKETS];
+};
+
+#endif
@@ -0,0 +1,153 @@
+/*
+ * util_mpsc_queue.h
+ *
+ * 多生产者单消费者队列, 用于其他线程把任务交给loop线程
+ * 1. 定长环形数组, 槽位预先分配好反复使用; 每个槽位一个序号, 生产者一次CAS占位, 写完发布
+ * 2. 环满时放进加锁的溢出链表, 不会失败; 溢出期间所有生产者都走溢出链表, 保证同一个生产者的顺序
+ * 3. 消费者一次取出一批, 只取开始时已经入队的, 执行中再投递的留到下一批
+ */
+
+#ifndef __UTIL_MPSC_QUEUE_H__
+#define __UTIL_MPSC_QUEUE_H__
+
+#include "ostype.h"
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+template <typename T>
+class CMpscQueue {
+  public:
+    // capacity向上取到2的幂
+    explicit CMpscQueue(size_t capacity) : head_(0), tail_(0), overflow_(false), overflow_count_(0) {
+        size_t size = 2;
+        while (size < capacity)
+            size <<= 1;
+        mask_ = size - 1;
+        slots_ = new Slot[size];
+        for (size_t i = 0; i < size; i++)
+            slots_[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    ~CMpscQueue() { delete[] slots_; }
+
+    CMpscQueue(const CMpscQueue &) = delete;
+    CMpscQueue &operator=(const CMpscQueue &) = delete;
+
+    // 任意线程调用
+    void Push(T &&item) {
+        if (!overflow_.load(std::memory_order_acquire) && _TryPush(item))
+            return;
+        std::lock_guard<std::mutex> lock(overflow_mutex_);
+        overflow_list_.push_back(std::move(item));
+        overflow_.store(true, std::memory_order_release);
+        overflow_count_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void Push(const T &item) {
+        T copy(item);
+        Push(std::move(copy));
+    }
+
+    /**
+     * @brief 只在消费线程调用, 对取出的每一个元素调用f
+     *
+     * @return 取出的个数
+     */
+    template <typename F>
+    size_t Drain(F &&f) {
+        size_t count = 0;
+        size_t tail = tail_.load(std::memory_order_acquire);
+        if (!overflow_.load(std::memory_order_acquire)) {
+            // 遇到还没写完的槽位就停下, 生产者写完之后会再唤醒
+            while (head_ != tail && _TryPop(f))
+                count++;
+            return count;
+        }
+
+        // 溢出链表里的元素晚于取链表时环里已经占位的元素, 先把这些取完(等还没写完的生产者)
+        std::vector<T> overflow;
+        {
+            std::lock_guard<std::mutex> lock(overflow_mutex_);
+            overflow.swap(overflow_list_);
+            tail = tail_.load(std::memory_order_acquire);
+        }
+        while (head_ != tail) {
+            if (_TryPop(f))
+                count++;
+            else
+                std::this_thread::yield();
+        }
+        for (size_t i = 0; i < overflow.size(); i++)
+            f(overflow[i]);
+        count += overflow.size();
+
+        // 溢出链表已经执行完才回到环, 之后的元素不会排到它们前面
+        std::lock_guard<std::mutex> lock(overflow_mutex_);
+        if (overflow_list_.empty())
+            overflow_.store(false, std::memory_order_release);
+        return count;
+    }
+
+    // 消费线程调用时是准确的, 其他线程只是近似值
+    bool Empty() const {
+        return head_ == tail_.load(std::memory_order_acquire) && !overflow_.load(std::memory_order_acquire);
+    }
+
+    size_t GetCapacity() const { return mask_ + 1; }
+    // 环满进溢出链表的次数
+    uint64_t GetOverflowCount() const { return overflow_count_.load(std::memory_order_relaxed); }
+
+  private:
+    typedef struct {
+        std::atomic<size_t> seq;    // ==pos时可以写, ==pos+1时可以读
+        T data;
+    } Slot;
+
+    // 成功时item被移走
+    bool _TryPush(T &item) {
+        size_t pos = tail_.load(std::memory_order_relaxed);
+        for (;;) {
+            Slot &slot = slots_[pos & mask_];
+            size_t seq = slot.seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    slot.data = std::move(item);
+                    slot.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;   // 满了
+            } else {
+                pos = tail_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    template <typename F>
+    bool _TryPop(F &f) {
+        Slot &slot = slots_[head_ & mask_];
+        if (slot.seq.load(std::memory_order_acquire) != head_ + 1)
+            return false;
+        T item(std::move(slot.data));
+        slot.data = T();
+        slot.seq.store(head_ + mask_ + 1, std::memory_order_release);
+        head_++;
+        f(item);
+        return true;
+    }
+
+  private:
+    Slot *slots_;
+    size_t mask_;
+    size_t head_;                   // 只有消费者访问
+    alignas(64) std::atomic<size_t> tail_;
+    alignas(64) std::atomic<bool> overflow_;
+    std::atomic<uint64_t> overflow_count_;
+    std::mutex overflow_mutex_;
+    std::vector<T> overflow_list_;
+};
+
+#endif
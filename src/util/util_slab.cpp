@@ -0,0 +1,64 @@
+#include "util_slab.h"
+#include <stdlib.h>
+#include <assert.h>
+
+CSlab::CSlab(size_t obj_size, uint32_t objs_per_slab) {
+    // 每个对象至少能放下空闲链表指针, 和malloc一样按两个指针大小对齐
+    obj_size_ = obj_size < sizeof(FreeNode) ? sizeof(FreeNode) : obj_size;
+    obj_size_ = (obj_size_ + sizeof(void *) * 2 - 1) & ~(sizeof(void *) * 2 - 1);
+    objs_per_slab_ = objs_per_slab ? objs_per_slab : 1;
+    free_list_ = NULL;
+    used_count_ = 0;
+}
+
+CSlab::~CSlab() {
+    if (used_count_ != 0) {
+        return;
+    }
+    for (size_t i = 0; i < slabs_.size(); i++) {
+        free(slabs_[i]);
+    }
+}
+
+void *CSlab::Alloc() {
+    if (!free_list_) {
+        char *slab = (char *)malloc(obj_size_ * objs_per_slab_);
+        if (!slab) {
+            return NULL;
+        }
+        slabs_.push_back(slab);
+        // 倒着挂, 分配时按地址顺序
+        for (uint32_t i = objs_per_slab_; i > 0; i--) {
+            FreeNode *node = (FreeNode *)(slab + (i - 1) * obj_size_);
+            node->next = free_list_;
+            free_list_ = node;
+        }
+    }
+
+    FreeNode *node = free_list_;
+    free_list_ = node->next;
+    used_count_++;
+    return node;
+}
+
+void CSlab::Free(void *ptr) {
+    if (!ptr) {
+        return;
+    }
+    assert(_Owns(ptr));
+    FreeNode *node = (FreeNode *)ptr;
+    node->next = free_list_;
+    free_list_ = node;
+    used_count_--;
+}
+
+// 只在断言里用, slab数量是峰值连接数/每个slab的对象数, 逐个比较地址范围
+bool CSlab::_Owns(void *ptr) {
+    for (size_t i = 0; i < slabs_.size(); i++) {
+        char *slab = (char *)slabs_[i];
+        if ((char *)ptr >= slab && (char *)ptr < slab + obj_size_ * objs_per_slab_) {
+            return ((char *)ptr - slab) % obj_size_ == 0;
+        }
+    }
+    return false;
+}
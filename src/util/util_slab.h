@@ -0,0 +1,44 @@
+/*
+ * util_slab.h
+ *
+ * 固定大小对象的slab分配器, 每个loop线程一个实例, 不加锁
+ * 1. 每次向系统申请一个slab(一批对象), 释放的对象挂到空闲链表上, 分配和释放都是O(1)
+ * 2. slab不还给系统, 内存维持在峰值, 重连风暴时不会反复malloc/free
+ * 3. 分配和释放必须在同一个线程: 没有锁也没有原子操作, 不是无锁分配器;
+ *    调试版本Free时检查对象属于本实例的slab, 在别的线程释放(用的是那个线程的实例)会断言失败
+ */
+
+#ifndef __UTIL_SLAB_H__
+#define __UTIL_SLAB_H__
+
+#include "ostype.h"
+#include <vector>
+
+class CSlab {
+  public:
+    CSlab(size_t obj_size, uint32_t objs_per_slab);
+    // 还有对象没释放时不释放slab, 避免线程退出后其他地方还在用
+    ~CSlab();
+
+    void *Alloc();
+    void Free(void *ptr);
+
+    size_t GetObjSize() { return obj_size_; }
+    size_t GetSlabCount() { return slabs_.size(); }
+    size_t GetUsedCount() { return used_count_; }
+
+  private:
+    bool _Owns(void *ptr);
+
+    struct FreeNode {
+        FreeNode *next;
+    };
+
+    size_t obj_size_;
+    uint32_t objs_per_slab_;
+    FreeNode *free_list_;
+    size_t used_count_;
+    std::vector<void *> slabs_;
+};
+
+#endif
@@ -0,0 +1,13 @@
+/*
+ * 测试程序共用的检查宏: 失败时打印条件和行号, main根据s_failed返回
+ */
+#ifndef TEST_CHECK_H
+#define TEST_CHECK_H
+
+#include <iostream>
+
+static int s_failed = 0;
+
+#define CHECK(cond) do { if (!(cond)) { std::cout << "CHECK failed: " #cond << ", line " << __LINE__ << std::endl; s_failed++; } } while (0)
+
+#endif
@@ -0,0 +1,65 @@
+#include <iostream>
+#include <stdlib.h>
+#include "protocol/rtmp_internal.h"
+#include "test_check.h"
+using namespace std;
+
+// 2-8走固定数组, 其他cid走哈希表, 地址在表增长后不变
+void test_find_get()
+{
+    struct rtmp_packet_table_t table;
+    rtmp_packet_table_init(&table);
+
+    CHECK(NULL == rtmp_packet_table_find(&table, 2));
+    CHECK(NULL == rtmp_packet_table_find(&table, 300));
+
+    struct rtmp_packet_t *p3 = rtmp_packet_table_get(&table, 3);
+    CHECK(p3 == &table.fast[3] && 3 == p3->header.cid);
+    CHECK(p3 == rtmp_packet_table_find(&table, 3));
+
+    uint32_t cids[] = { 9, 64, 70, 300, 319, 1000, 65599 };
+    struct rtmp_packet_t *pkts[sizeof(cids) / sizeof(cids[0])];
+    for (size_t i = 0; i < sizeof(cids) / sizeof(cids[0]); i++)
+        pkts[i] = rtmp_packet_table_get(&table, cids[i]);
+    for (size_t i = 0; i < sizeof(cids) / sizeof(cids[0]); i++) {
+        CHECK(pkts[i] && cids[i] == pkts[i]->header.cid);
+        CHECK(pkts[i] == rtmp_packet_table_find(&table, cids[i]));
+    }
+    CHECK(NULL == rtmp_packet_table_find(&table, 301));
+    rtmp_packet_table_free(NULL, &table);
+}
+
+// 超过N_CHUNK_STREAM_EXTRA个块流时淘汰空闲的, 全部在收消息时返回NULL
+void test_evict()
+{
+    struct rtmp_packet_table_t table;
+    rtmp_packet_table_init(&table);
+    for (uint32_t cid = 100; cid < 100 + N_CHUNK_STREAM_EXTRA; cid++) {
+        struct rtmp_packet_t *pkt = rtmp_packet_table_get(&table, cid);
+        pkt->payload = (uint8_t *)malloc(16);
+        pkt->capacity = 16;
+        pkt->bytes = (cid == 110) ? 0 : 8;    // 只有110是空闲的
+    }
+    CHECK(N_CHUNK_STREAM_EXTRA == table.count);
+
+    struct rtmp_packet_t *pkt = rtmp_packet_table_get(&table, 5000);
+    CHECK(pkt && 5000 == pkt->header.cid);
+    CHECK(NULL == rtmp_packet_table_find(&table, 110));
+    for (uint32_t cid = 100; cid < 100 + N_CHUNK_STREAM_EXTRA; cid++) {
+        if (cid != 110)
+            CHECK(NULL != rtmp_packet_table_find(&table, cid));
+    }
+
+    pkt->bytes = 8;
+    CHECK(NULL == rtmp_packet_table_get(&table, 5001));
+    CHECK(N_CHUNK_STREAM_EXTRA == table.count);
+    rtmp_packet_table_free(NULL, &table);
+}
+
+int main()
+{
+    test_find_get();
+    test_evict();
+    cout << (s_failed ? "test_chunk_stream failed" : "test_chunk_stream ok") << endl;
+    return s_failed ? 1 : 0;
+}
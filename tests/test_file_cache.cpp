@@ -0,0 +1,77 @@
+#include <iostream>
+#include <string>
+#include <fstream>
+#include <string.h>
+#include <unistd.h>
+#include "util/util_file_cache.h"
+#include "test_check.h"
+using namespace std;
+
+static void write_file(const char *path, size_t size)
+{
+    ofstream out(path, ios::binary | ios::trunc);
+    out << string(size, 'x');
+}
+
+// 同一个文件共享fd, 文件变化之后重新打开, 旧的fd还能用
+void test_open()
+{
+    const char *path = "/tmp/test_file_cache.dat";
+    write_file(path, 1000);
+
+    CFileCache cache(FILE_CACHE_MAX_FILES, 0);  // 每次都stat
+    CachedFilePtr file = cache.Open(path);
+    CHECK(file && file->GetFd() >= 0 && 1000 == file->GetSize());
+    CHECK(file == cache.Open(path));
+    CHECK(1 == cache.GetSize());
+
+    unlink(path);   // 换一个文件, inode不同
+    write_file(path, 2000);
+    CachedFilePtr file2 = cache.Open(path);
+    CHECK(file2 && file2 != file && 2000 == file2->GetSize());
+    char c = 0;
+    CHECK(file && 1 == pread(file->GetFd(), &c, 1, 999) && 'x' == c);
+
+    unlink(path);
+    CHECK(!cache.Open(path));
+    CHECK(0 == cache.GetSize());
+    CHECK(!cache.Open("/tmp"));     // 目录不缓存
+}
+
+// 在有效期内不重新stat
+void test_revalidate()
+{
+    const char *path = "/tmp/test_file_cache.dat";
+    write_file(path, 100);
+    CFileCache cache(FILE_CACHE_MAX_FILES, 60000);
+    CachedFilePtr file = cache.Open(path);
+    write_file(path, 200);
+    CHECK(file == cache.Open(path) && 100 == file->GetSize());
+    unlink(path);
+}
+
+// 超过上限时释放没有在用的
+void test_evict()
+{
+    CFileCache cache(2, 60000);
+    const char *paths[] = { "/tmp/test_file_cache.1", "/tmp/test_file_cache.2", "/tmp/test_file_cache.3" };
+    for (const char *path : paths)
+        write_file(path, 10);
+
+    CachedFilePtr file = cache.Open(paths[0]);
+    cache.Open(paths[1]);
+    CachedFilePtr file3 = cache.Open(paths[2]);
+    CHECK(file3 && 2 == cache.GetSize());
+    CHECK(file == cache.Open(paths[0]));   // 在用的没有被释放
+    for (const char *path : paths)
+        unlink(path);
+}
+
+int main()
+{
+    test_open();
+    test_revalidate();
+    test_evict();
+    cout << (s_failed ? "test_file_cache failed" : "test_file_cache ok") << endl;
+    return s_failed ? 1 : 0;
+}
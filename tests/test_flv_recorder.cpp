@@ -0,0 +1,132 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iterator>
+#include <string.h>
+#include <unistd.h>
+#include "app/app_flv_recorder.h"
+#include "test_check.h"
+using namespace std;
+
+typedef struct {
+    uint8_t type;
+    uint32_t size;
+    uint32_t timestamp;
+} Tag;
+
+static uint32_t read_be(const uint8_t *p, int n)
+{
+    uint32_t v = 0;
+    for (int i = 0; i < n; i++)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+// 解析整个文件, 格式不对时返回false
+static bool read_flv(const string &path, vector<Tag> *tags)
+{
+    ifstream in(path.c_str(), ios::binary);
+    string data((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+    const uint8_t *p = (const uint8_t *)data.data();
+    if (data.size() < FLV_HEADER_SIZE + 4 || 0 != memcmp(p, "FLV", 3))
+        return false;
+    size_t off = FLV_HEADER_SIZE + 4;
+    while (off < data.size()) {
+        if (off + FLV_TAG_HEADER_SIZE > data.size())
+            return false;
+        Tag tag;
+        tag.type = p[off];
+        tag.size = read_be(p + off + 1, 3);
+        tag.timestamp = read_be(p + off + 4, 3) | ((uint32_t)p[off + 7] << 24);
+        size_t end = off + FLV_TAG_HEADER_SIZE + tag.size;
+        if (end + 4 > data.size() || read_be(p + end, 4) != FLV_TAG_HEADER_SIZE + tag.size)
+            return false;
+        tags->push_back(tag);
+        off = end + 4;
+    }
+    return true;
+}
+
+static MediaPacketPtr video(uint32_t ts, bool key, size_t size)
+{
+    vector<uint8_t> data(size, 0x55);
+    data[0] = key ? 0x17 : 0x27;
+    data[1] = 1;
+    return MediaPacket::Create(FLV_TYPE_VIDEO, data.data(), data.size(), ts);
+}
+
+static FlvRecordConfig make_config(bool direct_io)
+{
+    // buffer比一帧小, 一帧要分几次写
+    FlvRecordConfig config = { true, "", 5000, FLV_RECORD_MAX_PENDING_BYTES, FLV_RECORD_DROP_TO_KEYFRAME, direct_io };
+    return config;
+}
+
+// 时间戳从第一帧开始算, append接着原文件最后一帧
+void test_record_append(bool direct_io)
+{
+    string path = "/tmp/test_flv_recorder/live/test.flv";
+    unlink(path.c_str());
+
+    uint8_t config[] = { 0x17, 0x00, 0, 0, 0, 1, 2, 3 };
+    FlvRecorderPtr recorder = make_shared<FlvRecorder>(path, false, make_config(direct_io));
+    recorder->OnPacket(MediaPacket::Create(FLV_TYPE_VIDEO, config, sizeof(config), 5000));
+    for (uint32_t i = 0; i < 20; i++)
+        recorder->OnPacket(video(5000 + i * 40, i % 10 == 0, 3000 + i));
+    recorder->Close();
+    recorder->OnPacket(video(6000, true, 100));     // 关闭之后不再写
+
+    FlvRecordStats stats = recorder->GetStats();
+    CHECK(0 == stats.pending_bytes);
+    CHECK(0 == stats.dropped_frames);
+    CHECK(stats.write_count > 1);
+
+    vector<Tag> tags;
+    CHECK(read_flv(path, &tags));
+    CHECK(21 == tags.size());
+    if (21 == tags.size()) {
+        CHECK(0 == tags[0].timestamp);
+        CHECK(0 == tags[1].timestamp);
+        CHECK(760 == tags[20].timestamp);
+        CHECK(3019 == tags[20].size);
+        CHECK(stats.written_bytes == FLV_HEADER_SIZE + 4 + 21 * (FLV_TAG_HEADER_SIZE + 4) + sizeof(config)
+                                     + 20 * 3000 + 190);
+    }
+
+    recorder = make_shared<FlvRecorder>(path, true, make_config(direct_io));
+    recorder->OnPacket(video(100, true, 500));
+    recorder->OnPacket(video(140, false, 500));
+    recorder->Close();
+
+    tags.clear();
+    CHECK(read_flv(path, &tags));
+    CHECK(23 == tags.size());
+    if (23 == tags.size()) {
+        CHECK(760 == tags[21].timestamp);
+        CHECK(800 == tags[22].timestamp);
+    }
+}
+
+// live不录, 流名不能跳出录制目录
+void test_create()
+{
+    FlvRecordConfig config = make_config(false);
+    config.dir = "/tmp/test_flv_recorder";
+    FlvRecordInit(config);
+    CHECK(!FlvRecordCreate("live/test", "live"));
+    CHECK(!FlvRecordCreate("live/test", NULL));
+    CHECK(!FlvRecordCreate("live/../test", "record"));
+    CHECK(!FlvRecordCreate("live/a/b", "record"));
+    FlvRecorderPtr recorder = FlvRecordCreate("live/test", "append");
+    CHECK(recorder && recorder->GetPath() == "/tmp/test_flv_recorder/live/test.flv");
+}
+
+int main()
+{
+    test_record_append(false);
+    test_record_append(true);
+    test_create();
+    cout << (s_failed ? "test_flv_recorder failed" : "test_flv_recorder ok") << endl;
+    return s_failed ? 1 : 0;
+}
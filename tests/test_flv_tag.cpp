@@ -0,0 +1,55 @@
+#include <iostream>
+#include <vector>
+#include <string.h>
+#include "app/app_media_packet.h"
+#include "test_check.h"
+using namespace std;
+
+static uint32_t read_be(const uint8_t *p, int n)
+{
+    uint32_t v = 0;
+    for (int i = 0; i < n; i++)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+// tag头、数据和PreviousTagSize, 时间戳超过24位时放进扩展字节
+void test_layout()
+{
+    vector<uint8_t> data(3000);
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = (uint8_t)i;
+    data[0] = 0x17;
+    data[1] = 1;
+    uint32_t timestamp = 0x12345678;
+    MediaPacketPtr pkt = MediaPacket::Create(FLV_TYPE_VIDEO, data.data(), data.size(), timestamp);
+
+    SendBufferPtr tag = pkt->GetFlvTag();
+    CHECK(tag->size() == FLV_TAG_HEADER_SIZE + data.size() + 4);
+    const uint8_t *p = (const uint8_t *)tag->data();
+    CHECK(FLV_TYPE_VIDEO == p[0]);
+    CHECK(data.size() == read_be(p + 1, 3));
+    CHECK(timestamp == (read_be(p + 4, 3) | ((uint32_t)p[7] << 24)));
+    CHECK(0 == read_be(p + 8, 3));
+    CHECK(0 == memcmp(p + FLV_TAG_HEADER_SIZE, data.data(), data.size()));
+    CHECK(FLV_TAG_HEADER_SIZE + data.size() == read_be(p + FLV_TAG_HEADER_SIZE + data.size(), 4));
+}
+
+// 同一帧只构造一次
+void test_shared()
+{
+    uint8_t data[] = { 0x2f, 'a', 'b' };
+    MediaPacketPtr pkt = MediaPacket::Create(FLV_TYPE_SCRIPT, data, sizeof(data), 40);
+    SendBufferPtr tag = pkt->GetFlvTag();
+    CHECK(tag == pkt->GetFlvTag());
+    CHECK(FLV_TYPE_SCRIPT == (uint8_t)(*tag)[0]);
+    CHECK(40 == read_be((const uint8_t *)tag->data() + 4, 3));
+}
+
+int main()
+{
+    test_layout();
+    test_shared();
+    cout << (s_failed ? "test_flv_tag failed" : "test_flv_tag ok") << endl;
+    return s_failed ? 1 : 0;
+}
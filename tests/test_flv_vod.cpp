@@ -0,0 +1,166 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <string.h>
+#include <unistd.h>
+#include <thread>
+#include "app/app_flv_recorder.h"
+#include "app/app_flv_vod.h"
+#include "test_check.h"
+using namespace std;
+
+static const char *s_path = "/tmp/test_flv_vod/live/vod.flv";
+
+static MediaPacketPtr packet(int type, uint8_t b0, uint8_t b1, uint32_t ts, size_t size)
+{
+    vector<uint8_t> data(size, 0x55);
+    data[0] = b0;
+    data[1] = b1;
+    return MediaPacket::Create(type, data.data(), data.size(), ts);
+}
+
+// metadata, avc/aac sequence header, 默认10秒25fps, 每秒一个关键帧
+static void write_file(const char *path = s_path, uint32_t frames = 250)
+{
+    FlvRecordConfig config = { true, "", FLV_RECORD_BUFFER_SIZE, FLV_RECORD_MAX_PENDING_BYTES,
+                               FLV_RECORD_DROP_TO_KEYFRAME, false };
+    FlvRecorderPtr recorder = make_shared<FlvRecorder>(path, false, config);
+    recorder->OnPacket(packet(FLV_TYPE_SCRIPT, 0x02, 0x00, 0, 30));
+    recorder->OnPacket(packet(FLV_TYPE_VIDEO, 0x17, 0x00, 0, 20));
+    recorder->OnPacket(packet(FLV_TYPE_AUDIO, 0xaf, 0x00, 0, 4));
+    for (uint32_t i = 0; i < frames; i++) {
+        recorder->OnPacket(packet(FLV_TYPE_VIDEO, i % 25 == 0 ? 0x17 : 0x27, 0x01, i * 40, 1000));
+        recorder->OnPacket(packet(FLV_TYPE_AUDIO, 0xaf, 0x01, i * 40 + 5, 100));
+    }
+    recorder->Close();
+}
+
+void test_index()
+{
+    FlvVodFilePtr file = FlvVodFile::Open(s_path);
+    CHECK(file);
+    if (!file)
+        return;
+    CHECK(file == FlvVodFile::Open(s_path));    // 同一个文件共享映射和索引
+    CHECK(9965 == file->GetDuration());
+    CHECK(10 == file->GetKeyframes().size());
+    CHECK(FLV_HEADER_SIZE + 4 == file->GetFirstTag());
+
+    FlvKeyframe k = file->Seek(0);
+    CHECK(0 == k.timestamp);
+    k = file->Seek(4500);
+    CHECK(4000 == k.timestamp);
+    FlvTag tag;
+    CHECK(file->ReadTag(k.offset, &tag) && FLV_TYPE_VIDEO == tag.type && 0x17 == tag.data[0] && 4000 == tag.timestamp);
+    CHECK(9000 == file->Seek(60000).timestamp);
+
+    CHECK(!FlvVodFile::Open("/tmp/test_flv_vod/live/none.flv"));
+}
+
+// 按时间戳匀速取帧, 暂停期间不取, seek之后先发metadata和sequence header
+void test_session()
+{
+    FlvVodFilePtr file = FlvVodFile::Open(s_path);
+    if (!file)
+        return;
+    FlvVodSession session(file);
+    vector<MediaPacketPtr> packets;
+
+    uint64_t now = 100000;
+    session.Seek(0, now);
+    session.Read(now, FLV_VOD_BATCH_BYTES, &packets);
+    // 开头3个tag + 预读1秒(0-1000ms)
+    CHECK(3 + 26 + 25 == packets.size());
+    CHECK(packets.size() > 3 && FLV_TYPE_SCRIPT == packets[0]->GetType() && packets[3]->IsKeyFrame());
+
+    packets.clear();
+    session.Read(now + 500, FLV_VOD_BATCH_BYTES, &packets);
+    CHECK(25 == packets.size());
+
+    session.Pause(true, now + 500);
+    packets.clear();
+    session.Read(now + 5000, FLV_VOD_BATCH_BYTES, &packets);
+    CHECK(packets.empty());
+    session.Pause(false, now + 5000);
+    packets.clear();
+    session.Read(now + 5000, FLV_VOD_BATCH_BYTES, &packets);
+    CHECK(packets.empty());     // 从暂停的位置继续
+
+    packets.clear();
+    session.Seek(6100, now + 6000);
+    session.Read(now + 6000, 10, &packets);
+    CHECK(4 == packets.size());
+    if (4 == packets.size()) {
+        CHECK(FLV_TYPE_SCRIPT == packets[0]->GetType() && 6000 == packets[0]->GetTimestamp());
+        CHECK(packets[1]->IsSequenceHeader() && packets[2]->IsSequenceHeader());
+        CHECK(packets[3]->IsKeyFrame() && 6000 == packets[3]->GetTimestamp());
+    }
+
+    packets.clear();
+    session.Read(now + 60000, 1024 * 1024, &packets);
+    CHECK(session.IsEnd());
+    CHECK(packets.size() > 0 && 9965 == packets.back()->GetTimestamp());
+}
+
+// loop里只查缓存; 没有缓存时几个线程同时打开, 只建一次索引
+void test_find()
+{
+    const char *path = "/tmp/test_flv_vod/live/find.flv";
+    unlink(path);
+    FlvVodFilePtr file;
+    CHECK(-1 == FlvVodFile::Find(path, &file) && !file);
+    write_file(path, 50);
+    CHECK(0 == FlvVodFile::Find(path, &file) && !file);
+
+    FlvVodFilePtr opened[4];
+    vector<thread> threads;
+    for (int i = 0; i < 4; i++)
+        threads.emplace_back([&opened, path, i]() { opened[i] = FlvVodFile::Open(path); });
+    for (size_t i = 0; i < threads.size(); i++)
+        threads[i].join();
+    CHECK(opened[0] && 1965 == opened[0]->GetDuration());
+    for (int i = 1; i < 4; i++)
+        CHECK(opened[i] == opened[0]);
+    CHECK(0 == FlvVodFile::Find(path, &file) && file == opened[0]);
+}
+
+// 观众还在读的时候重新录制同一个文件, 而且新文件更短:
+// 旧的观众读完旧文件, 不会读到截断后的映射收到SIGBUS; 新打开的是新文件
+void test_rerecord()
+{
+    FlvVodFilePtr file = FlvVodFile::Open(s_path);
+    if (!file)
+        return;
+    FlvVodSession session(file);
+    file.reset();
+    vector<MediaPacketPtr> packets;
+    uint64_t now = 100000;
+    session.Seek(0, now);
+    session.Read(now, FLV_VOD_BATCH_BYTES, &packets);
+    CHECK(!packets.empty());
+
+    write_file(s_path, 25);
+    FlvVodFilePtr fresh = FlvVodFile::Open(s_path);
+    CHECK(fresh && 965 == fresh->GetDuration());
+
+    packets.clear();
+    session.Read(now + 60000, 16 * 1024 * 1024, &packets);
+    CHECK(session.IsEnd());
+    CHECK(packets.size() > 0 && 9965 == packets.back()->GetTimestamp());
+    for (size_t i = 0; i < packets.size(); i++) {
+        if (FLV_TYPE_VIDEO == packets[i]->GetType() && !packets[i]->IsSequenceHeader())
+            CHECK(1000 == packets[i]->GetSize() && 0x55 == packets[i]->GetData()[999]);
+    }
+}
+
+int main()
+{
+    unlink(s_path);
+    write_file();
+    test_index();
+    test_session();
+    test_find();
+    test_rerecord();
+    cout << (s_failed ? "test_flv_vod failed" : "test_flv_vod ok") << endl;
+    return s_failed ? 1 : 0;
+}
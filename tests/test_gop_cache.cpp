@@ -0,0 +1,117 @@
+#include <iostream>
+#include <vector>
+#include "app/app_gop_cache.h"
+#include "test_check.h"
+using namespace std;
+
+#define FPS         25
+#define GOP_FRAMES  100     // 4秒一个关键帧
+#define FRAME_BYTES 4000
+
+static MediaPacketPtr make_video(uint32_t index)
+{
+    vector<uint8_t> data(FRAME_BYTES, 0);
+    data[0] = (index % GOP_FRAMES == 0) ? 0x17 : 0x27;  // AVC 关键帧/非关键帧
+    data[1] = 1;                                        // NALU
+    return MediaPacket::Create(FLV_TYPE_VIDEO, data.data(), data.size(), index * 1000 / FPS);
+}
+
+static MediaPacketPtr make_audio(uint32_t timestamp)
+{
+    vector<uint8_t> data(200, 0);
+    data[0] = 0xaf;     // AAC
+    data[1] = 1;        // raw
+    return MediaPacket::Create(FLV_TYPE_AUDIO, data.data(), data.size(), timestamp);
+}
+
+// 模拟直播流, 拉流端在join_ms加入, 比较有无GOP缓存时看到第一帧画面的时间(按流时间戳)
+void test_ttff()
+{
+    const uint32_t joins[] = { 100, 1500, 3900, 5000, 7990 };
+    for (size_t j = 0; j < sizeof(joins) / sizeof(joins[0]); j++) {
+        GopCache cache;
+        uint32_t join_ms = joins[j];
+        uint32_t i = 0;
+        for (; i * 1000 / FPS <= join_ms; i++) {
+            cache.Push(make_video(i));
+            cache.Push(make_audio(i * 1000 / FPS + 5));
+        }
+
+        // 无缓存: 等下一个关键帧
+        uint32_t next_key = (i + GOP_FRAMES - 1) / GOP_FRAMES * GOP_FRAMES;
+        uint32_t ttff_without = next_key * 1000 / FPS - join_ms;
+
+        // 有缓存: 加入时立即收到缓存的GOP, 之后的帧按时间戳实时到达; 取第一个视频关键帧的到达时间
+        const deque<MediaPacketPtr> &gop = cache.GetPackets();
+        CHECK(!gop.empty());
+        CHECK(gop.front()->IsKeyFrame());
+        vector<pair<uint32_t, MediaPacketPtr> > delivered;
+        for (size_t k = 0; k < gop.size(); k++)
+            delivered.push_back(make_pair(join_ms, gop[k]));
+        for (uint32_t k = i; k <= next_key; k++) {
+            MediaPacketPtr pkt = make_video(k);
+            delivered.push_back(make_pair(pkt->GetTimestamp(), pkt));
+        }
+        uint32_t ttff_with = UINT32_MAX;
+        for (size_t k = 0; k < delivered.size(); k++) {
+            if (delivered[k].second->IsKeyFrame()) {
+                ttff_with = delivered[k].first - join_ms;
+                break;
+            }
+        }
+        CHECK(ttff_with < ttff_without);
+
+        cout << "join at " << join_ms << "ms, ttff without cache: " << ttff_without
+             << "ms, with cache: " << ttff_with << "ms, cached " << gop.size()
+             << " packets, " << cache.GetBytes() << " bytes" << endl;
+    }
+    CHECK(0 == GopCache::GetTotalBytes());
+}
+
+// 超过上限时整个GOP丢弃, 等下一个关键帧
+void test_bounds()
+{
+    GopCache cache;
+    GopCacheConfig config = { true, 50 * FRAME_BYTES, GOP_CACHE_MAX_DURATION_MS };
+    cache.SetConfig(config);
+    for (uint32_t i = 0; i < 60; i++)
+        cache.Push(make_video(i));
+    CHECK(0 == cache.GetBytes());
+    for (uint32_t i = 60; i < 101; i++)
+        cache.Push(make_video(i));
+    CHECK(1 == cache.GetPackets().size());
+    CHECK(cache.GetBytes() == GopCache::GetTotalBytes());
+
+    config.max_bytes = GOP_CACHE_MAX_BYTES;
+    config.max_duration_ms = 1000;
+    cache.SetConfig(config);
+    for (uint32_t i = 101; i < 150; i++)
+        cache.Push(make_video(i));
+    CHECK(0 == cache.GetBytes());
+
+    // 纯音频流按时长滑动
+    GopCache audio;
+    audio.SetConfig(config);
+    for (uint32_t ts = 0; ts < 5000; ts += 23)
+        audio.Push(make_audio(ts));
+    CHECK(!audio.GetPackets().empty());
+    CHECK(audio.GetPackets().back()->GetTimestamp() - audio.GetPackets().front()->GetTimestamp() <= 1000);
+
+    // 关闭缓存
+    config.enable = false;
+    GopCache disabled;
+    disabled.SetConfig(config);
+    disabled.Push(make_video(0));
+    CHECK(0 == disabled.GetBytes());
+
+    cout << "total gop cache bytes: " << GopCache::GetTotalBytes() << endl;
+}
+
+int main()
+{
+    test_ttff();
+    test_bounds();
+    CHECK(0 == GopCache::GetTotalBytes());
+    cout << (s_failed ? "test_gop_cache failed" : "test_gop_cache ok") << endl;
+    return s_failed ? 1 : 0;
+}
@@ -0,0 +1,180 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include "app/app_hls_segmenter.h"
+#include "test_check.h"
+using namespace std;
+
+// FLV video tag body: 0x17 0x00 + cts, AVCDecoderConfigurationRecord(一个SPS一个PPS, 4字节长度)
+static MediaPacketPtr avc_config()
+{
+    uint8_t data[] = { 0x17, 0x00, 0, 0, 0,
+                       0x01, 0x64, 0x00, 0x1f, 0xff,
+                       0xe1, 0x00, 0x04, 0x67, 0x64, 0x00, 0x1f,
+                       0x01, 0x00, 0x02, 0x68, 0xee };
+    return MediaPacket::Create(FLV_TYPE_VIDEO, data, sizeof(data), 0);
+}
+
+// AAC LC, 44100, 双声道
+static MediaPacketPtr aac_config()
+{
+    uint8_t data[] = { 0xaf, 0x00, 0x12, 0x10 };
+    return MediaPacket::Create(FLV_TYPE_AUDIO, data, sizeof(data), 0);
+}
+
+static MediaPacketPtr video(uint32_t ts, bool key, size_t size)
+{
+    vector<uint8_t> data(size, 0x55);
+    data[0] = key ? 0x17 : 0x27;
+    data[1] = 1;
+    data[2] = data[3] = data[4] = 0;
+    uint32_t nalu = size - 9;
+    data[5] = nalu >> 24; data[6] = nalu >> 16; data[7] = nalu >> 8; data[8] = nalu;
+    data[9] = key ? 0x65 : 0x41;
+    return MediaPacket::Create(FLV_TYPE_VIDEO, data.data(), data.size(), ts);
+}
+
+static MediaPacketPtr audio(uint32_t ts)
+{
+    vector<uint8_t> data(200, 0x33);
+    data[0] = 0xaf;
+    data[1] = 1;
+    return MediaPacket::Create(FLV_TYPE_AUDIO, data.data(), data.size(), ts);
+}
+
+static bool check_ts(const SendBufferPtr &seg)
+{
+    if (!seg || seg->empty() || seg->size() % TS_PACKET_SIZE != 0)
+        return false;
+    for (size_t i = 0; i < seg->size(); i += TS_PACKET_SIZE)
+        if (0x47 != (uint8_t)(*seg)[i])
+            return false;
+    return true;
+}
+
+// 25fps, 每秒一个关键帧, 目标2秒: 在关键帧处切, 分片都是完整的TS包
+void test_cut_on_keyframe()
+{
+    HlsConfig config = { true, 2000, 3 };
+    HlsSegmenter segmenter("live/test", config);
+    segmenter.Input(avc_config());
+    segmenter.Input(aac_config());
+    CHECK(!segmenter.GetPlaylist());
+
+    for (uint32_t i = 0; i < 250; i++) {    // 10秒
+        uint32_t ts = i * 40;
+        segmenter.Input(video(ts, i % 25 == 0, 500 + i));
+        segmenter.Input(audio(ts));
+    }
+    segmenter.Flush();
+
+    // 0-2 2-4 4-6 6-8 8-10, 最后一帧也占一个帧间隔, 内存里多留一个
+    CHECK(!segmenter.GetSegment(0));
+    for (uint64_t seq = 1; seq <= 4; seq++)
+        CHECK(check_ts(segmenter.GetSegment(seq)));
+    CHECK(!segmenter.GetSegment(5));
+
+    SendBufferPtr playlist = segmenter.GetPlaylist();
+    CHECK(playlist);
+    if (!playlist)
+        return;
+    CHECK(0 == playlist->find("#EXTM3U\n"));
+    CHECK(string::npos != playlist->find("#EXT-X-TARGETDURATION:2\n"));
+    CHECK(string::npos != playlist->find("#EXT-X-MEDIA-SEQUENCE:2\n"));
+    CHECK(string::npos == playlist->find("test-1.ts"));
+    CHECK(string::npos != playlist->find("#EXTINF:2.000,\ntest-2.ts\n"));
+    CHECK(string::npos != playlist->find("#EXTINF:2.000,\ntest-4.ts\n"));
+    CHECK(string::npos == playlist->find("DISCONTINUITY"));
+}
+
+// 关键帧之前的帧丢掉; 推流结束后再推, 新分片带DISCONTINUITY
+void test_discontinuity()
+{
+    HlsConfig config = { true, 1000, 6 };
+    HlsSegmenter segmenter("live/test", config);
+    segmenter.Input(avc_config());
+    segmenter.Input(video(0, false, 300));
+    CHECK(!segmenter.GetPlaylist());
+    segmenter.Input(video(40, true, 300));
+    segmenter.Input(video(1040, true, 300));
+    CHECK(check_ts(segmenter.GetSegment(0)));
+
+    segmenter.Input(MediaPacketPtr());      // 推流结束
+    CHECK(check_ts(segmenter.GetSegment(1)));
+    segmenter.Input(video(0, true, 300));
+    segmenter.Input(video(1000, true, 300));
+
+    SendBufferPtr playlist = segmenter.GetPlaylist();
+    CHECK(playlist);
+    if (playlist)
+        CHECK(string::npos != playlist->find("#EXT-X-DISCONTINUITY\n#EXTINF:1.000,\ntest-2.ts\n"));
+}
+
+// 推流结束时只有一帧的分片: 不知道帧间隔时时长是0, 不输出EXTINF:0.000
+void test_flush_single_frame()
+{
+    HlsConfig config = { true, 1000, 6 };
+    HlsSegmenter segmenter("live/test", config);
+    segmenter.Input(avc_config());
+    segmenter.Input(video(0, true, 300));
+    segmenter.Flush();
+    CHECK(!segmenter.GetPlaylist());
+    CHECK(!segmenter.GetSegment(0));
+
+    // 知道帧间隔后, 只有一帧的最后一个分片按一个帧间隔计
+    segmenter.Input(video(1000, true, 300));
+    segmenter.Input(video(1040, false, 300));
+    segmenter.Input(video(2040, true, 300));
+    segmenter.Flush();
+    SendBufferPtr playlist = segmenter.GetPlaylist();
+    CHECK(playlist);
+    if (playlist) {
+        CHECK(string::npos != playlist->find("#EXTINF:1.040,\ntest-0.ts\n"));
+        CHECK(string::npos != playlist->find("#EXTINF:1.000,\ntest-1.ts\n"));
+        CHECK(string::npos == playlist->find("#EXTINF:0.000"));
+    }
+}
+
+// 线程池打包: OnPacket只入队, 帧按顺序打包, Finish之后最后一个分片也出来
+void test_thread_pool()
+{
+    HlsConfig config = { true, 1000, 20 };
+    CHECK(0 == HlsInit(config, 2));
+    HlsSegmenterPtr segmenter = make_shared<HlsSegmenter>("live/pool", config);
+    segmenter->OnPacket(avc_config());
+    segmenter->OnPacket(aac_config());
+    for (uint32_t i = 0; i < 250; i++) {    // 10秒, 每秒一个关键帧
+        uint32_t ts = i * 40;
+        segmenter->OnPacket(video(ts, i % 25 == 0, 500 + i));
+        segmenter->OnPacket(audio(ts));
+    }
+    segmenter->Finish();
+
+    // 等最后一个分片出来
+    for (int i = 0; i < 500 && !segmenter->GetSegment(9); i++)
+        this_thread::sleep_for(chrono::milliseconds(10));
+    for (uint64_t seq = 0; seq < 10; seq++)
+        CHECK(check_ts(segmenter->GetSegment(seq)));
+    CHECK(!segmenter->GetSegment(10));
+
+    SendBufferPtr playlist = segmenter->GetPlaylist();
+    CHECK(playlist);
+    if (!playlist)
+        return;
+    CHECK(string::npos != playlist->find("#EXT-X-MEDIA-SEQUENCE:0\n"));
+    for (uint64_t seq = 0; seq < 10; seq++)
+        CHECK(string::npos != playlist->find("#EXTINF:1.000,\npool-" + to_string(seq) + ".ts\n"));
+}
+
+int main()
+{
+    test_cut_on_keyframe();
+    test_discontinuity();
+    test_flush_single_frame();
+    test_thread_pool();
+    cout << (s_failed ? "test_hls_segmenter failed" : "test_hls_segmenter ok") << endl;
+    return s_failed ? 1 : 0;
+}
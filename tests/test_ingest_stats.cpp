@@ -0,0 +1,76 @@
+#include <iostream>
+#include <thread>
+#include <unistd.h>
+#include "util/util_histogram.h"
+#include "app/app_ingest_stats.h"
+#include "test_check.h"
+using namespace std;
+
+// 分桶是2的幂, 百分位返回所在桶的上界
+void test_histogram()
+{
+    CHECK(0 == CHistogram::GetBucket(0));
+    CHECK(1 == CHistogram::GetBucket(1));
+    CHECK(2 == CHistogram::GetBucket(3));
+    CHECK(11 == CHistogram::GetBucket(1024));
+    CHECK(HISTOGRAM_BUCKETS - 1 == CHistogram::GetBucket(UINT64_MAX));
+
+    CHistogram histogram;
+    for (uint64_t i = 1; i <= 100; i++)
+        histogram.Add(i < 100 ? 1000 : 1000000);
+    HistogramSnapshot snapshot;
+    histogram.GetSnapshot(&snapshot);
+    CHECK(100 == snapshot.count);
+    CHECK(1000000 == snapshot.max);
+    CHECK(1023 == snapshot.Percentile(50));
+    CHECK(1000000 == snapshot.Percentile(100));
+    CHECK((99 * 1000 + 1000000) / 100 == snapshot.Mean());
+
+    HistogramSnapshot merged;
+    merged.Merge(snapshot);
+    merged.Merge(snapshot);
+    CHECK(200 == merged.count && 1000000 == merged.max);
+    CHECK(0 == HistogramSnapshot().Percentile(99));
+}
+
+// 嵌套的阶段从外层扣掉, 不同线程的统计合并
+void test_stage_timer()
+{
+    {
+        IngestStageTimer parse(INGEST_STAGE_PARSE);
+        usleep(2000);
+        {
+            IngestStageTimer fanout(INGEST_STAGE_FANOUT);
+            usleep(20000);
+        }
+    }
+    HistogramSnapshot parse, fanout;
+    IngestStatsGetSnapshot(INGEST_STAGE_PARSE, &parse);
+    IngestStatsGetSnapshot(INGEST_STAGE_FANOUT, &fanout);
+    CHECK(1 == parse.count && 1 == fanout.count);
+    CHECK(fanout.max >= 20000000);
+    CHECK(parse.max >= 2000000 && parse.max < 15000000);
+
+    thread t([]() { IngestStageTimer fanout(INGEST_STAGE_FANOUT); });
+    t.join();
+    IngestStatsGetSnapshot(INGEST_STAGE_FANOUT, &fanout);
+    CHECK(2 == fanout.count);
+
+    IngestStatsEnable(false);
+    {
+        IngestStageTimer flush(INGEST_STAGE_FLUSH);
+    }
+    IngestStatsEnable(true);
+    HistogramSnapshot flush;
+    IngestStatsGetSnapshot(INGEST_STAGE_FLUSH, &flush);
+    CHECK(0 == flush.count);
+    CHECK(IngestStatsReport().find("dispatch") != string::npos);
+}
+
+int main()
+{
+    test_histogram();
+    test_stage_timer();
+    cout << (s_failed ? "test_ingest_stats failed" : "test_ingest_stats ok") << endl;
+    return s_failed ? 1 : 0;
+}
@@ -0,0 +1,257 @@
+/*
+ * epoll和io_uring后端对比: N个播放连接, 每轮循环给所有连接发一帧
+ * 客户端在单独的进程里(一个进程的fd不够两边各N个), 收完所有数据后把字节数写回管道
+ * 用法: test_io_backend [epoll|uring|all] [players] [frames] [frame_size]
+ */
+#include <iostream>
+#include <vector>
+#include <string.h>
+#include <time.h>
+#include <sys/wait.h>
+#include "network/netlib.h"
+#include "test_check.h"
+using namespace std;
+
+#define BENCH_PORT  19350   // 每个后端用自己的端口, 避开上一轮留下的TIME_WAIT
+
+typedef struct {
+    bool connected;
+    uint32_t offset;        // 当前帧已经发出的字节, 等于帧大小时空闲
+} Player;
+
+static uint32_t s_player_num = 10000;
+static uint32_t s_frame_num = 100;
+static uint32_t s_frame_size = 1024;
+static vector<char> s_frame;
+static vector<Player> s_players;   // 按句柄(fd)索引
+static vector<net_handle_t> s_handles;
+static uint32_t s_frames_sent = 0;
+static uint64_t s_bytes_sent = 0;
+static uint64_t s_dropped = 0;
+static bool s_closed = false;
+static int s_result_fd = -1;
+static uint16_t s_port = BENCH_PORT;
+static uint64_t s_start_us = 0;
+static uint64_t s_start_cpu_us = 0;
+
+static uint64_t now_us(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// 接着发当前帧剩下的部分
+static void send_rest(net_handle_t handle)
+{
+    Player &player = s_players[handle];
+    while (player.offset < s_frame_size) {
+        int ret = netlib_send(handle, &s_frame[player.offset], s_frame_size - player.offset);
+        if (ret <= 0)
+            return;
+        player.offset += ret;
+        s_bytes_sent += ret;
+    }
+}
+
+static void player_callback(void *callback_data, uint8_t msg, uint32_t handle, void *pParam)
+{
+    char buf[256];
+    if (msg == NETLIB_MSG_READ) {
+        while (netlib_recv(handle, buf, sizeof(buf)) > 0) {
+        }
+    } else if (msg == NETLIB_MSG_WRITE) {
+        send_rest(handle);
+    } else if (msg == NETLIB_MSG_CLOSE) {
+        s_players[handle].connected = false;
+        netlib_close(handle);
+    }
+}
+
+static void listen_callback(void *callback_data, uint8_t msg, uint32_t handle, void *pParam)
+{
+    if (msg != NETLIB_MSG_CONNECT)
+        return;
+    netlib_option(handle, NETLIB_OPT_SET_CALLBACK, (void *)player_callback);
+    if (s_players.size() <= handle)
+        s_players.resize(handle + 1);
+    s_players[handle].connected = true;
+    s_players[handle].offset = s_frame_size;
+    s_handles.push_back(handle);
+    if (s_handles.size() == s_player_num) {
+        s_start_us = now_us(CLOCK_MONOTONIC);
+        s_start_cpu_us = now_us(CLOCK_THREAD_CPUTIME_ID);
+    }
+}
+
+// 每毫秒给所有空闲的连接发一帧, 上一帧还没发完的丢掉这一帧
+static void broadcast_loop(void *callback_data, uint8_t msg, uint32_t handle, void *pParam)
+{
+    if (s_handles.size() < s_player_num)
+        return;
+
+    if (s_frames_sent < s_frame_num) {
+        for (size_t i = 0; i < s_handles.size(); i++) {
+            net_handle_t h = s_handles[i];
+            if (!s_players[h].connected)
+                continue;
+            if (s_players[h].offset < s_frame_size) {
+                s_dropped++;
+                continue;
+            }
+            s_players[h].offset = 0;
+            send_rest(h);
+        }
+        s_frames_sent++;
+        return;
+    }
+
+    if (!s_closed) {
+        for (size_t i = 0; i < s_handles.size(); i++) {
+            net_handle_t h = s_handles[i];
+            if (s_players[h].connected && s_players[h].offset < s_frame_size)
+                return;     // 等最后一帧交给网络库
+        }
+        for (size_t i = 0; i < s_handles.size(); i++) {
+            if (s_players[s_handles[i]].connected) {
+                s_players[s_handles[i]].connected = false;
+                netlib_close(s_handles[i]);
+            }
+        }
+        s_closed = true;
+    }
+
+    // 客户端收完所有数据后写回结果
+    uint64_t received = 0;
+    if (read(s_result_fd, &received, sizeof(received)) != sizeof(received))
+        return;
+    uint64_t elapsed = now_us(CLOCK_MONOTONIC) - s_start_us;
+    uint64_t cpu = now_us(CLOCK_THREAD_CPUTIME_ID) - s_start_cpu_us;
+    cout << (netlib_get_io_backend() == NETLIB_IO_URING ? "uring" : "epoll") << ": "
+         << s_player_num << " players, " << s_frame_num << " frames x " << s_frame_size << "B, sent "
+         << s_bytes_sent / 1024 / 1024 << "MB, dropped " << s_dropped << " frames, "
+         << elapsed / 1000 << "ms, server cpu " << cpu / 1000 << "ms, "
+         << (elapsed ? s_bytes_sent / elapsed : 0) << "MB/s" << endl;
+    CHECK(received == s_bytes_sent);
+    netlib_stop_event();
+}
+
+// 客户端进程: 连上所有播放连接, 一直读到服务器全部关闭
+static void run_players(int result_fd)
+{
+    int epfd = epoll_create(1024);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(s_port);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+    uint32_t open_num = 0;
+    for (uint32_t i = 0; i < s_player_num; i++) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        while (connect(fd, (sockaddr *)&addr, sizeof(addr)) != 0) {
+            close(fd);
+            usleep(10000);      // 服务器还没开始监听
+            fd = socket(AF_INET, SOCK_STREAM, 0);
+        }
+        fcntl(fd, F_SETFL, O_NONBLOCK | fcntl(fd, F_GETFL));
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+        open_num++;
+    }
+
+    uint64_t received = 0;
+    static char buf[64 * 1024];
+    struct epoll_event events[1024];
+    while (open_num > 0) {
+        int nfds = epoll_wait(epfd, events, 1024, 10000);
+        if (nfds <= 0)
+            break;      // 服务器卡住了
+        for (int i = 0; i < nfds; i++) {
+            int fd = events[i].data.fd;
+            for (;;) {
+                ssize_t ret = recv(fd, buf, sizeof(buf), 0);
+                if (ret > 0) {
+                    received += ret;
+                    continue;
+                }
+                if (ret < 0 && errno == EAGAIN)
+                    break;
+                close(fd);
+                open_num--;
+                break;
+            }
+        }
+    }
+    if (write(result_fd, &received, sizeof(received)) != sizeof(received))
+        _exit(1);
+    _exit(0);
+}
+
+static int run_bench(int backend)
+{
+    int fds[2];
+    s_port = BENCH_PORT + backend;
+    if (pipe(fds) != 0)
+        return 1;
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        run_players(fds[1]);
+    }
+    close(fds[1]);
+    s_result_fd = fds[0];
+    fcntl(s_result_fd, F_SETFL, O_NONBLOCK | fcntl(s_result_fd, F_GETFL));
+
+    signal(SIGPIPE, SIG_IGN);
+    s_frame.assign(s_frame_size, 'x');
+    netlib_set_io_backend(backend);
+    netlib_init(1);
+    if (netlib_get_io_backend() != backend) {
+        cout << "uring: not supported here, skipped" << endl;
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        return 0;
+    }
+    if (netlib_listen("127.0.0.1", s_port, listen_callback, NULL) != NETLIB_OK) {
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        return 1;
+    }
+    netlib_register_timer(broadcast_loop, NULL, 1);
+    netlib_eventloop();
+    waitpid(pid, NULL, 0);
+    return s_failed ? 1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    string mode = argc > 1 ? argv[1] : "all";
+    if (argc > 2)
+        s_player_num = atoi(argv[2]);
+    if (argc > 3)
+        s_frame_num = atoi(argv[3]);
+    if (argc > 4)
+        s_frame_size = atoi(argv[4]);
+
+    if (mode == "epoll")
+        return run_bench(NETLIB_IO_EPOLL);
+    if (mode == "uring")
+        return run_bench(NETLIB_IO_URING);
+
+    // 两个后端各在一个子进程里跑, loop只能初始化一次
+    int backends[] = { NETLIB_IO_EPOLL, NETLIB_IO_URING };
+    for (size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+        pid_t pid = fork();
+        if (pid == 0)
+            _exit(run_bench(backends[i]));
+        int status = 0;
+        waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            s_failed++;
+    }
+    cout << (s_failed ? "test_io_backend failed" : "test_io_backend ok") << endl;
+    return s_failed ? 1 : 0;
+}
@@ -0,0 +1,123 @@
+#include <iostream>
+#include <atomic>
+#include <vector>
+#include <string.h>
+#include <unistd.h>
+#include "network/netlib.h"
+#include "app/app_live_source.h"
+#include "test_check.h"
+using namespace std;
+
+// 跨loop投递: 推流端在0号loop, 拉流端在1号loop
+// 1号loop先被一个任务卡住, 投递的帧积压到LIVE_DISPATCH_MAX_PENDING之后开始丢, 放开后从下一个关键帧恢复
+
+class RecordConsumer : public LiveConsumer
+{
+public:
+    virtual int OnPacket(const MediaPacketPtr &pkt)
+    {
+        packets_.push_back(pkt);
+        received_++;
+        return 0;
+    }
+
+    vector<MediaPacketPtr> packets_;    // 只在1号loop写, loop都停了之后再读
+    atomic<size_t> received_{0};
+};
+
+static char s_publisher;        // 只用来表示有推流端, 不会被访问
+static atomic<bool> s_release{false};
+
+static MediaPacketPtr packet(int type, uint8_t b0, uint8_t b1, uint32_t ts)
+{
+    uint8_t data[32];
+    memset(data, 0x55, sizeof(data));
+    data[0] = b0;
+    data[1] = b1;
+    return MediaPacket::Create(type, data, sizeof(data), ts);
+}
+
+static MediaPacketPtr metadata(uint32_t ts) { return packet(FLV_TYPE_SCRIPT, 0x02, 0x00, ts); }
+static MediaPacketPtr video_config(uint32_t ts) { return packet(FLV_TYPE_VIDEO, 0x17, 0x00, ts); }
+static MediaPacketPtr audio_config(uint32_t ts) { return packet(FLV_TYPE_AUDIO, 0xaf, 0x00, ts); }
+static MediaPacketPtr video(uint32_t ts, bool key) { return packet(FLV_TYPE_VIDEO, key ? 0x17 : 0x27, 0x01, ts); }
+static MediaPacketPtr audio(uint32_t ts) { return packet(FLV_TYPE_AUDIO, 0xaf, 0x01, ts); }
+
+#define FILL_FRAMES     200     // 每帧一个视频一个音频, 远超过积压上限
+
+int main()
+{
+    netlib_init(2);
+    LiveSource source(reinterpret_cast<RtmpConn *>(&s_publisher), "live/test");
+    shared_ptr<RecordConsumer> player = make_shared<RecordConsumer>();
+    player->loop_index_ = 1;
+    source.add_player(player);
+
+    vector<MediaPacketPtr> expected;   // 拉流端应该按顺序收到的
+    size_t dropped = 0;
+
+    netlib_post(1, []() {
+        while (!s_release)
+            usleep(1000);
+    });
+    netlib_post(0, [&]() {
+        // 第一阶段: 1号loop卡住, 积压满了之后丢帧, 但metadata和sequence header照常投递
+        vector<MediaPacketPtr> media;
+        for (uint32_t i = 0; i < FILL_FRAMES; i++) {
+            media.push_back(video(i * 40, 0 == i));
+            media.push_back(audio(i * 40 + 5));
+        }
+        MediaPacketPtr headers[] = { metadata(0), video_config(0), audio_config(0) };
+        for (size_t i = 0; i < 3; i++) {
+            LiveSource::handler(&source, headers[i]);
+            expected.push_back(headers[i]);
+        }
+        for (size_t i = 0; i < media.size(); i++) {
+            LiveSource::handler(&source, media[i]);
+            if (expected.size() < LIVE_DISPATCH_MAX_PENDING)
+                expected.push_back(media[i]);
+            else
+                dropped++;
+        }
+        MediaPacketPtr meta2 = metadata(FILL_FRAMES * 40);
+        MediaPacketPtr config2 = video_config(FILL_FRAMES * 40);
+        LiveSource::handler(&source, meta2);
+        LiveSource::handler(&source, config2);
+        expected.push_back(meta2);
+        expected.push_back(config2);
+
+        // 放开1号loop, 等积压的都执行完
+        s_release = true;
+        while (player->received_ < expected.size())
+            usleep(1000);
+
+        // 第二阶段: 不积压了, 但关键帧之前的帧还是丢掉, 从关键帧恢复
+        uint32_t ts = FILL_FRAMES * 40 + 40;
+        LiveSource::handler(&source, video(ts, false));
+        LiveSource::handler(&source, audio(ts + 5));
+        dropped += 2;
+        MediaPacketPtr resume[] = { video(ts + 40, true), video(ts + 80, false), audio(ts + 85) };
+        for (size_t i = 0; i < 3; i++) {
+            LiveSource::handler(&source, resume[i]);
+            expected.push_back(resume[i]);
+        }
+
+        // 任务队列先进先出, 停止排在所有投递的帧后面
+        netlib_post(1, []() { netlib_stop_event(); });
+    });
+    netlib_eventloop();
+
+    CHECK(player->packets_.size() == expected.size());
+    for (size_t i = 0; i < expected.size() && i < player->packets_.size(); i++) {
+        if (player->packets_[i] != expected[i]) {
+            CHECK(player->packets_[i] == expected[i]);
+            cout << "first mismatch at " << i << endl;
+            break;
+        }
+    }
+    CHECK(dropped == source.GetDispatchDroppedFrames());
+    CHECK(2 * FILL_FRAMES + 3 - LIVE_DISPATCH_MAX_PENDING + 2 == dropped);
+
+    cout << (s_failed ? "test_live_source failed" : "test_live_source ok") << endl;
+    return s_failed ? 1 : 0;
+}
@@ -0,0 +1,242 @@
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include "util/util_mpsc_queue.h"
+#include "network/netlib.h"
+#include "test_check.h"
+using namespace std;
+
+#define PRODUCERS       4
+#define ITEMS           200000      // 每个生产者
+
+static uint64_t now_us()
+{
+    return chrono::duration_cast<chrono::microseconds>(
+        chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// 环很小, 大部分时间在溢出链表, 每个生产者的顺序不能乱
+void test_order()
+{
+    CMpscQueue<uint64_t> queue(64);
+    vector<thread> producers;
+    for (uint64_t p = 0; p < PRODUCERS; p++) {
+        producers.push_back(thread([&queue, p]() {
+            for (uint64_t i = 0; i < ITEMS; i++)
+                queue.Push(p << 32 | i);
+        }));
+    }
+
+    vector<uint64_t> next(PRODUCERS, 0);
+    uint64_t total = 0;
+    int disorder = 0;
+    while (total < (uint64_t)PRODUCERS * ITEMS) {
+        total += queue.Drain([&](uint64_t v) {
+            uint64_t p = v >> 32;
+            if ((v & 0xFFFFFFFF) != next[p])
+                disorder++;
+            next[p] = (v & 0xFFFFFFFF) + 1;
+        });
+    }
+    for (size_t i = 0; i < producers.size(); i++)
+        producers[i].join();
+    CHECK(0 == disorder);
+    CHECK(queue.Empty());
+    CHECK(queue.GetOverflowCount() > 0);
+    CHECK(64 == queue.GetCapacity());
+}
+
+// 执行中再投递的留到下一批
+void test_drain_batch()
+{
+    CMpscQueue<function<void()> > queue(16);
+    int runs = 0;
+    function<void()> again = [&]() { runs++; };
+    queue.Push([&]() { runs++; queue.Push(again); });
+    CHECK(1 == queue.Drain([](function<void()> &task) { task(); }));
+    CHECK(1 == runs && !queue.Empty());
+    CHECK(1 == queue.Drain([](function<void()> &task) { task(); }));
+    CHECK(2 == runs && queue.Empty());
+}
+
+// 原来的做法: 加锁放进vector, 消费者整个换出来
+class LockedQueue
+{
+public:
+    void Push(function<void()> &&task)
+    {
+        lock_guard<mutex> lock(mutex_);
+        tasks_.push_back(move(task));
+    }
+    size_t Drain()
+    {
+        vector<function<void()> > tasks;
+        {
+            lock_guard<mutex> lock(mutex_);
+            tasks.swap(tasks_);
+        }
+        for (size_t i = 0; i < tasks.size(); i++)
+            tasks[i]();
+        return tasks.size();
+    }
+
+private:
+    mutex mutex_;
+    vector<function<void()> > tasks_;
+};
+
+template <typename Q, typename D>
+static double bench(Q &queue, D drain)
+{
+    atomic<uint64_t> sum(0);
+    uint64_t start = now_us();
+    vector<thread> producers;
+    for (int p = 0; p < PRODUCERS; p++) {
+        producers.push_back(thread([&queue, &sum]() {
+            for (int i = 0; i < ITEMS; i++)
+                queue.Push([&sum]() { sum.fetch_add(1, memory_order_relaxed); });
+        }));
+    }
+    uint64_t total = 0;
+    while (total < (uint64_t)PRODUCERS * ITEMS)
+        total += drain();
+    for (size_t i = 0; i < producers.size(); i++)
+        producers[i].join();
+    CHECK(sum == total);
+    return total / (double)(now_us() - start);     // 百万/秒
+}
+
+void bench_handoff()
+{
+    LockedQueue locked;
+    double locked_rate = bench(locked, [&]() { return locked.Drain(); });
+    CMpscQueue<function<void()> > mpsc(16384);
+    double mpsc_rate = bench(mpsc, [&]() { return mpsc.Drain([](function<void()> &task) { task(); }); });
+    cout << "handoff " << PRODUCERS << " producers: mutex+vector " << locked_rate << " M/s, mpsc " << mpsc_rate
+         << " M/s" << endl;
+}
+
+// 空闲的loop: 投递之后马上被唤醒执行, 不用等到wait_timeout
+void bench_loop_wakeup()
+{
+    netlib_init();
+    thread loop([]() { netlib_eventloop(); });
+    this_thread::sleep_for(chrono::milliseconds(50));
+
+    vector<uint64_t> latency;
+    for (int i = 0; i < 200; i++) {
+        atomic<bool> done(false);
+        uint64_t start = now_us();
+        netlib_post(0, [&done]() { done = true; });
+        while (!done)
+            this_thread::yield();
+        latency.push_back(now_us() - start);
+        this_thread::sleep_for(chrono::microseconds(200));  // 让loop回到等待
+    }
+    sort(latency.begin(), latency.end());
+    cout << "idle loop wakeup: p50 " << latency[latency.size() / 2] << "us, p99 "
+         << latency[latency.size() * 99 / 100] << "us" << endl;
+    CHECK(latency[latency.size() / 2] < 50000);
+
+    atomic<uint64_t> count(0);
+    uint64_t start = now_us();
+    vector<thread> producers;
+    for (int p = 0; p < PRODUCERS; p++) {
+        producers.push_back(thread([&count]() {
+            for (int i = 0; i < ITEMS; i++)
+                netlib_post(0, [&count]() { count.fetch_add(1, memory_order_relaxed); });
+        }));
+    }
+    for (size_t i = 0; i < producers.size(); i++)
+        producers[i].join();
+    while (count < (uint64_t)PRODUCERS * ITEMS)
+        this_thread::yield();
+    cout << "netlib_post to loop: " << count / (double)(now_us() - start) << " M/s" << endl;
+
+    netlib_stop_event();
+    loop.join();
+}
+
+// 工作线程交给loop的回复: 原来每条回复make_shared一个string, lambda捕获shared_ptr, std::function还要再分配一次;
+// 池化之后lambda只捕获一个指针, 对象和字符串的容量都反复使用
+struct Response
+{
+    string data;
+};
+static mutex s_pool_mutex;
+static vector<Response *> s_pool;
+
+template <typename P>
+static double bench_post(P post)
+{
+    atomic<uint64_t> count(0);
+    uint64_t start = now_us();
+    vector<thread> producers;
+    for (int p = 0; p < PRODUCERS; p++) {
+        producers.push_back(thread([&count, &post]() {
+            string resp;
+            for (int i = 0; i < ITEMS; i++) {
+                resp.assign(200, 'r');      // 每次拼一条200字节的回复
+                post(resp, count);
+            }
+        }));
+    }
+    for (size_t i = 0; i < producers.size(); i++)
+        producers[i].join();
+    while (count < (uint64_t)PRODUCERS * ITEMS)
+        this_thread::yield();
+    return count / (double)(now_us() - start);
+}
+
+void bench_response()
+{
+    netlib_init();
+    thread loop([]() { netlib_eventloop(); });
+
+    double shared_rate = bench_post([](string &resp, atomic<uint64_t> &count) {
+        shared_ptr<string> data = make_shared<string>(move(resp));
+        netlib_post(0, [data, &count]() { count.fetch_add(data->size() ? 1 : 0, memory_order_relaxed); });
+    });
+    double pooled_rate = bench_post([](string &resp, atomic<uint64_t> &count) {
+        Response *r = NULL;
+        {
+            lock_guard<mutex> lock(s_pool_mutex);
+            if (!s_pool.empty()) {
+                r = s_pool.back();
+                s_pool.pop_back();
+            }
+        }
+        if (!r)
+            r = new Response();
+        r->data.swap(resp);
+        atomic<uint64_t> *c = &count;
+        netlib_post(0, [r, c]() {
+            c->fetch_add(r->data.size() ? 1 : 0, memory_order_relaxed);
+            r->data.clear();
+            lock_guard<mutex> lock(s_pool_mutex);
+            s_pool.push_back(r);
+        });
+    });
+    cout << "response post " << PRODUCERS << " producers: shared_ptr " << shared_rate << " M/s, pooled "
+         << pooled_rate << " M/s" << endl;
+
+    netlib_stop_event();
+    loop.join();
+}
+
+int main()
+{
+    test_order();
+    test_drain_batch();
+    bench_handoff();
+    bench_loop_wakeup();
+    bench_response();
+    cout << (s_failed ? "test_mpsc_queue failed" : "test_mpsc_queue ok") << endl;
+    return s_failed ? 1 : 0;
+}
@@ -0,0 +1,145 @@
+#include <iostream>
+#include <vector>
+#include "app/app_player_queue.h"
+#include "test_check.h"
+using namespace std;
+
+#define FPS         25
+#define GOP_FRAMES  25      // 1秒一个关键帧
+#define FRAME_BYTES 4000
+
+// 帧序列 I B P B P ..., B帧的nal_ref_idc为0
+static MediaPacketPtr make_video(uint32_t index)
+{
+    vector<uint8_t> data(FRAME_BYTES);
+    bool key = (index % GOP_FRAMES == 0);
+    data[0] = key ? 0x17 : 0x27;    // AVC 关键帧/非关键帧
+    data[1] = 1;                    // NALU
+    uint32_t len = FRAME_BYTES - 9;
+    data[5] = len >> 24; data[6] = len >> 16; data[7] = len >> 8; data[8] = len;
+    if (key)
+        data[9] = 0x65;             // IDR, nal_ref_idc 3
+    else if (index % 2)
+        data[9] = 0x01;             // 非参考slice
+    else
+        data[9] = 0x41;             // 参考slice
+    return MediaPacket::Create(FLV_TYPE_VIDEO, data.data(), data.size(), index * 1000 / FPS);
+}
+
+static MediaPacketPtr make_audio(uint32_t timestamp)
+{
+    vector<uint8_t> data(200);
+    data[0] = 0xaf;     // AAC
+    data[1] = 1;        // raw
+    return MediaPacket::Create(FLV_TYPE_AUDIO, data.data(), data.size(), timestamp);
+}
+
+static void count(const PlayerQueue &queue, size_t &video, size_t &audio)
+{
+    PlayerQueue copy = queue;
+    video = audio = 0;
+    while (!copy.Empty()) {
+        MediaPacketPtr pkt = copy.Pop();
+        (FLV_TYPE_VIDEO == pkt->GetType() ? video : audio)++;
+    }
+}
+
+void test_disposable()
+{
+    CHECK(make_video(0)->IsKeyFrame());
+    CHECK(!make_video(0)->IsDisposable());
+    CHECK(make_video(1)->IsDisposable());
+    CHECK(!make_video(2)->IsDisposable());
+    CHECK(!make_audio(0)->IsDisposable());
+}
+
+// 超过字节数上限时先丢非参考帧, 再丢整个GOP, 音频一直保留
+void test_drop_order()
+{
+    PlayerQueue queue;
+    PlayerQueueConfig config = { 40 * FRAME_BYTES, 100000, 0 };
+    queue.SetConfig(config);
+
+    uint32_t i = 0;
+    for (; i < GOP_FRAMES; i++) {
+        queue.Push(make_video(i));
+        queue.Push(make_audio(i * 1000 / FPS));
+    }
+    CHECK(0 == queue.GetDroppedFrames());
+
+    // 第二个GOP的一部分: 超过上限, 先丢B帧
+    for (; i < GOP_FRAMES + 20; i++) {
+        queue.Push(make_video(i));
+        queue.Push(make_audio(i * 1000 / FPS));
+    }
+    size_t video, audio;
+    count(queue, video, audio);
+    CHECK(queue.GetBytes() <= config.max_bytes);
+    CHECK(audio == i);
+    CHECK(queue.GetDroppedFrames() > 0);
+    cout << "after dropping non-reference frames: video " << video << ", audio " << audio
+         << ", dropped " << queue.GetDroppedFrames() << endl;
+    // 参考帧一个都没丢
+    size_t refs = 0;
+    for (uint32_t j = 0; j < i; j++)
+        refs += !make_video(j)->IsDisposable();
+    PlayerQueue copy = queue;
+    while (!copy.Empty()) {
+        MediaPacketPtr pkt = copy.Pop();
+        if (FLV_TYPE_VIDEO == pkt->GetType() && !pkt->IsDisposable())
+            refs--;
+    }
+    CHECK(refs == 0);
+
+    // 参考帧也放不下了, 从前面整个丢GOP
+    config.max_bytes = 20 * FRAME_BYTES;
+    queue.SetConfig(config);
+    for (; i < GOP_FRAMES * 2 + 10; i++) {
+        queue.Push(make_video(i));
+        queue.Push(make_audio(i * 1000 / FPS));
+    }
+    CHECK(queue.GetBytes() <= config.max_bytes);
+    copy = queue;
+    bool first_video = true;
+    while (!copy.Empty()) {
+        MediaPacketPtr pkt = copy.Pop();
+        if (FLV_TYPE_VIDEO == pkt->GetType() && first_video) {
+            CHECK(pkt->IsKeyFrame());
+            CHECK(pkt->GetTimestamp() >= 1000);
+            first_video = false;
+        }
+    }
+    count(queue, video, audio);
+    CHECK(audio == i);
+    cout << "after dropping gop: video " << video << ", audio " << audio
+         << ", dropped " << queue.GetDroppedFrames() << " frames, " << queue.GetDroppedBytes() << " bytes" << endl;
+}
+
+// 队列里没有下一个关键帧时丢掉所有视频, 等关键帧
+void test_wait_keyframe()
+{
+    PlayerQueue queue;
+    PlayerQueueConfig config = { 1000000, 500, 0 };
+    queue.SetConfig(config);
+    for (uint32_t i = 0; i < 20; i++)
+        queue.Push(make_video(i));
+
+    // 第13帧超过500ms, 队列里没有第二个关键帧, 视频全部丢掉, 之后的非关键帧也丢
+    CHECK(queue.Empty());
+    CHECK(20 == queue.GetDroppedFrames());
+    queue.Push(make_video(21));
+    CHECK(queue.Empty());
+    queue.Push(make_video(GOP_FRAMES));
+    CHECK(1 == queue.GetSize());
+    queue.Push(make_video(GOP_FRAMES + 1));
+    CHECK(2 == queue.GetSize());
+}
+
+int main()
+{
+    test_disposable();
+    test_drop_order();
+    test_wait_keyframe();
+    cout << (s_failed ? "test_player_queue failed" : "test_player_queue ok") << endl;
+    return s_failed ? 1 : 0;
+}
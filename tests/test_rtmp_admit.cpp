@@ -0,0 +1,397 @@
+/*
+ * 异步鉴权: 服务器在本进程的loop里跑, 客户端在另一个线程里用阻塞socket发命令
+ * 覆盖鉴权期间排队命令的顺序、connect被拒绝、线程池排队超时(expire)、结果返回前连接已经关闭
+ */
+#include <iostream>
+#include <vector>
+#include <string>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include "network/netlib.h"
+#include "app/app_rtmp_conn.h"
+#include "protocol/rtmp_netconnection.h"
+#include "protocol/rtmp_netstream.h"
+#include "test_check.h"
+using namespace std;
+
+#define ADMIT_PORT          19370
+#define ADMIT_TIMEOUT_MS    150     // 线程池里排队超过这个时间按-ETIMEDOUT拒绝
+#define CHUNK_SIZE          128     // 双方都没有set chunk size之前的默认值
+
+static atomic<int> s_delay_ms{0};   // 鉴权回调的耗时
+static atomic<int> s_started{0};
+static atomic<int> s_finished{0};
+static mutex s_mutex;
+static vector<RtmpAdmission> s_admissions;  // 鉴权回调按调用顺序记录
+
+// app为deny的connect拒绝, 其他都允许
+static int admit_handler(const RtmpAdmission &admission)
+{
+    s_started++;
+    {
+        lock_guard<mutex> lock(s_mutex);
+        s_admissions.push_back(admission);
+    }
+    usleep(s_delay_ms * 1000);
+    s_finished++;
+    return admission.app == "deny" ? -1 : 0;
+}
+
+static vector<RtmpAdmission> take_admissions()
+{
+    lock_guard<mutex> lock(s_mutex);
+    vector<RtmpAdmission> admissions;
+    admissions.swap(s_admissions);
+    return admissions;
+}
+
+struct Command
+{
+    string name;            // _result/_error/onStatus
+    double transaction;
+    string payload;
+};
+
+class TestClient
+{
+public:
+    ~TestClient() { Close(); }
+
+    bool Connect()
+    {
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(ADMIT_PORT);
+        addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+        for (int i = 0; i < 100; i++) {
+            fd_ = socket(AF_INET, SOCK_STREAM, 0);
+            if (connect(fd_, (sockaddr *)&addr, sizeof(addr)) == 0)
+                break;
+            Close();
+            usleep(10000);      // 服务器还没开始监听
+        }
+        if (fd_ < 0)
+            return false;
+        struct timeval tv = { 3, 0 };
+        setsockopt(fd_, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+        // C0C1, 收到S0S1S2之后回C2
+        string c0c1(1 + RTMP_HANDSHAKE_SIZE, '\0');
+        c0c1[0] = RTMP_VERSION;
+        string s0s1s2;
+        if (!SendAll(c0c1) || !RecvAll(1 + 2 * RTMP_HANDSHAKE_SIZE, &s0s1s2))
+            return false;
+        return SendAll(s0s1s2.substr(1, RTMP_HANDSHAKE_SIZE));
+    }
+
+    void Close()
+    {
+        if (fd_ >= 0)
+            close(fd_);
+        fd_ = -1;
+    }
+
+    // 命令消息, 按CHUNK_SIZE分块, 不等回复
+    bool SendCommand(const uint8_t *payload, const uint8_t *end, uint32_t stream_id)
+    {
+        uint32_t len = (uint32_t)(end - payload);
+        uint8_t header[12] = { 0x03, 0, 0, 0, (uint8_t)(len >> 16), (uint8_t)(len >> 8), (uint8_t)len, 20,
+                               (uint8_t)stream_id, (uint8_t)(stream_id >> 8), (uint8_t)(stream_id >> 16),
+                               (uint8_t)(stream_id >> 24) };
+        string out((const char *)header, sizeof(header));
+        for (uint32_t off = 0; off < len; off += CHUNK_SIZE) {
+            if (off > 0)
+                out += (char)0xC3;
+            out.append((const char *)payload + off, min(len - off, (uint32_t)CHUNK_SIZE));
+        }
+        return SendAll(out);
+    }
+
+    bool SendConnect(const char *app)
+    {
+        struct rtmp_connect_t connect;
+        memset(&connect, 0, sizeof(connect));
+        snprintf(connect.app, sizeof(connect.app), "%s", app);
+        snprintf(connect.tcUrl, sizeof(connect.tcUrl), "rtmp://127.0.0.1/%s", app);
+        snprintf(connect.flashver, sizeof(connect.flashver), "FMLE/3.0");
+        connect.capabilities = 15;
+        connect.encoding = RTMP_ENCODING_AMF_0;
+        uint8_t buf[1024];
+        return SendCommand(buf, rtmp_netconnection_connect(buf, sizeof(buf), 1, &connect), 0);
+    }
+
+    bool SendCreateStream(double transaction)
+    {
+        uint8_t buf[256];
+        return SendCommand(buf, rtmp_netconnection_create_stream(buf, sizeof(buf), transaction), 0);
+    }
+
+    bool SendPublish(double transaction, const char *stream_name)
+    {
+        uint8_t buf[512];
+        return SendCommand(buf, rtmp_netstream_publish(buf, sizeof(buf), transaction, stream_name, RTMP_STREAM_LIVE), 1);
+    }
+
+    // 跳过控制消息, 返回下一个命令; 连接关闭或者超时返回false
+    bool ReadCommand(Command *cmd)
+    {
+        uint8_t type;
+        string payload;
+        while (ReadMessage(&type, &payload)) {
+            if (20 != type)
+                continue;
+            // AMF0: string命令名, number事务号
+            if (payload.size() < 3 || 0x02 != (uint8_t)payload[0])
+                return false;
+            size_t n = ((uint8_t)payload[1] << 8) | (uint8_t)payload[2];
+            if (payload.size() < 3 + n + 9)
+                return false;
+            cmd->name = payload.substr(3, n);
+            uint64_t bits = 0;
+            for (size_t i = 0; i < 8; i++)
+                bits = (bits << 8) | (uint8_t)payload[3 + n + 1 + i];
+            memcpy(&cmd->transaction, &bits, sizeof(bits));
+            cmd->payload = payload;
+            return true;
+        }
+        return false;
+    }
+
+    // 服务器关闭了连接: 读到EOF, 不是超时
+    bool ReadEof()
+    {
+        uint8_t type;
+        string payload;
+        while (ReadMessage(&type, &payload)) {
+        }
+        return eof_;
+    }
+
+private:
+    struct ChunkStream
+    {
+        uint32_t len = 0;
+        uint8_t type = 0;
+        string payload;
+    };
+
+    bool SendAll(const string &data)
+    {
+        return send(fd_, data.data(), data.size(), MSG_NOSIGNAL) == (ssize_t)data.size();
+    }
+
+    bool RecvAll(size_t n, string *out)
+    {
+        out->resize(n);
+        size_t got = 0;
+        while (got < n) {
+            ssize_t ret = recv(fd_, &(*out)[got], n - got, 0);
+            if (ret <= 0) {
+                eof_ = 0 == ret;
+                return false;
+            }
+            got += ret;
+        }
+        return true;
+    }
+
+    bool ReadMessage(uint8_t *type, string *payload)
+    {
+        string buf;
+        for (;;) {
+            if (!RecvAll(1, &buf))
+                return false;
+            uint8_t fmt = (uint8_t)buf[0] >> 6;
+            uint32_t cid = (uint8_t)buf[0] & 0x3F;
+            if (0 == cid || 1 == cid) {
+                string ext;
+                if (!RecvAll(cid + 1, &ext))
+                    return false;
+                cid = 64 + (uint8_t)ext[0] + (1 == cid ? (uint8_t)ext[1] * 256 : 0);
+            }
+            ChunkStream &cs = streams_[cid];
+            static const size_t header_size[] = { 11, 7, 3, 0 };
+            string header;
+            if (header_size[fmt] > 0 && !RecvAll(header_size[fmt], &header))
+                return false;
+            if (fmt <= 1) {
+                cs.len = ((uint8_t)header[3] << 16) | ((uint8_t)header[4] << 8) | (uint8_t)header[5];
+                cs.type = (uint8_t)header[6];
+            }
+            if (fmt <= 2 && 0xFFFFFF == (((uint8_t)header[0] << 16) | ((uint8_t)header[1] << 8) | (uint8_t)header[2])
+                && !RecvAll(4, &header))
+                return false;
+
+            string data;
+            size_t n = min((size_t)in_chunk_size_, cs.len - cs.payload.size());
+            if (!RecvAll(n, &data))
+                return false;
+            cs.payload += data;
+            if (cs.payload.size() < cs.len)
+                continue;
+
+            *type = cs.type;
+            payload->swap(cs.payload);
+            cs.payload.clear();
+            if (1 == *type && payload->size() >= 4)
+                in_chunk_size_ = ((uint8_t)(*payload)[0] << 24) | ((uint8_t)(*payload)[1] << 16)
+                                 | ((uint8_t)(*payload)[2] << 8) | (uint8_t)(*payload)[3];
+            return true;
+        }
+    }
+
+    int fd_ = -1;
+    bool eof_ = false;
+    uint32_t in_chunk_size_ = CHUNK_SIZE;
+    map<uint32_t, ChunkStream> streams_;
+};
+
+static bool has(const Command &cmd, const char *code)
+{
+    return cmd.payload.find(code) != string::npos;
+}
+
+// connect/createStream/publish一次发出去, connect鉴权期间后两个排队, 回复的顺序和请求一致
+static void test_pipelined()
+{
+    s_delay_ms = 100;
+    TestClient client;
+    CHECK(client.Connect());
+    CHECK(client.SendConnect("live"));
+    CHECK(client.SendCreateStream(2));
+    CHECK(client.SendPublish(3, "admit_order"));
+
+    Command cmd;
+    CHECK(client.ReadCommand(&cmd) && "_result" == cmd.name && 1 == cmd.transaction
+          && has(cmd, "NetConnection.Connect.Success"));
+    CHECK(client.ReadCommand(&cmd) && "_result" == cmd.name && 2 == cmd.transaction);
+    CHECK(client.ReadCommand(&cmd) && "onStatus" == cmd.name && has(cmd, "NetStream.Publish.Start"));
+
+    // publish用的是connect通过之后的app
+    vector<RtmpAdmission> admissions = take_admissions();
+    CHECK(2 == admissions.size());
+    if (2 == admissions.size()) {
+        CHECK(RTMP_ADMIT_CONNECT == admissions[0].type && "live" == admissions[0].app);
+        CHECK(RTMP_ADMIT_PUBLISH == admissions[1].type && "live" == admissions[1].app
+              && "admit_order" == admissions[1].stream_name);
+    }
+}
+
+// connect被拒绝: 回_error之后关闭, 排在后面的publish不会进鉴权
+static void test_reject()
+{
+    s_delay_ms = 50;
+    TestClient client;
+    CHECK(client.Connect());
+    CHECK(client.SendConnect("deny"));
+    CHECK(client.SendCreateStream(2));
+    CHECK(client.SendPublish(3, "bypass"));
+
+    Command cmd;
+    CHECK(client.ReadCommand(&cmd) && "_error" == cmd.name && 1 == cmd.transaction
+          && has(cmd, "NetConnection.Connect.Rejected"));
+    CHECK(!client.ReadCommand(&cmd));
+    CHECK(client.ReadEof());
+
+    vector<RtmpAdmission> admissions = take_admissions();
+    CHECK(1 == admissions.size() && RTMP_ADMIT_CONNECT == admissions[0].type);
+}
+
+// 同一个连接再次connect, 拒绝并关闭
+static void test_repeat_connect()
+{
+    s_delay_ms = 0;
+    TestClient client;
+    CHECK(client.Connect());
+    CHECK(client.SendConnect("live"));
+    CHECK(client.SendConnect("other"));
+
+    Command cmd;
+    CHECK(client.ReadCommand(&cmd) && "_result" == cmd.name && has(cmd, "NetConnection.Connect.Success"));
+    CHECK(client.ReadCommand(&cmd) && "_error" == cmd.name && has(cmd, "NetConnection.Connect.Rejected"));
+    CHECK(client.ReadEof());
+    take_admissions();
+}
+
+// 线程池只有一个线程, 第一个鉴权占住它, 第二个排队超时后expire()按-ETIMEDOUT拒绝, 不会调用鉴权回调
+static void test_expire()
+{
+    s_delay_ms = ADMIT_TIMEOUT_MS * 3;
+    int started = s_started;
+    TestClient slow, expired;
+    CHECK(slow.Connect());
+    CHECK(slow.SendConnect("live"));
+    while (s_started == started)
+        usleep(1000);
+    CHECK(expired.Connect());
+    CHECK(expired.SendConnect("live"));
+
+    Command cmd;
+    CHECK(expired.ReadCommand(&cmd) && "_error" == cmd.name && has(cmd, "NetConnection.Connect.Rejected"));
+    CHECK(expired.ReadEof());
+    CHECK(slow.ReadCommand(&cmd) && "_result" == cmd.name && has(cmd, "NetConnection.Connect.Success"));
+
+    vector<RtmpAdmission> admissions = take_admissions();
+    CHECK(1 == admissions.size());
+}
+
+// 鉴权返回前客户端已经断开, 结果投递回loop时找不到连接, 直接丢掉
+static void test_closed_before_result()
+{
+    s_delay_ms = 100;
+    int started = s_started;
+    int finished = s_finished;
+    {
+        TestClient client;
+        CHECK(client.Connect());
+        CHECK(client.SendConnect("live"));
+        while (s_started == started)
+            usleep(1000);
+    }
+    while (s_finished == finished)
+        usleep(1000);
+    usleep(50 * 1000);      // 等结果投递回loop
+
+    // 服务器照常处理新的连接
+    s_delay_ms = 0;
+    TestClient client;
+    CHECK(client.Connect());
+    CHECK(client.SendConnect("live"));
+    Command cmd;
+    CHECK(client.ReadCommand(&cmd) && "_result" == cmd.name && has(cmd, "NetConnection.Connect.Success"));
+    CHECK(2 == take_admissions().size());
+}
+
+int main()
+{
+    signal(SIGPIPE, SIG_IGN);
+    DLog::SetLevel("err");
+    netlib_init(1);
+    RtmpSetAdmitHandler(admit_handler, ADMIT_TIMEOUT_MS);
+    if (RtmpInitListen("127.0.0.1", ADMIT_PORT, 1) != NETLIB_OK) {
+        cout << "test_rtmp_admit: listen failed" << endl;
+        return 1;
+    }
+
+    thread client([]() {
+        test_pipelined();
+        test_reject();
+        test_repeat_connect();
+        test_expire();
+        test_closed_before_result();
+        netlib_post(0, []() { netlib_stop_event(); });
+    });
+    netlib_eventloop();
+    client.join();
+
+    cout << (s_failed ? "test_rtmp_admit failed" : "test_rtmp_admit ok") << endl;
+    return s_failed ? 1 : 0;
+}
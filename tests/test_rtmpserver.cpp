@@ -1,5 +1,5 @@
 /**
- * 支持rtmp多路推流、rtmp多路拉流
+ * 支持rtmp多路推流、rtmp/http-flv/hls多路拉流
 */
  
 #include "util/util.h"
@@ -7,22 +7,49 @@
 #include "util/dlog.h"
 #include "network/netlib.h"
 #include "app/app_rtmp_conn.h"
+#include "app/app_http_flv_conn.h"
+#include "app/app_hls_segmenter.h"
+#include "app/app_flv_recorder.h"
+#include "app/app_ingest_stats.h"
 #include <list>
 #include <mutex>
 #include <stdexcept>
 #include <errno.h>
+#include <thread>
+
+static void accept_stats_timer(void *callback_data, uint8_t msg, uint32_t handle, void *pParam)
+{
+    NetlibAcceptStats stats;
+    netlib_get_accept_stats(&stats);
+    LogInfo("accept stats: accepted {}, deferred {}, rejected {}", stats.accepted, stats.deferred, stats.rejected);
+}
+
+static void ingest_stats_timer(void *callback_data, uint8_t msg, uint32_t handle, void *pParam)
+{
+    LogInfo("ingest stats:\n{}", IngestStatsReport());
+}
 
 int main(int argc, char *argv[]) 
 {
     try {
         LogInfo("程序开始执行");
         
-        // 初始化网络库
-        if (netlib_init() != NETLIB_OK) {
+        // 第4个参数: IO后端, epoll(默认)或uring
+        if (argc > 4 && strcmp(argv[4], "uring") == 0) {
+            netlib_set_io_backend(NETLIB_IO_URING);
+        }
+
+        // 初始化网络库, 每个核一个事件循环
+        uint32_t loop_num = std::thread::hardware_concurrency();
+        if (argc > 2) {
+            loop_num = atoi(argv[2]);
+        }
+        if (netlib_init(loop_num) != NETLIB_OK) {
             LogError("网络库初始化失败");
             return -1;
         }
-        LogInfo("网络库初始化成功");
+        LogInfo("网络库初始化成功, loop数: {}, IO后端: {}", netlib_loop_num(),
+                netlib_get_io_backend() == NETLIB_IO_URING ? "uring" : "epoll");
 
         signal(SIGPIPE, SIG_IGN);
         LogInfo("SIGPIPE 信号已忽略");
@@ -38,6 +65,45 @@ int main(int argc, char *argv[])
             LogInfo("日志级别设置为 {}", argv[1]);
         }
 
+        // 第3个参数: 每秒最多接入的新连接数
+        if (argc > 3) {
+            NetlibAcceptConfig accept_config = { NETLIB_DEFAULT_BACKLOG, NETLIB_DEFAULT_ACCEPT_BUDGET,
+                                                 (uint32_t)atoi(argv[3]), 0, NETLIB_DEFAULT_MAX_DEFER_MS };
+            netlib_set_accept_config(accept_config);
+            netlib_register_timer(accept_stats_timer, NULL, 5000);
+            LogInfo("新连接限速 {}/s", accept_config.rate);
+        }
+
+        // 各阶段耗时, 每分钟打印一次
+        netlib_register_timer(ingest_stats_timer, NULL, 60000);
+
+        // hls在线程池里切片, 推流开始前启动
+        HlsConfig hls_config = { true, HLS_DEFAULT_SEGMENT_MS, HLS_DEFAULT_WINDOW };
+        if (HlsInit(hls_config) != 0) {
+            LogError("HlsInit 初始化失败");
+            netlib_destroy();
+            return -1;
+        }
+
+        // publish类型为record/append的流录制到 record/app/stream.flv
+        FlvRecordConfig record_config = { true, "record", FLV_RECORD_BUFFER_SIZE, FLV_RECORD_MAX_PENDING_BYTES,
+                                          FLV_RECORD_DROP_TO_KEYFRAME, false };
+        if (FlvRecordInit(record_config) != 0) {
+            LogError("FlvRecordInit 初始化失败");
+            netlib_destroy();
+            return -1;
+        }
+
+        // 第5个参数: 模拟慢鉴权的耗时(毫秒), 在线程池里执行; 流名以deny开头的拒绝
+        if (argc > 5 && atoi(argv[5]) > 0) {
+            int delay_ms = atoi(argv[5]);
+            RtmpSetAdmitHandler([delay_ms](const RtmpAdmission &admission) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms));
+                return admission.stream_name.compare(0, 4, "deny") == 0 ? -1 : 0;
+            });
+            LogInfo("鉴权延迟 {}ms", delay_ms);
+        }
+
         LogInfo("准备初始化RTMP监听器");
         int port = 1936;
         ret = RtmpInitListen("0.0.0.0", port, 4);
@@ -49,12 +115,21 @@ int main(int argc, char *argv[])
         }
         LogInfo("RTMP监听器初始化成功");
 
+        // http-flv拉流: http://ip:8081/app/stream.flv, hls: http://ip:8081/app/stream.m3u8
+        int http_flv_port = 8081;
+        ret = HttpFlvInitListen("0.0.0.0", http_flv_port);
+        if(ret != NETLIB_OK) {
+            LogError("HttpFlvInitListen {} 初始化失败, 错误代码: {}", http_flv_port, ret);
+            netlib_destroy();
+            return -1;
+        }
+
         LogInfo("准备写入PID");
         WritePid();
         LogInfo("PID写入完成");
 
         LogInfo("准备开始事件循环");
-        netlib_eventloop(1);
+        netlib_eventloop();
 
         LogInfo("事件循环结束，程序正常退出");
         netlib_destroy();
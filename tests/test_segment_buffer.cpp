@@ -0,0 +1,170 @@
+#include <string.h>
+#include <chrono>
+#include <iostream>
+#include <vector>
+#include "util/util_pdu.h"
+#include "util/util_buffer.h"
+#include "test_check.h"
+using namespace std;
+
+static uint64_t now_us()
+{
+    return chrono::duration_cast<chrono::microseconds>(
+        chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// 随机长度的写入和消费, 和一份连续的参考数据比较
+void test_correctness()
+{
+    CSegmentBuffer buf;
+    vector<uint8_t> ref;
+    size_t ref_pos = 0;
+    uint8_t seq = 0;
+    uint32_t seed = 1;
+    vector<uint8_t> tmp(3 * SEGMENT_BLOCK_SIZE);
+
+    for (int round = 0; round < 20000; round++) {
+        seed = seed * 1103515245 + 12345;
+        uint32_t len = (seed >> 8) % (2 * SEGMENT_BLOCK_SIZE);
+        if (seed & 1) {
+            for (uint32_t i = 0; i < len; i++)
+                tmp[i] = seq++;
+            buf.Write(tmp.data(), len);
+            ref.insert(ref.end(), tmp.begin(), tmp.begin() + len);
+        } else {
+            uint32_t n = buf.Read(tmp.data(), len);
+            CHECK(n == min<size_t>(len, ref.size() - ref_pos));
+            CHECK(0 == memcmp(tmp.data(), ref.data() + ref_pos, n));
+            ref_pos += n;
+        }
+        CHECK(buf.GetReadableSize() == ref.size() - ref_pos);
+
+        // 可读片段拼起来和参考数据一致
+        struct iovec iov[16];
+        int cnt = buf.GetReadSpans(iov, 16);
+        size_t off = ref_pos;
+        for (int i = 0; i < cnt; i++) {
+            CHECK(0 == memcmp(iov[i].iov_base, ref.data() + off, iov[i].iov_len));
+            off += iov[i].iov_len;
+        }
+        if (s_failed)
+            return;
+    }
+
+    // 可写片段 + IncWriteOffset
+    buf.Clear();
+    struct iovec iov[4];
+    int cnt = buf.GetWriteSpans(iov, 4, SEGMENT_BLOCK_SIZE + 100);
+    CHECK(cnt >= 2);
+    memset(iov[0].iov_base, 'a', iov[0].iov_len);
+    memset(iov[1].iov_base, 'b', 100);
+    buf.IncWriteOffset(iov[0].iov_len + 100);
+    CHECK(buf.GetReadableSize() == iov[0].iov_len + 100);
+    buf.Skip(iov[0].iov_len);
+    char c = 0;
+    CHECK(1 == buf.Peek(&c, 1) && 'b' == c);
+    buf.Clear();
+    CHECK(buf.Empty());
+}
+
+// 慢速拉流端: 发送缓冲区积压了很多数据, 每次只能发出一小部分
+// CSimpleBuffer每次消费都要memmove剩下的全部数据
+template <typename ConsumeFn, typename Buffer>
+uint64_t bench_slow_viewer(Buffer &buf, ConsumeFn consume)
+{
+    vector<uint8_t> frame(4096, 0x5a);
+    uint64_t start = now_us();
+    // 积压约8MB, 之后每写入一帧消费一帧, 每次只消费1500字节(一次部分写)
+    for (int i = 0; i < 2048; i++)
+        buf.Write(frame.data(), frame.size());
+    for (int i = 0; i < 2000; i++) {
+        buf.Write(frame.data(), frame.size());
+        for (uint32_t sent = 0; sent < frame.size(); sent += 1500)
+            consume(buf, min<uint32_t>(1500, frame.size() - sent));
+    }
+    return now_us() - start;
+}
+
+// 收包解析: 每次收4KB, 解析器只消费完整的消息, 留下一小段不完整的消息
+template <typename ConsumeFn, typename Buffer>
+uint64_t bench_recv_parse(Buffer &buf, ConsumeFn consume)
+{
+    vector<uint8_t> data(4096, 0x33);
+    uint64_t start = now_us();
+    buf.Write(data.data(), 100);
+    for (int i = 0; i < 200000; i++) {
+        buf.Write(data.data(), data.size());
+        consume(buf, data.size());
+    }
+    return now_us() - start;
+}
+
+// RtmpConn::OnRead的实际用法: 预留200K收一次, 解析器是流式的, 解析完全部消费
+// CSimpleBuffer按改动前的写法: Extend后直接recv到连续内存, 再Skip
+uint64_t bench_conn_input_simple()
+{
+    CSimpleBuffer buf;
+    vector<uint8_t> data(4096, 0x33);
+    uint64_t start = now_us();
+    for (int i = 0; i < 200000; i++) {
+        if (buf.GetAllocSize() - buf.GetWriteOffset() < 200000 + 1)
+            buf.Extend(200000 + 1);
+        memcpy(buf.GetBuffer() + buf.GetWriteOffset(), data.data(), data.size());
+        buf.IncWriteOffset(data.size());
+        buf.Skip(buf.GetWriteOffset());
+    }
+    return now_us() - start;
+}
+
+uint64_t bench_conn_input_segment()
+{
+    CSegmentBuffer buf;
+    vector<uint8_t> data(4096, 0x33);
+    struct iovec iov[8];
+    uint64_t start = now_us();
+    for (int i = 0; i < 200000; i++) {
+        buf.GetWriteSpans(iov, 8, 200000);
+        memcpy(iov[0].iov_base, data.data(), data.size());
+        buf.IncWriteOffset(data.size());
+        buf.GetReadSpans(iov, 8);
+        buf.Clear();
+    }
+    return now_us() - start;
+}
+
+int main()
+{
+    test_correctness();
+
+    auto simple_skip = [](CSimpleBuffer &b, uint32_t n) { b.Read(NULL, n); };
+    auto segment_skip = [](CSegmentBuffer &b, uint32_t n) { b.Skip(n); };
+
+    {
+        CSimpleBuffer simple;
+        CSegmentBuffer segment;
+        uint64_t t1 = bench_slow_viewer(simple, simple_skip);
+        uint64_t t2 = bench_slow_viewer(segment, segment_skip);
+        CHECK(simple.GetWriteOffset() == segment.GetReadableSize());
+        cout << "slow viewer, 8MB backlog: CSimpleBuffer " << t1 / 1000 << "ms, CSegmentBuffer "
+             << t2 / 1000 << "ms" << endl;
+    }
+    {
+        CSimpleBuffer simple;
+        CSegmentBuffer segment;
+        uint64_t t1 = bench_recv_parse(simple, simple_skip);
+        uint64_t t2 = bench_recv_parse(segment, segment_skip);
+        CHECK(simple.GetWriteOffset() == segment.GetReadableSize());
+        cout << "recv/parse: CSimpleBuffer " << t1 / 1000 << "ms, CSegmentBuffer "
+             << t2 / 1000 << "ms" << endl;
+    }
+
+    {
+        uint64_t t1 = bench_conn_input_simple();
+        uint64_t t2 = bench_conn_input_segment();
+        cout << "conn input: CSimpleBuffer " << t1 / 1000 << "ms, CSegmentBuffer "
+             << t2 / 1000 << "ms" << endl;
+    }
+
+    cout << (s_failed ? "test_segment_buffer failed" : "test_segment_buffer ok") << endl;
+    return s_failed ? 1 : 0;
+}
@@ -1,8 +1,21 @@
 #include <iostream>
+#include <chrono>
+#include <queue>
+#include <set>
 #include "thread/thread_pool.h"
+#include "test_check.h"
 using namespace std;
 using namespace longkit;
 
+#define PRODUCERS       4
+#define TASKS           200000      // 每个生产者
+
+static uint64_t now_us()
+{
+    return chrono::duration_cast<chrono::microseconds>(
+        chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 // 无参数的测试函数
 void func0()
 {
@@ -150,12 +163,267 @@ void test4()
     threadpool.stop();
 }
 
+// post不返回future; 单线程时按提交顺序执行; 只能移动的参数和放不进槽位的大对象都可以
+void test_post()
+{
+    ThreadPool threadpool;
+    threadpool.init(1);
+    threadpool.start();
+
+    vector<int> order;
+    for (int i = 0; i < 100; i++)
+        threadpool.post([&order, i]() { order.push_back(i); });
+    unique_ptr<int> owned(new int(7));
+    int owned_value = 0;
+    threadpool.post([&owned_value](unique_ptr<int> &p) { owned_value = *p; }, std::move(owned));
+    char big[256] = {1};
+    int big_value = 0;
+    threadpool.post([&big_value, big]() { big_value = big[0]; });
+    threadpool.waitForAllDone();
+
+    CHECK(100 == order.size());
+    bool in_order = true;
+    for (int i = 0; i < (int)order.size(); i++)
+        in_order = in_order && order[i] == i;
+    CHECK(in_order);
+    CHECK(7 == owned_value);
+    CHECK(1 == big_value);
+    CHECK(0 == threadpool.getJobNum());
+    threadpool.stop();
+}
+
+// 一个工作线程里提交的子任务被其他线程偷走执行
+void test_steal()
+{
+    ThreadPool threadpool;
+    threadpool.init(4);
+    threadpool.start();
+
+    atomic<int> count(0);
+    mutex threads_mutex;
+    set<thread::id> threads;
+    threadpool.post([&]() {
+        for (int i = 0; i < 5000; i++) {
+            threadpool.post([&]() {
+                {
+                    lock_guard<mutex> lock(threads_mutex);
+                    threads.insert(this_thread::get_id());
+                }
+                this_thread::sleep_for(chrono::microseconds(50));
+                count++;
+            });
+        }
+    });
+    CHECK(threadpool.waitForAllDone(30000));
+    CHECK(5000 == count);
+    cout << "steal: subtasks ran on " << threads.size() << " threads" << endl;
+    CHECK(threads.size() > 1);
+
+    // 超过每个队列的大小, 进溢出队列, 一个都不能少
+    count = 0;
+    for (int i = 0; i < THREAD_POOL_QUEUE_SIZE * 8; i++)
+        threadpool.post([&count]() { count++; });
+    CHECK(threadpool.waitForAllDone(30000));
+    CHECK(THREAD_POOL_QUEUE_SIZE * 8 == count);
+    threadpool.stop();
+}
+
+// 排队时已经过期的任务不执行, future得到TaskExpiredError
+void test_expire()
+{
+    ThreadPool threadpool;
+    threadpool.init(1);
+    threadpool.start();
+
+    int64_t now = getMonoMs();
+    CHECK(now > 0 && getMonoMs() >= now);
+
+    threadpool.post([]() { this_thread::sleep_for(chrono::milliseconds(100)); });
+    bool ran = false;
+    auto expired = threadpool.exec(10, [&ran]() { ran = true; return 1; });
+    threadpool.post(10, [&ran]() { ran = true; });
+    auto alive = threadpool.exec(10000, []() { return 2; });
+    auto failed = threadpool.exec([]() -> int { throw runtime_error("fail"); });
+
+    bool timeout = false;
+    try {
+        expired.get();
+    } catch (const TaskExpiredError &) {
+        timeout = true;
+    }
+    CHECK(timeout);
+    CHECK(2 == alive.get());
+    bool thrown = false;
+    try {
+        failed.get();
+    } catch (const runtime_error &) {
+        thrown = true;
+    }
+    CHECK(thrown);
+    threadpool.waitForAllDone();
+    CHECK(!ran);
+    CHECK(2 == threadpool.getExpiredNum());
+    threadpool.stop();
+}
+
+// 按到期时间调度: 带超时的先到期先执行, stop时没执行的丢掉
+void test_deadline_first()
+{
+    ThreadPool threadpool;
+    threadpool.init(1);
+    threadpool.setDeadlineFirst(true);
+    threadpool.start();
+
+    mutex order_mutex;
+    vector<int> order;
+    threadpool.post([]() { this_thread::sleep_for(chrono::milliseconds(50)); });
+    this_thread::sleep_for(chrono::milliseconds(10));
+    int timeouts[] = {3000, 1000, 0, 2000};
+    for (int i = 0; i < 4; i++) {
+        threadpool.post(timeouts[i], [&order, &order_mutex, i]() {
+            lock_guard<mutex> lock(order_mutex);
+            order.push_back(i);
+        });
+    }
+    threadpool.waitForAllDone();
+    CHECK(4 == order.size());
+    CHECK(order.size() == 4 && 1 == order[0] && 3 == order[1] && 0 == order[2] && 2 == order[3]);
+
+    threadpool.post([]() { this_thread::sleep_for(chrono::milliseconds(50)); });
+    this_thread::sleep_for(chrono::milliseconds(10));
+    auto dropped = threadpool.exec(1000, []() { return 1; });
+    for (int i = 0; i < 10; i++)
+        threadpool.post([]() {});
+    threadpool.stop();
+    CHECK(11 == threadpool.getDroppedNum());
+    CHECK(0 == threadpool.getJobNum());
+    bool broken = false;
+    try {
+        dropped.get();
+    } catch (const future_error &) {
+        broken = true;
+    }
+    CHECK(broken);
+}
+
+// 原来的线程池: 一个队列一把锁, 每个任务两个shared_ptr加一个std::function
+class LegacyPool
+{
+public:
+    LegacyPool(size_t num) : terminate_(false), active_(0)
+    {
+        for (size_t i = 0; i < num; i++)
+            threads_.push_back(thread(&LegacyPool::run, this));
+    }
+
+    ~LegacyPool()
+    {
+        {
+            unique_lock<mutex> lock(mutex_);
+            terminate_ = true;
+            condition_.notify_all();
+        }
+        for (size_t i = 0; i < threads_.size(); i++)
+            threads_[i].join();
+    }
+
+    template <class F>
+    future<void> exec(F &&f)
+    {
+        auto task = make_shared<packaged_task<void()> >(std::bind(std::forward<F>(f)));
+        shared_ptr<function<void()> > func = make_shared<function<void()> >([task]() { (*task)(); });
+        unique_lock<mutex> lock(mutex_);
+        tasks_.push(func);
+        condition_.notify_one();
+        return task->get_future();
+    }
+
+    void waitForAllDone()
+    {
+        unique_lock<mutex> lock(mutex_);
+        condition_.wait(lock, [this] { return tasks_.empty() && active_ == 0; });
+    }
+
+private:
+    void run()
+    {
+        for (;;) {
+            shared_ptr<function<void()> > task;
+            {
+                unique_lock<mutex> lock(mutex_);
+                condition_.wait(lock, [this] { return terminate_ || !tasks_.empty(); });
+                if (terminate_)
+                    return;
+                task = tasks_.front();
+                tasks_.pop();
+                active_++;
+            }
+            (*task)();
+            unique_lock<mutex> lock(mutex_);
+            active_--;
+            if (active_ == 0 && tasks_.empty())
+                condition_.notify_all();
+        }
+    }
+
+    vector<thread> threads_;
+    queue<shared_ptr<function<void()> > > tasks_;
+    mutex mutex_;
+    condition_variable condition_;
+    bool terminate_;
+    int active_;
+};
+
+// 多个生产者提交很小的任务, 全部执行完的吞吐(百万/秒)
+template <typename Pool, typename Submit>
+static double bench(Pool &pool, Submit submit)
+{
+    atomic<uint64_t> sum(0);
+    uint64_t start = now_us();
+    vector<thread> producers;
+    for (int p = 0; p < PRODUCERS; p++) {
+        producers.push_back(thread([&]() {
+            for (int i = 0; i < TASKS; i++)
+                submit(pool, [&sum]() { sum.fetch_add(1, memory_order_relaxed); });
+        }));
+    }
+    for (size_t i = 0; i < producers.size(); i++)
+        producers[i].join();
+    pool.waitForAllDone();
+    CHECK(sum == (uint64_t)PRODUCERS * TASKS);
+    return sum / (double)(now_us() - start);
+}
+
+void bench_pools()
+{
+    size_t workers = max(2u, thread::hardware_concurrency());
+    double legacy_rate, exec_rate, post_rate;
+    {
+        LegacyPool legacy(workers);
+        legacy_rate = bench(legacy, [](LegacyPool &pool, auto &&f) { pool.exec(f); });
+    }
+    {
+        ThreadPool threadpool;
+        threadpool.init(workers);
+        threadpool.start();
+        exec_rate = bench(threadpool, [](ThreadPool &pool, auto &&f) { pool.exec(f); });
+        post_rate = bench(threadpool, [](ThreadPool &pool, auto &&f) { pool.post(f); });
+    }
+    cout << PRODUCERS << " producers, " << workers << " workers: legacy exec " << legacy_rate
+         << " M/s, exec " << exec_rate << " M/s, post " << post_rate << " M/s" << endl;
+}
+
 int main()
 {
    test1(); // 简单测试线程池
    test2(); // 测试任务函数返回值
    test3(); // 测试类对象函数的绑定
    test4(); // 测试重载函数的提交
-   cout << "main finish!" << endl;
-   return 0;
+   test_post();
+   test_steal();
+   test_expire();
+   test_deadline_first();
+   bench_pools();
+   cout << (s_failed ? "test_threadpool failed" : "test_threadpool ok") << endl;
+   return s_failed ? 1 : 0;
 }
@@ -0,0 +1,240 @@
+#include <chrono>
+#include <iostream>
+#include <list>
+#include <vector>
+#include <thread>
+#include <sys/resource.h>
+#include "network/netlib.h"
+#include "network/timer_wheel.h"
+#include "test_check.h"
+using namespace std;
+
+#define TIMER_NUM   20000
+
+static uint64_t now_us()
+{
+    return chrono::duration_cast<chrono::microseconds>(
+        chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+typedef struct {
+    uint64_t expect;    // 下一次应该触发的时间
+    uint64_t interval;
+    int fired;
+    int late;           // 没有在应该触发的那个tick触发
+} TimerCtx;
+
+static uint64_t s_now = 0;
+
+static void timer_callback(void *callback_data, uint8_t msg, uint32_t handle, void *pParam)
+{
+    TimerCtx *ctx = (TimerCtx *)callback_data;
+    if (s_now != ctx->expect)
+        ctx->late++;
+    ctx->fired++;
+    ctx->expect += ctx->interval;
+}
+
+// 随机到期时间, 逐ms推进, 每个定时器都必须在到期的那个tick触发
+void test_expire()
+{
+    CTimerWheel wheel(s_now);
+    vector<TimerCtx> ctxs(2000);
+    vector<timer_handle_t> handles(ctxs.size());
+    uint32_t seed = 7;
+    for (size_t i = 0; i < ctxs.size(); i++) {
+        seed = seed * 1103515245 + 12345;
+        uint64_t delay = (seed >> 8) % 100000;     // 覆盖前3层
+        ctxs[i] = { s_now + delay, 0, 0, 0 };
+        handles[i] = wheel.Add(timer_callback, &ctxs[i], s_now, delay, 0);
+    }
+    // 取消一半
+    for (size_t i = 0; i < ctxs.size(); i += 2)
+        wheel.Cancel(handles[i]);
+    CHECK(wheel.Size() == ctxs.size() / 2);
+
+    for (int i = 0; i < 100000; i++) {
+        s_now++;
+        wheel.Advance(s_now);
+    }
+    for (size_t i = 0; i < ctxs.size(); i++) {
+        CHECK(ctxs[i].fired == (i % 2 ? 1 : 0));
+        CHECK(ctxs[i].late == 0);
+    }
+    CHECK(wheel.Size() == 0);
+}
+
+// 同样的随机定时器, 按NextTimeout跳着推进, 不能晚也不能漏
+void test_expire_jump()
+{
+    CTimerWheel wheel(s_now);
+    vector<TimerCtx> ctxs(2000);
+    uint32_t seed = 11;
+    uint64_t end = s_now;
+    for (size_t i = 0; i < ctxs.size(); i++) {
+        seed = seed * 1103515245 + 12345;
+        uint64_t delay = 1 + (seed >> 8) % 2000000;    // 覆盖4层
+        ctxs[i] = { s_now + delay, 0, 0, 0 };
+        wheel.Add(timer_callback, &ctxs[i], s_now, delay, 0);
+        end = max(end, s_now + delay);
+    }
+    int wakeups = 0;
+    while (s_now < end) {
+        s_now += wheel.NextTimeout(s_now, UINT32_MAX);
+        wheel.Advance(s_now);
+        wakeups++;
+    }
+    for (size_t i = 0; i < ctxs.size(); i++)
+        CHECK(ctxs[i].fired == 1 && ctxs[i].late == 0);
+    CHECK(wheel.Size() == 0);
+    CHECK(wakeups <= (int)ctxs.size() * 2);
+}
+
+// 周期定时器, 跳着推进时不补触发; 超出范围的定时器按真实时间触发
+void test_periodic_and_far()
+{
+    CTimerWheel wheel(s_now);
+    TimerCtx periodic = { s_now + 1000, 1000, 0, 0 };
+    timer_handle_t handle = wheel.Add(timer_callback, &periodic, s_now, 1000, 1000);
+    for (int i = 0; i < 10000; i++) {
+        s_now++;
+        CHECK(wheel.NextTimeout(s_now, 100) <= 100);
+        wheel.Advance(s_now);
+    }
+    CHECK(periodic.fired == 10 && periodic.late == 0);
+    wheel.Cancel(handle);
+
+    uint64_t far = TIMER_WHEEL_MAX_SPAN + 12345;
+    TimerCtx far_ctx = { s_now + far, 0, 0, 0 };
+    wheel.Add(timer_callback, &far_ctx, s_now, far, 0);
+    uint64_t end = s_now + far;
+    // 按NextTimeout跳着推进, 模拟epoll_wait醒来
+    int wakeups = 0;
+    while (s_now < end) {
+        s_now += wheel.NextTimeout(s_now, UINT32_MAX);   // 和NETLIB_WAIT_INFINITE一样不限
+        wheel.Advance(s_now);
+        wakeups++;
+    }
+    CHECK(far_ctx.fired == 1 && far_ctx.late == 0);
+    CHECK(wakeups <= 10);     // 每层分散时多醒一次, 超出范围的再多一轮
+    cout << "far timer (" << far << "ms) fired after " << wakeups << " wakeups" << endl;
+}
+
+// 只有一个10秒的定时器时, 空闲的loop不会每转一圈第0层就醒一次
+void test_idle_wakeups()
+{
+    CTimerWheel wheel(s_now);
+    TimerCtx ctx = { s_now + 10000, 0, 0, 0 };
+    wheel.Add(timer_callback, &ctx, s_now, 10000, 0);
+    uint64_t end = s_now + 10000;
+    int wakeups = 0, first_second = 0;
+    uint64_t start = s_now;
+    while (s_now < end) {
+        s_now += wheel.NextTimeout(s_now, UINT32_MAX);
+        wheel.Advance(s_now);
+        wakeups++;
+        if (s_now - start <= 1000)
+            first_second++;
+    }
+    CHECK(ctx.fired == 1 && ctx.late == 0);
+    CHECK(first_second <= 2);
+    CHECK(wakeups <= 4);
+}
+
+static long thread_switches()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_THREAD, &usage);
+    return usage.ru_nvcsw;
+}
+
+static void idle_timer_callback(void *callback_data, uint8_t msg, uint32_t handle, void *pParam)
+{
+}
+
+// 真实的loop: 只挂一个10秒的定时器, 2秒里loop线程每次阻塞等待都是一次主动切换, 不能每256ms醒一次
+void test_idle_loop()
+{
+    static long switches = 0;
+    netlib_init(1);
+    netlib_post(0, []() {
+        netlib_add_timer(idle_timer_callback, NULL, 10000, 0);
+        switches = thread_switches();
+    });
+    thread stopper([]() {
+        this_thread::sleep_for(chrono::seconds(2));
+        netlib_post(0, []() {
+            switches = thread_switches() - switches;
+            netlib_stop_event();
+        });
+    });
+    netlib_eventloop();
+    stopper.join();
+    CHECK(switches <= 3);   // 等停止任务唤醒一次, 再留点余量
+    cout << "idle loop with a 10s timer: " << switches << " wakeups in 2s" << endl;
+}
+
+// 大量连接定时器: 时间轮和原来的list(线性查找删除, 每轮遍历)对比
+void bench()
+{
+    vector<TimerCtx> ctxs(TIMER_NUM);
+    vector<timer_handle_t> handles(TIMER_NUM);
+    uint64_t start = now_us();
+    {
+        CTimerWheel wheel(s_now);
+        for (int i = 0; i < TIMER_NUM; i++) {
+            ctxs[i] = { 0, 0, 0, 0 };
+            handles[i] = wheel.Add(timer_callback, &ctxs[i], s_now, 30000 + i % 5000, 30000);
+        }
+        // 模拟1秒的loop, 每10ms醒一次
+        for (int i = 0; i < 100; i++)
+            wheel.Advance(s_now + i * 10);
+        for (int i = 0; i < TIMER_NUM; i++)
+            wheel.Cancel(handles[i]);
+    }
+    uint64_t t_wheel = now_us() - start;
+
+    typedef struct { callback_t callback; void *user_data; uint64_t interval; uint64_t next_tick; } Item;
+    start = now_us();
+    {
+        list<Item *> timer_list;
+        for (int i = 0; i < TIMER_NUM; i++) {
+            for (auto it = timer_list.begin(); it != timer_list.end(); ++it) {
+                if ((*it)->user_data == &ctxs[i])
+                    break;
+            }
+            timer_list.push_back(new Item{ timer_callback, &ctxs[i], 30000, s_now + 30000 + i % 5000 });
+        }
+        for (int i = 0; i < 100; i++) {
+            uint64_t tick = s_now + i * 10;
+            for (auto it = timer_list.begin(); it != timer_list.end(); ++it) {
+                if (tick >= (*it)->next_tick)
+                    (*it)->callback((*it)->user_data, 0, 0, NULL);
+            }
+        }
+        for (int i = 0; i < TIMER_NUM; i++) {
+            for (auto it = timer_list.begin(); it != timer_list.end(); ++it) {
+                if ((*it)->user_data == &ctxs[i]) {
+                    delete *it;
+                    timer_list.erase(it);
+                    break;
+                }
+            }
+        }
+    }
+    uint64_t t_list = now_us() - start;
+    cout << TIMER_NUM << " timers add + 1s of ticks + cancel: list " << t_list / 1000
+         << "ms, timer wheel " << t_wheel / 1000 << "ms" << endl;
+}
+
+int main()
+{
+    test_expire();
+    test_expire_jump();
+    test_periodic_and_far();
+    test_idle_wakeups();
+    test_idle_loop();
+    bench();
+    cout << (s_failed ? "test_timer_wheel failed" : "test_timer_wheel ok") << endl;
+    return s_failed ? 1 : 0;
+}
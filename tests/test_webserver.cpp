@@ -10,6 +10,7 @@
 // 项目内头文件
 #include "util/util.h"
 #include "util/util_pdu.h"
+#include "util/util_buffer.h"
 #include "util/dlog.h"
 #include "protocol/http_parser_wrapper.h"
 #include "network/netlib.h"
@@ -38,6 +39,12 @@ using namespace longkit;
 // 定义读取缓冲区大小
 #define READ_BUF_SIZE 2048
 
+// 请求的最大长度
+#define HTTP_REQUEST_MAX 2048
+
+// 一次readv/writev最多的片段数
+#define HTTP_IOVEC 8
+
 // 定义HTTP JSON响应格式
 #define HTTP_RESPONSE_JSON                                                     \
     "HTTP/1.1 200 OK\r\n"                                                      \
@@ -105,13 +112,6 @@ void http_conn_timer_callback(void *callback_data, uint8_t msg, uint32_t handle,
 // 根据UUID查找HTTP连接
 CHttpConn *GetHttpConnByUuid(uint32_t uuid);
 
-// 定义响应PDU结构体
-typedef struct 
-{
-    uint32_t conn_uuid; // 用于查找connection
-    string resp_data;   // 要回发的数据
-} ResponsePdu_t;
-
 // HTTP连接类定义
 class CHttpConn : public CRefObject 
 {
@@ -164,7 +164,7 @@ class CHttpConn : public CRefObject
                 (char *)data + ret,
                 len - ret); // 保存buffer里面，下次reactor write触发后再发送
             busy_ = true;
-            LogDebug("not send all, remain= {}", out_buf_.GetWriteOffset());
+            LogDebug("not send all, remain= {}", out_buf_.GetReadableSize());
         } else {
             OnWriteComlete();
         }
@@ -198,31 +198,34 @@ class CHttpConn : public CRefObject
 
     // 读取数据
     void OnRead(){
+        struct iovec iov[HTTP_IOVEC];
         for (;;) {
-            uint32_t free_buf_len =
-                in_buf_.GetAllocSize() - in_buf_.GetWriteOffset();
-            if (free_buf_len < READ_BUF_SIZE + 1)
-                in_buf_.Extend(READ_BUF_SIZE + 1);
-
-            int ret = netlib_recv(m_sock_handle,
-                                in_buf_.GetBuffer() + in_buf_.GetWriteOffset(),
-                                READ_BUF_SIZE);
-            if (ret <= 0)
+            int cnt = in_buf_.GetWriteSpans(iov, HTTP_IOVEC, READ_BUF_SIZE);
+            size_t space = 0;
+            for (int i = 0; i < cnt; i++)
+                space += iov[i].iov_len;
+            int ret = netlib_recvv(m_sock_handle, iov, cnt);
+            if (ret == NETLIB_AGAIN)
                 break;
+            if (ret <= 0) {
+                // 对端关闭或者出错, 请求还没收完也没法回复了
+                Close();
+                return;
+            }
 
             in_buf_.IncWriteOffset(ret);
-
             last_recv_tick_ = GetTickCount();
+            if ((size_t)ret < space)
+                break;  // 已经读空
         }
 
         // 每次请求对应一个HTTP连接，所以读完数据后，不用在同一个连接里面准备读取下个请求
-        char *in_buf = (char *)in_buf_.GetBuffer();
-        uint32_t buf_len = in_buf_.GetWriteOffset();
-        in_buf[buf_len] = '\0';
-
         // 如果buf_len 过长可能是受到攻击，则断开连接
         // 正常的url最大长度为2048，我们接受的所有数据长度不得大于2K
-        if (buf_len > 2048) {
+        char in_buf[HTTP_REQUEST_MAX + 1];
+        uint32_t buf_len = in_buf_.GetReadableSize();
+        in_buf[in_buf_.Peek(in_buf, HTTP_REQUEST_MAX)] = '\0';
+        if (buf_len > HTTP_REQUEST_MAX) {
             LogError("get too much data: {}", in_buf);
             Close();
             return;
@@ -245,9 +248,9 @@ class CHttpConn : public CRefObject
                 str_json = str_content;
                 int ret = Send((void *)str_content, strlen(str_content));
             } else  if (strncmp(url.c_str(), "/html2", 6) == 0) {
-                g_thread_pool.exec(std::bind(&CHttpConn::_HandleHtmlRequest2, this, std::placeholders::_1), uuid_);
+                g_thread_pool.post(std::bind(&CHttpConn::_HandleHtmlRequest2, this, std::placeholders::_1), uuid_);
             }else  if (strncmp(url.c_str(), "/html", 5) == 0) {
-                g_thread_pool.exec(std::bind(&CHttpConn::_HandleHtmlRequest, this, std::placeholders::_1), uuid_);                
+                g_thread_pool.post(std::bind(&CHttpConn::_HandleHtmlRequest, this, std::placeholders::_1), uuid_);                
             } 
             else {
                 // LogInfo("no handle {}", url.c_str);
@@ -260,18 +263,18 @@ class CHttpConn : public CRefObject
         if (!busy_)
             return;
 
-        int ret = netlib_send(m_sock_handle, out_buf_.GetBuffer(),
-                            out_buf_.GetWriteOffset());
+        // 输出缓冲区是分段的, 一次writev把所有片段发出去
+        struct iovec iov[HTTP_IOVEC];
+        int cnt = out_buf_.GetReadSpans(iov, HTTP_IOVEC);
+        int ret = netlib_sendv(m_sock_handle, iov, cnt);
         if (ret < 0)
             ret = 0;
 
-        int out_buf_size = (int)out_buf_.GetWriteOffset();
-
-        out_buf_.Read(NULL, ret);
+        out_buf_.Skip(ret);
 
-        if (ret < out_buf_size) {
+        if (!out_buf_.Empty()) {
             busy_ = true;
-            LogInfo("not send all, remain = {}", out_buf_.GetWriteOffset());
+            LogInfo("not send all, remain = {}", out_buf_.GetReadableSize());
         } else {
             OnWriteComlete();
             busy_ = false;
@@ -315,8 +318,6 @@ class CHttpConn : public CRefObject
     // 添加响应数据（静态方法，工作线程调用）
     static void AddResponseData(uint32_t conn_uuid,
                                 string &resp_data);
-    // 发送响应数据列表（静态方法，主线程调用）
-    static void SendResponseDataList();
 
   private:
      
@@ -329,8 +330,8 @@ class CHttpConn : public CRefObject
     uint32_t state_;                // 连接状态
     std::string peer_ip_;           // 对端IP
     uint16_t peer_port_;            // 对端端口
-    CSimpleBuffer in_buf_;          // 输入缓冲区
-    CSimpleBuffer out_buf_;         // 输出缓冲区
+    CSegmentBuffer in_buf_;         // 输入缓冲区
+    CSegmentBuffer out_buf_;        // 输出缓冲区
 
     uint64_t last_send_tick_;       // 上次发送��间
     uint64_t last_recv_tick_;       // 上次接收时间
@@ -338,48 +339,18 @@ class CHttpConn : public CRefObject
     CHttpParserWrapper http_parser_; // HTTP解析器
  
     uint32_t uuid_;                  // 自己的uuid
-
-    static std::mutex s_resp_mutex;
-    static std::list<ResponsePdu_t *> s_response_pdu_list; // 主线程发送回复消息
 };
 
-// 静态成员初始化
-std::list<ResponsePdu_t *> CHttpConn::s_response_pdu_list;
-std::mutex CHttpConn::s_resp_mutex;
-
-// 添加响应数据
+// 添加响应数据, 投递到loop线程发送, 不用每轮循环去查一个加锁的链表
 void CHttpConn::AddResponseData(uint32_t conn_uuid, string &resp_data) {
     LogDebug("into");
-    ResponsePdu_t *pResp = new ResponsePdu_t;
-    pResp->conn_uuid = conn_uuid;
-    pResp->resp_data = std::move(resp_data);
-
-    s_resp_mutex.lock();
-    s_response_pdu_list.push_back(pResp);
-    s_resp_mutex.unlock();
-}
-
-// 发送响应数据列表
-void CHttpConn::SendResponseDataList() {
-    LogDebug("into");
-    // 发送数据
-    s_resp_mutex.lock();
-    while (!s_response_pdu_list.empty()) {
-        ResponsePdu_t *pResp = s_response_pdu_list.front();
-        s_response_pdu_list.pop_front();
-        s_resp_mutex.unlock();
-        CHttpConn *pConn = GetHttpConnByUuid(
-            pResp->conn_uuid); // 该连接有可能已经被释放，如果被释放则返回NULL
+    std::shared_ptr<string> data = std::make_shared<string>(std::move(resp_data));
+    netlib_post(0, [conn_uuid, data]() {
+        CHttpConn *pConn = GetHttpConnByUuid(conn_uuid); // 该连接有可能已经被释放，如果被释放则返回NULL
         if (pConn) {
-            pConn->Send((void *)pResp->resp_data.c_str(),
-                        pResp->resp_data.size());  // 最终socket send
+            pConn->Send((void *)data->c_str(), data->size());  // 最终socket send
         }
-        delete pResp;
-
-        s_resp_mutex.lock();
-    }
-
-    s_resp_mutex.unlock();
+    });
 }
 
 // HTTP连接回调函数
@@ -470,21 +441,10 @@ void http_callback(void *callback_data, uint8_t msg, uint32_t handle,
     }
 }
 
-// HTTP循环回调函数
-void http_loop_callback(void *callback_data, uint8_t msg, uint32_t handle,
-                        void *pParam) {
-    UNUSED(callback_data);
-    UNUSED(msg);
-    UNUSED(handle);
-    UNUSED(pParam);
-    CHttpConn::SendResponseDataList(); // 静态函数, 将要发送的数据循环发给客户端
-}
-
 // 初始化HTTP连接
 int initHttpConn(uint32_t thread_num) {
     g_thread_pool.init(thread_num); // 初始化线程数量
     g_thread_pool.start();          // 启动多线程
-    netlib_add_loop(http_loop_callback,NULL); // http_loop_callback被epoll所在线程循环调用
     return 0;
 }
 
@@ -556,8 +516,7 @@ int main(int argc, char *argv[]) {
     LogInfo("now enter the event loop...");
 
     WritePid();
-    // 超时参数影响回发客户端的时间
-    netlib_eventloop(1);
+    netlib_eventloop();
 
     return 0;
 }